@@ -0,0 +1,263 @@
+﻿//
+//  AmbientOcclusion.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+
+#include "LoadScene.h"
+#include "Bvh.h"
+#include "SceneFile.h"
+#include "Profiler.h"
+#include "AmbientOcclusion.h"
+
+extern SCENE scene;
+
+#define AO_CACHE_MAGIC		(0x314f4142)	// "BAO1"
+#define AO_VERTEX_BLOCK		(1024)			// distinct vertices per job
+#define PI					(3.14159265359f)
+
+typedef struct {
+	float	position[3], normal[3];
+} AO_VERTEX;
+
+// the bake: vertices sorted so that equal ones are adjacent, the first of each run is baked
+static std::vector<AO_VERTEX> bake_vertices;
+static std::vector<int> bake_order;
+static std::vector<int> bake_runs;	// start of each run in bake_order, plus the end
+static unsigned char* bake_ao;
+static std::atomic<int> next_block;
+
+bool parse_ao_bake_options(int argc, char* argv[], int* n_threads) {
+	bool bake = false;
+
+	*n_threads = 0;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--bake-ao"))
+			bake = true;
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			*n_threads = atoi(argv[++i]);
+	}
+	return bake;
+}
+
+static int get_vertex_count(SCENE* pScene) {
+	int n_vertices = 0;
+
+	for (int materialIdx = 0; materialIdx < pScene->n_materials; materialIdx++)
+		n_vertices += 3 * pScene->material_list[materialIdx].geometry.tm.n_triangle;
+	return n_vertices;
+}
+
+// from the scene file and everything that changes the result
+static unsigned long long get_ao_cache_key(int n_vertices) {
+	unsigned long long key = 0xcbf29ce484222325ull; // FNV-1a
+	unsigned long long values[5] = { get_scene_source_key(NULL), (unsigned long long)n_vertices, AO_RAYS_PER_VERTEX, 0, 0 };
+	float parameters[2] = { AO_RAY_LENGTH, AO_RAY_OFFSET };
+
+	memcpy(&values[3], parameters, sizeof(parameters));
+	const unsigned char* bytes = (const unsigned char*)values;
+	for (size_t i = 0; i < sizeof(values); i++) {
+		key ^= bytes[i];
+		key *= 0x100000001b3ull;
+	}
+	return key;
+}
+
+static bool load_ao_cache(unsigned long long key, unsigned char* ao, int n_vertices) {
+	FILE* fp = fopen(AO_CACHE_FILE, "rb");
+	unsigned int magic = 0;
+	unsigned long long file_key = 0;
+	bool loaded = false;
+
+	if (fp == NULL)
+		return false;
+	if (fread(&magic, sizeof(magic), 1, fp) == 1 && magic == AO_CACHE_MAGIC
+		&& fread(&file_key, sizeof(file_key), 1, fp) == 1 && file_key == key)
+		loaded = fread(ao, 1, n_vertices, fp) == (size_t)n_vertices;
+	fclose(fp);
+
+	return loaded;
+}
+
+static void save_ao_cache(unsigned long long key, const unsigned char* ao, int n_vertices) {
+	FILE* fp = fopen(AO_CACHE_FILE, "wb");
+	unsigned int magic = AO_CACHE_MAGIC;
+
+	if (fp == NULL) {
+		fprintf(stderr, "Error: cannot write %s\n", AO_CACHE_FILE);
+		return;
+	}
+	fwrite(&magic, sizeof(magic), 1, fp);
+	fwrite(&key, sizeof(key), 1, fp);
+	fwrite(ao, 1, n_vertices, fp);
+	fclose(fp);
+}
+
+static void get_vertex(TRIANGLE* pTri, int triVertex, AO_VERTEX* pVertex) {
+	memcpy(pVertex->position, &pTri->position[triVertex], sizeof(pVertex->position));
+	memcpy(pVertex->normal, &pTri->normal_vetcor[triVertex], sizeof(pVertex->normal));
+	for (int k = 0; k < 3; k++) { // -0 and 0 are one vertex
+		if (pVertex->position[k] == 0.0f)
+			pVertex->position[k] = 0.0f;
+		if (pVertex->normal[k] == 0.0f)
+			pVertex->normal[k] = 0.0f;
+	}
+}
+
+static float radical_inverse(unsigned int bits) {
+	bits = (bits << 16u) | (bits >> 16u);
+	bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+	bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+	bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+	bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+	return bits * 2.3283064365386963e-10f;
+}
+
+// the unoccluded fraction of a cosine-weighted Hammersley set, rotated by a per-vertex offset so that
+// neighboring vertices do not share their sampling pattern
+static unsigned char bake_vertex(const AO_VERTEX* pVertex, unsigned int seed) {
+	float n[3] = { pVertex->normal[0], pVertex->normal[1], pVertex->normal[2] };
+	float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+	if (!(length > 0.0f))
+		return 255;
+	for (int k = 0; k < 3; k++)
+		n[k] /= length;
+
+	float sign = (n[2] >= 0.0f) ? 1.0f : -1.0f;
+	float a = -1.0f / (sign + n[2]), c = n[0] * n[1] * a;
+	float t[3] = { 1.0f + sign * n[0] * n[0] * a, sign * c, -sign * n[0] };
+	float b[3] = { c, sign + n[1] * n[1] * a, -n[1] };
+
+	seed = (seed ^ 61u) ^ (seed >> 16);
+	seed *= 9u;
+	seed ^= seed >> 4;
+	seed *= 0x27d4eb2du;
+	seed ^= seed >> 15;
+	float offset_u = (seed & 0xFFFF) / 65536.0f, offset_v = (seed >> 16) / 65536.0f;
+
+	BVH_PACKET packet;
+	int n_open = 0;
+	for (int first = 0; first < AO_RAYS_PER_VERTEX; first += BVH_PACKET_SIZE) {
+		for (int lane = 0; lane < BVH_PACKET_SIZE; lane++) {
+			int i = first + lane;
+			float u = (i + 0.5f) / AO_RAYS_PER_VERTEX + offset_u, v = radical_inverse((unsigned int)i) + offset_v;
+			u -= floorf(u);
+			v -= floorf(v);
+			float r = sqrtf(u), phi = 2.0f * PI * v;
+			float x = r * cosf(phi), y = r * sinf(phi), z = sqrtf(max(0.0f, 1.0f - u));
+			for (int k = 0; k < 3; k++) {
+				packet.origin[k][lane] = pVertex->position[k] + AO_RAY_OFFSET * n[k];
+				packet.direction[k][lane] = x * t[k] + y * b[k] + z * n[k];
+			}
+			packet.t_max[lane] = AO_RAY_LENGTH;
+		}
+		packet.active = (1 << BVH_PACKET_SIZE) - 1;
+		int occluded = occluded_bvh_packet(&packet);
+		for (int lane = 0; lane < BVH_PACKET_SIZE; lane++)
+			n_open += !(occluded & (1 << lane));
+	}
+	return (unsigned char)((255 * n_open + AO_RAYS_PER_VERTEX / 2) / AO_RAYS_PER_VERTEX);
+}
+
+static void bake_job(void) {
+	int n_runs = (int)bake_runs.size() - 1;
+
+	for (int block = next_block++; block * AO_VERTEX_BLOCK < n_runs; block = next_block++) {
+		int end = min((block + 1) * AO_VERTEX_BLOCK, n_runs);
+		for (int run = block * AO_VERTEX_BLOCK; run < end; run++) {
+			const AO_VERTEX* pVertex = &bake_vertices[bake_order[bake_runs[run]]];
+			const unsigned int* bits = (const unsigned int*)pVertex;
+			unsigned int seed = 0;
+			for (int k = 0; k < 6; k++)
+				seed = seed * 31u + bits[k];
+			unsigned char ao = bake_vertex(pVertex, seed);
+			for (int i = bake_runs[run]; i < bake_runs[run + 1]; i++)
+				bake_ao[bake_order[i]] = ao;
+		}
+	}
+}
+
+static unsigned char* bake_vertex_ao(SCENE* pScene, int n_threads) {
+	std::thread threads[AO_MAX_THREADS];
+	int n_vertices = get_vertex_count(pScene);
+	double start = profiler_time_ms();
+
+	n_threads = n_threads > 0 ? n_threads : (int)std::thread::hardware_concurrency();
+	n_threads = max(1, min(n_threads, AO_MAX_THREADS));
+	build_bvh(pScene, n_threads);
+
+	// a vertex shared by several triangles is baked once
+	bake_vertices.resize(n_vertices);
+	bake_order.resize(n_vertices);
+	int index = 0;
+	for (int materialIdx = 0; materialIdx < pScene->n_materials; materialIdx++) {
+		GEOMETRY_TRIANGULAR_MESH* tm = &pScene->material_list[materialIdx].geometry.tm;
+		for (int triIdx = 0; triIdx < tm->n_triangle; triIdx++)
+			for (int triVertex = 0; triVertex < 3; triVertex++, index++) {
+				get_vertex(&tm->triangle_list[triIdx], triVertex, &bake_vertices[index]);
+				bake_order[index] = index;
+			}
+	}
+	std::sort(bake_order.begin(), bake_order.end(), [](int a, int b) {
+		return memcmp(&bake_vertices[a], &bake_vertices[b], sizeof(AO_VERTEX)) < 0;
+	});
+	bake_runs.clear();
+	for (int i = 0; i < n_vertices; i++)
+		if (i == 0 || memcmp(&bake_vertices[bake_order[i - 1]], &bake_vertices[bake_order[i]], sizeof(AO_VERTEX)) != 0)
+			bake_runs.push_back(i);
+	bake_runs.push_back(n_vertices);
+	bake_ao = (unsigned char*)malloc(max(n_vertices, 1));
+
+	next_block = 0;
+	for (int t = 1; t < n_threads; t++)
+		threads[t] = std::thread(bake_job);
+	bake_job();
+	for (int t = 1; t < n_threads; t++)
+		threads[t].join();
+
+	fprintf(stdout, " * Baked the ambient occlusion of %d vertices (%d distinct, %d rays each) in %.1f s (%d threads).\n",
+		n_vertices, (int)bake_runs.size() - 1, AO_RAYS_PER_VERTEX, (profiler_time_ms() - start) / 1000.0, n_threads);
+
+	std::vector<AO_VERTEX>().swap(bake_vertices);
+	std::vector<int>().swap(bake_order);
+	std::vector<int>().swap(bake_runs);
+	free_bvh();
+	return bake_ao;
+}
+
+unsigned char* prepare_vertex_ao(SCENE* pScene) {
+	int n_vertices = get_vertex_count(pScene);
+	unsigned long long key = get_ao_cache_key(n_vertices);
+	unsigned char* ao = (unsigned char*)malloc(max(n_vertices, 1));
+
+	if (load_ao_cache(key, ao, n_vertices)) {
+		fprintf(stdout, " * Loaded the ambient occlusion from %s.\n", AO_CACHE_FILE);
+		return ao;
+	}
+	free(ao);
+	ao = bake_vertex_ao(pScene, 0);
+	save_ao_cache(key, ao, n_vertices);
+	return ao;
+}
+
+int run_ao_bake(int n_threads) {
+	int n_vertices = get_vertex_count(&scene);
+	unsigned char* ao = bake_vertex_ao(&scene, n_threads);
+
+	save_ao_cache(get_ao_cache_key(n_vertices), ao, n_vertices);
+	free(ao);
+	return 0;
+}
@@ -0,0 +1,27 @@
+﻿//
+//  AmbientOcclusion.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+#include "LoadScene.h"
+
+// Ambient occlusion of the static Bistro, baked per vertex: AO_RAYS_PER_VERTEX cosine-distributed
+// rays of length AO_RAY_LENGTH are cast from every distinct vertex (position and normal) against the
+// scene BVH, and the unoccluded fraction is stored as one byte. The bake runs once on all cores and
+// is cached in AO_CACHE_FILE, keyed by the scene file and the bake parameters.
+#define AO_RAYS_PER_VERTEX	(32)		// a multiple of BVH_PACKET_SIZE
+#define AO_RAY_LENGTH		(250.0f)	// scene units; farther occluders do not count
+#define AO_RAY_OFFSET		(0.5f)		// along the normal, against self-occlusion
+#define AO_MAX_THREADS		(32)
+#define AO_CACHE_FILE		"Scene/BistroExterior.ao"
+
+// AmbientOcclusion.cpp
+// one byte per scene vertex (3 per triangle, materials in order), 255 for fully open; free() it
+unsigned char* prepare_vertex_ao(SCENE* pScene);	// the cache, or a bake that is then cached
+bool parse_ao_bake_options(int argc, char* argv[], int* n_threads);	// false without --bake-ao
+int run_ao_bake(int n_threads);	// bakes ignoring the cache; process exit code
@@ -0,0 +1,304 @@
+﻿//
+//  Benchmark.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+//  Headless benchmark: renders into an FBO of an offscreen context (EGL with -DUSE_EGL,
+//  OSMesa with -DUSE_OSMESA, both work on llvmpipe), flies through the predefined
+//  cameras and writes frame time statistics and per-pass CPU timings as JSON.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glew.h>
+#if defined(USE_EGL)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#elif defined(USE_OSMESA)
+#include <GL/osmesa.h>
+#endif
+
+#include "LoadScene.h"
+#include "DrawScene.h"
+#include "Profiler.h"
+#include "TextureResidency.h"
+#include "TextureDedup.h"
+#include "Benchmark.h"
+
+bool parse_benchmark_options(int argc, char* argv[], BENCHMARK_OPTIONS* pOptions) {
+	bool benchmark = false;
+
+	pOptions->width = 900;
+	pOptions->height = 600;
+	pOptions->warmup_frames = 30;
+	pOptions->frames_per_camera = 60;
+	pOptions->deferred_shading = false;
+	pOptions->depth_prepass = false;
+	pOptions->low_memory = false;
+	pOptions->keep_positions = false;
+	pOptions->output_file = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--benchmark"))
+			benchmark = true;
+		else if (!strcmp(argv[i], "--size") && i + 1 < argc)
+			sscanf(argv[++i], "%dx%d", &pOptions->width, &pOptions->height);
+		else if (!strcmp(argv[i], "--warmup") && i + 1 < argc)
+			pOptions->warmup_frames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--frames-per-camera") && i + 1 < argc)
+			pOptions->frames_per_camera = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--deferred"))
+			pOptions->deferred_shading = true;
+		else if (!strcmp(argv[i], "--depth-prepass"))
+			pOptions->depth_prepass = true;
+		else if (!strcmp(argv[i], "--low-memory"))
+			pOptions->low_memory = true;
+		else if (!strcmp(argv[i], "--keep-positions"))
+			pOptions->keep_positions = true;
+		else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+			pOptions->output_file = argv[++i];
+	}
+	if (pOptions->frames_per_camera < 1)
+		pOptions->frames_per_camera = 1;
+
+	return benchmark;
+}
+
+/*****************************  START: offscreen context *****************************/
+#if defined(USE_EGL)
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+static EGLContext egl_context = EGL_NO_CONTEXT;
+static EGLSurface egl_surface = EGL_NO_SURFACE;
+
+static bool create_offscreen_context(int /*width*/, int /*height*/) {
+	static const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+		EGL_NONE
+	};
+	static const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 0,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+	EGLConfig config;
+	EGLint n_configs;
+
+	egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, NULL, NULL)) {
+		fprintf(stderr, "Error: cannot initialize EGL.\n");
+		return false;
+	}
+	if (!eglChooseConfig(egl_display, config_attribs, &config, 1, &n_configs) || n_configs < 1
+		|| !eglBindAPI(EGL_OPENGL_API)) {
+		fprintf(stderr, "Error: no EGL config for desktop OpenGL.\n");
+		return false;
+	}
+	egl_context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, context_attribs);
+	if (egl_context == EGL_NO_CONTEXT) {
+		fprintf(stderr, "Error: cannot create an OpenGL 4.0 core context through EGL.\n");
+		return false;
+	}
+
+	// everything is drawn into an FBO; the 1x1 pbuffer only exists for drivers without surfaceless contexts
+	if (!eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context)) {
+		egl_surface = eglCreatePbufferSurface(egl_display, config, pbuffer_attribs);
+		if (!eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context)) {
+			fprintf(stderr, "Error: cannot make the EGL context current.\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+static void destroy_offscreen_context(void) {
+	eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (egl_surface != EGL_NO_SURFACE)
+		eglDestroySurface(egl_display, egl_surface);
+	eglDestroyContext(egl_display, egl_context);
+	eglTerminate(egl_display);
+}
+#elif defined(USE_OSMESA)
+static OSMesaContext osmesa_context;
+static GLubyte* osmesa_buffer;
+
+static bool create_offscreen_context(int width, int height) {
+	static const int context_attribs[] = {
+		OSMESA_FORMAT, OSMESA_RGBA,
+		OSMESA_DEPTH_BITS, 24,
+		OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+		OSMESA_CONTEXT_MAJOR_VERSION, 4,
+		OSMESA_CONTEXT_MINOR_VERSION, 0,
+		0
+	};
+
+	osmesa_context = OSMesaCreateContextAttribs(context_attribs, NULL);
+	if (osmesa_context == NULL) {
+		fprintf(stderr, "Error: cannot create an OpenGL 4.0 core context through OSMesa.\n");
+		return false;
+	}
+	osmesa_buffer = (GLubyte*)malloc(4 * width * height);
+	if (!OSMesaMakeCurrent(osmesa_context, osmesa_buffer, GL_UNSIGNED_BYTE, width, height)) {
+		fprintf(stderr, "Error: cannot make the OSMesa context current.\n");
+		return false;
+	}
+	return true;
+}
+
+static void destroy_offscreen_context(void) {
+	OSMesaDestroyContext(osmesa_context);
+	free(osmesa_buffer);
+}
+#else
+static bool create_offscreen_context(int /*width*/, int /*height*/) {
+	fprintf(stderr, "Error: this build has no headless mode; rebuild with USE_EGL or USE_OSMESA defined.\n");
+	return false;
+}
+
+static void destroy_offscreen_context(void) {
+}
+#endif
+/******************************  END: offscreen context ******************************/
+
+static int compare_doubles(const void* a, const void* b) {
+	double d = *(const double*)a - *(const double*)b;
+	return (d > 0.0) - (d < 0.0);
+}
+
+// nearest-rank percentile of sorted values
+static double percentile(const double* sorted, int n, double p) {
+	int rank = (int)(p / 100.0 * n + 0.999999);
+	if (rank < 1)
+		rank = 1;
+	return sorted[(rank > n ? n : rank) - 1];
+}
+
+static void write_report(FILE* fp, BENCHMARK_OPTIONS* pOptions, double* frame_ms, int n_frames, double* pass_ms) {
+	double sum = 0.0;
+
+	for (int i = 0; i < n_frames; i++)
+		sum += frame_ms[i];
+	qsort(frame_ms, n_frames, sizeof(double), compare_doubles);
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"renderer\": \"%s\",\n", (const char*)glGetString(GL_RENDERER));
+	fprintf(fp, "  \"width\": %d,\n  \"height\": %d,\n", pOptions->width, pOptions->height);
+	fprintf(fp, "  \"deferred_shading\": %s,\n", pOptions->deferred_shading ? "true" : "false");
+	fprintf(fp, "  \"depth_prepass\": %s,\n", pOptions->depth_prepass ? "true" : "false");
+	fprintf(fp, "  \"low_memory\": %s,\n", pOptions->low_memory ? "true" : "false");
+	fprintf(fp, "  \"frames\": %d,\n", n_frames);
+	fprintf(fp, "  \"frame_ms\": { \"mean\": %.4f, \"min\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }",
+		sum / n_frames, frame_ms[0], percentile(frame_ms, n_frames, 50.0), percentile(frame_ms, n_frames, 95.0),
+		percentile(frame_ms, n_frames, 99.0), frame_ms[n_frames - 1]);
+	size_t resident_bytes, peak_bytes;
+	if (profiler_memory(&resident_bytes, &peak_bytes)) // after the run: the steady state
+		fprintf(fp, ",\n  \"memory_mb\": { \"resident\": %.1f, \"peak\": %.1f }", resident_bytes / 1048576.0, peak_bytes / 1048576.0);
+	const RESIDENCY_STATS* pResidency = get_residency_stats();
+	fprintf(fp, ",\n  \"texture_residency\": { \"resident_mb\": %.2f, \"budget_mb\": %.2f, \"used_textures\": %d, \"textures\": %d, \"misses\": %u, \"uploads\": %u, \"evictions\": %u }",
+		pResidency->resident_bytes / 1048576.0, pResidency->budget_bytes / 1048576.0, pResidency->n_used_textures,
+		pResidency->n_textures, pResidency->n_misses, pResidency->n_uploads, pResidency->n_evictions);
+	const TEXTURE_DEDUP_STATS* pDedup = get_texture_dedup_stats();
+	fprintf(fp, ",\n  \"texture_dedup\": { \"file_duplicates\": %d, \"pixel_duplicates\": %d, \"read_mb_saved\": %.2f, \"decode_ms_saved\": %.1f, \"memory_mb_saved\": %.2f }",
+		pDedup->n_file_duplicates, pDedup->n_pixel_duplicates, pDedup->read_bytes_saved / 1048576.0, pDedup->decode_ms_saved,
+		pDedup->memory_bytes_saved / 1048576.0);
+	fprintf(fp, ",\n  \"cpu_pass_ms\": {");
+	for (int pass = 0; pass < N_PROFILE_PASSES; pass++)
+		fprintf(fp, "%s \"%s\": %.4f", pass ? "," : "", profiler_pass_name((PROFILE_PASS)pass), pass_ms[pass] / n_frames);
+	fprintf(fp, " }");
+	fprintf(fp, "\n}\n");
+}
+
+int run_benchmark(BENCHMARK_OPTIONS* pOptions) {
+	if (!create_offscreen_context(pOptions->width, pOptions->height))
+		return 1;
+
+	glewExperimental = GL_TRUE;
+#if defined(USE_EGL)
+	GLenum error = glewContextInit(); // glewInit() would look for a GLX/WGL context
+#else
+	GLenum error = glewInit();
+#endif
+	if (error != GLEW_OK) {
+		fprintf(stderr, "Error: %s\n", glewGetErrorString(error));
+		destroy_offscreen_context();
+		return 1;
+	}
+	fprintf(stdout, " - OpenGL renderer: %s\n", glGetString(GL_RENDERER));
+	fprintf(stdout, " - OpenGL version supported: %s\n\n", glGetString(GL_VERSION));
+
+	// offscreen target with the layout of the window's default framebuffer
+	GLuint fbo, color_rbo, depth_rbo;
+	glGenRenderbuffers(1, &color_rbo);
+	glBindRenderbuffer(GL_RENDERBUFFER, color_rbo);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, pOptions->width, pOptions->height);
+	glGenRenderbuffers(1, &depth_rbo);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth_rbo);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, pOptions->width, pOptions->height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_rbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_rbo);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "Error: the offscreen framebuffer is incomplete.\n");
+		destroy_offscreen_context();
+		return 1;
+	}
+
+	set_memory_options(pOptions->low_memory, pOptions->keep_positions);
+	initialize_scene_renderer();
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	resize_renderer(pOptions->width, pOptions->height);
+	set_render_options(pOptions->deferred_shading, pOptions->depth_prepass);
+
+	// camera path: CAMERA_1 -> CAMERA_2 -> ... -> CAMERA_a, one simulation tick per frame
+	int n_frames = (NUM_CAMERAS - 1) * pOptions->frames_per_camera + 1;
+	double* frame_ms = (double*)malloc(sizeof(double) * n_frames);
+	double pass_ms[N_PROFILE_PASSES] = { 0.0 };
+
+	set_current_camera(CAMERA_1);
+	for (int frame = 0; frame < pOptions->warmup_frames; frame++) {
+		render_frame();
+		glFinish();
+	}
+
+	for (int frame = 0; frame < n_frames; frame++) {
+		double start = profiler_time_ms();
+
+		set_camera_path_position((float)frame / pOptions->frames_per_camera);
+		update_scene();
+		render_frame();
+		glFinish(); // frame time includes the GPU (or llvmpipe) work, not just submission
+		frame_ms[frame] = profiler_time_ms() - start;
+
+		for (int pass = 0; pass < N_PROFILE_PASSES; pass++)
+			pass_ms[pass] += profiler_last_frame_ms((PROFILE_PASS)pass);
+	}
+
+	FILE* fp = pOptions->output_file ? fopen(pOptions->output_file, "w") : stdout;
+	if (fp == NULL) {
+		fprintf(stderr, "Error: cannot write %s\n", pOptions->output_file);
+		fp = stdout;
+	}
+	write_report(fp, pOptions, frame_ms, n_frames, pass_ms);
+	if (fp != stdout)
+		fclose(fp);
+	free(frame_ms);
+
+	cleanup();
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(1, &color_rbo);
+	glDeleteRenderbuffers(1, &depth_rbo);
+	destroy_offscreen_context();
+
+	return 0;
+}
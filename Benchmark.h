@@ -0,0 +1,23 @@
+﻿//
+//  Benchmark.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+typedef struct {
+	int			width, height;
+	int			warmup_frames;
+	int			frames_per_camera;	// frames spent flying from one predefined camera to the next
+	bool		deferred_shading;
+	bool		depth_prepass;
+	bool		low_memory, keep_positions;	// see set_memory_options
+	const char*	output_file;		// JSON report; stdout when NULL
+} BENCHMARK_OPTIONS;
+
+// Benchmark.cpp
+bool parse_benchmark_options(int argc, char* argv[], BENCHMARK_OPTIONS* pOptions);	// false without --benchmark
+int run_benchmark(BENCHMARK_OPTIONS* pOptions);	// process exit code
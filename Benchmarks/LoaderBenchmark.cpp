@@ -0,0 +1,496 @@
+﻿//
+//  LoaderBenchmark.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+// Microbenchmarks of the scene loading and conversion stages, without a GL context: the legacy .bin
+// reader, the conversion to the chunked file, the chunked reader on one and on all threads, the geometry
+// of one material, the vertex interleaving of prepare_bistro_exterior, and the texture decoding and mip
+// chain building. Each runs on the real scene (when Scene/BistroExterior.bin is found in the working
+// directory) and on a synthetic one written to BENCH_SYNTHETIC_DIR, as many iterations as fit in
+// --benchmark_min_time seconds. Allocations are those of the loaders (SCENE_MALLOC) and of operator new;
+// FreeImage's own are not seen.
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <new>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#if defined(_WIN32)
+#include <direct.h>
+#define chdir	_chdir
+#define getcwd	_getcwd
+#define mkdir_0755(path)	_mkdir(path)
+#else
+#include <unistd.h>
+#define mkdir_0755(path)	mkdir(path, 0755)
+#endif
+
+#include "../LoadScene.h"
+#include "../SceneFile.h"
+#include "../CpuTexture.h"
+#include "../Profiler.h"
+#include "../DrawScene.h"
+
+#define BENCH_SYNTHETIC_DIR			"LoaderBenchmark.synthetic"
+#define BENCH_MIN_ITERATIONS		(3)
+#define BENCH_MAX_ITERATIONS		(1000)
+#define BENCH_SYNTHETIC_MATERIALS	(64)
+#define BENCH_SYNTHETIC_TEXTURE		(2048)	// texels on a side
+#define BENCH_REAL_TEXTURES			(8)		// the first readable textures of the real scene
+
+SCENE scene; // get_bistro_vertices reads it
+
+typedef struct {
+	double				min_time_ms;
+	int					iterations;
+	double				elapsed_ms, start_ms;
+	bool				paused;
+	unsigned long long	allocations_start, allocations_paused;	// excluded while paused
+	unsigned long long	bytes_per_iteration, items_per_iteration;	// set by the benchmark
+	const char*			item_name;
+} BENCH_STATE;
+
+typedef struct {
+	std::string			name;
+	int					iterations;
+	double				ms_per_iteration;
+	double				bytes_per_second, items_per_second;
+	const char*			item_name;
+	double				allocations_per_iteration;
+} BENCH_RESULT;
+
+static std::atomic<unsigned long long> n_allocations;
+static std::vector<BENCH_RESULT> results;
+static const char* filter = "";
+static double min_time_s = 1.0;
+static int synthetic_triangles = 1 << 20;
+
+/*****************************  START: allocation counting *****************************/
+void* scene_malloc(size_t size) {
+	n_allocations++;
+	return malloc(size);
+}
+
+void* operator new(size_t size) {
+	n_allocations++;
+	void* p = malloc(size > 0 ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+/*****************************  END: allocation counting *****************************/
+
+/*****************************  START: harness *****************************/
+// while (keep_running(pState)) { ... }: the loop body is one iteration
+static bool keep_running(BENCH_STATE* pState) {
+	double now = profiler_time_ms();
+
+	if (pState->iterations == 0)
+		pState->allocations_start = n_allocations;
+	else if (!pState->paused)
+		pState->elapsed_ms += now - pState->start_ms;
+	if (pState->iterations >= BENCH_MAX_ITERATIONS
+		|| (pState->iterations >= BENCH_MIN_ITERATIONS && pState->elapsed_ms >= pState->min_time_ms))
+		return false;
+	pState->iterations++;
+	pState->paused = false;
+	pState->start_ms = profiler_time_ms();
+	return true;
+}
+
+// around the untimed work of an iteration, e.g. freeing what it loaded
+static void pause_timing(BENCH_STATE* pState) {
+	pState->elapsed_ms += profiler_time_ms() - pState->start_ms;
+	pState->paused = true;
+	pState->allocations_paused = n_allocations;
+}
+
+static void resume_timing(BENCH_STATE* pState) {
+	pState->allocations_start += n_allocations - pState->allocations_paused;
+	pState->paused = false;
+	pState->start_ms = profiler_time_ms();
+}
+
+static void run_benchmark(const std::string& name, void (*benchmark)(BENCH_STATE*)) {
+	BENCH_STATE state;
+	BENCH_RESULT result;
+
+	if (strstr(name.c_str(), filter) == NULL)
+		return;
+	memset(&state, 0, sizeof(state));
+	state.min_time_ms = 1000.0 * min_time_s;
+	state.item_name = "items";
+	benchmark(&state);
+	if (state.iterations == 0)
+		return; // skipped
+
+	unsigned long long allocations = n_allocations - state.allocations_start;
+	result.name = name;
+	result.iterations = state.iterations;
+	result.ms_per_iteration = state.elapsed_ms / state.iterations;
+	result.bytes_per_second = state.bytes_per_iteration / (result.ms_per_iteration / 1000.0);
+	result.items_per_second = state.items_per_iteration / (result.ms_per_iteration / 1000.0);
+	result.item_name = state.item_name;
+	result.allocations_per_iteration = (double)allocations / state.iterations;
+	results.push_back(result);
+
+	fprintf(stdout, "%-36s %12.3f ms %10d %12.1f %12.3f M%s/s %*s%14.0f\n", name.c_str(), result.ms_per_iteration, result.iterations,
+		result.bytes_per_second / 1048576.0, result.items_per_second / 1.0e6, result.item_name, (int)(10 - strlen(result.item_name)), "", result.allocations_per_iteration);
+	fflush(stdout);
+}
+
+static void write_json(const char* filename) {
+	FILE* fp = fopen(filename, "w");
+
+	if (fp == NULL) {
+		fprintf(stderr, "Error: cannot write %s\n", filename);
+		return;
+	}
+	fprintf(fp, "{\n  \"benchmarks\": [");
+	for (size_t i = 0; i < results.size(); i++) {
+		const BENCH_RESULT* pResult = &results[i];
+		fprintf(fp, "%s\n    { \"name\": \"%s\", \"iterations\": %d, \"real_time_ms\": %.4f, \"bytes_per_second\": %.1f, \"%s_per_second\": %.1f, \"allocations_per_iteration\": %.1f }",
+			i ? "," : "", pResult->name.c_str(), pResult->iterations, pResult->ms_per_iteration, pResult->bytes_per_second,
+			pResult->item_name, pResult->items_per_second, pResult->allocations_per_iteration);
+	}
+	fprintf(fp, "\n  ]\n}\n");
+	fclose(fp);
+}
+/*****************************  END: harness *****************************/
+
+/*****************************  START: inputs *****************************/
+static unsigned long long get_file_size(const char* filename) {
+	struct stat file_stat;
+
+	return (stat(filename, &file_stat) == 0) ? (unsigned long long)file_stat.st_size : 0;
+}
+
+static unsigned long long get_triangle_count(const SCENE* pScene) {
+	unsigned long long n_triangles = 0;
+
+	for (int materialIdx = 0; materialIdx < pScene->n_materials; materialIdx++)
+		n_triangles += pScene->material_list[materialIdx].geometry.tm.n_triangle;
+	return n_triangles;
+}
+
+// the legacy format as the exporter wrote it: SCENE, the lights, the materials, then per material its
+// triangles followed by their texture coordinates
+static bool write_synthetic_scene(void) {
+	static SCENE synthetic;
+	int n_materials = BENCH_SYNTHETIC_MATERIALS;
+	int n_per_material = max(synthetic_triangles / n_materials, 1);
+	unsigned int seed = 1;
+
+	mkdir_0755(BENCH_SYNTHETIC_DIR);
+	mkdir_0755(BENCH_SYNTHETIC_DIR "/Scene");
+	FILE* fp = fopen(BENCH_SYNTHETIC_DIR "/" SCENE_LEGACY_FILE, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Error: cannot write %s/%s\n", BENCH_SYNTHETIC_DIR, SCENE_LEGACY_FILE);
+		return false;
+	}
+
+	memset(&synthetic, 0, sizeof(synthetic));
+	synthetic.n_materials = n_materials;
+	synthetic.n_lights = 1;
+	synthetic.n_textures = 1;
+	strcpy(synthetic.texture_file_name[0], "Scene/synthetic.png");
+	fwrite(&synthetic, sizeof(SCENE), 1, fp);
+
+	LIGHT light;
+	memset(&light, 0, sizeof(light));
+	fwrite(&light, sizeof(LIGHT), 1, fp);
+
+	std::vector<MATERIAL> materials(n_materials);
+	for (int materialIdx = 0; materialIdx < n_materials; materialIdx++) {
+		MATERIAL* pMaterial = &materials[materialIdx];
+		memset(pMaterial, 0, sizeof(MATERIAL));
+		pMaterial->geometry_type = GEOMETRY_TYPE_TRIANGULAR_MESH;
+		pMaterial->geometry.tm.n_triangle = n_per_material;
+		pMaterial->geometry.tm.n_textures = 1;
+		pMaterial->diffuseTexId = 0;
+		pMaterial->normalMapTexId = pMaterial->specularTexId = pMaterial->emissiveTexId = (int)INVALID_TEX_ID;
+	}
+	fwrite(materials.data(), sizeof(MATERIAL), n_materials, fp);
+
+	std::vector<TRIANGLE> triangles(n_per_material);
+	std::vector<float2> uvs(NUM_TRI_VERTICES * (size_t)n_per_material);
+	for (int materialIdx = 0; materialIdx < n_materials; materialIdx++) {
+		memset(triangles.data(), 0, sizeof(TRIANGLE) * triangles.size());
+		for (int triIdx = 0; triIdx < n_per_material; triIdx++) {
+			TRIANGLE* tri = &triangles[triIdx];
+			for (int vertexIdx = 0; vertexIdx < NUM_TRI_VERTICES; vertexIdx++) {
+				float* p = &tri->position[vertexIdx].x;
+				for (int k = 0; k < 3; k++) {
+					seed = seed * 1664525u + 12345u;
+					p[k] = (seed >> 8) * (1.0f / 16777216.0f) * 1000.0f;
+				}
+				tri->normal_vetcor[vertexIdx].z = 1.0f;
+				uvs[NUM_TRI_VERTICES * triIdx + vertexIdx].u = p[0] * 0.01f;
+				uvs[NUM_TRI_VERTICES * triIdx + vertexIdx].v = p[1] * 0.01f;
+			}
+			tri->tangent.x = 1.0f;
+			tri->bitangent.y = 1.0f;
+		}
+		fwrite(triangles.data(), sizeof(TRIANGLE), n_per_material, fp);
+		for (int triIdx = 0; triIdx < n_per_material; triIdx++)
+			for (int vertexIdx = 0; vertexIdx < NUM_TRI_VERTICES; vertexIdx++)
+				fwrite(&uvs[NUM_TRI_VERTICES * triIdx + vertexIdx], sizeof(float2), 1, fp);
+	}
+	fclose(fp);
+
+	// a noisy image, so that the PNG does not compress to nothing
+	std::vector<unsigned char> pixels(3 * BENCH_SYNTHETIC_TEXTURE * BENCH_SYNTHETIC_TEXTURE);
+	for (size_t i = 0; i < pixels.size(); i++) {
+		seed = seed * 1664525u + 12345u;
+		pixels[i] = (unsigned char)(((i / 3) % BENCH_SYNTHETIC_TEXTURE) + (seed >> 28));
+	}
+	if (!save_png_bgr(BENCH_SYNTHETIC_DIR "/Scene/synthetic.png", BENCH_SYNTHETIC_TEXTURE, BENCH_SYNTHETIC_TEXTURE, pixels.data()))
+		fprintf(stderr, "Error: cannot write %s/Scene/synthetic.png\n", BENCH_SYNTHETIC_DIR); // texture_decode is skipped
+	return true;
+}
+
+static void remove_synthetic_scene(void) {
+	remove(BENCH_SYNTHETIC_DIR "/" SCENE_LEGACY_FILE);
+	remove(BENCH_SYNTHETIC_DIR "/" SCENE_FILE);
+	remove(BENCH_SYNTHETIC_DIR "/Scene/synthetic.png");
+	rmdir(BENCH_SYNTHETIC_DIR "/Scene");
+	rmdir(BENCH_SYNTHETIC_DIR);
+}
+/*****************************  END: inputs *****************************/
+
+/*****************************  START: benchmarks *****************************/
+// all run in the directory holding Scene/; converted from the legacy file if missing or out of date
+static bool prepare_scene_file(void) {
+	bool prepared = open_scene_file(&scene);
+
+	if (prepared)
+		close_scene_file();
+	else
+		prepared = readLegacySceneFile(&scene) && write_scene_file(&scene);
+	freeData(&scene);
+	return prepared;
+}
+
+static void BM_legacy_read(BENCH_STATE* pState) {
+	if (get_file_size(SCENE_LEGACY_FILE) == 0)
+		return;
+	while (keep_running(pState)) {
+		readLegacySceneFile(&scene);
+		pause_timing(pState);
+		pState->items_per_iteration = get_triangle_count(&scene);
+		freeData(&scene);
+		resume_timing(pState);
+	}
+	pState->bytes_per_iteration = get_file_size(SCENE_LEGACY_FILE);
+	pState->item_name = "triangles";
+}
+
+static void BM_convert(BENCH_STATE* pState) {
+	if (!readLegacySceneFile(&scene))
+		return;
+	while (keep_running(pState))
+		write_scene_file(&scene);
+	pState->bytes_per_iteration = get_file_size(SCENE_FILE);
+	pState->items_per_iteration = get_triangle_count(&scene);
+	pState->item_name = "triangles";
+	freeData(&scene);
+}
+
+static void chunked_read(BENCH_STATE* pState, int n_threads) {
+	if (!prepare_scene_file())
+		return;
+	while (keep_running(pState)) {
+		open_scene_file(&scene);
+		load_scene_materials(&scene, n_threads);
+		close_scene_file();
+		pause_timing(pState);
+		pState->items_per_iteration = get_triangle_count(&scene);
+		freeData(&scene);
+		resume_timing(pState);
+	}
+	pState->bytes_per_iteration = get_file_size(SCENE_FILE);
+	pState->item_name = "triangles";
+}
+
+static void BM_chunked_read_1_thread(BENCH_STATE* pState) {
+	chunked_read(pState, 1);
+}
+
+static void BM_chunked_read_all_threads(BENCH_STATE* pState) {
+	chunked_read(pState, 0);
+}
+
+static void free_material_geometry(MATERIAL* pMaterial) {
+	GEOMETRY_TRIANGULAR_MESH* pMesh = &pMaterial->geometry.tm;
+
+	for (int triIdx = 0; triIdx < pMesh->n_triangle; triIdx++)
+		for (int vertexIdx = 0; vertexIdx < NUM_TRI_VERTICES; vertexIdx++)
+			free(pMesh->triangle_list[triIdx].texture_list[vertexIdx]);
+	free(pMesh->triangle_list);
+	pMesh->triangle_list = NULL;
+}
+
+// the largest material alone, as a lazy loader would read it
+static void BM_material_geometry(BENCH_STATE* pState) {
+	int largest = 0;
+
+	if (!prepare_scene_file() || !open_scene_file(&scene))
+		return;
+	for (int materialIdx = 1; materialIdx < scene.n_materials; materialIdx++)
+		if (get_scene_material_entry(materialIdx)->n_triangles > get_scene_material_entry(largest)->n_triangles)
+			largest = materialIdx;
+	while (scene.n_materials > 0 && keep_running(pState)) {
+		load_scene_material(&scene, largest);
+		pause_timing(pState);
+		free_material_geometry(&scene.material_list[largest]);
+		resume_timing(pState);
+	}
+	if (scene.n_materials > 0) {
+		pState->bytes_per_iteration = get_scene_material_entry(largest)->size;
+		pState->items_per_iteration = get_scene_material_entry(largest)->n_triangles;
+	}
+	pState->item_name = "triangles";
+	close_scene_file();
+	freeData(&scene);
+}
+
+// the loop of prepare_bistro_exterior that fills the vertex buffers, one material after another
+static void BM_interleave_vertices(BENCH_STATE* pState) {
+	int max_triangles = 0;
+
+	read3DSceneFromFile(&scene);
+	for (int materialIdx = 0; materialIdx < scene.n_materials; materialIdx++)
+		max_triangles = max(max_triangles, scene.material_list[materialIdx].geometry.tm.n_triangle);
+	std::vector<unsigned char> ao(NUM_TRI_VERTICES * (size_t)max_triangles, 255);
+	std::vector<float> vertices(BISTRO_VERTEX_FLOATS * NUM_TRI_VERTICES * (size_t)max(max_triangles, 1));
+
+	while (keep_running(pState))
+		for (int materialIdx = 0; materialIdx < scene.n_materials; materialIdx++)
+			get_bistro_vertices(materialIdx, 0, scene.material_list[materialIdx].geometry.tm.n_triangle, ao.data(), vertices.data());
+	pState->items_per_iteration = get_triangle_count(&scene);
+	pState->bytes_per_iteration = sizeof(float) * BISTRO_VERTEX_FLOATS * NUM_TRI_VERTICES * pState->items_per_iteration; // written
+	pState->item_name = "triangles";
+	freeData(&scene);
+}
+
+// decoding and the mip chain, as prepare_bistro_exterior loads the textures
+static void BM_texture_decode(BENCH_STATE* pState) {
+	std::vector<std::string> files;
+	unsigned long long texels = 0, bytes = 0;
+
+	read3DSceneFromFile(&scene);
+	for (int texId = 0; texId < scene.n_textures && (int)files.size() < BENCH_REAL_TEXTURES; texId++) {
+		CPU_TEXTURE texture;
+		if (!load_cpu_texture(scene.texture_file_name[texId], 1 << (CPU_TEXTURE_MAX_LEVELS - 1), false, &texture))
+			continue;
+		files.push_back(scene.texture_file_name[texId]);
+		texels += (unsigned long long)texture.levels[0].width * texture.levels[0].height;
+		bytes += get_file_size(scene.texture_file_name[texId]);
+		free_cpu_texture(&texture);
+	}
+	freeData(&scene);
+
+	while (!files.empty() && keep_running(pState))
+		for (const std::string& file : files) {
+			CPU_TEXTURE texture;
+			load_cpu_texture(file.c_str(), 1 << (CPU_TEXTURE_MAX_LEVELS - 1), false, &texture);
+			pause_timing(pState);
+			free_cpu_texture(&texture);
+			resume_timing(pState);
+		}
+	pState->bytes_per_iteration = bytes;
+	pState->items_per_iteration = texels;
+	pState->item_name = "texels";
+}
+
+// the mip chain alone, from texels in memory
+static void BM_mip_chain(BENCH_STATE* pState) {
+	std::vector<unsigned int> texels((size_t)BENCH_SYNTHETIC_TEXTURE * BENCH_SYNTHETIC_TEXTURE);
+
+	for (size_t i = 0; i < texels.size(); i++)
+		texels[i] = (unsigned int)(i * 2654435761u);
+	while (keep_running(pState)) {
+		CPU_TEXTURE texture;
+		create_cpu_texture(BENCH_SYNTHETIC_TEXTURE, BENCH_SYNTHETIC_TEXTURE, texels.data(), &texture);
+		pause_timing(pState);
+		free_cpu_texture(&texture);
+		resume_timing(pState);
+	}
+	pState->bytes_per_iteration = sizeof(unsigned int) * texels.size();
+	pState->items_per_iteration = texels.size();
+	pState->item_name = "texels";
+}
+/*****************************  END: benchmarks *****************************/
+
+static void run_scene_benchmarks(const char* prefix) {
+	std::string p(prefix);
+
+	run_benchmark(p + "/legacy_read", BM_legacy_read);
+	run_benchmark(p + "/convert", BM_convert);
+	run_benchmark(p + "/chunked_read/threads:1", BM_chunked_read_1_thread);
+	run_benchmark(p + "/chunked_read/threads:all", BM_chunked_read_all_threads);
+	run_benchmark(p + "/material_geometry", BM_material_geometry);
+	run_benchmark(p + "/interleave_vertices", BM_interleave_vertices);
+	run_benchmark(p + "/texture_decode", BM_texture_decode);
+}
+
+int main(int argc, char* argv[]) {
+	const char* output_file = NULL;
+	char root[1024];
+
+	for (int i = 1; i < argc; i++) {
+		if (!strncmp(argv[i], "--benchmark_filter=", 19))
+			filter = argv[i] + 19;
+		else if (!strncmp(argv[i], "--benchmark_min_time=", 21))
+			min_time_s = atof(argv[i] + 21);
+		else if (!strncmp(argv[i], "--benchmark_out=", 16))
+			output_file = argv[i] + 16;
+		else if (!strncmp(argv[i], "--synthetic_triangles=", 22))
+			synthetic_triangles = max(atoi(argv[i] + 22), 1);
+		else {
+			fprintf(stderr, "Usage: %s [--benchmark_filter=substring] [--benchmark_min_time=seconds] [--benchmark_out=file.json] [--synthetic_triangles=n]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (getcwd(root, sizeof(root)) == NULL)
+		return 1;
+
+	fprintf(stdout, "Run on %u threads; the files are read warm from the OS cache after the first iteration.\n", std::thread::hardware_concurrency());
+	fprintf(stdout, "%-36s %15s %10s %12s %22s %14s\n", "Benchmark", "Time", "Iterations", "MB/s", "Throughput", "Allocs/iter");
+	fprintf(stdout, "------------------------------------------------------------------------------------------------------------------\n");
+
+	if (get_file_size(SCENE_LEGACY_FILE) > 0 || get_file_size(SCENE_FILE) > 0)
+		run_scene_benchmarks("real");
+	else
+		fprintf(stdout, "(no %s in the working directory: skipping the real scene)\n", SCENE_LEGACY_FILE);
+
+	if (write_synthetic_scene() && chdir(BENCH_SYNTHETIC_DIR) == 0) {
+		run_scene_benchmarks("synthetic");
+		if (chdir(root) != 0)
+			return 1;
+	}
+	remove_synthetic_scene();
+	run_benchmark("memory/mip_chain", BM_mip_chain);
+
+	if (output_file != NULL)
+		write_json(output_file);
+	return 0;
+}
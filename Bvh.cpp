@@ -0,0 +1,479 @@
+﻿//
+//  Bvh.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define BVH_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+#include "Bvh.h"
+
+#define PARALLEL_BUILD_MIN_TRIANGLES	(65536)	// smaller subtrees are built on the thread that split them
+
+typedef struct {
+	float	box_min[3], box_max[3];
+	float	centroid[3];
+} BUILD_PRIMITIVE;
+
+static BVH_NODE* nodes;
+static BVH_TRIANGLE* triangles;
+static int n_bvh_triangles;
+
+// build state
+static BUILD_PRIMITIVE* primitives;
+static int* primitive_order;
+static std::atomic<int> n_nodes;
+static int parallel_depth;
+
+static float box_area(const float* box_min, const float* box_max) {
+	float dx = box_max[0] - box_min[0], dy = box_max[1] - box_min[1], dz = box_max[2] - box_min[2];
+	return (dx < 0.0f) ? 0.0f : 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+static void grow_box(float* box_min, float* box_max, const float* other_min, const float* other_max) {
+	for (int k = 0; k < 3; k++) {
+		box_min[k] = min(box_min[k], other_min[k]);
+		box_max[k] = max(box_max[k], other_max[k]);
+	}
+}
+
+static void make_leaf(BVH_NODE* pNode, int begin, int end) {
+	pNode->first = begin;
+	pNode->n_triangles = (unsigned short)(end - begin);
+	pNode->axis = 0;
+}
+
+static void build_node(int node, int begin, int end, int depth) {
+	BVH_NODE* pNode = &nodes[node];
+	float box_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, box_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	float centroid_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, centroid_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	for (int i = begin; i < end; i++) {
+		BUILD_PRIMITIVE* pPrimitive = &primitives[primitive_order[i]];
+		grow_box(box_min, box_max, pPrimitive->box_min, pPrimitive->box_max);
+		grow_box(centroid_min, centroid_max, pPrimitive->centroid, pPrimitive->centroid);
+	}
+	pNode->bounds.p_min.x = box_min[0]; pNode->bounds.p_min.y = box_min[1]; pNode->bounds.p_min.z = box_min[2];
+	pNode->bounds.p_max.x = box_max[0]; pNode->bounds.p_max.y = box_max[1]; pNode->bounds.p_max.z = box_max[2];
+
+	int count = end - begin;
+	if (count <= BVH_MAX_LEAF_TRIANGLES) {
+		make_leaf(pNode, begin, end);
+		return;
+	}
+
+	// binned SAH over the centroid bounds: cost = area(left) * n(left) + area(right) * n(right)
+	float best_cost = FLT_MAX;
+	int best_axis = -1, best_split = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		float extent = centroid_max[axis] - centroid_min[axis];
+		if (extent <= 0.0f)
+			continue;
+		float bin_min[BVH_BINS][3], bin_max[BVH_BINS][3];
+		int bin_count[BVH_BINS] = { 0 };
+		for (int b = 0; b < BVH_BINS; b++)
+			for (int k = 0; k < 3; k++) {
+				bin_min[b][k] = FLT_MAX;
+				bin_max[b][k] = -FLT_MAX;
+			}
+		float scale = BVH_BINS / extent;
+		for (int i = begin; i < end; i++) {
+			BUILD_PRIMITIVE* pPrimitive = &primitives[primitive_order[i]];
+			int b = min((int)((pPrimitive->centroid[axis] - centroid_min[axis]) * scale), BVH_BINS - 1);
+			bin_count[b]++;
+			grow_box(bin_min[b], bin_max[b], pPrimitive->box_min, pPrimitive->box_max);
+		}
+
+		float right_cost[BVH_BINS];
+		float right_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, right_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		int right_count = 0;
+		for (int b = BVH_BINS - 1; b > 0; b--) {
+			grow_box(right_min, right_max, bin_min[b], bin_max[b]);
+			right_count += bin_count[b];
+			right_cost[b] = box_area(right_min, right_max) * right_count;
+		}
+		float left_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, left_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		int left_count = 0;
+		for (int b = 0; b < BVH_BINS - 1; b++) {
+			grow_box(left_min, left_max, bin_min[b], bin_max[b]);
+			left_count += bin_count[b];
+			float cost = box_area(left_min, left_max) * left_count + right_cost[b + 1];
+			if (left_count > 0 && left_count < count && cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_split = b + 1;
+			}
+		}
+	}
+
+	int middle;
+	if (best_axis < 0) {
+		// all centroids coincide: split by count, or stop if the leaf is still small
+		if (count <= 4 * BVH_MAX_LEAF_TRIANGLES) {
+			make_leaf(pNode, begin, end);
+			return;
+		}
+		best_axis = 0;
+		middle = begin + count / 2;
+	}
+	else {
+		if (best_cost >= box_area(box_min, box_max) * count && count <= 4 * BVH_MAX_LEAF_TRIANGLES) {
+			make_leaf(pNode, begin, end); // splitting does not pay off
+			return;
+		}
+		float split_min = centroid_min[best_axis], scale = BVH_BINS / (centroid_max[best_axis] - centroid_min[best_axis]);
+		int axis = best_axis, split = best_split;
+		middle = (int)(std::partition(primitive_order + begin, primitive_order + end, [=](int primitive) {
+			return min((int)((primitives[primitive].centroid[axis] - split_min) * scale), BVH_BINS - 1) < split;
+		}) - primitive_order);
+	}
+
+	int first_child = n_nodes.fetch_add(2);
+	pNode->first = first_child;
+	pNode->n_triangles = 0;
+	pNode->axis = (unsigned short)best_axis;
+
+	if (depth < parallel_depth && count >= PARALLEL_BUILD_MIN_TRIANGLES) {
+		std::thread left(build_node, first_child, begin, middle, depth + 1);
+		build_node(first_child + 1, middle, end, depth + 1);
+		left.join();
+	}
+	else {
+		build_node(first_child, begin, middle, depth + 1);
+		build_node(first_child + 1, middle, end, depth + 1);
+	}
+}
+
+void build_bvh(SCENE* pScene, int n_threads) {
+	n_bvh_triangles = 0;
+	for (int materialIdx = 0; materialIdx < pScene->n_materials; materialIdx++)
+		n_bvh_triangles += pScene->material_list[materialIdx].geometry.tm.n_triangle;
+
+	primitives = (BUILD_PRIMITIVE*)malloc(sizeof(BUILD_PRIMITIVE) * max(n_bvh_triangles, 1));
+	primitive_order = (int*)malloc(sizeof(int) * max(n_bvh_triangles, 1));
+	triangles = (BVH_TRIANGLE*)malloc(sizeof(BVH_TRIANGLE) * max(n_bvh_triangles, 1));
+	nodes = (BVH_NODE*)malloc(sizeof(BVH_NODE) * max(2 * n_bvh_triangles - 1, 1));
+
+	int index = 0;
+	for (int materialIdx = 0; materialIdx < pScene->n_materials; materialIdx++) {
+		GEOMETRY_TRIANGULAR_MESH* tm = &pScene->material_list[materialIdx].geometry.tm;
+
+		for (int triIdx = 0; triIdx < tm->n_triangle; triIdx++, index++) {
+			TRIANGLE* pTri = &tm->triangle_list[triIdx];
+			BUILD_PRIMITIVE* pPrimitive = &primitives[index];
+			for (int k = 0; k < 3; k++) {
+				pPrimitive->box_min[k] = FLT_MAX;
+				pPrimitive->box_max[k] = -FLT_MAX;
+			}
+			for (int v = 0; v < 3; v++)
+				grow_box(pPrimitive->box_min, pPrimitive->box_max, &pTri->position[v].x, &pTri->position[v].x);
+			for (int k = 0; k < 3; k++)
+				pPrimitive->centroid[k] = 0.5f * (pPrimitive->box_min[k] + pPrimitive->box_max[k]);
+			primitive_order[index] = index;
+
+			BVH_TRIANGLE* pBvhTri = &triangles[index]; // in scene order for now
+			float3 p0 = pTri->position[0], p1 = pTri->position[1], p2 = pTri->position[2];
+			float3 e1 = { p1.x - p0.x, p1.y - p0.y, p1.z - p0.z }, e2 = { p2.x - p0.x, p2.y - p0.y, p2.z - p0.z };
+			pBvhTri->v0 = p0;
+			pBvhTri->accel.e1 = e1;
+			pBvhTri->accel.e2 = e2;
+			pBvhTri->accel.e2e1.x = e1.y * e2.z - e1.z * e2.y;
+			pBvhTri->accel.e2e1.y = e1.z * e2.x - e1.x * e2.z;
+			pBvhTri->accel.e2e1.z = e1.x * e2.y - e1.y * e2.x;
+			pBvhTri->material = materialIdx;
+			pBvhTri->triangle = triIdx;
+		}
+	}
+
+	parallel_depth = 0;
+	while ((1 << parallel_depth) < n_threads)
+		parallel_depth++;
+	n_nodes = 1;
+	if (n_bvh_triangles > 0)
+		build_node(0, 0, n_bvh_triangles, 0);
+	else
+		make_leaf(&nodes[0], 0, 0);
+
+	// leaves index the triangles directly
+	BVH_TRIANGLE* ordered = (BVH_TRIANGLE*)malloc(sizeof(BVH_TRIANGLE) * max(n_bvh_triangles, 1));
+	for (int i = 0; i < n_bvh_triangles; i++)
+		ordered[i] = triangles[primitive_order[i]];
+	free(triangles);
+	triangles = ordered;
+	free(primitives);
+	free(primitive_order);
+
+	fprintf(stdout, " * Built a BVH of %d nodes over %d triangles.\n", (int)n_nodes, n_bvh_triangles);
+}
+
+const BVH_TRIANGLE* get_bvh_triangle(int index) {
+	return &triangles[index];
+}
+
+// a zero component gets a huge reciprocal of the right sign, so that slabs never produce 0 * inf
+static float safe_reciprocal(float d) {
+	if (fabsf(d) < 1e-20f)
+		d = (d >= 0.0f) ? 1e-20f : -1e-20f;
+	return 1.0f / d;
+}
+
+#ifdef BVH_USE_SSE
+typedef struct {
+	__m128	origin[3], direction[3], inv_direction[3];
+	__m128	t_max;
+	__m128	active;
+	int		near_first[3];	// visit the second child first along an axis the rays mostly go down
+} PACKET_SSE;
+
+static void load_packet(const BVH_PACKET* pPacket, PACKET_SSE* pSse) {
+	for (int k = 0; k < 3; k++) {
+		float inv[BVH_PACKET_SIZE], sum = 0.0f;
+		for (int i = 0; i < BVH_PACKET_SIZE; i++) {
+			inv[i] = safe_reciprocal(pPacket->direction[k][i]);
+			if (pPacket->active & (1 << i))
+				sum += pPacket->direction[k][i];
+		}
+		pSse->origin[k] = _mm_loadu_ps(pPacket->origin[k]);
+		pSse->direction[k] = _mm_loadu_ps(pPacket->direction[k]);
+		pSse->inv_direction[k] = _mm_loadu_ps(inv);
+		pSse->near_first[k] = (sum < 0.0f);
+	}
+	pSse->t_max = _mm_loadu_ps(pPacket->t_max);
+	pSse->active = _mm_cmpneq_ps(_mm_set_ps((float)(pPacket->active & 8), (float)(pPacket->active & 4),
+		(float)(pPacket->active & 2), (float)(pPacket->active & 1)), _mm_setzero_ps());
+}
+
+// mask of the lanes whose ray enters the box before t_max
+static __m128 intersect_box(const PACKET_SSE* pSse, const GEOMETRY_AABB* pBox) {
+	const float* box_min = &pBox->p_min.x, * box_max = &pBox->p_max.x;
+	__m128 t_enter = _mm_setzero_ps(), t_exit = pSse->t_max;
+
+	for (int k = 0; k < 3; k++) {
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box_min[k]), pSse->origin[k]), pSse->inv_direction[k]);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box_max[k]), pSse->origin[k]), pSse->inv_direction[k]);
+		t_enter = _mm_max_ps(t_enter, _mm_min_ps(t0, t1));
+		t_exit = _mm_min_ps(t_exit, _mm_max_ps(t0, t1));
+	}
+	return _mm_and_ps(pSse->active, _mm_cmple_ps(t_enter, t_exit));
+}
+
+// Moller-Trumbore for all four lanes; returns the hit mask and the hit distance and barycentrics
+static __m128 intersect_triangle(const PACKET_SSE* pSse, const BVH_TRIANGLE* pTri, __m128* t, __m128* u, __m128* v) {
+	__m128 e1[3] = { _mm_set1_ps(pTri->accel.e1.x), _mm_set1_ps(pTri->accel.e1.y), _mm_set1_ps(pTri->accel.e1.z) };
+	__m128 e2[3] = { _mm_set1_ps(pTri->accel.e2.x), _mm_set1_ps(pTri->accel.e2.y), _mm_set1_ps(pTri->accel.e2.z) };
+	const __m128* d = pSse->direction;
+
+	__m128 p[3] = {
+		_mm_sub_ps(_mm_mul_ps(d[1], e2[2]), _mm_mul_ps(d[2], e2[1])),
+		_mm_sub_ps(_mm_mul_ps(d[2], e2[0]), _mm_mul_ps(d[0], e2[2])),
+		_mm_sub_ps(_mm_mul_ps(d[0], e2[1]), _mm_mul_ps(d[1], e2[0])) };
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1[0], p[0]), _mm_mul_ps(e1[1], p[1])), _mm_mul_ps(e1[2], p[2]));
+	__m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);	// inf / NaN for parallel rays fail every test below
+
+	__m128 s[3] = { _mm_sub_ps(pSse->origin[0], _mm_set1_ps(pTri->v0.x)), _mm_sub_ps(pSse->origin[1], _mm_set1_ps(pTri->v0.y)),
+		_mm_sub_ps(pSse->origin[2], _mm_set1_ps(pTri->v0.z)) };
+	*u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s[0], p[0]), _mm_mul_ps(s[1], p[1])), _mm_mul_ps(s[2], p[2])), inv_det);
+
+	__m128 q[3] = {
+		_mm_sub_ps(_mm_mul_ps(s[1], e1[2]), _mm_mul_ps(s[2], e1[1])),
+		_mm_sub_ps(_mm_mul_ps(s[2], e1[0]), _mm_mul_ps(s[0], e1[2])),
+		_mm_sub_ps(_mm_mul_ps(s[0], e1[1]), _mm_mul_ps(s[1], e1[0])) };
+	*v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], q[0]), _mm_mul_ps(d[1], q[1])), _mm_mul_ps(d[2], q[2])), inv_det);
+	*t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2[0], q[0]), _mm_mul_ps(e2[1], q[1])), _mm_mul_ps(e2[2], q[2])), inv_det);
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 hit = _mm_and_ps(_mm_cmpge_ps(*u, zero), _mm_cmpge_ps(*v, zero));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(*u, *v), _mm_set1_ps(1.0f)));
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpgt_ps(*t, zero), _mm_cmplt_ps(*t, pSse->t_max)));
+	return _mm_and_ps(hit, pSse->active);
+}
+
+void intersect_bvh_packet(BVH_PACKET* pPacket) {
+	PACKET_SSE packet;
+	int stack[BVH_STACK_SIZE], stack_size = 0, node = 0;
+
+	for (int i = 0; i < BVH_PACKET_SIZE; i++)
+		pPacket->hit[i] = BVH_NO_HIT;
+	if (!pPacket->active)
+		return;
+	load_packet(pPacket, &packet);
+
+	while (true) {
+		BVH_NODE* pNode = &nodes[node];
+
+		if (_mm_movemask_ps(intersect_box(&packet, &pNode->bounds))) {
+			if (pNode->n_triangles == 0) {
+				int near_child = pNode->first + packet.near_first[pNode->axis];
+				stack[stack_size++] = pNode->first + pNode->first + 1 - near_child;
+				node = near_child;
+				continue;
+			}
+			for (int i = pNode->first; i < pNode->first + pNode->n_triangles; i++) {
+				__m128 t, u, v;
+				__m128 hit = intersect_triangle(&packet, &triangles[i], &t, &u, &v);
+				int mask = _mm_movemask_ps(hit);
+				if (!mask)
+					continue;
+				packet.t_max = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, packet.t_max));
+
+				float u_lanes[BVH_PACKET_SIZE], v_lanes[BVH_PACKET_SIZE];
+				_mm_storeu_ps(u_lanes, u);
+				_mm_storeu_ps(v_lanes, v);
+				for (int lane = 0; lane < BVH_PACKET_SIZE; lane++)
+					if (mask & (1 << lane)) {
+						pPacket->hit[lane] = i;
+						pPacket->u[lane] = u_lanes[lane];
+						pPacket->v[lane] = v_lanes[lane];
+					}
+			}
+		}
+		if (stack_size == 0)
+			break;
+		node = stack[--stack_size];
+	}
+	_mm_storeu_ps(pPacket->t_max, packet.t_max);
+}
+
+int occluded_bvh_packet(const BVH_PACKET* pPacket) {
+	PACKET_SSE packet;
+	int stack[BVH_STACK_SIZE], stack_size = 0, node = 0, occluded = 0;
+
+	if (!pPacket->active)
+		return 0;
+	load_packet(pPacket, &packet);
+
+	while (true) {
+		BVH_NODE* pNode = &nodes[node];
+
+		if (_mm_movemask_ps(intersect_box(&packet, &pNode->bounds))) {
+			if (pNode->n_triangles == 0) {
+				stack[stack_size++] = pNode->first + 1;
+				node = pNode->first;
+				continue;
+			}
+			for (int i = pNode->first; i < pNode->first + pNode->n_triangles; i++) {
+				__m128 t, u, v;
+				__m128 hit = intersect_triangle(&packet, &triangles[i], &t, &u, &v);
+				if (!_mm_movemask_ps(hit))
+					continue;
+				occluded |= _mm_movemask_ps(hit);
+				packet.active = _mm_andnot_ps(hit, packet.active); // any hit ends a lane
+				if (!_mm_movemask_ps(packet.active))
+					return occluded;
+			}
+		}
+		if (stack_size == 0)
+			break;
+		node = stack[--stack_size];
+	}
+	return occluded;
+}
+#else
+static bool intersect_box(const BVH_PACKET* pPacket, int lane, const float* inv_direction, float t_max, const GEOMETRY_AABB* pBox) {
+	const float* box_min = &pBox->p_min.x, * box_max = &pBox->p_max.x;
+	float t_enter = 0.0f, t_exit = t_max;
+
+	for (int k = 0; k < 3; k++) {
+		float t0 = (box_min[k] - pPacket->origin[k][lane]) * inv_direction[k];
+		float t1 = (box_max[k] - pPacket->origin[k][lane]) * inv_direction[k];
+		t_enter = max(t_enter, min(t0, t1));
+		t_exit = min(t_exit, max(t0, t1));
+	}
+	return t_enter <= t_exit;
+}
+
+static bool intersect_triangle(const BVH_PACKET* pPacket, int lane, const BVH_TRIANGLE* pTri, float t_max, float* t, float* u, float* v) {
+	const float* e1 = &pTri->accel.e1.x, * e2 = &pTri->accel.e2.x;
+	float d[3] = { pPacket->direction[0][lane], pPacket->direction[1][lane], pPacket->direction[2][lane] };
+	float p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+	float inv_det = 1.0f / (e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2]);
+	float s[3] = { pPacket->origin[0][lane] - pTri->v0.x, pPacket->origin[1][lane] - pTri->v0.y, pPacket->origin[2][lane] - pTri->v0.z };
+	float q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+
+	*u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv_det;
+	*v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv_det;
+	*t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv_det;
+	return *u >= 0.0f && *v >= 0.0f && *u + *v <= 1.0f && *t > 0.0f && *t < t_max;
+}
+
+// one ray at a time; returns true on a hit (the first one when any_hit)
+static bool trace_lane(BVH_PACKET* pPacket, int lane, bool any_hit) {
+	float inv_direction[3], t_max = pPacket->t_max[lane];
+	int stack[BVH_STACK_SIZE], stack_size = 0, node = 0;
+	bool found = false;
+
+	for (int k = 0; k < 3; k++)
+		inv_direction[k] = safe_reciprocal(pPacket->direction[k][lane]);
+	while (true) {
+		BVH_NODE* pNode = &nodes[node];
+
+		if (intersect_box(pPacket, lane, inv_direction, t_max, &pNode->bounds)) {
+			if (pNode->n_triangles == 0) {
+				int near_child = pNode->first + (pPacket->direction[pNode->axis][lane] < 0.0f);
+				stack[stack_size++] = pNode->first + pNode->first + 1 - near_child;
+				node = near_child;
+				continue;
+			}
+			for (int i = pNode->first; i < pNode->first + pNode->n_triangles; i++) {
+				float t, u, v;
+				if (!intersect_triangle(pPacket, lane, &triangles[i], t_max, &t, &u, &v))
+					continue;
+				if (any_hit)
+					return true;
+				t_max = t;
+				pPacket->hit[lane] = i;
+				pPacket->u[lane] = u;
+				pPacket->v[lane] = v;
+				found = true;
+			}
+		}
+		if (stack_size == 0)
+			break;
+		node = stack[--stack_size];
+	}
+	pPacket->t_max[lane] = t_max;
+	return found;
+}
+
+void intersect_bvh_packet(BVH_PACKET* pPacket) {
+	for (int lane = 0; lane < BVH_PACKET_SIZE; lane++) {
+		pPacket->hit[lane] = BVH_NO_HIT;
+		if (pPacket->active & (1 << lane))
+			trace_lane(pPacket, lane, false);
+	}
+}
+
+int occluded_bvh_packet(const BVH_PACKET* pPacket) {
+	BVH_PACKET packet = *pPacket;
+	int occluded = 0;
+
+	for (int lane = 0; lane < BVH_PACKET_SIZE; lane++)
+		if ((pPacket->active & (1 << lane)) && trace_lane(&packet, lane, true))
+			occluded |= 1 << lane;
+	return occluded;
+}
+#endif
+
+void free_bvh(void) {
+	free(nodes);
+	free(triangles);
+	nodes = NULL;
+	triangles = NULL;
+	n_bvh_triangles = 0;
+}
@@ -0,0 +1,49 @@
+﻿//
+//  Bvh.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+#include "LoadScene.h"
+
+// Bounding volume hierarchy over the static Bistro triangles for the path tracer, built with a binned
+// surface area heuristic. Rays are traced in packets of BVH_PACKET_SIZE, four lanes of an SSE register;
+// a packet visits a node if any of its active rays hits the node's box.
+#define BVH_PACKET_SIZE			(4)
+#define BVH_MAX_LEAF_TRIANGLES	(4)
+#define BVH_BINS				(16)
+#define BVH_STACK_SIZE			(64)
+#define BVH_NO_HIT				(-1)
+
+typedef struct {
+	GEOMETRY_AABB	bounds;
+	int				first;			// first child of an inner node (the second follows it) or first triangle of a leaf
+	unsigned short	n_triangles;	// 0 for inner nodes
+	unsigned short	axis;			// split axis of an inner node, to visit the nearer child first
+} BVH_NODE;
+
+typedef struct {
+	float3		v0;
+	TRIACCEL	accel;				// e1 = v1 - v0, e2 = v2 - v0, e2e1 = e1 x e2 (unnormalized geometric normal)
+	int			material, triangle;
+} BVH_TRIANGLE;
+
+typedef struct {
+	float	origin[3][BVH_PACKET_SIZE];		// x, y and z of every lane
+	float	direction[3][BVH_PACKET_SIZE];
+	float	t_max[BVH_PACKET_SIZE];			// shortened to the closest hit by intersect_bvh_packet
+	int		active;							// mask of the lanes to trace
+	int		hit[BVH_PACKET_SIZE];			// BVH triangle, BVH_NO_HIT on a miss
+	float	u[BVH_PACKET_SIZE], v[BVH_PACKET_SIZE];	// barycentrics of vertices 1 and 2 at the hit
+} BVH_PACKET;
+
+// Bvh.cpp
+void build_bvh(SCENE* pScene, int n_threads);
+const BVH_TRIANGLE* get_bvh_triangle(int index);
+void intersect_bvh_packet(BVH_PACKET* pPacket);			// closest hits of the active lanes
+int occluded_bvh_packet(const BVH_PACKET* pPacket);		// mask of the active lanes with any hit before t_max
+void free_bvh(void);
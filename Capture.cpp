@@ -0,0 +1,235 @@
+﻿//
+//  Capture.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <GL/glew.h>
+#include <FreeImage/FreeImage.h>
+
+#include "Capture.h"
+
+typedef struct {
+	int				frame;
+	unsigned char*	pixels;	// BGRA, bottom row first
+} CAPTURE_JOB;
+
+static bool capturing;
+static CAPTURE_FORMAT capture_format;
+static char capture_path[512];
+static int capture_width, capture_height;
+
+static GLuint capture_pbo[CAPTURE_PBO_COUNT];
+static GLsync capture_fence[CAPTURE_PBO_COUNT];
+static int capture_pbo_frame[CAPTURE_PBO_COUNT];
+static int n_frames_read, n_frames_queued;
+
+static std::thread workers[CAPTURE_MAX_WORKERS];
+static int n_workers;
+static std::deque<CAPTURE_JOB> job_queue;
+static std::mutex job_mutex;
+static std::condition_variable job_ready, job_taken, frame_written;
+static bool workers_quit;
+
+static FILE* y4m_fp;
+static int y4m_next_frame; // Y4M frames are written in order; workers convert in parallel
+
+static void write_png(CAPTURE_JOB* pJob) {
+	char filename[600];
+	FIBITMAP* bitmap = FreeImage_ConvertFromRawBits(pJob->pixels, capture_width, capture_height, 4 * capture_width, 32,
+		FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, FALSE); // GL rows are bottom-up like FreeImage's
+
+	sprintf(filename, "%s%05d.png", capture_path, pJob->frame);
+	if (bitmap == NULL || !FreeImage_Save(FIF_PNG, bitmap, filename, PNG_DEFAULT))
+		fprintf(stderr, "Error: cannot write %s\n", filename);
+	if (bitmap != NULL)
+		FreeImage_Unload(bitmap);
+}
+
+// BT.601 limited range, 2x2 chroma averaging; the frame is flipped to top row first
+static void write_y4m(CAPTURE_JOB* pJob) {
+	int w = capture_width, h = capture_height, cw = (w + 1) / 2, ch = (h + 1) / 2;
+	unsigned char* yuv = (unsigned char*)malloc(w * h + 2 * cw * ch);
+	unsigned char* u_plane = yuv + w * h, * v_plane = u_plane + cw * ch;
+
+	for (int y = 0; y < h; y++) {
+		const unsigned char* src = pJob->pixels + 4 * w * (h - 1 - y);
+		for (int x = 0; x < w; x++, src += 4)
+			yuv[y * w + x] = (unsigned char)((66 * src[2] + 129 * src[1] + 25 * src[0] + 128) / 256 + 16);
+	}
+	for (int y = 0; y < ch; y++) {
+		for (int x = 0; x < cw; x++) {
+			int r = 0, g = 0, b = 0, n = 0;
+
+			for (int dy = 0; dy < 2 && 2 * y + dy < h; dy++)
+				for (int dx = 0; dx < 2 && 2 * x + dx < w; dx++) {
+					const unsigned char* src = pJob->pixels + 4 * (w * (h - 1 - (2 * y + dy)) + 2 * x + dx);
+					b += src[0]; g += src[1]; r += src[2]; n++;
+				}
+			r /= n; g /= n; b /= n;
+			u_plane[y * cw + x] = (unsigned char)((-38 * r - 74 * g + 112 * b + 128) / 256 + 128);
+			v_plane[y * cw + x] = (unsigned char)((112 * r - 94 * g - 18 * b + 128) / 256 + 128);
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(job_mutex);
+	frame_written.wait(lock, [pJob] { return y4m_next_frame == pJob->frame; });
+	fprintf(y4m_fp, "FRAME\n");
+	fwrite(yuv, 1, w * h + 2 * cw * ch, y4m_fp);
+	y4m_next_frame++;
+	lock.unlock();
+	frame_written.notify_all();
+
+	free(yuv);
+}
+
+static void capture_worker(void) {
+	for (;;) {
+		CAPTURE_JOB job;
+		{
+			std::unique_lock<std::mutex> lock(job_mutex);
+			job_ready.wait(lock, [] { return workers_quit || !job_queue.empty(); });
+			if (job_queue.empty())
+				return;
+			job = job_queue.front();
+			job_queue.pop_front();
+		}
+		job_taken.notify_one();
+
+		if (capture_format == CAPTURE_PNG)
+			write_png(&job);
+		else
+			write_y4m(&job);
+		free(job.pixels);
+	}
+}
+
+bool begin_capture(const char* path, CAPTURE_FORMAT format, int width, int height, int fps) {
+	if (capturing)
+		end_capture();
+
+	strncpy(capture_path, path, sizeof(capture_path) - 1);
+	capture_format = format;
+	capture_width = width;
+	capture_height = height;
+
+	if (format == CAPTURE_Y4M) {
+		y4m_fp = fopen(path, "wb");
+		if (y4m_fp == NULL) {
+			fprintf(stderr, "Error: cannot write %s\n", path);
+			return false;
+		}
+		fprintf(y4m_fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+		y4m_next_frame = 0;
+	}
+
+	glGenBuffers(CAPTURE_PBO_COUNT, capture_pbo);
+	for (int i = 0; i < CAPTURE_PBO_COUNT; i++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, capture_pbo[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, 4 * width * height, NULL, GL_STREAM_READ);
+		capture_fence[i] = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	n_frames_read = n_frames_queued = 0;
+
+	n_workers = (int)std::thread::hardware_concurrency() - 1;
+	if (n_workers < 1)
+		n_workers = 1;
+	if (n_workers > CAPTURE_MAX_WORKERS)
+		n_workers = CAPTURE_MAX_WORKERS;
+	workers_quit = false;
+	for (int i = 0; i < n_workers; i++)
+		workers[i] = std::thread(capture_worker);
+
+	capturing = true;
+	fprintf(stdout, " * Capturing %dx%d frames to %s%s (%d encoder threads)\n", width, height, path,
+		format == CAPTURE_PNG ? "#####.png" : "", n_workers);
+
+	return true;
+}
+
+bool is_capturing(void) {
+	return capturing;
+}
+
+// maps the oldest slot and hands a copy of its pixels to the workers
+static void queue_slot(int slot) {
+	CAPTURE_JOB job;
+
+	glClientWaitSync(capture_fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED); // normally signaled already
+	glDeleteSync(capture_fence[slot]);
+	capture_fence[slot] = 0;
+
+	job.frame = capture_pbo_frame[slot];
+	job.pixels = (unsigned char*)malloc(4 * capture_width * capture_height);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, capture_pbo[slot]);
+	void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 4 * capture_width * capture_height, GL_MAP_READ_BIT);
+	if (mapped != NULL) {
+		memcpy(job.pixels, mapped, 4 * capture_width * capture_height);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	else
+		memset(job.pixels, 0, 4 * capture_width * capture_height);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	{
+		std::unique_lock<std::mutex> lock(job_mutex);
+		job_taken.wait(lock, [] { return job_queue.size() < CAPTURE_MAX_QUEUED; });
+		job_queue.push_back(job);
+	}
+	job_ready.notify_one();
+	n_frames_queued++;
+}
+
+void capture_frame(void) {
+	if (!capturing)
+		return;
+
+	int slot = n_frames_read % CAPTURE_PBO_COUNT;
+	if (capture_fence[slot])
+		queue_slot(slot); // frame n_frames_read - CAPTURE_PBO_COUNT
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, capture_pbo[slot]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, capture_width, capture_height, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	capture_fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	capture_pbo_frame[slot] = n_frames_read++;
+}
+
+void end_capture(void) {
+	if (!capturing)
+		return;
+
+	for (int i = 0; i < CAPTURE_PBO_COUNT; i++) {
+		int slot = (n_frames_read + i) % CAPTURE_PBO_COUNT; // oldest first
+		if (capture_fence[slot])
+			queue_slot(slot);
+	}
+	glDeleteBuffers(CAPTURE_PBO_COUNT, capture_pbo);
+
+	{
+		std::lock_guard<std::mutex> lock(job_mutex);
+		workers_quit = true;
+	}
+	job_ready.notify_all();
+	for (int i = 0; i < n_workers; i++)
+		workers[i].join();
+
+	if (y4m_fp != NULL)
+		fclose(y4m_fp);
+	y4m_fp = NULL;
+	capturing = false;
+	fprintf(stdout, " * Captured %d frames\n", n_frames_queued);
+}
@@ -0,0 +1,26 @@
+﻿//
+//  Capture.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+// Frame capture: glReadPixels into a ring of pixel buffer objects, each mapped CAPTURE_PBO_COUNT frames
+// later behind a fence, so the read never waits for the GPU; worker threads encode the frames.
+#define CAPTURE_PBO_COUNT		(3)
+#define CAPTURE_MAX_WORKERS		(4)
+#define CAPTURE_MAX_QUEUED		(8)	// frames waiting for a worker before the render loop blocks
+
+typedef enum {
+	CAPTURE_PNG,	// numbered frames: <path>00000.png, <path>00001.png, ...
+	CAPTURE_Y4M		// one raw YUV 4:2:0 stream: <path>
+} CAPTURE_FORMAT;
+
+// Capture.cpp
+bool begin_capture(const char* path, CAPTURE_FORMAT format, int width, int height, int fps);
+bool is_capturing(void);
+void capture_frame(void);	// reads the current read buffer; call after rendering, before the swap
+void end_capture(void);	// drains the ring and the workers
@@ -0,0 +1,102 @@
+﻿//
+//  CpuShading.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <math.h>
+#include <float.h>
+#include <glm/glm.hpp>
+
+#include "LoadScene.h"
+#include "CpuShading.h"
+
+#define PI	(3.14159265359f)
+
+static float distribution_GGX(float NdotH, float roughness) {
+	float a = roughness * roughness;
+	float a2 = a * a;
+	float denom = NdotH * NdotH * (a2 - 1.0f) + 1.0f;
+
+	return a2 / (PI * denom * denom);
+}
+
+static float geometry_schlick_GGX(float NdotV, float roughness) {
+	float r = roughness + 1.0f;
+	float k = (r * r) / 8.0f;
+
+	return NdotV / (NdotV * (1.0f - k) + k);
+}
+
+// shadeLight() of PBR_Lighting.frag
+float shade_cpu_light(const float* light, const float* P, const float* N, const float* V, const float* albedo,
+	float metallic, float roughness, float* radiance, float* L) {
+	glm::vec3 position = glm::vec3(P[0], P[1], P[2]), normal = glm::vec3(N[0], N[1], N[2]), view = glm::vec3(V[0], V[1], V[2]);
+	glm::vec3 to_light;
+	float attenuation = 1.0f, distance = FLT_MAX;
+
+	if ((int)light[7] == LIGHT_DIRECTIONAL)
+		to_light = glm::normalize(glm::vec3(light[0], light[1], light[2]));
+	else {
+		to_light = glm::vec3(light[0], light[1], light[2]) - position;
+		distance = glm::length(to_light);
+		to_light = to_light / distance;
+
+		if (light[3] > 0.0f) {
+			float ratio = distance / light[3];
+			float window = glm::clamp(1.0f - ratio * ratio * ratio * ratio, 0.0f, 1.0f);
+			attenuation = window * window / max(light[8] + light[9] * distance + light[10] * distance * distance, 0.0001f);
+		}
+		if (light[15] > -1.0f) {
+			float spot_cos = -glm::dot(to_light, glm::normalize(glm::vec3(light[12], light[13], light[14])));
+			attenuation *= (spot_cos < light[15]) ? 0.0f : powf(spot_cos, light[11]);
+		}
+	}
+	for (int k = 0; k < 3; k++)
+		L[k] = to_light[k];
+
+	float NdotL = max(glm::dot(normal, to_light), 0.0f);
+	if (attenuation <= 0.0f || NdotL <= 0.0f) {
+		radiance[0] = radiance[1] = radiance[2] = 0.0f;
+		return distance;
+	}
+
+	glm::vec3 H = glm::normalize(view + to_light);
+	glm::vec3 color = glm::vec3(albedo[0], albedo[1], albedo[2]);
+	glm::vec3 F0 = glm::vec3(0.04f) * (1.0f - metallic) + color * metallic;
+	float NdotV = max(glm::dot(normal, view), 0.0f);
+	float NDF = distribution_GGX(max(glm::dot(normal, H), 0.0f), roughness);
+	float G = geometry_schlick_GGX(NdotV, roughness) * geometry_schlick_GGX(NdotL, roughness);
+	float fresnel = powf(glm::clamp(1.0f - max(glm::dot(H, view), 0.0f), 0.0f, 1.0f), 5.0f);
+	glm::vec3 F = F0 + (glm::vec3(1.0f) - F0) * fresnel;
+
+	glm::vec3 specular = F * (NDF * G / (4.0f * NdotV * NdotL + 0.0001f));
+	glm::vec3 kD = (glm::vec3(1.0f) - F) * (1.0f - metallic);
+	glm::vec3 result = (kD * color + specular) * glm::vec3(light[4], light[5], light[6]) * (attenuation * 4.5f * NdotL); // day heuristic
+
+	for (int k = 0; k < 3; k++)
+		radiance[k] = result[k];
+	return distance;
+}
+
+void evaluate_irradiance_sh(const float irradiance[SH_COEFFICIENTS][3], const float* n, float* rgb) {
+	float basis[SH_COEFFICIENTS] = { 1.0f, n[1], n[2], n[0], n[0] * n[1], n[1] * n[2], 3.0f * n[2] * n[2] - 1.0f, n[0] * n[2], n[0] * n[0] - n[1] * n[1] };
+
+	for (int c = 0; c < 3; c++) {
+		rgb[c] = 0.0f;
+		for (int k = 0; k < SH_COEFFICIENTS; k++)
+			rgb[c] += basis[k] * irradiance[k][c];
+	}
+}
+
+void encode_display_color(const float* color, unsigned char* bgr) {
+	for (int c = 0; c < 3; c++) {
+		float value = max(color[c], 0.0f);
+		value = powf(value / (value + 1.0f), 1.0f / 2.2f);
+		bgr[2 - c] = (unsigned char)(min(value, 1.0f) * 255.0f + 0.5f);
+	}
+}
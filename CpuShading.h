@@ -0,0 +1,22 @@
+﻿//
+//  CpuShading.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+#include "SphericalHarmonics.h"
+
+// PBR_Lighting.frag on the CPU for the software renderer and the path tracer.
+// Vectors are float[3], in the coordinate system of the light data.
+
+// CpuShading.cpp
+// light: the LIGHT_TEXELS_PER_LIGHT texels of a light in LIGHT_CLUSTERS::light_data; writes the reflected
+// radiance (no visibility) and the direction to the light; returns the distance to the light (FLT_MAX if directional)
+float shade_cpu_light(const float* light, const float* P, const float* N, const float* V, const float* albedo,
+	float metallic, float roughness, float* radiance, float* L);
+void evaluate_irradiance_sh(const float irradiance[SH_COEFFICIENTS][3], const float* n, float* rgb);	// n in cube map coordinates
+void encode_display_color(const float* color, unsigned char* bgr);	// HDR tonemapping and gamma of shadePBR()
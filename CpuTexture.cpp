@@ -0,0 +1,275 @@
+﻿//
+//  CpuTexture.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <thread>
+#include <atomic>
+#include <FreeImage/FreeImage.h>
+
+#include "CpuTexture.h"
+
+#define MAX_LOADER_THREADS	(32)
+
+static int n_scene_textures;
+static CPU_TEXTURE* scene_textures;	// n_levels < 0 marks a texture to load
+static CPU_TEXTURE skybox_faces[6];
+static std::atomic<int> next_texture;
+
+static unsigned int average_texels(unsigned int a, unsigned int b, unsigned int c, unsigned int d) {
+	unsigned int result = 0;
+
+	for (int shift = 0; shift < 32; shift += 8) {
+		unsigned int sum = ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) + ((c >> shift) & 0xFF) + ((d >> shift) & 0xFF);
+		result |= ((sum + 2) / 4) << shift;
+	}
+	return result;
+}
+
+static void build_mip_chain(CPU_TEXTURE* pTexture) {
+	while (pTexture->n_levels < CPU_TEXTURE_MAX_LEVELS) {
+		CPU_TEXTURE_LEVEL* pSource = &pTexture->levels[pTexture->n_levels - 1];
+		CPU_TEXTURE_LEVEL* pLevel = &pTexture->levels[pTexture->n_levels];
+
+		if (pSource->width == 1 && pSource->height == 1)
+			break;
+		pLevel->width = (pSource->width > 1) ? pSource->width / 2 : 1;
+		pLevel->height = (pSource->height > 1) ? pSource->height / 2 : 1;
+		pLevel->texels = (unsigned int*)SCENE_MALLOC(sizeof(unsigned int) * pLevel->width * pLevel->height);
+
+		for (int y = 0; y < pLevel->height; y++) {
+			int y0 = (2 * y < pSource->height) ? 2 * y : pSource->height - 1;
+			int y1 = (2 * y + 1 < pSource->height) ? 2 * y + 1 : y0;
+			for (int x = 0; x < pLevel->width; x++) {
+				int x0 = (2 * x < pSource->width) ? 2 * x : pSource->width - 1;
+				int x1 = (2 * x + 1 < pSource->width) ? 2 * x + 1 : x0;
+				pLevel->texels[y * pLevel->width + x] = average_texels(pSource->texels[y0 * pSource->width + x0],
+					pSource->texels[y0 * pSource->width + x1], pSource->texels[y1 * pSource->width + x0], pSource->texels[y1 * pSource->width + x1]);
+			}
+		}
+		pTexture->n_levels++;
+	}
+}
+
+bool load_cpu_texture(const char* filename, int max_size, bool flip_vertical, CPU_TEXTURE* pTexture) {
+	FIBITMAP* pixmap, * pixmap_32;
+
+	memset(pTexture, 0, sizeof(CPU_TEXTURE));
+	pixmap = FreeImage_Load(FreeImage_GetFileType(filename, 0), filename);
+	if (pixmap == NULL)
+		return false;
+	pixmap_32 = FreeImage_ConvertTo32Bits(pixmap);
+	FreeImage_Unload(pixmap);
+	if (pixmap_32 == NULL)
+		return false;
+
+	int width = FreeImage_GetWidth(pixmap_32), height = FreeImage_GetHeight(pixmap_32);
+	if (width > max_size || height > max_size) {
+		float scale = (float)max_size / (float)((width > height) ? width : height);
+		FIBITMAP* scaled;
+
+		width = (int)(width * scale) > 1 ? (int)(width * scale) : 1;
+		height = (int)(height * scale) > 1 ? (int)(height * scale) : 1;
+		scaled = FreeImage_Rescale(pixmap_32, width, height, FILTER_BOX);
+		FreeImage_Unload(pixmap_32);
+		if (scaled == NULL)
+			return false;
+		pixmap_32 = scaled;
+	}
+	if (flip_vertical)
+		FreeImage_FlipVertical(pixmap_32);
+
+	CPU_TEXTURE_LEVEL* pLevel = &pTexture->levels[0];
+	pLevel->width = width;
+	pLevel->height = height;
+	pLevel->texels = (unsigned int*)SCENE_MALLOC(sizeof(unsigned int) * width * height);
+	for (int y = 0; y < height; y++)
+		memcpy(&pLevel->texels[y * width], FreeImage_GetScanLine(pixmap_32, y), sizeof(unsigned int) * width);
+	FreeImage_Unload(pixmap_32);
+
+	pTexture->n_levels = 1;
+	pTexture->lod_offset = 0.5f * log2f((float)width * height);
+	build_mip_chain(pTexture);
+	return true;
+}
+
+void create_cpu_texture(int width, int height, const unsigned int* texels, CPU_TEXTURE* pTexture) {
+	CPU_TEXTURE_LEVEL* pLevel = &pTexture->levels[0];
+
+	memset(pTexture, 0, sizeof(CPU_TEXTURE));
+	pLevel->width = width;
+	pLevel->height = height;
+	pLevel->texels = (unsigned int*)SCENE_MALLOC(sizeof(unsigned int) * width * height);
+	memcpy(pLevel->texels, texels, sizeof(unsigned int) * width * height);
+
+	pTexture->n_levels = 1;
+	pTexture->lod_offset = 0.5f * log2f((float)width * height);
+	build_mip_chain(pTexture);
+}
+
+void sample_cpu_texture(const CPU_TEXTURE* pTexture, float u, float v, float lod, float* rgb) {
+	int level = (int)(lod + 0.5f);
+
+	if (level < 0)
+		level = 0;
+	if (level >= pTexture->n_levels)
+		level = pTexture->n_levels - 1;
+	const CPU_TEXTURE_LEVEL* pLevel = &pTexture->levels[level];
+
+	float x = (u - floorf(u)) * pLevel->width - 0.5f, y = (v - floorf(v)) * pLevel->height - 0.5f;
+	float x_floor = floorf(x), y_floor = floorf(y);
+	float fx = x - x_floor, fy = y - y_floor;
+	int x0 = ((int)x_floor + pLevel->width) % pLevel->width, x1 = (x0 + 1) % pLevel->width;
+	int y0 = ((int)y_floor + pLevel->height) % pLevel->height, y1 = (y0 + 1) % pLevel->height;
+	unsigned int t00 = pLevel->texels[y0 * pLevel->width + x0], t10 = pLevel->texels[y0 * pLevel->width + x1];
+	unsigned int t01 = pLevel->texels[y1 * pLevel->width + x0], t11 = pLevel->texels[y1 * pLevel->width + x1];
+
+	// BGRA bytes: red is at shift 16, blue at 0
+	for (int c = 0; c < 3; c++) {
+		int shift = 16 - 8 * c;
+		float top = (1.0f - fx) * ((t00 >> shift) & 0xFF) + fx * ((t10 >> shift) & 0xFF);
+		float bottom = (1.0f - fx) * ((t01 >> shift) & 0xFF) + fx * ((t11 >> shift) & 0xFF);
+		rgb[c] = ((1.0f - fy) * top + fy * bottom) * (1.0f / 255.0f);
+	}
+}
+
+void free_cpu_texture(CPU_TEXTURE* pTexture) {
+	for (int level = 0; level < pTexture->n_levels; level++)
+		free(pTexture->levels[level].texels);
+	pTexture->n_levels = 0;
+}
+
+static void load_texture_job(SCENE* pScene, int max_size) {
+	static const char* skybox_files[6] = SKYBOX_FACE_FILES;
+
+	// the skybox faces are jobs [0, 6), flipped like in readTexImage2DForCubeMap
+	for (int job = next_texture++; job < 6 + n_scene_textures; job = next_texture++) {
+		if (job < 6) {
+			if (!load_cpu_texture(skybox_files[job], max_size, true, &skybox_faces[job]))
+				fprintf(stderr, "Error: cannot read %s\n", skybox_files[job]);
+		}
+		else if (scene_textures[job - 6].n_levels < 0)
+			load_cpu_texture(pScene->texture_file_name[job - 6], max_size, false, &scene_textures[job - 6]);
+	}
+}
+
+void load_scene_textures(SCENE* pScene, int max_size, int n_threads) {
+	std::thread threads[MAX_LOADER_THREADS];
+	int n_loaded = 0;
+
+	n_threads = max(1, min(n_threads, MAX_LOADER_THREADS));
+	n_scene_textures = pScene->n_textures;
+	scene_textures = (CPU_TEXTURE*)calloc(max(n_scene_textures, 1), sizeof(CPU_TEXTURE));
+	for (int materialIdx = 0; materialIdx < pScene->n_materials; materialIdx++) {
+		MATERIAL* pMaterial = &pScene->material_list[materialIdx];
+		int texIds[3] = { pMaterial->diffuseTexId, pMaterial->specularTexId, pMaterial->emissiveTexId };
+		for (int k = 0; k < 3; k++)
+			if (texIds[k] != (int)INVALID_TEX_ID && texIds[k] < n_scene_textures)
+				scene_textures[texIds[k]].n_levels = -1;
+	}
+
+	next_texture = 0;
+	for (int t = 1; t < n_threads; t++)
+		threads[t] = std::thread(load_texture_job, pScene, max_size);
+	load_texture_job(pScene, max_size);
+	for (int t = 1; t < n_threads; t++)
+		threads[t].join();
+
+	for (int texId = 0; texId < n_scene_textures; texId++) {
+		if (scene_textures[texId].n_levels < 0)
+			scene_textures[texId].n_levels = 0; // unreadable
+		if (scene_textures[texId].n_levels > 0)
+			n_loaded++;
+	}
+	fprintf(stdout, " * Loaded %d textures of up to %dx%d into system memory.\n", n_loaded, max_size, max_size);
+}
+
+const CPU_TEXTURE* get_scene_texture(int texId) {
+	if (texId == (int)INVALID_TEX_ID || texId < 0 || texId >= n_scene_textures || scene_textures[texId].n_levels == 0)
+		return NULL;
+	return &scene_textures[texId];
+}
+
+const CPU_TEXTURE* get_skybox_face(int face) {
+	return skybox_faces[face].n_levels > 0 ? &skybox_faces[face] : NULL;
+}
+
+// face selection and orientation as in the GL specification
+void sample_skybox(const float* dir, float* rgb) {
+	float ax = fabsf(dir[0]), ay = fabsf(dir[1]), az = fabsf(dir[2]);
+	int face;
+	float sc, tc, ma;
+
+	if (ax >= ay && ax >= az) {
+		face = (dir[0] > 0.0f) ? 0 : 1;
+		sc = (dir[0] > 0.0f) ? -dir[2] : dir[2]; tc = -dir[1]; ma = ax;
+	}
+	else if (ay >= az) {
+		face = (dir[1] > 0.0f) ? 2 : 3;
+		sc = dir[0]; tc = (dir[1] > 0.0f) ? dir[2] : -dir[2]; ma = ay;
+	}
+	else {
+		face = (dir[2] > 0.0f) ? 4 : 5;
+		sc = (dir[2] > 0.0f) ? dir[0] : -dir[0]; tc = -dir[1]; ma = az;
+	}
+	if (skybox_faces[face].n_levels == 0 || !(ma > 0.0f)) {
+		rgb[0] = rgb[1] = rgb[2] = 0.0f;
+		return;
+	}
+	sample_cpu_texture(&skybox_faces[face], 0.5f * (sc / ma + 1.0f), 0.5f * (tc / ma + 1.0f), 0.0f, rgb);
+}
+
+// the skybox is a cube around the world origin, not the eye; look up where the ray leaves it
+void sample_skybox_ray(const float* origin, const float* dir, float* rgb) {
+	float hit[3] = { dir[0], dir[1], dir[2] };
+	float t_exit = 1e30f;
+
+	for (int k = 0; k < 3; k++)
+		if (dir[k] != 0.0f)
+			t_exit = min(t_exit, ((dir[k] > 0.0f ? SKYBOX_HALF_SIZE : -SKYBOX_HALF_SIZE) - origin[k]) / dir[k]);
+	if (t_exit > 0.0f && t_exit < 1e30f)
+		for (int k = 0; k < 3; k++)
+			hit[k] = origin[k] + t_exit * dir[k];
+
+	float dir_skybox[3] = { hit[0], hit[2], hit[1] }; // the skybox swaps y and z
+	sample_skybox(dir_skybox, rgb);
+}
+
+bool save_png_bgr(const char* filename, int width, int height, const unsigned char* pixels) {
+	FIBITMAP* pixmap = FreeImage_Allocate(width, height, 24);
+	bool saved;
+
+	if (pixmap == NULL)
+		return false;
+	for (int y = 0; y < height; y++) {
+		BYTE* scanline = FreeImage_GetScanLine(pixmap, y);
+		const unsigned char* bgr = &pixels[3 * (size_t)y * width];
+		for (int x = 0; x < width; x++, scanline += 3, bgr += 3) {
+			scanline[FI_RGBA_BLUE] = bgr[0];
+			scanline[FI_RGBA_GREEN] = bgr[1];
+			scanline[FI_RGBA_RED] = bgr[2];
+		}
+	}
+	saved = FreeImage_Save(FIF_PNG, pixmap, filename, PNG_DEFAULT) != 0;
+	FreeImage_Unload(pixmap);
+	return saved;
+}
+
+void free_scene_textures(void) {
+	for (int texId = 0; texId < n_scene_textures; texId++)
+		free_cpu_texture(&scene_textures[texId]);
+	free(scene_textures);
+	scene_textures = NULL;
+	n_scene_textures = 0;
+	for (int face = 0; face < 6; face++)
+		free_cpu_texture(&skybox_faces[face]);
+}
@@ -0,0 +1,50 @@
+﻿//
+//  CpuTexture.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+#include "LoadScene.h"
+
+// Textures in system memory for the software renderer, the path tracer and the texture residency manager,
+// with a box-filtered mip chain.
+#define CPU_TEXTURE_MAX_LEVELS	(16)
+
+#define SKYBOX_HALF_SIZE		(20000.0f)	// see draw_skybox
+
+// the skybox faces in GL order (+X, -X, +Y, -Y, +Z, -Z), as in prepare_skybox
+#define SKYBOX_FACE_FILES	{ "Scene/Cubemap/px.png", "Scene/Cubemap/nx.png", "Scene/Cubemap/py.png", \
+							  "Scene/Cubemap/ny.png", "Scene/Cubemap/pz.png", "Scene/Cubemap/nz.png" }
+
+typedef struct {
+	int				width, height;
+	unsigned int*	texels;		// BGRA8 as FreeImage stores them; row 0 is at v = 0 like the GL textures
+} CPU_TEXTURE_LEVEL;
+
+typedef struct {
+	int					n_levels;	// 0 if the texture could not be loaded
+	float				lod_offset;	// log2 of the side of level 0 in texels, added to lods in uv units
+	CPU_TEXTURE_LEVEL	levels[CPU_TEXTURE_MAX_LEVELS];
+} CPU_TEXTURE;
+
+// CpuTexture.cpp
+// larger images are scaled down to fit max_size; flip_vertical as done for the cube map faces
+bool load_cpu_texture(const char* filename, int max_size, bool flip_vertical, CPU_TEXTURE* pTexture);
+void create_cpu_texture(int width, int height, const unsigned int* texels, CPU_TEXTURE* pTexture);	// copies the texels
+// bilinear within the nearest mip level, repeat wrapping; rgb as stored (not linearized)
+void sample_cpu_texture(const CPU_TEXTURE* pTexture, float u, float v, float lod, float* rgb);
+void free_cpu_texture(CPU_TEXTURE* pTexture);
+
+// the material textures (albedo, metallic-roughness, emissive) and the skybox faces, read by n_threads threads
+void load_scene_textures(SCENE* pScene, int max_size, int n_threads);
+const CPU_TEXTURE* get_scene_texture(int texId);	// NULL without the texture
+const CPU_TEXTURE* get_skybox_face(int face);		// NULL if the face could not be read
+void sample_skybox(const float* dir, float* rgb);	// dir in cube map coordinates; black for missing faces
+void sample_skybox_ray(const float* origin, const float* dir, float* rgb);	// world coordinates, as draw_skybox shows it
+void free_scene_textures(void);
+
+bool save_png_bgr(const char* filename, int width, int height, const unsigned char* pixels);	// BGR, bottom row first
@@ -0,0 +1,144 @@
+﻿//
+//  CreatureMesh.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <vector>
+#include <unordered_map>
+
+#include "LoadScene.h"
+#include "CreatureMesh.h"
+
+#define CREATURE_FLOATS_PER_VERTEX	(8)	// 3 for vertex, 3 for normal, and 2 for texcoord
+
+static short quantize_snorm16(float x) {
+	x = min(max(x, -1.0f), 1.0f);
+	return (short)floorf(x * 32767.0f + 0.5f);
+}
+
+static unsigned int pack_normal(const float* n) {
+	float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+	float scale = (length > 0.0f) ? 1.0f / length : 0.0f; // the tiger's normals are not unit length
+	int max_value = (1 << (CREATURE_NORMAL_BITS - 1)) - 1;
+	unsigned int mask = (1u << CREATURE_NORMAL_BITS) - 1, packed = 0;
+
+	for (int k = 0; k < 3; k++) {
+		float x = min(max(n[k] * scale, -1.0f), 1.0f);
+		int q = (int)floorf(x * max_value + 0.5f);
+		packed |= ((unsigned int)q & mask) << (CREATURE_NORMAL_BITS * k);
+	}
+	return packed;
+}
+
+static unsigned long long hash_vertex(const CREATURE_VERTEX* frames, int n_frames) {
+	unsigned long long key = 0xcbf29ce484222325ull;
+
+	for (int frame = 0; frame < n_frames; frame++) {
+		const unsigned char* bytes = (const unsigned char*)&frames[frame];
+		for (size_t i = 0; i < sizeof(CREATURE_VERTEX); i++) {
+			key ^= bytes[i];
+			key *= 0x100000001b3ull;
+		}
+	}
+	return key;
+}
+
+static bool are_vertices_equal(const CREATURE_VERTEX* frames_a, const CREATURE_VERTEX* frames_b, int n_frames) {
+	return memcmp(frames_a, frames_b, sizeof(CREATURE_VERTEX) * n_frames) == 0;
+}
+
+bool build_creature_mesh(const float* const* frames, int n_frames, int n_triangles, CREATURE_MESH* pMesh) {
+	size_t n_corners = 3 * (size_t)max(n_triangles, 0);
+	float box_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, box_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	memset(pMesh, 0, sizeof(CREATURE_MESH));
+	if (n_frames <= 0 || n_triangles <= 0)
+		return false;
+	for (int frame = 0; frame < n_frames; frame++) {
+		if (frames[frame] == NULL)
+			return false;
+		for (size_t corner = 0; corner < n_corners; corner++) {
+			const float* p = &frames[frame][CREATURE_FLOATS_PER_VERTEX * corner];
+			for (int k = 0; k < 3; k++) {
+				box_min[k] = min(box_min[k], p[k]);
+				box_max[k] = max(box_max[k], p[k]);
+			}
+		}
+	}
+	pMesh->position_scale = 1.0e-6f;
+	for (int k = 0; k < 3; k++) {
+		pMesh->position_center[k] = 0.5f * (box_min[k] + box_max[k]);
+		pMesh->position_scale = max(pMesh->position_scale, 0.5f * (box_max[k] - box_min[k]));
+	}
+
+	// every corner in every frame, corner-major so that the frames of a corner are compared together
+	std::vector<CREATURE_VERTEX> corners(n_corners * n_frames);
+	for (int frame = 0; frame < n_frames; frame++) {
+		for (size_t corner = 0; corner < n_corners; corner++) {
+			const float* v = &frames[frame][CREATURE_FLOATS_PER_VERTEX * corner];
+			CREATURE_VERTEX* pVertex = &corners[corner * n_frames + frame];
+
+			for (int k = 0; k < 3; k++) {
+				float snorm = (v[k] - pMesh->position_center[k]) / pMesh->position_scale;
+				pVertex->position[k] = quantize_snorm16(snorm);
+				float error = fabsf(pMesh->position_center[k] + pMesh->position_scale * (pVertex->position[k] / 32767.0f) - v[k]);
+				pMesh->max_position_error = max(pMesh->max_position_error, error);
+			}
+			pVertex->padding = 0;
+			pVertex->normal = pack_normal(&v[3]);
+		}
+	}
+
+	// the vertices quantized the same in every frame are stored once
+	std::unordered_map<unsigned long long, std::vector<int> > kept;	// by the hash of all frames
+	std::vector<size_t> first_corner;	// of each vertex
+	pMesh->indices = (unsigned int*)malloc(sizeof(unsigned int) * n_corners);
+	for (size_t corner = 0; corner < n_corners; corner++) {
+		const CREATURE_VERTEX* pCorner = &corners[corner * n_frames];
+		std::vector<int>& candidates = kept[hash_vertex(pCorner, n_frames)];
+		int vertex = -1;
+
+		for (int candidate : candidates)
+			if (are_vertices_equal(&corners[first_corner[candidate] * n_frames], pCorner, n_frames)) {
+				vertex = candidate;
+				break;
+			}
+		if (vertex < 0) {
+			vertex = (int)first_corner.size();
+			first_corner.push_back(corner);
+			candidates.push_back(vertex);
+		}
+		pMesh->indices[corner] = (unsigned int)vertex;
+	}
+
+	pMesh->n_frames = n_frames;
+	pMesh->n_triangles = n_triangles;
+	pMesh->n_vertices = (int)first_corner.size();
+	pMesh->vertices = (CREATURE_VERTEX*)malloc(sizeof(CREATURE_VERTEX) * n_frames * (size_t)pMesh->n_vertices);
+	for (int frame = 0; frame < n_frames; frame++)
+		for (int vertex = 0; vertex < pMesh->n_vertices; vertex++)
+			pMesh->vertices[(size_t)frame * pMesh->n_vertices + vertex] = corners[first_corner[vertex] * n_frames + frame];
+	pMesh->source_bytes = sizeof(float) * CREATURE_FLOATS_PER_VERTEX * n_corners * n_frames;
+	return true;
+}
+
+size_t get_creature_mesh_bytes(const CREATURE_MESH* pMesh) {
+	return sizeof(unsigned int) * 3 * (size_t)pMesh->n_triangles
+		+ sizeof(CREATURE_VERTEX) * pMesh->n_frames * (size_t)pMesh->n_vertices;
+}
+
+void free_creature_mesh(CREATURE_MESH* pMesh) {
+	free(pMesh->indices);
+	free(pMesh->vertices);
+	memset(pMesh, 0, sizeof(CREATURE_MESH));
+}
@@ -0,0 +1,44 @@
+﻿//
+//  CreatureMesh.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+#include <stddef.h>
+
+// The animated creatures (tiger, wolf, spider) as one triangle list shared by all frames. The .geom files
+// repeat every frame as 3 vertices of 8 floats per triangle (position, normal, texture coordinates) with
+// the same triangle order. Here the positions are quantized to SNORM16 within the bounds of all frames,
+// with one scale for the three axes: the dequantization is then a translation and a uniform scale, which
+// can be folded into a model matrix without breaking its normal matrix. The normals are quantized to signed
+// 2_10_10_10, and a vertex is stored once if it is quantized the same as another one in every frame. So one
+// index list serves all frames, each frame is a block of n_vertices vertices, and frame f is drawn with
+// base vertex f * n_vertices. The texture coordinates are dropped: no shader of the creatures reads them,
+// and those of the wolf and the spider differ between frames at the seams.
+#define CREATURE_NORMAL_BITS	(10)
+
+typedef struct {
+	short			position[3];	// SNORM16, see position_center and position_scale
+	short			padding;		// keeps the normal 4-byte aligned
+	unsigned int	normal;			// x, y and z signed normalized in the low 30 bits, w = 0
+} CREATURE_VERTEX;
+
+typedef struct {
+	int					n_frames, n_triangles;
+	int					n_vertices;		// per frame
+	unsigned int*		indices;		// 3 * n_triangles, shared by all frames
+	CREATURE_VERTEX*	vertices;		// n_frames * n_vertices, one frame after another
+	float				position_center[3], position_scale;	// position = center + scale * snorm
+	float				max_position_error;	// over all vertices and frames, in model units
+	size_t				source_bytes;	// of the frames as read
+} CREATURE_MESH;
+
+// CreatureMesh.cpp
+// frames: n_frames arrays of 3 * n_triangles vertices of 8 floats, as read_geometry reads them
+bool build_creature_mesh(const float* const* frames, int n_frames, int n_triangles, CREATURE_MESH* pMesh);
+size_t get_creature_mesh_bytes(const CREATURE_MESH* pMesh);	// of the indices and the vertices
+void free_creature_mesh(CREATURE_MESH* pMesh);
@@ -0,0 +1,282 @@
+﻿//
+//  Culling.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <float.h>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define CULLING_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+#include "Culling.h"
+
+typedef struct {
+	float			view_projection[16];	// of the flags below
+	bool			valid;
+	unsigned char*	visible;
+	int				n_visible_triangles;
+} CULL_VIEW;
+
+static CULL_CHUNKS chunks;
+static int n_cull_materials;
+
+// world-space AABBs as center and half extent, SoA and padded by 3 so that four boxes can always be loaded;
+// the material boxes bound all chunks of a material and are tested first
+static float* chunk_center[3], * chunk_extent[3], * chunk_radius;
+static float* material_center[3], * material_extent[3];
+
+static CULL_VIEW views[CULL_MAX_VIEWS];
+static float cull_detail;
+
+static void set_box(float* center[3], float* extent[3], int i, const float* box_min, const float* box_max) {
+	for (int k = 0; k < 3; k++) {
+		center[k][i] = 0.5f * (box_max[k] + box_min[k]);
+		extent[k][i] = 0.5f * (box_max[k] - box_min[k]);
+	}
+}
+
+static void allocate_boxes(float* center[3], float* extent[3], int n) {
+	for (int k = 0; k < 3; k++) {
+		center[k] = (float*)calloc(n + 3, sizeof(float));
+		extent[k] = (float*)calloc(n + 3, sizeof(float));
+	}
+}
+
+void initialize_culling(SCENE* pScene) {
+	n_cull_materials = pScene->n_materials;
+	chunks.material_first_chunk = (int*)malloc(sizeof(int) * (n_cull_materials + 1));
+	chunks.n_chunks = 0;
+	for (int m = 0; m < n_cull_materials; m++) {
+		chunks.material_first_chunk[m] = chunks.n_chunks;
+		chunks.n_chunks += (pScene->material_list[m].geometry.tm.n_triangle + CULL_CHUNK_TRIANGLES - 1) / CULL_CHUNK_TRIANGLES;
+	}
+	chunks.material_first_chunk[n_cull_materials] = chunks.n_chunks;
+
+	chunks.chunk_first_triangle = (int*)malloc(sizeof(int) * chunks.n_chunks);
+	chunks.chunk_n_triangles = (int*)malloc(sizeof(int) * chunks.n_chunks);
+	allocate_boxes(chunk_center, chunk_extent, chunks.n_chunks);
+	chunk_radius = (float*)calloc(chunks.n_chunks + 3, sizeof(float));
+	allocate_boxes(material_center, material_extent, n_cull_materials);
+
+	for (int m = 0; m < n_cull_materials; m++) {
+		GEOMETRY_TRIANGULAR_MESH* tm = &pScene->material_list[m].geometry.tm;
+		float material_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, material_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		for (int c = chunks.material_first_chunk[m]; c < chunks.material_first_chunk[m + 1]; c++) {
+			int first = (c - chunks.material_first_chunk[m]) * CULL_CHUNK_TRIANGLES;
+			int n = min(tm->n_triangle - first, CULL_CHUNK_TRIANGLES);
+			float box_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, box_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+			for (int t = first; t < first + n; t++) {
+				for (int v = 0; v < 3; v++) {
+					const float p[3] = { tm->triangle_list[t].position[v].x, tm->triangle_list[t].position[v].y, tm->triangle_list[t].position[v].z };
+					for (int k = 0; k < 3; k++) {
+						box_min[k] = min(box_min[k], p[k]);
+						box_max[k] = max(box_max[k], p[k]);
+					}
+				}
+			}
+			chunks.chunk_first_triangle[c] = first;
+			chunks.chunk_n_triangles[c] = n;
+			set_box(chunk_center, chunk_extent, c, box_min, box_max);
+			chunk_radius[c] = sqrtf(chunk_extent[0][c] * chunk_extent[0][c] + chunk_extent[1][c] * chunk_extent[1][c]
+				+ chunk_extent[2][c] * chunk_extent[2][c]);
+			for (int k = 0; k < 3; k++) {
+				material_min[k] = min(material_min[k], box_min[k]);
+				material_max[k] = max(material_max[k], box_max[k]);
+			}
+		}
+		if (tm->n_triangle > 0)
+			set_box(material_center, material_extent, m, material_min, material_max);
+	}
+
+	for (int slot = 0; slot < CULL_MAX_VIEWS; slot++) {
+		views[slot].visible = (unsigned char*)calloc(chunks.n_chunks + 3, 1);
+		views[slot].valid = false;
+	}
+	fprintf(stdout, " * Split %d materials into %d culling chunks.\n", n_cull_materials, chunks.n_chunks);
+}
+
+CULL_CHUNKS* get_cull_chunks(void) {
+	return &chunks;
+}
+
+float get_cull_chunk_distance(int chunk, const float* eye) {
+	float distance2 = 0.0f;
+
+	for (int k = 0; k < 3; k++) {
+		float d = fabsf(eye[k] - chunk_center[k][chunk]) - chunk_extent[k][chunk];
+		if (d > 0.0f)
+			distance2 += d * d;
+	}
+	return sqrtf(distance2);
+}
+
+// clip-space -w <= x, y, z <= w as six world-space planes (not normalized; only the signs are used)
+static void get_frustum_planes(const float* m, float planes[6][4]) {
+	for (int axis = 0; axis < 3; axis++) {
+		for (int k = 0; k < 4; k++) {
+			planes[2 * axis][k] = m[4 * k + 3] + m[4 * k + axis];
+			planes[2 * axis + 1][k] = m[4 * k + 3] - m[4 * k + axis];
+		}
+	}
+}
+
+// boxes [i, i + 4): returns the mask of the boxes that intersect the frustum, *pInside those entirely inside it
+static int classify_boxes(const float planes[6][4], float* const center[3], float* const extent[3], int i, int* pInside) {
+#ifdef CULLING_USE_SSE
+	__m128 cx = _mm_loadu_ps(&center[0][i]), cy = _mm_loadu_ps(&center[1][i]), cz = _mm_loadu_ps(&center[2][i]);
+	__m128 ex = _mm_loadu_ps(&extent[0][i]), ey = _mm_loadu_ps(&extent[1][i]), ez = _mm_loadu_ps(&extent[2][i]);
+	__m128 outside = _mm_setzero_ps(), crossing = _mm_setzero_ps(), zero = _mm_setzero_ps();
+
+	for (int p = 0; p < 6; p++) {
+		// signed distance of the center and projected radius of the box, scaled by the plane normal length
+		__m128 s = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p][0]), cx), _mm_mul_ps(_mm_set1_ps(planes[p][1]), cy)),
+			_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p][2]), cz), _mm_set1_ps(planes[p][3])));
+		__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(fabsf(planes[p][0])), ex), _mm_mul_ps(_mm_set1_ps(fabsf(planes[p][1])), ey)),
+			_mm_mul_ps(_mm_set1_ps(fabsf(planes[p][2])), ez));
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(s, r), zero));
+		crossing = _mm_or_ps(crossing, _mm_cmplt_ps(_mm_sub_ps(s, r), zero));
+	}
+	*pInside = ~_mm_movemask_ps(crossing) & 0xF;
+	return ~_mm_movemask_ps(outside) & 0xF;
+#else
+	int visible = 0, inside = 0;
+
+	for (int lane = 0; lane < 4; lane++) {
+		bool lane_outside = false, lane_crossing = false;
+
+		for (int p = 0; p < 6; p++) {
+			float s = planes[p][0] * center[0][i + lane] + planes[p][1] * center[1][i + lane] + planes[p][2] * center[2][i + lane] + planes[p][3];
+			float r = fabsf(planes[p][0]) * extent[0][i + lane] + fabsf(planes[p][1]) * extent[1][i + lane] + fabsf(planes[p][2]) * extent[2][i + lane];
+			lane_outside |= s + r < 0.0f;
+			lane_crossing |= s - r < 0.0f;
+		}
+		if (!lane_outside)
+			visible |= 1 << lane;
+		if (!lane_crossing)
+			inside |= 1 << lane;
+	}
+	*pInside = inside;
+	return visible;
+#endif
+}
+
+// chunks [i, i + 4) not too small on screen: radius >= cull_detail * clip w of the center (the view depth);
+// chunks around or behind the camera always pass
+static int detail_mask(const float* m, int i) {
+#ifdef CULLING_USE_SSE
+	__m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[3]), _mm_loadu_ps(&chunk_center[0][i])), _mm_mul_ps(_mm_set1_ps(m[7]), _mm_loadu_ps(&chunk_center[1][i]))),
+		_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[11]), _mm_loadu_ps(&chunk_center[2][i])), _mm_set1_ps(m[15])));
+	return _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(&chunk_radius[i]), _mm_mul_ps(_mm_set1_ps(cull_detail), w)));
+#else
+	int mask = 0;
+
+	for (int lane = 0; lane < 4; lane++) {
+		float w = m[3] * chunk_center[0][i + lane] + m[7] * chunk_center[1][i + lane] + m[11] * chunk_center[2][i + lane] + m[15];
+		if (chunk_radius[i + lane] >= cull_detail * w)
+			mask |= 1 << lane;
+	}
+	return mask;
+#endif
+}
+
+static void set_chunks_visible(CULL_VIEW* pView, int first, int last) {
+	for (int c = first; c < last; c++) {
+		pView->visible[c] = 1;
+		pView->n_visible_triangles += chunks.chunk_n_triangles[c];
+	}
+}
+
+void cull_views(int first_slot, int n_views, const float* view_projections) {
+	int dirty[CULL_MAX_VIEWS], n_dirty = 0;
+	float planes[CULL_MAX_VIEWS][6][4];
+
+	// the geometry is static, so a view that did not move keeps its flags
+	for (int v = 0; v < n_views; v++) {
+		CULL_VIEW* pView = &views[first_slot + v];
+		const float* m = &view_projections[16 * v];
+
+		if (pView->valid && memcmp(pView->view_projection, m, sizeof(pView->view_projection)) == 0)
+			continue;
+		memcpy(pView->view_projection, m, sizeof(pView->view_projection));
+		memset(pView->visible, 0, chunks.n_chunks);
+		pView->n_visible_triangles = 0;
+		pView->valid = true;
+		get_frustum_planes(m, planes[n_dirty]);
+		dirty[n_dirty++] = first_slot + v;
+	}
+	if (n_dirty == 0)
+		return;
+
+	// one pass over the boxes for all views: a material's chunks are only tested by the views that see
+	// the material box partially, and are loaded once for all of them
+	for (int m0 = 0; m0 < n_cull_materials; m0 += 4) {
+		for (int d = 0; d < n_dirty; d++) {
+			CULL_VIEW* pView = &views[dirty[d]];
+			int inside_materials, visible_materials = classify_boxes(planes[d], material_center, material_extent, m0, &inside_materials);
+
+			for (int k = 0; k < 4 && m0 + k < n_cull_materials; k++) {
+				int first = chunks.material_first_chunk[m0 + k], last = chunks.material_first_chunk[m0 + k + 1];
+
+				if (!(visible_materials & (1 << k)))
+					continue;
+				if ((inside_materials & (1 << k)) && cull_detail <= 0.0f) {
+					set_chunks_visible(pView, first, last);
+					continue;
+				}
+				for (int c = first; c < last; c += 4) {
+					int inside_chunks, visible_chunks = classify_boxes(planes[d], chunk_center, chunk_extent, c, &inside_chunks);
+					if (cull_detail > 0.0f)
+						visible_chunks &= detail_mask(pView->view_projection, c);
+
+					for (int j = 0; j < 4 && c + j < last; j++)
+						if (visible_chunks & (1 << j))
+							set_chunks_visible(pView, c + j, c + j + 1);
+				}
+			}
+		}
+	}
+}
+
+const unsigned char* get_cull_visibility(int slot) {
+	return views[slot].visible;
+}
+
+int get_cull_visible_triangles(int slot) {
+	return views[slot].n_visible_triangles;
+}
+
+void set_cull_detail(float min_size) {
+	if (min_size == cull_detail)
+		return;
+	cull_detail = min_size;
+	for (int slot = 0; slot < CULL_MAX_VIEWS; slot++)
+		views[slot].valid = false;
+}
+
+void free_culling(void) {
+	for (int k = 0; k < 3; k++) {
+		free(chunk_center[k]);
+		free(chunk_extent[k]);
+		free(material_center[k]);
+		free(material_extent[k]);
+	}
+	free(chunk_radius);
+	for (int slot = 0; slot < CULL_MAX_VIEWS; slot++)
+		free(views[slot].visible);
+	free(chunks.chunk_first_triangle);
+	free(chunks.chunk_n_triangles);
+	free(chunks.material_first_chunk);
+}
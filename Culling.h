@@ -0,0 +1,37 @@
+﻿//
+//  Culling.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+#include "LoadScene.h"
+
+// The static Bistro triangles are split into chunks of up to CULL_CHUNK_TRIANGLES consecutive
+// triangles of one material (a range of the material's vertex buffer), each with a world-space AABB.
+// A view keeps a visibility flag per chunk; the flags are recomputed only when its view-projection
+// matrix changes, and all views that need an update are culled in one pass over the boxes.
+#define CULL_CHUNK_TRIANGLES	(1024)
+#define CULL_MAX_VIEWS			(16)	// view slots, see cull_views()
+
+typedef struct {
+	int		n_chunks;
+	int*	chunk_first_triangle;	// in the chunk's material
+	int*	chunk_n_triangles;
+	int*	material_first_chunk;	// chunks of material m: [material_first_chunk[m], material_first_chunk[m + 1])
+} CULL_CHUNKS;
+
+// Culling.cpp
+void initialize_culling(SCENE* pScene);
+CULL_CHUNKS* get_cull_chunks(void);
+float get_cull_chunk_distance(int chunk, const float* eye);	// to the box of the chunk, 0 inside
+// view_projections: n_views column-major 4x4 matrices for the slots [first_slot, first_slot + n_views)
+void cull_views(int first_slot, int n_views, const float* view_projections);
+const unsigned char* get_cull_visibility(int slot);	// a flag per chunk
+int get_cull_visible_triangles(int slot);
+// geometric LOD bias: also cull chunks whose bounding sphere radius / depth is below min_size (0: none)
+void set_cull_detail(float min_size);
+void free_culling(void);
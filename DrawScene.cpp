@@ -10,10 +10,31 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <float.h>
+#include <string.h>
+#include <limits.h>
 #include <GL/glew.h>
 #include <GL/freeglut.h>
-#include "LoadScene.h"
+// the C++ headers come before LoadScene.h, whose min and max macros break them outside of MSVC
+#include <glm/gtc/matrix_transform.hpp> //translate, rotate, scale, lookAt, perspective, etc.
 #include <glm/gtc/matrix_inverse.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "LoadScene.h"
+#include "DrawScene.h"
+#include "LightCluster.h"
+#include "Profiler.h"
+#include "Replay.h"
+#include "Capture.h"
+#include "SphericalHarmonics.h"
+#include "Culling.h"
+#include "Governor.h"
+#include "SpatialHash.h"
+#include "AmbientOcclusion.h"
+#include "Streaming.h"
+#include "TextureResidency.h"
+#include "TextureDedup.h"
+#include "CreatureMesh.h"
 
 // Begin of shader setup
 #include "Shaders/LoadShaders.h"
@@ -27,20 +48,45 @@ GLuint h_ShaderProgram_background, h_ShaderProgram_equiToCube;
 GLint loc_ModelViewProjectionMatrix, loc_primitive_color; // indices of uniform variables
 
 // for PBR
-GLuint h_ShaderProgram_TXPBR;
-#define NUMBER_OF_LIGHT_SUPPORTED 1
+// one program per material variant: which of the normal, metallic-roughness and emissive
+// maps the material has (PBR_Material.frag is specialized with #defines)
+#define MATERIAL_VARIANT_NORMAL_MAP				(1)
+#define MATERIAL_VARIANT_METALLIC_ROUGHNESS_MAP	(2)
+#define MATERIAL_VARIANT_EMISSIVE_MAP			(4)
+#define N_MATERIAL_VARIANTS						(8)
+
+GLuint h_ShaderProgram_TXPBR[N_MATERIAL_VARIANTS];
 GLint loc_global_ambient_color;
-GLint loc_lightCount;
-loc_light_Parameters loc_light[NUMBER_OF_LIGHT_SUPPORTED];
-loc_Material_Parameters loc_material;
-GLint loc_ModelViewProjectionMatrix_TXPBR, loc_ModelViewMatrix_TXPBR, loc_ModelViewMatrixInvTrans_TXPBR;
-GLint loc_cameraPos;
+loc_PBR_Program loc_TXPBR[N_MATERIAL_VARIANTS];
+
+// for the deferred path: G-buffer pass, then one fullscreen lighting pass
+GLuint h_ShaderProgram_GBuffer[N_MATERIAL_VARIANTS], h_ShaderProgram_Deferred;
+loc_PBR_Program loc_GBuffer[N_MATERIAL_VARIANTS];
+loc_Cluster_Parameters loc_cluster_Deferred;
+loc_Shadow_Parameters loc_shadow_Deferred;
+loc_Ambient_Parameters loc_ambient_Deferred;
+loc_GBuffer_Parameters loc_gbuffer;
+GLint loc_InvProjectionMatrix_Deferred;
+
+// for the depth pre-pass over the static Bistro geometry
+GLuint h_ShaderProgram_Depth;
+GLint loc_ModelViewProjectionMatrix_Depth;
 
 #define TEXTURE_INDEX_DIFFUSE	(0)
 #define TEXTURE_INDEX_NORMAL	(1)
 #define TEXTURE_INDEX_SPECULAR	(2)
 #define TEXTURE_INDEX_EMISSIVE	(3)
 #define TEXTURE_INDEX_SKYMAP	(4)
+#define TEXTURE_INDEX_LIGHT_DATA		(5)
+#define TEXTURE_INDEX_CLUSTER_GRID		(6)
+#define TEXTURE_INDEX_CLUSTER_INDEX		(7)
+#define TEXTURE_INDEX_GBUFFER_ALBEDO	(8)
+#define TEXTURE_INDEX_GBUFFER_NORMAL	(9)
+#define TEXTURE_INDEX_GBUFFER_MATERIAL	(10)
+#define TEXTURE_INDEX_GBUFFER_EMISSIVE	(11)
+#define TEXTURE_INDEX_GBUFFER_DEPTH		(12)
+#define TEXTURE_INDEX_STATIC_SHADOW		(13)
+#define TEXTURE_INDEX_DYNAMIC_SHADOW	(14)
 
 // for skybox shaders
 GLuint h_ShaderProgram_skybox;
@@ -49,7 +95,6 @@ GLint loc_ModelViewProjectionMatrix_SKY;
 
 // include glm/*.hpp only if necessary
 // #include <glm/glm.hpp> 
-#include <glm/gtc/matrix_transform.hpp> //translate, rotate, scale, lookAt, perspective, etc.
 // ViewProjectionMatrix = ProjectionMatrix * ViewMatrix
 glm::mat4 ViewProjectionMatrix, ViewMatrix, ProjectionMatrix;
 // ModelViewProjectionMatrix = ProjectionMatrix * ViewMatrix * ModelMatrix
@@ -60,6 +105,7 @@ glm::mat4 Matrix_TigerEye, Matrix_TigerBody, Matrix_EyeCamInv, TigerViewMatrix;
 glm::mat4 Matrix_FollowingTiger, Matrix_FollowingCamInv;
 glm::vec3 treePos(4500, -2588, 0);
 glm::vec3 tankPos(1350, 3500, 0);
+glm::vec3 doorPos(-800, -550, 0);	// where the tiger turns back
 
 #define TO_RADIAN 0.01745329252f  
 #define TO_DEGREE 57.295779513f
@@ -67,6 +113,10 @@ glm::vec3 tankPos(1350, 3500, 0);
 #define CAM_RSPEED 0.1f
 #define EPSILON 10
 #define WOLF_ROTATION_RADIUS 3500
+#define PROXIMITY_RADIUS 300
+#define TIGER_RADIUS 50
+#define DOOR_HALF_SIZE 100
+#define SCENE_TICK_MS 100	// of the simulation, timer_scene()
 
 #define LOC_POSITION 0
 #define LOC_NORMAL 1
@@ -97,21 +147,6 @@ unsigned int tiger_timestamp_scene = 0;
 int ctrl_pressed = 0, shift_pressed = 0, leftbuttonpressed = 0, rightbuttonpressed = 0;
 
 /*********************************  START: camera *********************************/
-typedef enum {
-	CAMERA_1,
-	CAMERA_2,
-	CAMERA_3,
-	CAMERA_4,
-	CAMERA_5,
-	CAMERA_6,
-	CAMERA_u,
-	CAMERA_i,
-	CAMERA_o,
-	CAMERA_p,
-	CAMERA_a,
-	NUM_CAMERAS
-} CAMERA_INDEX;
-
 typedef struct _Camera {
 	float pos[3];
 	float uaxis[3], vaxis[3], naxis[3];
@@ -140,6 +175,30 @@ void set_current_camera(int camera_num) {
 	ViewProjectionMatrix = ProjectionMatrix * ViewMatrix;
 }
 
+// s in [0, NUM_CAMERAS - 1]: position and orientation interpolated between camera floor(s) and the next one
+void set_camera_path_position(float s) {
+	int from = (int)s;
+	if (from >= NUM_CAMERAS - 1)
+		from = NUM_CAMERAS - 2;
+	float t = s - from;
+	Camera* pFrom = &camera_info[from];
+	Camera* pTo = &camera_info[from + 1];
+
+	glm::quat q_from = glm::quat_cast(glm::mat3(glm::make_vec3(pFrom->uaxis), glm::make_vec3(pFrom->vaxis), glm::make_vec3(pFrom->naxis)));
+	glm::quat q_to = glm::quat_cast(glm::mat3(glm::make_vec3(pTo->uaxis), glm::make_vec3(pTo->vaxis), glm::make_vec3(pTo->naxis)));
+	glm::mat3 axes = glm::mat3_cast(glm::slerp(q_from, q_to, t));
+
+	memcpy(&current_camera, pFrom, sizeof(Camera));
+	for (int k = 0; k < 3; k++) {
+		current_camera.pos[k] = (1.0f - t) * pFrom->pos[k] + t * pTo->pos[k];
+		current_camera.uaxis[k] = axes[0][k];
+		current_camera.vaxis[k] = axes[1][k];
+		current_camera.naxis[k] = axes[2][k];
+	}
+	set_ViewMatrix_from_camera_frame();
+	ViewProjectionMatrix = ProjectionMatrix * ViewMatrix;
+}
+
 void initialize_camera(void) {
 	//CAMERA_1 : original view
 	Camera* pCamera = &camera_info[CAMERA_1];
@@ -246,62 +305,214 @@ void initialize_camera(void) {
 
 	set_current_camera(CAMERA_1);
 }
+
+void get_camera(int camera_num, float* view_matrix, float* fovy, float* aspect_ratio, float* near_c, float* far_c) {
+	Camera saved_camera = current_camera;
+	glm::mat4 saved_ViewMatrix = ViewMatrix;
+
+	current_camera = camera_info[camera_num];
+	set_ViewMatrix_from_camera_frame();
+	memcpy(view_matrix, &ViewMatrix[0][0], sizeof(float) * 16);
+	*fovy = current_camera.fovy;
+	*aspect_ratio = current_camera.aspect_ratio;
+	*near_c = current_camera.near_c;
+	*far_c = current_camera.far_c;
+
+	current_camera = saved_camera;
+	ViewMatrix = saved_ViewMatrix;
+}
+
+static const char* camera_keys[NUM_CAMERAS] = { "1", "2", "3", "4", "5", "6", "u", "i", "o", "p", "a" };
+
+const char* get_camera_key(int camera_num) {
+	return camera_keys[camera_num];
+}
+
+int get_camera_index(const char* key) {
+	for (int camera = 0; camera < NUM_CAMERAS; camera++)
+		if (!strcmp(key, camera_keys[camera]))
+			return camera;
+	return -1;
+}
 /*********************************  END: camera *********************************/
 
 /******************************  START: shader setup ****************************/
 // Begin of Callback function definitions
-void prepare_shader_program(void) {
-	char string[256];
+void get_material_variant_defines(int variant, char* defines) {
+	defines[0] = '\0';
+	if (variant & MATERIAL_VARIANT_NORMAL_MAP)
+		strcat(defines, "#define MATERIAL_NORMAL_MAP\n");
+	if (variant & MATERIAL_VARIANT_METALLIC_ROUGHNESS_MAP)
+		strcat(defines, "#define MATERIAL_METALLIC_ROUGHNESS_MAP\n");
+	if (variant & MATERIAL_VARIANT_EMISSIVE_MAP)
+		strcat(defines, "#define MATERIAL_EMISSIVE_MAP\n");
+}
 
+// shadow uniforms of the lit program in use (forward, G-buffer or deferred); binds its shadow map units
+void get_shadow_locations(GLuint program, loc_Shadow_Parameters* pLoc) {
+	pLoc->shadowMatrix = glGetUniformLocation(program, "u_ShadowMatrix");
+	pLoc->staticShadowMap = glGetUniformLocation(program, "u_staticShadowMap");
+	pLoc->dynamicShadowMap = glGetUniformLocation(program, "u_dynamicShadowMap");
+	pLoc->shadowLightIndex = glGetUniformLocation(program, "u_shadow_light_index");
+
+	glUniform1i(pLoc->staticShadowMap, TEXTURE_INDEX_STATIC_SHADOW);
+	glUniform1i(pLoc->dynamicShadowMap, TEXTURE_INDEX_DYNAMIC_SHADOW);
+	glUniform1i(pLoc->shadowLightIndex, -1);
+}
+
+// ambient irradiance of the skybox, set once in prepare_skybox (before the programs are prepared)
+float irradiance_sh[SH_COEFFICIENTS][3];
+
+// ambient uniforms of the lit program in use; sets the irradiance, which does not change after loading
+void get_ambient_locations(GLuint program, loc_Ambient_Parameters* pLoc) {
+	pLoc->irradianceSH = glGetUniformLocation(program, "u_irradianceSH");
+	pLoc->eyeToEnvironment = glGetUniformLocation(program, "u_EyeToEnvironment");
+
+	glUniform3fv(pLoc->irradianceSH, SH_COEFFICIENTS, &irradiance_sh[0][0]);
+}
+
+// uniform locations of a forward or G-buffer program; also fixes its material texture units
+void prepare_PBR_program(GLuint program, loc_PBR_Program* pLoc) {
+	glUseProgram(program);
+
+	pLoc->modelViewProjectionMatrix = glGetUniformLocation(program, "u_ModelViewProjectionMatrix");
+	pLoc->modelViewMatrix = glGetUniformLocation(program, "u_ModelViewMatrix");
+	pLoc->modelViewMatrixInvTrans = glGetUniformLocation(program, "u_ModelViewMatrixInvTrans");
+
+	pLoc->cluster.lightData = glGetUniformLocation(program, "u_lightData");
+	pLoc->cluster.clusterGrid = glGetUniformLocation(program, "u_clusterGrid");
+	pLoc->cluster.clusterLightIndex = glGetUniformLocation(program, "u_clusterLightIndex");
+	pLoc->cluster.globalLightCount = glGetUniformLocation(program, "u_global_light_count");
+	pLoc->cluster.clusterParams = glGetUniformLocation(program, "u_cluster_params");
+	get_shadow_locations(program, &pLoc->shadow);
+	get_ambient_locations(program, &pLoc->ambient);
+
+	//Textures
+	pLoc->material.diffuseTex = glGetUniformLocation(program, "u_albedoMap");
+	pLoc->material.normalTex = glGetUniformLocation(program, "u_normalMap");
+	pLoc->material.specularTex = glGetUniformLocation(program, "u_metallicRoughnessMap");
+	pLoc->material.emissiveTex = glGetUniformLocation(program, "u_emissiveMap");
+
+	glUniform1i(pLoc->material.diffuseTex, TEXTURE_INDEX_DIFFUSE);
+	glUniform1i(pLoc->material.normalTex, TEXTURE_INDEX_NORMAL);
+	glUniform1i(pLoc->material.specularTex, TEXTURE_INDEX_SPECULAR);
+	glUniform1i(pLoc->material.emissiveTex, TEXTURE_INDEX_EMISSIVE);
+}
+
+// starts building every program; compilation runs while the scene is prepared
+void begin_shader_programs(void) {
 	ShaderInfo shader_info[3] = {
-		{ GL_VERTEX_SHADER, "Shaders/simple.vert" },
-		{ GL_FRAGMENT_SHADER, "Shaders/simple.frag" },
-		{ GL_NONE, NULL }
+		{ GL_VERTEX_SHADER, "Shaders/simple.vert", 0, NULL },
+		{ GL_FRAGMENT_SHADER, "Shaders/simple.frag", 0, NULL },
+		{ GL_NONE, NULL, 0, NULL }
 	};
 
-	h_ShaderProgram_simple = LoadShaders(shader_info);
-	glUseProgram(h_ShaderProgram_simple);
+	h_ShaderProgram_simple = BeginLoadShaders(shader_info);
 
-	loc_ModelViewProjectionMatrix = glGetUniformLocation(h_ShaderProgram_simple, "u_ModelViewProjectionMatrix");
-	loc_primitive_color = glGetUniformLocation(h_ShaderProgram_simple, "u_primitive_color");
+	for (int variant = 0; variant < N_MATERIAL_VARIANTS; variant++) {
+		char defines[256];
 
-	ShaderInfo shader_info_TXPBR[3] = {
-		{ GL_VERTEX_SHADER, "Shaders/Background/PBR_Tx.vert" },
-		{ GL_FRAGMENT_SHADER, "Shaders/Background/PBR_Tx.frag" },
-		{ GL_NONE, NULL }
-	};
+		get_material_variant_defines(variant, defines);
 
-	h_ShaderProgram_TXPBR = LoadShaders(shader_info_TXPBR);
-	glUseProgram(h_ShaderProgram_TXPBR);
+		ShaderInfo shader_info_TXPBR[5] = {
+			{ GL_VERTEX_SHADER, "Shaders/Background/PBR_Tx.vert", 0, NULL },
+			{ GL_FRAGMENT_SHADER, "Shaders/Background/PBR_Tx.frag", 0, NULL },
+			{ GL_FRAGMENT_SHADER, "Shaders/Background/PBR_Material.frag", 0, defines },
+			{ GL_FRAGMENT_SHADER, "Shaders/Background/PBR_Lighting.frag", 0, NULL },
+			{ GL_NONE, NULL, 0, NULL }
+		};
 
-	loc_ModelViewProjectionMatrix_TXPBR = glGetUniformLocation(h_ShaderProgram_TXPBR, "u_ModelViewProjectionMatrix");
-	loc_ModelViewMatrix_TXPBR = glGetUniformLocation(h_ShaderProgram_TXPBR, "u_ModelViewMatrix");
-	loc_ModelViewMatrixInvTrans_TXPBR = glGetUniformLocation(h_ShaderProgram_TXPBR, "u_ModelViewMatrixInvTrans");
+		h_ShaderProgram_TXPBR[variant] = BeginLoadShaders(shader_info_TXPBR);
 
-	loc_lightCount = glGetUniformLocation(h_ShaderProgram_TXPBR, "u_light_count");
+		ShaderInfo shader_info_GBuffer[4] = {
+			{ GL_VERTEX_SHADER, "Shaders/Background/PBR_Tx.vert", 0, NULL },
+			{ GL_FRAGMENT_SHADER, "Shaders/Background/PBR_GBuffer.frag", 0, NULL },
+			{ GL_FRAGMENT_SHADER, "Shaders/Background/PBR_Material.frag", 0, defines },
+			{ GL_NONE, NULL, 0, NULL }
+		};
 
-	for (int i = 0; i < NUMBER_OF_LIGHT_SUPPORTED; i++) {
-		sprintf(string, "u_light[%d].position", i);
-		loc_light[i].position = glGetUniformLocation(h_ShaderProgram_TXPBR, string);
-		sprintf(string, "u_light[%d].color", i);
-		loc_light[i].color = glGetUniformLocation(h_ShaderProgram_TXPBR, string);
+		h_ShaderProgram_GBuffer[variant] = BeginLoadShaders(shader_info_GBuffer);
 	}
 
-	loc_cameraPos = glGetUniformLocation(h_ShaderProgram_TXPBR, "u_camPos");
+	ShaderInfo shader_info_Deferred[4] = {
+		{ GL_VERTEX_SHADER, "Shaders/Background/PBR_Deferred.vert", 0, NULL },
+		{ GL_FRAGMENT_SHADER, "Shaders/Background/PBR_Deferred.frag", 0, NULL },
+		{ GL_FRAGMENT_SHADER, "Shaders/Background/PBR_Lighting.frag", 0, NULL },
+		{ GL_NONE, NULL, 0, NULL }
+	};
 
-	//Textures
-	loc_material.diffuseTex = glGetUniformLocation(h_ShaderProgram_TXPBR, "u_albedoMap");
-	loc_material.normalTex = glGetUniformLocation(h_ShaderProgram_TXPBR, "u_normalMap");
-	loc_material.specularTex = glGetUniformLocation(h_ShaderProgram_TXPBR, "u_metallicRoughnessMap");
-	loc_material.emissiveTex = glGetUniformLocation(h_ShaderProgram_TXPBR, "u_emissiveMap");
+	h_ShaderProgram_Deferred = BeginLoadShaders(shader_info_Deferred);
+
+	ShaderInfo shader_info_Depth[3] = {
+		{ GL_VERTEX_SHADER, "Shaders/Background/Depth.vert", 0, NULL },
+		{ GL_FRAGMENT_SHADER, "Shaders/Background/Depth.frag", 0, NULL },
+		{ GL_NONE, NULL, 0, NULL }
+	};
+
+	h_ShaderProgram_Depth = BeginLoadShaders(shader_info_Depth);
 
 	ShaderInfo shader_info_skybox[3] = {
-		{ GL_VERTEX_SHADER, "Shaders/Background/skybox.vert" },
-		{ GL_FRAGMENT_SHADER, "Shaders/Background/skybox.frag" },
-		{ GL_NONE, NULL }
+		{ GL_VERTEX_SHADER, "Shaders/Background/skybox.vert", 0, NULL },
+		{ GL_FRAGMENT_SHADER, "Shaders/Background/skybox.frag", 0, NULL },
+		{ GL_NONE, NULL, 0, NULL }
+	};
+
+	h_ShaderProgram_skybox = BeginLoadShaders(shader_info_skybox);
+}
+
+// waits for the programs started by begin_shader_programs()
+void prepare_shader_program(void) {
+	GLuint* programs[4 + 2 * N_MATERIAL_VARIANTS] = {
+		&h_ShaderProgram_simple, &h_ShaderProgram_Deferred, &h_ShaderProgram_Depth, &h_ShaderProgram_skybox
 	};
+	int n_programs = 4, n_ready = 0;
+
+	for (int variant = 0; variant < N_MATERIAL_VARIANTS; variant++) {
+		programs[n_programs++] = &h_ShaderProgram_TXPBR[variant];
+		programs[n_programs++] = &h_ShaderProgram_GBuffer[variant];
+	}
+
+	for (int i = 0; i < n_programs; i++)
+		if (PollShaders(*programs[i]))
+			n_ready++;
+
+	double start_time = profiler_time_ms();
+	for (int i = 0; i < n_programs; i++)
+		*programs[i] = FinishLoadShaders(*programs[i]);
+	fprintf(stdout, " * %d of %d shader programs were ready after scene loading; waited %.0f ms for the rest.\n",
+		n_ready, n_programs, profiler_time_ms() - start_time);
+
+	glUseProgram(h_ShaderProgram_simple);
+
+	loc_ModelViewProjectionMatrix = glGetUniformLocation(h_ShaderProgram_simple, "u_ModelViewProjectionMatrix");
+	loc_primitive_color = glGetUniformLocation(h_ShaderProgram_simple, "u_primitive_color");
+
+	for (int variant = 0; variant < N_MATERIAL_VARIANTS; variant++) {
+		prepare_PBR_program(h_ShaderProgram_TXPBR[variant], &loc_TXPBR[variant]);
+		prepare_PBR_program(h_ShaderProgram_GBuffer[variant], &loc_GBuffer[variant]);
+	}
+	glUseProgram(0);
+
+	loc_InvProjectionMatrix_Deferred = glGetUniformLocation(h_ShaderProgram_Deferred, "u_InvProjectionMatrix");
+
+	loc_cluster_Deferred.lightData = glGetUniformLocation(h_ShaderProgram_Deferred, "u_lightData");
+	loc_cluster_Deferred.clusterGrid = glGetUniformLocation(h_ShaderProgram_Deferred, "u_clusterGrid");
+	loc_cluster_Deferred.clusterLightIndex = glGetUniformLocation(h_ShaderProgram_Deferred, "u_clusterLightIndex");
+	loc_cluster_Deferred.globalLightCount = glGetUniformLocation(h_ShaderProgram_Deferred, "u_global_light_count");
+	loc_cluster_Deferred.clusterParams = glGetUniformLocation(h_ShaderProgram_Deferred, "u_cluster_params");
+	glUseProgram(h_ShaderProgram_Deferred);
+	get_shadow_locations(h_ShaderProgram_Deferred, &loc_shadow_Deferred);
+	get_ambient_locations(h_ShaderProgram_Deferred, &loc_ambient_Deferred);
+	glUseProgram(0);
+
+	loc_gbuffer.albedo = glGetUniformLocation(h_ShaderProgram_Deferred, "u_gAlbedo");
+	loc_gbuffer.normal = glGetUniformLocation(h_ShaderProgram_Deferred, "u_gNormal");
+	loc_gbuffer.metallicRoughness = glGetUniformLocation(h_ShaderProgram_Deferred, "u_gMetallicRoughness");
+	loc_gbuffer.emissive = glGetUniformLocation(h_ShaderProgram_Deferred, "u_gEmissive");
+	loc_gbuffer.depth = glGetUniformLocation(h_ShaderProgram_Deferred, "u_gDepth");
+
+	loc_ModelViewProjectionMatrix_Depth = glGetUniformLocation(h_ShaderProgram_Depth, "u_ModelViewProjectionMatrix");
 
-	h_ShaderProgram_skybox = LoadShaders(shader_info_skybox);
 	loc_cubemap_skybox = glGetUniformLocation(h_ShaderProgram_skybox, "u_skymap");
 	loc_ModelViewProjectionMatrix_SKY = glGetUniformLocation(h_ShaderProgram_skybox, "u_ModelViewProjectionMatrix");
 }
@@ -314,6 +525,8 @@ void prepare_shader_program(void) {
 #define INDEX_VERTEX_POSITION	0
 #define INDEX_NORMAL			1
 #define INDEX_TEX_COORD			2
+#define INDEX_TANGENT			3
+#define INDEX_AO				4
 
 bool b_draw_grid = false;
 
@@ -447,125 +660,322 @@ int* bistro_exterior_n_triangles;
 int* bistro_exterior_vertex_offset;
 GLfloat** bistro_exterior_vertices;
 GLuint* bistro_exterior_texture_names;
+GLuint bistro_exterior_position_VBO, bistro_exterior_position_VAO; // all materials, positions only
+int bistro_exterior_n_total_vertices;
+
+// draw order sorted by material variant: material_draw_order[material_variant_first[v] .. material_variant_first[v + 1])
+int* material_draw_order;
+int material_variant_first[N_MATERIAL_VARIANTS + 1];
+GLuint white_texture; // albedo of materials without a (loadable) albedo map
+// stand-ins for streamed maps that are not resident, with the values the shaders use without the map
+GLuint flat_normal_texture, default_metallic_roughness_texture, black_texture;
+
+// distance-based streaming (--stream, Streaming.cpp): instead of the per-material buffers, one buffer and
+// vertex array per resident tile, holding the chunks of the tile in material order
+bool flag_streaming = false;
+int stream_cpu_budget_mb = STREAM_DEFAULT_CPU_MB, stream_gpu_budget_mb = STREAM_DEFAULT_GPU_MB;
+GLuint* stream_tile_VBO, * stream_tile_VAO;
+unsigned char* stream_vertex_ao; // only while the tile file is written
+
+// texture residency (TextureResidency.cpp): the draw loop requests the footprint of the maps of every visible
+// material, from the distance to its nearest visible chunk and its texture coordinate density
+int texture_budget_mb = RESIDENCY_DEFAULT_BUDGET_MB;
+float* material_uv_density; // uv units per scene unit
+
+// low-memory mode (--low-memory): the CPU triangles are freed once everything is in graphics memory,
+// --keep-positions keeps their positions for CPU queries (getScenePositions); streaming frees them as well
+bool flag_low_memory = false, flag_keep_positions = false;
+
+void report_process_memory(const char* when) {
+	size_t resident_bytes, peak_bytes;
+
+	if (profiler_memory(&resident_bytes, &peak_bytes))
+		fprintf(stdout, " * Memory %s: %.1f MB resident, %.1f MB peak\n", when, resident_bytes / 1048576.0, peak_bytes / 1048576.0);
+}
+
+void set_memory_options(bool low_memory, bool keep_positions) {
+	flag_low_memory = low_memory;
+	flag_keep_positions = keep_positions;
+}
+
+// after everything that reads the triangles: culling, streaming, AO, uploads and triggers. The streamed tiles
+// are read from the tile file, so once it and the culling chunks are built the triangles are not needed either.
+void release_scene_geometry(void) {
+	if (!flag_low_memory && !flag_streaming)
+		return;
+	size_t released = releaseSceneGeometry(&scene, flag_keep_positions);
+	fprintf(stdout, " * Released %.1f MB of CPU scene geometry%s.\n", released / 1048576.0,
+		flag_keep_positions ? " (positions kept)" : "");
+}
 
 int flag_fog;
 bool* flag_texture_mapping;
 
-void initialize_lights(void) { // follow OpenGL conventions for initialization //DON'T TOUCH?
-	glUseProgram(h_ShaderProgram_TXPBR);
+// frustum culling of the Bistro chunks (Culling.cpp); slot 0 is the main view,
+// the multi-view grid uses slot CULL_SLOT_MULTIVIEW + camera
+#define CULL_SLOT_MAIN			(0)
+#define CULL_SLOT_MULTIVIEW		(1)
+int cull_slot = CULL_SLOT_MAIN;
+bool measure_view = true; // false for all but the first view of a multi-view frame (the queries are read back once per frame)
+
+// clustered lights: light table, per-cluster (offset, count) and packed light indices as buffer textures
+GLuint light_data_buffer, cluster_grid_buffer, cluster_index_buffer;
+GLuint light_data_texture, cluster_grid_texture, cluster_index_texture;
+int window_width = 900, window_height = 600;
+int render_width = 900, render_height = 600; // of the frame render_frame() draws (the window size scaled by the governor)
+
+void set_light_cluster_samplers(loc_Cluster_Parameters* pLoc) {
+	glUniform1i(pLoc->lightData, TEXTURE_INDEX_LIGHT_DATA);
+	glUniform1i(pLoc->clusterGrid, TEXTURE_INDEX_CLUSTER_GRID);
+	glUniform1i(pLoc->clusterLightIndex, TEXTURE_INDEX_CLUSTER_INDEX);
+	glUniform1i(pLoc->globalLightCount, get_light_clusters()->n_global_lights);
+}
+
+void initialize_lights(void) { // follow OpenGL conventions for initialization
+	initialize_light_clusters(&scene);
+
+	glGenBuffers(1, &light_data_buffer);
+	glGenBuffers(1, &cluster_grid_buffer);
+	glGenBuffers(1, &cluster_index_buffer);
+	glGenTextures(1, &light_data_texture);
+	glGenTextures(1, &cluster_grid_texture);
+	glGenTextures(1, &cluster_index_texture);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, light_data_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(float) * 4 * LIGHT_TEXELS_PER_LIGHT * MAX_CLUSTER_LIGHTS, NULL, GL_STREAM_DRAW);
+	glBindTexture(GL_TEXTURE_BUFFER, light_data_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, light_data_buffer);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, cluster_grid_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(unsigned int) * 2 * CLUSTER_COUNT, NULL, GL_STREAM_DRAW);
+	glBindTexture(GL_TEXTURE_BUFFER, cluster_grid_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, cluster_grid_buffer);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, cluster_index_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(unsigned int) * CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER, NULL, GL_STREAM_DRAW);
+	glBindTexture(GL_TEXTURE_BUFFER, cluster_index_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, cluster_index_buffer);
+
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	for (int variant = 0; variant < N_MATERIAL_VARIANTS; variant++) {
+		glUseProgram(h_ShaderProgram_TXPBR[variant]);
+		set_light_cluster_samplers(&loc_TXPBR[variant].cluster);
+	}
+	glUseProgram(h_ShaderProgram_Deferred);
+	set_light_cluster_samplers(&loc_cluster_Deferred);
+	glUseProgram(0);
+}
+
+// must follow every change of ProjectionMatrix or of the window size
+void update_light_cluster_projection(void) {
+	set_light_cluster_projection(current_camera.fovy, current_camera.aspect_ratio, current_camera.near_c, current_camera.far_c,
+		render_width, render_height);
+}
 
-	glUniform1f(loc_lightCount, scene.n_lights);
+// bins the lights for the current view and binds the cluster buffers; once per frame
+void prepare_light_clusters_for_view(void) {
+	LIGHT_CLUSTERS* pClusters = get_light_clusters();
+
+	update_light_clusters(&ViewMatrix[0][0]);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, light_data_buffer);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(float) * 4 * LIGHT_TEXELS_PER_LIGHT * pClusters->n_lights, pClusters->light_data);
+	glBindBuffer(GL_TEXTURE_BUFFER, cluster_grid_buffer);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(unsigned int) * 2 * CLUSTER_COUNT, pClusters->cluster_grid);
+	glBindBuffer(GL_TEXTURE_BUFFER, cluster_index_buffer);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(unsigned int) * pClusters->n_light_indices, pClusters->light_index);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glActiveTexture(GL_TEXTURE0 + TEXTURE_INDEX_LIGHT_DATA);
+	glBindTexture(GL_TEXTURE_BUFFER, light_data_texture);
+	glActiveTexture(GL_TEXTURE0 + TEXTURE_INDEX_CLUSTER_GRID);
+	glBindTexture(GL_TEXTURE_BUFFER, cluster_grid_texture);
+	glActiveTexture(GL_TEXTURE0 + TEXTURE_INDEX_CLUSTER_INDEX);
+	glBindTexture(GL_TEXTURE_BUFFER, cluster_index_texture);
+}
 
-	for (int i = 0; i < scene.n_lights; i++) {
-		glUniform4f(loc_light[i].position,
-			scene.light_list[i].pos[0],
-			scene.light_list[i].pos[1],
-			scene.light_list[i].pos[2],
-			0.0f);
+// for the current program
+void set_light_cluster_params(loc_Cluster_Parameters* pLoc) {
+	LIGHT_CLUSTER_PARAMS* pParams = get_light_cluster_params();
 
-		glUniform3f(loc_light[i].color,
-			scene.light_list[i].color[0],
-			scene.light_list[i].color[1],
-			scene.light_list[i].color[2]);
+	glUniform4f(pLoc->clusterParams, pParams->near_depth, pParams->slice_scale, pParams->tile_size[0], pParams->tile_size[1]);
+}
+
+// sun shadows: the Bistro and the objects that never move go into a static map that is only
+// re-rendered when the sun changes; the moving creatures are drawn each frame into a second,
+// smaller map with the same light projection, and the shader takes the darker of the two
+#define STATIC_SHADOW_MAP_SIZE	(4096)
+#define DYNAMIC_SHADOW_MAP_SIZE	(2048)	// at full quality; the governor may lower it
+
+bool flag_shadows = true;
+bool flag_static_shadow_valid = false;
+GLuint static_shadow_FBO, static_shadow_texture;
+GLuint dynamic_shadow_FBO, dynamic_shadow_texture;
+glm::vec3 shadow_sun_direction; // world space, towards the sun, of the cached static map
+glm::mat4 ShadowViewProjectionMatrix;
+float bistro_exterior_bounds[2][3]; // world-space AABB of the Bistro geometry
+
+void set_shadow_params(loc_Shadow_Parameters* pLoc) {
+	if (!flag_shadows || !flag_static_shadow_valid) {
+		glUniform1i(pLoc->shadowLightIndex, -1);
+		return;
 	}
 
-	glUseProgram(0);
+	// eye coordinates -> light clip coordinates -> [0, 1]
+	glm::mat4 ShadowMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f));
+	ShadowMatrix = glm::scale(ShadowMatrix, glm::vec3(0.5f));
+	ShadowMatrix = ShadowMatrix * ShadowViewProjectionMatrix * glm::inverse(ViewMatrix);
+	glUniformMatrix4fv(pLoc->shadowMatrix, 1, GL_FALSE, &ShadowMatrix[0][0]);
+	glUniform1i(pLoc->shadowLightIndex, get_light_clusters()->sun_light);
 }
 
-bool readTexImage2D_from_file(char* filename) { //DON'T TOUCH?
-	FREE_IMAGE_FORMAT tx_file_format;
-	int tx_bits_per_pixel;
-	FIBITMAP* tx_pixmap, * tx_pixmap_32;
+void set_ambient_params(loc_Ambient_Parameters* pLoc) {
+	// eye -> world, then world -> cube map coordinates (the skybox swaps y and z, see draw_skybox)
+	glm::mat3 WorldToEnvironment = glm::mat3(1.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f,
+		0.0f, 1.0f, 0.0f);
+	glm::mat3 EyeToEnvironment = WorldToEnvironment * glm::transpose(glm::mat3(ViewMatrix));
+	glUniformMatrix3fv(pLoc->eyeToEnvironment, 1, GL_FALSE, &EyeToEnvironment[0][0]);
+}
 
-	int width, height;
-	GLvoid* data;
+bool material_has_texture(int texId) {
+	return texId != (int)INVALID_TEX_ID && flag_texture_mapping[texId];
+}
 
-	tx_file_format = FreeImage_GetFileType(filename, 0);
-	// assume everything is fine with reading texture from file: no error checking
-	tx_pixmap = FreeImage_Load(tx_file_format, filename);
-	if (tx_pixmap == NULL)
-		return false;
-	tx_bits_per_pixel = FreeImage_GetBPP(tx_pixmap);
+int get_material_variant(MATERIAL* pMaterial) {
+	int variant = 0;
 
-	//fprintf(stdout, " * A %d-bit texture was read from %s.\n", tx_bits_per_pixel, filename);
-	GLenum format, internalFormat;
-	if (tx_bits_per_pixel == 32) {
-		format = GL_BGRA;
-		internalFormat = GL_RGBA;
-	}
-	else if (tx_bits_per_pixel == 24) {
-		format = GL_BGR;
-		internalFormat = GL_RGB;
-	}
-	else {
-		fprintf(stdout, " * Converting texture from %d bits to 32 bits...\n", tx_bits_per_pixel);
-		tx_pixmap = FreeImage_ConvertTo32Bits(tx_pixmap);
-		format = GL_BGRA;
-		internalFormat = GL_RGBA;
+	if (material_has_texture(pMaterial->normalMapTexId))
+		variant |= MATERIAL_VARIANT_NORMAL_MAP;
+	if (material_has_texture(pMaterial->specularTexId))
+		variant |= MATERIAL_VARIANT_METALLIC_ROUGHNESS_MAP;
+	if (material_has_texture(pMaterial->emissiveTexId))
+		variant |= MATERIAL_VARIANT_EMISSIVE_MAP;
+	return variant;
+}
+
+// counting sort of the materials by variant, keeping file order within a variant
+void sort_materials_by_variant(void) {
+	int count[N_MATERIAL_VARIANTS] = { 0 };
+
+	for (int materialIdx = 0; materialIdx < scene.n_materials; materialIdx++)
+		count[get_material_variant(&scene.material_list[materialIdx])]++;
+
+	material_variant_first[0] = 0;
+	for (int variant = 0; variant < N_MATERIAL_VARIANTS; variant++) {
+		material_variant_first[variant + 1] = material_variant_first[variant] + count[variant];
+		count[variant] = material_variant_first[variant];
 	}
 
-	width = FreeImage_GetWidth(tx_pixmap);
-	height = FreeImage_GetHeight(tx_pixmap);
-	data = FreeImage_GetBits(tx_pixmap);
+	material_draw_order = (int*)malloc(sizeof(int) * scene.n_materials);
+	for (int materialIdx = 0; materialIdx < scene.n_materials; materialIdx++)
+		material_draw_order[count[get_material_variant(&scene.material_list[materialIdx])]++] = materialIdx;
 
-	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-	//fprintf(stdout, " * Loaded %dx%d RGBA texture into graphics memory.\n\n", width, height);
+	for (int variant = 0; variant < N_MATERIAL_VARIANTS; variant++)
+		fprintf(stdout, " * Material variant%s%s%s: %d materials\n",
+			(variant & MATERIAL_VARIANT_NORMAL_MAP) ? " +normal" : "",
+			(variant & MATERIAL_VARIANT_METALLIC_ROUGHNESS_MAP) ? " +metallic-roughness" : "",
+			(variant & MATERIAL_VARIANT_EMISSIVE_MAP) ? " +emissive" : (variant ? "" : " albedo only"),
+			material_variant_first[variant + 1] - material_variant_first[variant]);
+}
 
-	FreeImage_Unload(tx_pixmap);
+// tangent of a triangle corner, Gram-Schmidt orthogonalized against the vertex normal; w is the
+// handedness of (T, B, N). Falls back to the UV gradient when the stored tangent frame is degenerate.
+void get_vertex_tangent(TRIANGLE* tri, int triVertex, GLfloat* tangent) {
+	glm::vec3 N(tri->normal_vetcor[triVertex].x, tri->normal_vetcor[triVertex].y, tri->normal_vetcor[triVertex].z);
+	glm::vec3 T(tri->tangent.x, tri->tangent.y, tri->tangent.z);
+	glm::vec3 B(tri->bitangent.x, tri->bitangent.y, tri->bitangent.z);
+
+	if (glm::length(T - N * glm::dot(N, T)) < 1.0e-6f) {
+		glm::vec3 p0(tri->position[0].x, tri->position[0].y, tri->position[0].z);
+		glm::vec3 e1 = glm::vec3(tri->position[1].x, tri->position[1].y, tri->position[1].z) - p0;
+		glm::vec3 e2 = glm::vec3(tri->position[2].x, tri->position[2].y, tri->position[2].z) - p0;
+		float du1 = tri->texture_list[1][0].u - tri->texture_list[0][0].u, dv1 = tri->texture_list[1][0].v - tri->texture_list[0][0].v;
+		float du2 = tri->texture_list[2][0].u - tri->texture_list[0][0].u, dv2 = tri->texture_list[2][0].v - tri->texture_list[0][0].v;
+		float det = du1 * dv2 - du2 * dv1;
+
+		if (fabsf(det) > 1.0e-12f) {
+			T = (e1 * dv2 - e2 * dv1) / det;
+			B = (e2 * du1 - e1 * du2) / det;
+		}
+		if (glm::length(T - N * glm::dot(N, T)) < 1.0e-6f) // no usable UVs either: any vector perpendicular to N
+			T = (fabsf(N.x) < 0.9f) ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	}
 
-	return true;
+	T = glm::normalize(T - N * glm::dot(N, T));
+	tangent[0] = T.x;
+	tangent[1] = T.y;
+	tangent[2] = T.z;
+	tangent[3] = (glm::dot(glm::cross(N, T), B) < 0.0f) ? -1.0f : 1.0f;
 }
 
-void prepare_bistro_exterior(void) { //DON'T TOUCH?
-	int n_bytes_per_vertex, n_bytes_per_triangle;
-	char filename[512];
+// interleaved vertices of n_triangles triangles of a material: position, normal, texcoord, tangent and the AO
+// byte; ao holds a byte per vertex of the material
+void get_bistro_vertices(int materialIdx, int first_triangle, int n_triangles, const unsigned char* ao, GLfloat* vertices) {
+	GEOMETRY_TRIANGULAR_MESH* tm = &(scene.material_list[materialIdx].geometry.tm);
+	int vertexIdx = 0;
 
-	n_bytes_per_vertex = 8 * sizeof(float); // 3 for vertex, 3 for normal, and 2 for texcoord
-	n_bytes_per_triangle = 3 * n_bytes_per_vertex;
+	for (int triIdx = first_triangle; triIdx < first_triangle + n_triangles; triIdx++) {
+		TRIANGLE tri = tm->triangle_list[triIdx];
+		for (int triVertex = 0; triVertex < 3; triVertex++) {
+			vertices[vertexIdx++] = tri.position[triVertex].x;
+			vertices[vertexIdx++] = tri.position[triVertex].y;
+			vertices[vertexIdx++] = tri.position[triVertex].z;
 
-	// VBO, VAO malloc
-	bistro_exterior_VBO = (GLuint*)malloc(sizeof(GLuint) * scene.n_materials);
-	bistro_exterior_VAO = (GLuint*)malloc(sizeof(GLuint) * scene.n_materials);
+			vertices[vertexIdx++] = tri.normal_vetcor[triVertex].x;
+			vertices[vertexIdx++] = tri.normal_vetcor[triVertex].y;
+			vertices[vertexIdx++] = tri.normal_vetcor[triVertex].z;
 
-	bistro_exterior_n_triangles = (int*)malloc(sizeof(int) * scene.n_materials);
-	bistro_exterior_vertex_offset = (int*)malloc(sizeof(int) * scene.n_materials);
+			vertices[vertexIdx++] = tri.texture_list[triVertex][0].u;
+			vertices[vertexIdx++] = tri.texture_list[triVertex][0].v;
 
-	flag_texture_mapping = (bool*)malloc(sizeof(bool) * scene.n_textures);
+			get_vertex_tangent(&tri, triVertex, &vertices[vertexIdx]);
+			vertexIdx += 4;
 
-	// vertices
-	bistro_exterior_vertices = (GLfloat**)malloc(sizeof(GLfloat*) * scene.n_materials);
+			unsigned char vertex_ao[4] = { ao[3 * triIdx + triVertex], 0, 0, 0 };
+			memcpy(&vertices[vertexIdx++], vertex_ao, sizeof(vertex_ao));
+		}
+	}
+}
 
-	for (int materialIdx = 0; materialIdx < scene.n_materials; materialIdx++) {
-		MATERIAL* pMaterial = &(scene.material_list[materialIdx]);
-		GEOMETRY_TRIANGULAR_MESH* tm = &(pMaterial->geometry.tm);
+// for the bound VAO and array buffer, in the layout of get_bistro_vertices
+void set_bistro_vertex_attributes(void) {
+	int n_bytes_per_vertex = BISTRO_VERTEX_FLOATS * sizeof(float);
 
-		// vertex
-		bistro_exterior_vertices[materialIdx] = (GLfloat*)malloc(sizeof(GLfloat) * 8 * tm->n_triangle * 3);
+	glVertexAttribPointer(INDEX_VERTEX_POSITION, 3, GL_FLOAT, GL_FALSE, n_bytes_per_vertex, BUFFER_OFFSET(0));
+	glEnableVertexAttribArray(INDEX_VERTEX_POSITION);
+	glVertexAttribPointer(INDEX_NORMAL, 3, GL_FLOAT, GL_FALSE, n_bytes_per_vertex, BUFFER_OFFSET(3 * sizeof(float)));
+	glEnableVertexAttribArray(INDEX_NORMAL);
+	glVertexAttribPointer(INDEX_TEX_COORD, 2, GL_FLOAT, GL_FALSE, n_bytes_per_vertex, BUFFER_OFFSET(6 * sizeof(float)));
+	glEnableVertexAttribArray(INDEX_TEX_COORD);
+	glVertexAttribPointer(INDEX_TANGENT, 4, GL_FLOAT, GL_FALSE, n_bytes_per_vertex, BUFFER_OFFSET(8 * sizeof(float)));
+	glEnableVertexAttribArray(INDEX_TANGENT);
+	glVertexAttribPointer(INDEX_AO, 1, GL_UNSIGNED_BYTE, GL_TRUE, n_bytes_per_vertex, BUFFER_OFFSET(12 * sizeof(float)));
+	glEnableVertexAttribArray(INDEX_AO);
+}
 
-		int vertexIdx = 0;
-		for (int triIdx = 0; triIdx < tm->n_triangle; triIdx++) {
-			TRIANGLE tri = tm->triangle_list[triIdx];
-			for (int triVertex = 0; triVertex < 3; triVertex++) {
-				bistro_exterior_vertices[materialIdx][vertexIdx++] = tri.position[triVertex].x;
-				bistro_exterior_vertices[materialIdx][vertexIdx++] = tri.position[triVertex].y;
-				bistro_exterior_vertices[materialIdx][vertexIdx++] = tri.position[triVertex].z;
+// all materials and textures, resident for the whole run
+void load_bistro_exterior(void) {
+	int n_bytes_per_vertex = BISTRO_VERTEX_FLOATS * sizeof(float); // 3 for vertex, 3 for normal, 2 for texcoord, 4 for tangent, and the AO byte
 
-				bistro_exterior_vertices[materialIdx][vertexIdx++] = tri.normal_vetcor[triVertex].x;
-				bistro_exterior_vertices[materialIdx][vertexIdx++] = tri.normal_vetcor[triVertex].y;
-				bistro_exterior_vertices[materialIdx][vertexIdx++] = tri.normal_vetcor[triVertex].z;
+	// vertices
+	bistro_exterior_vertices = (GLfloat**)malloc(sizeof(GLfloat*) * scene.n_materials);
 
-				bistro_exterior_vertices[materialIdx][vertexIdx++] = tri.texture_list[triVertex][0].u;
-				bistro_exterior_vertices[materialIdx][vertexIdx++] = tri.texture_list[triVertex][0].v;
-			}
-		}
+	GLfloat* positions = (GLfloat*)malloc(sizeof(GLfloat) * 3 * bistro_exterior_n_total_vertices);
+	unsigned char* vertex_ao = prepare_vertex_ao(&scene);
 
-		// # of triangles
-		bistro_exterior_n_triangles[materialIdx] = tm->n_triangle;
+	for (int materialIdx = 0; materialIdx < scene.n_materials; materialIdx++) {
+		GEOMETRY_TRIANGULAR_MESH* tm = &(scene.material_list[materialIdx].geometry.tm);
+
+		// vertex
+		bistro_exterior_vertices[materialIdx] = (GLfloat*)malloc(sizeof(GLfloat) * BISTRO_VERTEX_FLOATS * tm->n_triangle * 3);
+		get_bistro_vertices(materialIdx, 0, tm->n_triangle, vertex_ao + bistro_exterior_vertex_offset[materialIdx],
+			bistro_exterior_vertices[materialIdx]);
 
-		if (materialIdx == 0)
-			bistro_exterior_vertex_offset[materialIdx] = 0;
-		else
-			bistro_exterior_vertex_offset[materialIdx] = bistro_exterior_vertex_offset[materialIdx - 1] + 3 * bistro_exterior_n_triangles[materialIdx - 1];
+		for (int vertex = 0; vertex < 3 * tm->n_triangle; vertex++)
+			memcpy(&positions[3 * (bistro_exterior_vertex_offset[materialIdx] + vertex)], &bistro_exterior_vertices[materialIdx][BISTRO_VERTEX_FLOATS * vertex], sizeof(GLfloat) * 3);
 
 		glGenBuffers(1, &bistro_exterior_VBO[materialIdx]);
 
@@ -581,12 +991,7 @@ void prepare_bistro_exterior(void) { //DON'T TOUCH?
 		glBindVertexArray(bistro_exterior_VAO[materialIdx]);
 
 		glBindBuffer(GL_ARRAY_BUFFER, bistro_exterior_VBO[materialIdx]);
-		glVertexAttribPointer(INDEX_VERTEX_POSITION, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), BUFFER_OFFSET(0));
-		glEnableVertexAttribArray(INDEX_VERTEX_POSITION);
-		glVertexAttribPointer(INDEX_NORMAL, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), BUFFER_OFFSET(3 * sizeof(float)));
-		glEnableVertexAttribArray(INDEX_NORMAL);
-		glVertexAttribPointer(INDEX_TEX_COORD, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), BUFFER_OFFSET(6 * sizeof(float)));
-		glEnableVertexAttribArray(INDEX_TEX_COORD);
+		set_bistro_vertex_attributes();
 
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 		glBindVertexArray(0);
@@ -595,75 +1000,567 @@ void prepare_bistro_exterior(void) { //DON'T TOUCH?
 			fprintf(stdout, " * Loaded %d bistro exterior materials into graphics memory.\n", materialIdx / 100 * 100);
 	}
 	fprintf(stdout, " * Loaded %d bistro exterior materials into graphics memory.\n", scene.n_materials);
+	free(vertex_ao);
+
+	// one position-only stream for the depth pre-pass, drawn with a single call
+	glGenBuffers(1, &bistro_exterior_position_VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, bistro_exterior_position_VBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 3 * bistro_exterior_n_total_vertices, positions, GL_STATIC_DRAW);
+	for (int k = 0; k < 3; k++) {
+		bistro_exterior_bounds[0][k] = FLT_MAX;
+		bistro_exterior_bounds[1][k] = -FLT_MAX;
+	}
+	for (int i = 0; i < 3 * bistro_exterior_n_total_vertices; i++) {
+		bistro_exterior_bounds[0][i % 3] = min(bistro_exterior_bounds[0][i % 3], positions[i]);
+		bistro_exterior_bounds[1][i % 3] = max(bistro_exterior_bounds[1][i % 3], positions[i]);
+	}
+	free(positions);
 
-	// textures
-	bistro_exterior_texture_names = (GLuint*)malloc(sizeof(GLuint) * scene.n_textures);
-	glGenTextures(scene.n_textures, bistro_exterior_texture_names);
+	glGenVertexArrays(1, &bistro_exterior_position_VAO);
+	glBindVertexArray(bistro_exterior_position_VAO);
+	glVertexAttribPointer(INDEX_VERTEX_POSITION, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), BUFFER_OFFSET(0));
+	glEnableVertexAttribArray(INDEX_VERTEX_POSITION);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
 
+	// textures: the mip chains stay in system memory, the residency manager uploads the levels in use;
+	// byte-identical duplicates are not decoded, pixel-identical ones are dropped after decoding
+	CPU_TEXTURE* textures = (CPU_TEXTURE*)calloc(max(scene.n_textures, 1), sizeof(CPU_TEXTURE));
+	double start = profiler_time_ms();
+	for (int texId = 0; texId < scene.n_textures; texId++)
+		if (!is_texture_duplicate(texId))
+			load_cpu_texture(scene.texture_file_name[texId], 1 << (CPU_TEXTURE_MAX_LEVELS - 1), false, &textures[texId]);
+	dedup_texture_pixels(&scene, textures, profiler_time_ms() - start);
 	for (int texId = 0; texId < scene.n_textures; texId++) {
-		glBindTexture(GL_TEXTURE_2D, bistro_exterior_texture_names[texId]);
-
-		bool bReturn = readTexImage2D_from_file(scene.texture_file_name[texId]);
-
-		if (bReturn) {
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-			//glGenerateMipmap(GL_TEXTURE_2D);
-			flag_texture_mapping[texId] = true;
-		}
-		else {
-			flag_texture_mapping[texId] = false;
+		flag_texture_mapping[texId] = textures[texId].n_levels > 0;
+		if (flag_texture_mapping[texId])
+			set_residency_source(texId, &textures[texId]);
+	}
+	free(textures);
+	fprintf(stdout, " * Loaded bistro exterior textures into system memory.\n");
+
+	free(bistro_exterior_vertices);
+}
+
+// streaming (Streaming.cpp): the tile file is written from the scene the first time, with the baked AO
+void get_stream_vertices(int materialIdx, int first_triangle, int n_triangles, float* vertices) {
+	if (stream_vertex_ao == NULL)
+		stream_vertex_ao = prepare_vertex_ao(&scene);
+	get_bistro_vertices(materialIdx, first_triangle, n_triangles, stream_vertex_ao + bistro_exterior_vertex_offset[materialIdx], vertices);
+}
+
+void upload_stream_tile(int tile, const float* vertices, int n_vertices) {
+	glGenBuffers(1, &stream_tile_VBO[tile]);
+	glBindBuffer(GL_ARRAY_BUFFER, stream_tile_VBO[tile]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * BISTRO_VERTEX_FLOATS * n_vertices, vertices, GL_STATIC_DRAW);
+
+	glGenVertexArrays(1, &stream_tile_VAO[tile]);
+	glBindVertexArray(stream_tile_VAO[tile]);
+	set_bistro_vertex_attributes();
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+void delete_stream_tile(int tile) {
+	glDeleteVertexArrays(1, &stream_tile_VAO[tile]);
+	glDeleteBuffers(1, &stream_tile_VBO[tile]);
+	stream_tile_VAO[tile] = stream_tile_VBO[tile] = 0;
+}
+
+// a streamed texture is handed to the residency manager, which uploads the levels in use
+void upload_stream_texture(int texId, int width, int height, const unsigned int* texels) {
+	CPU_TEXTURE texture;
+
+	create_cpu_texture(width, height, texels, &texture);
+	set_residency_source(texId, &texture);
+}
+
+void delete_stream_texture(int texId) {
+	release_residency_source(texId);
+}
+
+// sqrt of the uv area over the world area of all triangles of a material
+void prepare_material_uv_density(void) {
+	material_uv_density = (float*)malloc(sizeof(float) * scene.n_materials);
+	for (int materialIdx = 0; materialIdx < scene.n_materials; materialIdx++) {
+		GEOMETRY_TRIANGULAR_MESH* tm = &(scene.material_list[materialIdx].geometry.tm);
+		double uv_area = 0.0, world_area = 0.0;
+
+		for (int triIdx = 0; triIdx < tm->n_triangle; triIdx++) {
+			TRIANGLE* tri = &tm->triangle_list[triIdx];
+			glm::vec3 p0(tri->position[0].x, tri->position[0].y, tri->position[0].z);
+			glm::vec3 e1 = glm::vec3(tri->position[1].x, tri->position[1].y, tri->position[1].z) - p0;
+			glm::vec3 e2 = glm::vec3(tri->position[2].x, tri->position[2].y, tri->position[2].z) - p0;
+			float du1 = tri->texture_list[1][0].u - tri->texture_list[0][0].u, dv1 = tri->texture_list[1][0].v - tri->texture_list[0][0].v;
+			float du2 = tri->texture_list[2][0].u - tri->texture_list[0][0].u, dv2 = tri->texture_list[2][0].v - tri->texture_list[0][0].v;
+
+			uv_area += 0.5 * fabs(du1 * dv2 - du2 * dv1);
+			world_area += 0.5 * glm::length(glm::cross(e1, e2));
 		}
+		material_uv_density[materialIdx] = (world_area > 0.0) ? (float)sqrt(uv_area / world_area) : 0.0f;
+	}
+}
 
-		glBindTexture(GL_TEXTURE_2D, 0);
+bool prepare_bistro_streaming(void) {
+	STREAM_CALLBACKS callbacks = { BISTRO_VERTEX_FLOATS, get_stream_vertices, upload_stream_tile, delete_stream_tile,
+		upload_stream_texture, delete_stream_texture };
+	bool streaming = initialize_streaming(&scene, (size_t)stream_cpu_budget_mb << 20, (size_t)stream_gpu_budget_mb << 20, &callbacks);
+
+	free(stream_vertex_ao);
+	stream_vertex_ao = NULL;
+	if (!streaming) {
+		fprintf(stderr, "Error: cannot stream the bistro exterior; loading all of it\n");
+		return false;
 	}
-	fprintf(stdout, " * Loaded bistro exterior textures into graphics memory.\n");
 
-	free(bistro_exterior_vertices);
+	const STREAM_TILES* pTiles = get_stream_tiles();
+	stream_tile_VBO = (GLuint*)calloc(max(pTiles->n_tiles, 1), sizeof(GLuint));
+	stream_tile_VAO = (GLuint*)calloc(max(pTiles->n_tiles, 1), sizeof(GLuint));
+	for (int texId = 0; texId < scene.n_textures; texId++)
+		flag_texture_mapping[texId] = is_stream_texture_available(texId);
+
+	for (int k = 0; k < 3; k++) {
+		bistro_exterior_bounds[0][k] = FLT_MAX;
+		bistro_exterior_bounds[1][k] = -FLT_MAX;
+	}
+	for (int materialIdx = 0; materialIdx < scene.n_materials; materialIdx++) {
+		GEOMETRY_TRIANGULAR_MESH* tm = &(scene.material_list[materialIdx].geometry.tm);
+		for (int triIdx = 0; triIdx < tm->n_triangle; triIdx++)
+			for (int triVertex = 0; triVertex < 3; triVertex++) {
+				const float* p = &tm->triangle_list[triIdx].position[triVertex].x;
+				for (int k = 0; k < 3; k++) {
+					bistro_exterior_bounds[0][k] = min(bistro_exterior_bounds[0][k], p[k]);
+					bistro_exterior_bounds[1][k] = max(bistro_exterior_bounds[1][k], p[k]);
+				}
+			}
+	}
+	return true;
 }
 
-void bindTexture(GLuint tex, int glTextureId, int texId) { //DON'T TOUCH?
-	if (INVALID_TEX_ID != texId) {
-		glActiveTexture(GL_TEXTURE0 + glTextureId);
-		glBindTexture(GL_TEXTURE_2D, bistro_exterior_texture_names[texId]);
-		glUniform1i(tex, glTextureId);
+GLuint create_single_texel_texture(const GLubyte* rgba) {
+	GLuint texture;
+
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+void prepare_bistro_exterior(void) { //DON'T TOUCH?
+	// VBO, VAO malloc (zeroed: while streaming they are not generated, but deleted all the same)
+	bistro_exterior_VBO = (GLuint*)calloc(scene.n_materials, sizeof(GLuint));
+	bistro_exterior_VAO = (GLuint*)calloc(scene.n_materials, sizeof(GLuint));
+
+	bistro_exterior_n_triangles = (int*)malloc(sizeof(int) * scene.n_materials);
+	bistro_exterior_vertex_offset = (int*)malloc(sizeof(int) * scene.n_materials);
+
+	flag_texture_mapping = (bool*)malloc(sizeof(bool) * scene.n_textures);
+	bistro_exterior_texture_names = (GLuint*)calloc(scene.n_textures, sizeof(GLuint)); // named by the residency manager
+	initialize_texture_residency(bistro_exterior_texture_names, scene.n_textures, (size_t)texture_budget_mb << 20);
+	prepare_material_uv_density();
+
+	bistro_exterior_n_total_vertices = 0;
+	for (int materialIdx = 0; materialIdx < scene.n_materials; materialIdx++) {
+		// # of triangles
+		bistro_exterior_n_triangles[materialIdx] = scene.material_list[materialIdx].geometry.tm.n_triangle;
+		bistro_exterior_vertex_offset[materialIdx] = bistro_exterior_n_total_vertices;
+		bistro_exterior_n_total_vertices += 3 * bistro_exterior_n_triangles[materialIdx];
+	}
+
+	dedup_texture_files(&scene); // the materials refer to one texture id per set of identical files
+	if (flag_streaming)
+		flag_streaming = prepare_bistro_streaming();
+	if (!flag_streaming)
+		load_bistro_exterior();
+	report_texture_dedup();
+
+	static const GLubyte white[4] = { 255, 255, 255, 255 };
+	static const GLubyte flat_normal[4] = { 128, 128, 0, 255 };				// (0, 0, 1) after the DirectX flip
+	static const GLubyte default_metallic_roughness[4] = { 255, 255, 0, 255 };	// ao 1, roughness 1, metallic 0
+	static const GLubyte black[4] = { 0, 0, 0, 255 };
+	white_texture = create_single_texel_texture(white);
+	flat_normal_texture = create_single_texel_texture(flat_normal);
+	default_metallic_roughness_texture = create_single_texel_texture(default_metallic_roughness);
+	black_texture = create_single_texel_texture(black);
+
+	sort_materials_by_variant();
+}
+
+// the texture, or the stand-in while it is streamed in
+GLuint get_bistro_texture(int texId, GLuint fallback) {
+	return (!flag_streaming || is_stream_texture_resident(texId)) ? bistro_exterior_texture_names[texId] : fallback;
+}
+
+// a map is only bound when the material's variant samples it; a missing albedo map reads the white texture
+void bind_material_textures(MATERIAL* pMaterial, int variant) {
+	glActiveTexture(GL_TEXTURE0 + TEXTURE_INDEX_DIFFUSE);
+	glBindTexture(GL_TEXTURE_2D, material_has_texture(pMaterial->diffuseTexId)
+		? get_bistro_texture(pMaterial->diffuseTexId, white_texture) : white_texture);
+	if (variant & MATERIAL_VARIANT_NORMAL_MAP) {
+		glActiveTexture(GL_TEXTURE0 + TEXTURE_INDEX_NORMAL);
+		glBindTexture(GL_TEXTURE_2D, get_bistro_texture(pMaterial->normalMapTexId, flat_normal_texture));
+	}
+	if (variant & MATERIAL_VARIANT_METALLIC_ROUGHNESS_MAP) {
+		glActiveTexture(GL_TEXTURE0 + TEXTURE_INDEX_SPECULAR);
+		glBindTexture(GL_TEXTURE_2D, get_bistro_texture(pMaterial->specularTexId, default_metallic_roughness_texture));
+	}
+	if (variant & MATERIAL_VARIANT_EMISSIVE_MAP) {
+		glActiveTexture(GL_TEXTURE0 + TEXTURE_INDEX_EMISSIVE);
+		glBindTexture(GL_TEXTURE_2D, get_bistro_texture(pMaterial->emissiveTexId, black_texture));
 	}
 }
 
-void draw_bistro_exterior(void) { //DON'T TOUCH?
-	glUseProgram(h_ShaderProgram_TXPBR);
+void set_bistro_matrices(loc_PBR_Program* pLoc) {
 	ModelViewMatrix = ViewMatrix;
 	ModelViewProjectionMatrix = ProjectionMatrix * ModelViewMatrix;
 	ModelViewMatrixInvTrans = glm::transpose(glm::inverse(glm::mat3(ModelViewMatrix)));
 
-	glUniformMatrix4fv(loc_ModelViewProjectionMatrix_TXPBR, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
-	glUniformMatrix4fv(loc_ModelViewMatrix_TXPBR, 1, GL_FALSE, &ModelViewMatrix[0][0]);
-	glUniformMatrix3fv(loc_ModelViewMatrixInvTrans_TXPBR, 1, GL_FALSE, &ModelViewMatrixInvTrans[0][0]);
+	glUniformMatrix4fv(pLoc->modelViewProjectionMatrix, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
+	glUniformMatrix4fv(pLoc->modelViewMatrix, 1, GL_FALSE, &ModelViewMatrix[0][0]);
+	glUniformMatrix3fv(pLoc->modelViewMatrixInvTrans, 1, GL_FALSE, &ModelViewMatrixInvTrans[0][0]);
+}
 
-	glUniform4fv(loc_cameraPos, 1, current_camera.pos);
+bool is_material_visible(int materialIdx) {
+	CULL_CHUNKS* pChunks = get_cull_chunks();
+	const unsigned char* visible = get_cull_visibility(cull_slot);
 
-	for (int materialIdx = 0; materialIdx < scene.n_materials; materialIdx++) {
-		int diffuseTexId = scene.material_list[materialIdx].diffuseTexId;
-		int normalMapTexId = scene.material_list[materialIdx].normalMapTexId;
-		int specularTexId = scene.material_list[materialIdx].specularTexId;;
-		int emissiveTexId = scene.material_list[materialIdx].emissiveTexId;
+	for (int c = pChunks->material_first_chunk[materialIdx]; c < pChunks->material_first_chunk[materialIdx + 1]; c++)
+		if (visible[c])
+			return true;
+	return false;
+}
 
-		bindTexture(loc_material.diffuseTex, TEXTURE_INDEX_DIFFUSE, diffuseTexId);
-		bindTexture(loc_material.normalTex, TEXTURE_INDEX_NORMAL, normalMapTexId);
-		bindTexture(loc_material.specularTex, TEXTURE_INDEX_SPECULAR, specularTexId);
-		bindTexture(loc_material.emissiveTex, TEXTURE_INDEX_EMISSIVE, emissiveTexId);
-		glEnable(GL_TEXTURE_2D);
+// visible chunks of materials [first_material, last_material), in a buffer where material m starts at
+// vertex_offsets[m] (0 if NULL); chunks that follow each other in the buffer are merged into one call.
+// While streaming, the chunks of resident tiles are drawn from the tile vertex arrays instead.
+void draw_visible_chunks(int first_material, int last_material, const int* vertex_offsets) {
+	CULL_CHUNKS* pChunks = get_cull_chunks();
+	const STREAM_TILES* pTiles = flag_streaming ? get_stream_tiles() : NULL;
+	const unsigned char* visible = get_cull_visibility(cull_slot);
+	int run_first = 0, run_count = 0, bound_tile = -1;
+
+	for (int materialIdx = first_material; materialIdx < last_material; materialIdx++) {
+		int base = vertex_offsets ? vertex_offsets[materialIdx] : 0;
+
+		for (int c = pChunks->material_first_chunk[materialIdx]; c < pChunks->material_first_chunk[materialIdx + 1]; c++) {
+			if (!visible[c])
+				continue;
+			int first = base + 3 * pChunks->chunk_first_triangle[c], count = 3 * pChunks->chunk_n_triangles[c];
+			if (pTiles) {
+				int tile = pTiles->chunk_tile[c];
+				if (!is_stream_tile_resident(tile))
+					continue;
+				first = pTiles->chunk_first_vertex[c];
+				if (tile != bound_tile) {
+					if (run_count > 0)
+						glDrawArrays(GL_TRIANGLES, run_first, run_count);
+					run_count = 0;
+					glBindVertexArray(stream_tile_VAO[tile]);
+					bound_tile = tile;
+				}
+			}
+			if (run_count > 0 && run_first + run_count == first) {
+				run_count += count;
+				continue;
+			}
+			if (run_count > 0)
+				glDrawArrays(GL_TRIANGLES, run_first, run_count);
+			run_first = first;
+			run_count = count;
+		}
+	}
+	if (run_count > 0)
+		glDrawArrays(GL_TRIANGLES, run_first, run_count);
+}
 
-		glBindVertexArray(bistro_exterior_VAO[materialIdx]);
-		glDrawArrays(GL_TRIANGLES, 0, 3 * bistro_exterior_n_triangles[materialIdx]);
+// uv units per pixel at the nearest visible chunk of a material, for the maps its variant samples;
+// view_scale is the size of a pixel at distance 1
+void request_material_textures(MATERIAL* pMaterial, int materialIdx, int variant, float view_scale) {
+	CULL_CHUNKS* pChunks = get_cull_chunks();
+	const unsigned char* visible = get_cull_visibility(cull_slot);
+	float distance = FLT_MAX;
+
+	for (int c = pChunks->material_first_chunk[materialIdx]; c < pChunks->material_first_chunk[materialIdx + 1]; c++)
+		if (visible[c])
+			distance = min(distance, get_cull_chunk_distance(c, current_camera.pos));
+	float uv_per_pixel = material_uv_density[materialIdx] * view_scale * distance;
+
+	if (material_has_texture(pMaterial->diffuseTexId))
+		request_texture_footprint(pMaterial->diffuseTexId, uv_per_pixel);
+	if (variant & MATERIAL_VARIANT_NORMAL_MAP)
+		request_texture_footprint(pMaterial->normalMapTexId, uv_per_pixel);
+	if (variant & MATERIAL_VARIANT_METALLIC_ROUGHNESS_MAP)
+		request_texture_footprint(pMaterial->specularTexId, uv_per_pixel);
+	if (variant & MATERIAL_VARIANT_EMISSIVE_MAP)
+		request_texture_footprint(pMaterial->emissiveTexId, uv_per_pixel);
+}
 
-		glBindVertexArray(0);
+// materials in variant order, one program switch per variant in use
+void draw_bistro_materials(GLuint* programs, loc_PBR_Program* pLocs) {
+	GLint viewport[4];
+
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	float view_scale = 2.0f / (ProjectionMatrix[1][1] * max(viewport[3], 1));
+	for (int variant = 0; variant < N_MATERIAL_VARIANTS; variant++) {
+		if (material_variant_first[variant] == material_variant_first[variant + 1])
+			continue;
+
+		glUseProgram(programs[variant]);
+		set_bistro_matrices(&pLocs[variant]);
+		set_light_cluster_params(&pLocs[variant].cluster);
+		set_shadow_params(&pLocs[variant].shadow);
+		set_ambient_params(&pLocs[variant].ambient);
+
+		for (int i = material_variant_first[variant]; i < material_variant_first[variant + 1]; i++) {
+			int materialIdx = material_draw_order[i];
+
+			if (!is_material_visible(materialIdx))
+				continue;
+			request_material_textures(&scene.material_list[materialIdx], materialIdx, variant, view_scale);
+			bind_material_textures(&scene.material_list[materialIdx], variant);
+
+			glBindVertexArray(bistro_exterior_VAO[materialIdx]);
+			draw_visible_chunks(materialIdx, materialIdx + 1, NULL);
+		}
+	}
+	glBindVertexArray(0);
+	glActiveTexture(GL_TEXTURE0);
+	glUseProgram(0);
+}
+
+// G-buffer for the deferred path, sized to the window
+//   0: RGBA8 albedo, 1: RG16F octahedral normal, 2: RGBA8 metallic/roughness/ao, 3: R11F_G11F_B10F emissive
+#define GBUFFER_ALBEDO		(0)
+#define GBUFFER_NORMAL		(1)
+#define GBUFFER_MATERIAL	(2)
+#define GBUFFER_EMISSIVE	(3)
+#define N_GBUFFER_TARGETS	(4)
+
+bool flag_deferred_shading = false;
+GLuint gbuffer_FBO, gbuffer_depth_texture;
+GLuint gbuffer_textures[N_GBUFFER_TARGETS];
+GLuint fullscreen_VAO; // attributeless; vertices come from gl_VertexID
+int gbuffer_width, gbuffer_height;
+
+void resize_gbuffer(int width, int height) {
+	static const GLenum internal_formats[N_GBUFFER_TARGETS] = { GL_RGBA8, GL_RG16F, GL_RGBA8, GL_R11F_G11F_B10F };
+	static const GLenum formats[N_GBUFFER_TARGETS] = { GL_RGBA, GL_RG, GL_RGBA, GL_RGB };
+
+	if (width == gbuffer_width && height == gbuffer_height)
+		return;
+	gbuffer_width = width;
+	gbuffer_height = height;
+
+	for (int i = 0; i < N_GBUFFER_TARGETS; i++) {
+		glBindTexture(GL_TEXTURE_2D, gbuffer_textures[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, internal_formats[i], width, height, 0, formats[i], GL_UNSIGNED_BYTE, NULL);
+	}
+	glBindTexture(GL_TEXTURE_2D, gbuffer_depth_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, gbuffer_FBO);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		fprintf(stderr, " * Error: the G-buffer (%dx%d) is incomplete.\n", width, height);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void prepare_gbuffer(void) {
+	static const GLenum draw_buffers[N_GBUFFER_TARGETS] = {
+		GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3
+	};
+
+	glGenTextures(N_GBUFFER_TARGETS, gbuffer_textures);
+	glGenTextures(1, &gbuffer_depth_texture);
+	for (int i = 0; i <= N_GBUFFER_TARGETS; i++) {
+		glBindTexture(GL_TEXTURE_2D, (i < N_GBUFFER_TARGETS) ? gbuffer_textures[i] : gbuffer_depth_texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &gbuffer_FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, gbuffer_FBO);
+	for (int i = 0; i < N_GBUFFER_TARGETS; i++)
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, gbuffer_textures[i], 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, gbuffer_depth_texture, 0);
+	glDrawBuffers(N_GBUFFER_TARGETS, draw_buffers);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	resize_gbuffer(render_width, render_height);
+
+	glGenVertexArrays(1, &fullscreen_VAO);
+
+	glUseProgram(h_ShaderProgram_Deferred);
+	glUniform1i(loc_gbuffer.albedo, TEXTURE_INDEX_GBUFFER_ALBEDO);
+	glUniform1i(loc_gbuffer.normal, TEXTURE_INDEX_GBUFFER_NORMAL);
+	glUniform1i(loc_gbuffer.metallicRoughness, TEXTURE_INDEX_GBUFFER_MATERIAL);
+	glUniform1i(loc_gbuffer.emissive, TEXTURE_INDEX_GBUFFER_EMISSIVE);
+	glUniform1i(loc_gbuffer.depth, TEXTURE_INDEX_GBUFFER_DEPTH);
+	glUseProgram(0);
+
+	fprintf(stdout, " * Prepared the G-buffer for deferred shading.\n");
+}
+
+// depth pre-pass: the shading pass then runs with GL_EQUAL, so each pixel is shaded once.
+// Fragments saved = samples passing the pre-pass (what the shading pass would have run without it)
+// minus fragment shader invocations of the shading pass (samples passed when pipeline statistics are missing).
+#define PREPASS_QUERY_DEPTH		(0)
+#define PREPASS_QUERY_SHADING	(1)
+
+bool flag_depth_prepass = false;
+bool flag_pipeline_statistics;
+GLuint prepass_queries[2][2];
+bool prepass_pending[2];
+double prepass_total_depth_samples, prepass_total_shaded;
+int prepass_samples, prepass_frame;
+
+void prepare_depth_prepass(void) {
+	flag_pipeline_statistics = GLEW_ARB_pipeline_statistics_query ? true : false;
+	glGenQueries(4, &prepass_queries[0][0]);
+}
+
+void draw_bistro_depth_prepass(void) {
+	int slot = prepass_frame & 1;
+
+	if (measure_view && prepass_pending[slot]) {
+		GLuint64 depth_samples, shaded;
+
+		glGetQueryObjectui64v(prepass_queries[slot][PREPASS_QUERY_DEPTH], GL_QUERY_RESULT, &depth_samples);
+		glGetQueryObjectui64v(prepass_queries[slot][PREPASS_QUERY_SHADING], GL_QUERY_RESULT, &shaded);
+		prepass_total_depth_samples += (double)depth_samples;
+		prepass_total_shaded += (double)shaded;
+		prepass_samples++;
+	}
+
+	PROFILE_BEGIN(PROFILE_DEPTH_PREPASS);
+	if (measure_view)
+		glBeginQuery(GL_SAMPLES_PASSED, prepass_queries[slot][PREPASS_QUERY_DEPTH]);
+
+	glUseProgram(h_ShaderProgram_Depth);
+	ModelViewProjectionMatrix = ProjectionMatrix * ViewMatrix;
+	glUniformMatrix4fv(loc_ModelViewProjectionMatrix_Depth, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
+
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glBindVertexArray(bistro_exterior_position_VAO);
+	draw_visible_chunks(0, scene.n_materials, bistro_exterior_vertex_offset);
+	glBindVertexArray(0);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glUseProgram(0);
+
+	if (measure_view)
+		glEndQuery(GL_SAMPLES_PASSED);
+	PROFILE_END(PROFILE_DEPTH_PREPASS);
+
+	glDepthFunc(GL_EQUAL);
+	glDepthMask(GL_FALSE);
+	if (measure_view) {
+		glBeginQuery(flag_pipeline_statistics ? GL_FRAGMENT_SHADER_INVOCATIONS_ARB : GL_SAMPLES_PASSED, prepass_queries[slot][PREPASS_QUERY_SHADING]);
+		prepass_pending[slot] = true;
+	}
+}
+
+// after the shading pass that followed draw_bistro_depth_prepass()
+void end_bistro_depth_prepass(void) {
+	if (measure_view)
+		glEndQuery(flag_pipeline_statistics ? GL_FRAGMENT_SHADER_INVOCATIONS_ARB : GL_SAMPLES_PASSED);
+	glDepthMask(GL_TRUE);
+	glDepthFunc(GL_LESS);
+}
+
+// called once per frame
+void report_depth_prepass(void) {
+	if ((++prepass_frame % PROFILER_REPORT_FRAMES) || prepass_samples == 0)
+		return;
+
+	double saved = (prepass_total_depth_samples - prepass_total_shaded) / prepass_samples;
+	fprintf(stdout, " * Depth pre-pass: %.0f fragment shader invocations saved per frame (%.1f%%, %s)\n", saved,
+		prepass_total_depth_samples > 0.0 ? 100.0 * (prepass_total_depth_samples - prepass_total_shaded) / prepass_total_depth_samples : 0.0,
+		flag_pipeline_statistics ? "pipeline statistics" : "estimated from samples passed");
+	prepass_total_depth_samples = prepass_total_shaded = 0.0;
+	prepass_samples = 0;
+}
+
+void draw_bistro_exterior_deferred(void) {
+	GLint target_FBO;
+
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target_FBO);
+
+	// G-buffer pass: material fetches only, no lighting
+	glBindFramebuffer(GL_FRAMEBUFFER, gbuffer_FBO);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if (flag_depth_prepass)
+		draw_bistro_depth_prepass();
+
+	PROFILE_BEGIN(PROFILE_GBUFFER);
+	draw_bistro_materials(h_ShaderProgram_GBuffer, loc_GBuffer);
+	PROFILE_END(PROFILE_GBUFFER);
+	if (flag_depth_prepass)
+		end_bistro_depth_prepass();
+
+	// lighting pass: every covered pixel is shaded once; the G-buffer depth goes into the
+	// target depth buffer so that what is drawn afterwards is still occluded by the Bistro
+	PROFILE_BEGIN(PROFILE_DEFERRED_LIGHTING);
+	glBindFramebuffer(GL_FRAMEBUFFER, target_FBO);
+
+	glUseProgram(h_ShaderProgram_Deferred);
+	glm::mat4 InvProjectionMatrix = glm::inverse(ProjectionMatrix);
+	glUniformMatrix4fv(loc_InvProjectionMatrix_Deferred, 1, GL_FALSE, &InvProjectionMatrix[0][0]);
+	PROFILE_BEGIN(PROFILE_LIGHT_CLUSTERS);
+	prepare_light_clusters_for_view();
+	PROFILE_END(PROFILE_LIGHT_CLUSTERS);
+	set_light_cluster_params(&loc_cluster_Deferred);
+	set_shadow_params(&loc_shadow_Deferred);
+	set_ambient_params(&loc_ambient_Deferred);
+
+	for (int i = 0; i < N_GBUFFER_TARGETS; i++) {
+		glActiveTexture(GL_TEXTURE0 + TEXTURE_INDEX_GBUFFER_ALBEDO + i);
+		glBindTexture(GL_TEXTURE_2D, gbuffer_textures[i]);
+	}
+	glActiveTexture(GL_TEXTURE0 + TEXTURE_INDEX_GBUFFER_DEPTH);
+	glBindTexture(GL_TEXTURE_2D, gbuffer_depth_texture);
+
+	glBindVertexArray(fullscreen_VAO);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+
+	for (int i = 0; i <= N_GBUFFER_TARGETS; i++) {
+		glActiveTexture(GL_TEXTURE0 + TEXTURE_INDEX_GBUFFER_ALBEDO + i);
 		glBindTexture(GL_TEXTURE_2D, 0);
 	}
+	glActiveTexture(GL_TEXTURE0);
 	glUseProgram(0);
+	PROFILE_END(PROFILE_DEFERRED_LIGHTING);
+}
+
+void draw_bistro_exterior(void) {
+	glm::mat4 CullViewProjectionMatrix = ProjectionMatrix * ViewMatrix;
+	cull_views(cull_slot, 1, &CullViewProjectionMatrix[0][0]); // no-op if the view has not moved
+
+	if (flag_deferred_shading) {
+		draw_bistro_exterior_deferred();
+		return;
+	}
+
+	if (flag_depth_prepass)
+		draw_bistro_depth_prepass();
+
+	PROFILE_BEGIN(PROFILE_LIGHT_CLUSTERS);
+	prepare_light_clusters_for_view();
+	PROFILE_END(PROFILE_LIGHT_CLUSTERS);
+	PROFILE_BEGIN(PROFILE_FORWARD);
+	draw_bistro_materials(h_ShaderProgram_TXPBR, loc_TXPBR);
+	PROFILE_END(PROFILE_FORWARD);
+
+	if (flag_depth_prepass)
+		end_bistro_depth_prepass();
 }
 
 int read_geometry(GLfloat** object, int bytes_per_primitive, char* filename) {
@@ -691,193 +1588,132 @@ int read_geometry(GLfloat** object, int bytes_per_primitive, char* filename) {
 }
 
 
-// tiger object
-#define N_TIGER_FRAMES 12
-GLuint tiger_VBO, tiger_VAO;
-int tiger_n_triangles[N_TIGER_FRAMES];
-int tiger_vertex_offset[N_TIGER_FRAMES];
-GLfloat* tiger_vertices[N_TIGER_FRAMES];
+// animated creatures: one triangle list shared by all frames, the frames one after another in one
+// vertex buffer (CreatureMesh.h)
+typedef struct {
+	GLuint		VBO, IBO, VAO;
+	int			n_triangles, n_vertices;	// n_vertices per frame
+	glm::mat4	position_decode;			// from the quantized positions to model coordinates
+} ANIMATED_CREATURE;
 
-void prepare_tiger(void) { // vertices enumerated clockwise
-	int i, n_bytes_per_vertex, n_bytes_per_triangle, tiger_n_total_triangles = 0;
+void prepare_animated_creature(const char* name, const char* filename_format, int n_frames, ANIMATED_CREATURE* pCreature) {
+	GLfloat** frames = (GLfloat**)calloc(n_frames, sizeof(GLfloat*));
+	int n_bytes_per_vertex, n_bytes_per_triangle, n_triangles = 0;
+	bool loaded = true;
 	char filename[512];
+	double start = profiler_time_ms();
+	CREATURE_MESH mesh;
 
 	n_bytes_per_vertex = 8 * sizeof(float); // 3 for vertex, 3 for normal, and 2 for texcoord
 	n_bytes_per_triangle = 3 * n_bytes_per_vertex;
 
-	for (i = 0; i < N_TIGER_FRAMES; i++) {
-		sprintf(filename, "Data/dynamic_objects/tiger/Tiger_%d%d_triangles_vnt.geom", i / 10, i % 10);
-		tiger_n_triangles[i] = read_geometry(&tiger_vertices[i], n_bytes_per_triangle, filename);
-		// assume all geometry files are effective
-		tiger_n_total_triangles += tiger_n_triangles[i];
-
-		if (i == 0)
-			tiger_vertex_offset[i] = 0;
-		else
-			tiger_vertex_offset[i] = tiger_vertex_offset[i - 1] + 3 * tiger_n_triangles[i - 1];
+	for (int i = 0; i < n_frames; i++) {
+		sprintf(filename, filename_format, i);
+		int n = read_geometry(&frames[i], n_bytes_per_triangle, filename);
+		if (n <= 0 || (i > 0 && n != n_triangles)) {
+			fprintf(stderr, "Error: cannot load the %s, %s is missing or has other triangles than the first frame\n", name, filename);
+			loaded = false;
+			break;
+		}
+		n_triangles = n;
 	}
+	loaded = loaded && build_creature_mesh(frames, n_frames, n_triangles, &mesh);
+	for (int i = 0; i < n_frames; i++)
+		free(frames[i]);
+	free(frames);
+	pCreature->VBO = pCreature->IBO = pCreature->VAO = 0;
+	pCreature->n_triangles = pCreature->n_vertices = 0; // nothing to draw
+	pCreature->position_decode = glm::mat4(1.0f);
+	if (!loaded)
+		return;
 
 	// initialize vertex buffer object
-	glGenBuffers(1, &tiger_VBO);
-
-	glBindBuffer(GL_ARRAY_BUFFER, tiger_VBO);
-	glBufferData(GL_ARRAY_BUFFER, tiger_n_total_triangles * n_bytes_per_triangle, NULL, GL_STATIC_DRAW);
-
-	for (i = 0; i < N_TIGER_FRAMES; i++)
-		glBufferSubData(GL_ARRAY_BUFFER, tiger_vertex_offset[i] * n_bytes_per_vertex,
-			tiger_n_triangles[i] * n_bytes_per_triangle, tiger_vertices[i]);
-
-	// as the geometry data exists now in graphics memory, ...
-	for (i = 0; i < N_TIGER_FRAMES; i++)
-		free(tiger_vertices[i]);
+	glGenBuffers(1, &pCreature->VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, pCreature->VBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(CREATURE_VERTEX) * n_frames * mesh.n_vertices, mesh.vertices, GL_STATIC_DRAW);
 
 	// initialize vertex array object
-	glGenVertexArrays(1, &tiger_VAO);
-	glBindVertexArray(tiger_VAO);
+	glGenVertexArrays(1, &pCreature->VAO);
+	glBindVertexArray(pCreature->VAO);
 
-	glBindBuffer(GL_ARRAY_BUFFER, tiger_VBO);
-	glVertexAttribPointer(LOC_POSITION, 3, GL_FLOAT, GL_FALSE, n_bytes_per_vertex, BUFFER_OFFSET(0));
+	glGenBuffers(1, &pCreature->IBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pCreature->IBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * 3 * mesh.n_triangles, mesh.indices, GL_STATIC_DRAW);
+
+	glVertexAttribPointer(LOC_POSITION, 3, GL_SHORT, GL_TRUE, sizeof(CREATURE_VERTEX), BUFFER_OFFSET(0));
 	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(LOC_NORMAL, 3, GL_FLOAT, GL_FALSE, n_bytes_per_vertex, BUFFER_OFFSET(3 * sizeof(float)));
+	// the normals are kept per frame for lit creature shaders; the wireframe shader reads the positions only
+	glVertexAttribPointer(LOC_NORMAL, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(CREATURE_VERTEX), BUFFER_OFFSET(offsetof(CREATURE_VERTEX, normal)));
 	glEnableVertexAttribArray(1);
 
+	glBindVertexArray(0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	pCreature->n_triangles = mesh.n_triangles;
+	pCreature->n_vertices = mesh.n_vertices;
+	pCreature->position_decode = glm::scale(glm::translate(glm::mat4(1.0f), glm::make_vec3(mesh.position_center)), glm::vec3(mesh.position_scale));
+	fprintf(stdout, " * %s: %d frames of %d triangles share %d of %d vertices; %.2f MB uploaded instead of %.2f MB in %.0f ms (positions within %.4f)\n",
+		name, n_frames, mesh.n_triangles, mesh.n_vertices, 3 * mesh.n_triangles, get_creature_mesh_bytes(&mesh) / 1048576.0, mesh.source_bytes / 1048576.0,
+		profiler_time_ms() - start, mesh.max_position_error);
+	free_creature_mesh(&mesh);
+}
+
+void draw_animated_creature(const ANIMATED_CREATURE* pCreature, int frame) {
+	glBindVertexArray(pCreature->VAO);
+	glDrawElementsBaseVertex(GL_TRIANGLES, 3 * pCreature->n_triangles, GL_UNSIGNED_INT, BUFFER_OFFSET(0), frame * pCreature->n_vertices);
 	glBindVertexArray(0);
 }
 
+void free_animated_creature(ANIMATED_CREATURE* pCreature) {
+	glDeleteVertexArrays(1, &pCreature->VAO);
+	glDeleteBuffers(1, &pCreature->VBO);
+	glDeleteBuffers(1, &pCreature->IBO);
+}
+
+// tiger object
+#define N_TIGER_FRAMES 12
+ANIMATED_CREATURE tiger_mesh;
+
+void prepare_tiger(void) { // vertices enumerated clockwise
+	prepare_animated_creature("Tiger", "Data/dynamic_objects/tiger/Tiger_%02d_triangles_vnt.geom", N_TIGER_FRAMES, &tiger_mesh);
+}
+
 void draw_tiger(void) {
 	glFrontFace(GL_CW);//clockwise
 
 	//glPolygonMode(GL_LINES);
-	glBindVertexArray(tiger_VAO);
-	glDrawArrays(GL_TRIANGLES, tiger_vertex_offset[cur_frame_tiger], 3 * tiger_n_triangles[cur_frame_tiger]);
-	glBindVertexArray(0);
+	draw_animated_creature(&tiger_mesh, cur_frame_tiger);
 }
 
 // wolf object
 #define N_WOLF_FRAMES 17
-GLuint wolf_VBO, wolf_VAO;
-int wolf_n_triangles[N_WOLF_FRAMES];
-int wolf_vertex_offset[N_WOLF_FRAMES];
-GLfloat* wolf_vertices[N_WOLF_FRAMES];
+ANIMATED_CREATURE wolf_mesh;
 
 Material_Parameters material_wolf;
 
 void prepare_wolf(void) {
-	int i, n_bytes_per_vertex, n_bytes_per_triangle, wolf_n_total_triangles = 0;
-	char filename[512];
-
-	n_bytes_per_vertex = 8 * sizeof(float); // 3 for vertex, 3 for normal, and 2 for texcoord
-	n_bytes_per_triangle = 3 * n_bytes_per_vertex;
-
-	for (i = 0; i < N_WOLF_FRAMES; i++) {
-		sprintf(filename, "Data/dynamic_objects/wolf/wolf_%02d_vnt.geom", i);
-		wolf_n_triangles[i] = read_geometry(&wolf_vertices[i], n_bytes_per_triangle, filename);
-		// assume all geometry files are effective
-		wolf_n_total_triangles += wolf_n_triangles[i];
-
-		if (i == 0)
-			wolf_vertex_offset[i] = 0;
-		else
-			wolf_vertex_offset[i] = wolf_vertex_offset[i - 1] + 3 * wolf_n_triangles[i - 1];
-	}
-
-	// initialize vertex buffer object
-	glGenBuffers(1, &wolf_VBO);
-
-	glBindBuffer(GL_ARRAY_BUFFER, wolf_VBO);
-	glBufferData(GL_ARRAY_BUFFER, wolf_n_total_triangles * n_bytes_per_triangle, NULL, GL_STATIC_DRAW);
-
-	for (i = 0; i < N_WOLF_FRAMES; i++)
-		glBufferSubData(GL_ARRAY_BUFFER, wolf_vertex_offset[i] * n_bytes_per_vertex,
-			wolf_n_triangles[i] * n_bytes_per_triangle, wolf_vertices[i]);
-
-	// as the geometry data exists now in graphics memory, ...
-	for (i = 0; i < N_WOLF_FRAMES; i++)
-		free(wolf_vertices[i]);
-
-	// initialize vertex array object
-	glGenVertexArrays(1, &wolf_VAO);
-	glBindVertexArray(wolf_VAO);
-
-	glBindBuffer(GL_ARRAY_BUFFER, wolf_VBO);
-	glVertexAttribPointer(LOC_POSITION, 3, GL_FLOAT, GL_FALSE, n_bytes_per_vertex, BUFFER_OFFSET(0));
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(LOC_NORMAL, 3, GL_FLOAT, GL_FALSE, n_bytes_per_vertex, BUFFER_OFFSET(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+	prepare_animated_creature("Wolf", "Data/dynamic_objects/wolf/wolf_%02d_vnt.geom", N_WOLF_FRAMES, &wolf_mesh);
 }
 
 void draw_wolf(void) {
 	glFrontFace(GL_CW);
 
-	glBindVertexArray(wolf_VAO);
-	glDrawArrays(GL_TRIANGLES, wolf_vertex_offset[cur_frame_wolf], 3 * wolf_n_triangles[cur_frame_wolf]);
-	glBindVertexArray(0);
+	draw_animated_creature(&wolf_mesh, cur_frame_wolf);
 }
 
 //spider object
 #define N_SPIDER_FRAMES 16
-GLuint spider_VBO, spider_VAO;
-int spider_n_triangles[N_SPIDER_FRAMES];
-int spider_vertex_offset[N_SPIDER_FRAMES];
-GLfloat* spider_vertices[N_SPIDER_FRAMES];
+ANIMATED_CREATURE spider_mesh;
 
 void prepare_spider(void) {
-	int i, n_bytes_per_vertex, n_bytes_per_triangle, spider_n_total_triangles = 0;
-	char filename[512];
-
-	n_bytes_per_vertex = 8 * sizeof(float); // 3 for vertex, 3 for normal, and 2 for texcoord
-	n_bytes_per_triangle = 3 * n_bytes_per_vertex;
-
-	for (i = 0; i < N_SPIDER_FRAMES; i++) {
-		sprintf(filename, "Data/dynamic_objects/spider/spider_vnt_%d%d.geom", i / 10, i % 10);
-		spider_n_triangles[i] = read_geometry(&spider_vertices[i], n_bytes_per_triangle, filename);
-		// assume all geometry files are effective
-		spider_n_total_triangles += spider_n_triangles[i];
-
-		if (i == 0)
-			spider_vertex_offset[i] = 0;
-		else
-			spider_vertex_offset[i] = spider_vertex_offset[i - 1] + 3 * spider_n_triangles[i - 1];
-	}
-
-	// initialize vertex buffer object
-	glGenBuffers(1, &spider_VBO);
-
-	glBindBuffer(GL_ARRAY_BUFFER, spider_VBO);
-	glBufferData(GL_ARRAY_BUFFER, spider_n_total_triangles * n_bytes_per_triangle, NULL, GL_STATIC_DRAW);
-
-	for (i = 0; i < N_SPIDER_FRAMES; i++)
-		glBufferSubData(GL_ARRAY_BUFFER, spider_vertex_offset[i] * n_bytes_per_vertex,
-			spider_n_triangles[i] * n_bytes_per_triangle, spider_vertices[i]);
-
-	// as the geometry data exists now in graphics memory, ...
-	for (i = 0; i < N_SPIDER_FRAMES; i++)
-		free(spider_vertices[i]);
-
-	// initialize vertex array object
-	glGenVertexArrays(1, &spider_VAO);
-	glBindVertexArray(spider_VAO);
-
-	glBindBuffer(GL_ARRAY_BUFFER, spider_VBO);
-	glVertexAttribPointer(LOC_POSITION, 3, GL_FLOAT, GL_FALSE, n_bytes_per_vertex, BUFFER_OFFSET(0));
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(LOC_NORMAL, 3, GL_FLOAT, GL_FALSE, n_bytes_per_vertex, BUFFER_OFFSET(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+	prepare_animated_creature("Spider", "Data/dynamic_objects/spider/spider_vnt_%02d.geom", N_SPIDER_FRAMES, &spider_mesh);
 }
 
 void draw_spider(void) {
 	glFrontFace(GL_CW);
 
-	glBindVertexArray(spider_VAO);
-	glDrawArrays(GL_TRIANGLES, spider_vertex_offset[cur_frame_spider], 3 * spider_n_triangles[cur_frame_spider]);
-	glBindVertexArray(0);
+	draw_animated_creature(&spider_mesh, cur_frame_spider);
 }
 
 // godzilla object
@@ -1175,7 +2011,8 @@ GLfloat cube_vertices[72][3] = {
 	 0.0f, -1.0f, 0.0f,      0.0f, -1.0f, 0.0f,     0.0f, -1.0f, 0.0f
 };
 
-void readTexImage2DForCubeMap(const char* filename, GLenum texture_target) {
+// returns the flipped image, kept for the irradiance projection (NULL if the file could not be read)
+FIBITMAP* readTexImage2DForCubeMap(const char* filename, GLenum texture_target) {
 	FREE_IMAGE_FORMAT tx_file_format;
 	int tx_bits_per_pixel;
 	FIBITMAP* tx_pixmap;
@@ -1186,6 +2023,10 @@ void readTexImage2DForCubeMap(const char* filename, GLenum texture_target) {
 	tx_file_format = FreeImage_GetFileType(filename, 0);
 	// assume everything is fine with reading texture from file: no error checking
 	tx_pixmap = FreeImage_Load(tx_file_format, filename);
+	if (tx_pixmap == NULL) {
+		fprintf(stderr, "Error: cannot read %s\n", filename);
+		return NULL;
+	}
 	tx_bits_per_pixel = FreeImage_GetBPP(tx_pixmap);
 
 	//fprintf(stdout, " * A %d-bit texture was read from %s.\n", tx_bits_per_pixel, filename);
@@ -1198,7 +2039,42 @@ void readTexImage2DForCubeMap(const char* filename, GLenum texture_target) {
 	glTexImage2D(texture_target, 0, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, data);
 	//fprintf(stdout, " * Loaded %dx%d RGBA texture into graphics memory.\n\n", width, height);
 
-	FreeImage_Unload(tx_pixmap);
+	return tx_pixmap;
+}
+
+#define IRRADIANCE_CACHE_FILE	"Scene/Cubemap/irradiance.sh9"
+
+void prepare_ambient_irradiance(const char* filenames[6], FIBITMAP* faces[6]) {
+	unsigned long long key = get_cubemap_cache_key(filenames);
+
+	if (load_irradiance_cache(IRRADIANCE_CACHE_FILE, key, irradiance_sh)) {
+		fprintf(stdout, " * Loaded the ambient irradiance from %s.\n", IRRADIANCE_CACHE_FILE);
+		return;
+	}
+
+	// square faces of one size and 24 or 32 bits, as uploaded; otherwise keep the old constant ambient
+	const unsigned char* face_bits[6];
+	int size = faces[0] ? FreeImage_GetWidth(faces[0]) : 0;
+	int bits_per_pixel = faces[0] ? FreeImage_GetBPP(faces[0]) : 0;
+	bool usable = size > 0 && (bits_per_pixel == 24 || bits_per_pixel == 32);
+	for (int face = 0; face < 6 && usable; face++) {
+		usable = faces[face] != NULL && (int)FreeImage_GetWidth(faces[face]) == size && (int)FreeImage_GetHeight(faces[face]) == size
+			&& (int)FreeImage_GetBPP(faces[face]) == bits_per_pixel && FreeImage_GetPitch(faces[face]) == FreeImage_GetPitch(faces[0]);
+		if (usable)
+			face_bits[face] = FreeImage_GetBits(faces[face]);
+	}
+	if (!usable) {
+		memset(irradiance_sh, 0, sizeof(irradiance_sh));
+		irradiance_sh[0][0] = irradiance_sh[0][1] = irradiance_sh[0][2] = 0.9f;
+		fprintf(stderr, "Error: cannot project the cube map faces, using a constant ambient.\n");
+		return;
+	}
+
+	double start = profiler_time_ms();
+	project_cubemap_irradiance(face_bits, size, FreeImage_GetPitch(faces[0]), bits_per_pixel / 8, irradiance_sh);
+	fprintf(stdout, " * Projected the %dx%d cube map onto spherical harmonics in %.1f ms (%d threads).\n",
+		size, size, profiler_time_ms() - start, get_irradiance_thread_count());
+	save_irradiance_cache(IRRADIANCE_CACHE_FILE, key, irradiance_sh);
 }
 
 void prepare_skybox(void) { // Draw skybox.
@@ -1218,13 +2094,18 @@ void prepare_skybox(void) { // Draw skybox.
 	glGenTextures(1, &skybox_texture_name);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, skybox_texture_name);
 
-	readTexImage2DForCubeMap("Scene/Cubemap/px.png", GL_TEXTURE_CUBE_MAP_POSITIVE_X);
-	readTexImage2DForCubeMap("Scene/Cubemap/nx.png", GL_TEXTURE_CUBE_MAP_NEGATIVE_X);
-	readTexImage2DForCubeMap("Scene/Cubemap/py.png", GL_TEXTURE_CUBE_MAP_POSITIVE_Y);
-	readTexImage2DForCubeMap("Scene/Cubemap/ny.png", GL_TEXTURE_CUBE_MAP_NEGATIVE_Y);
-	readTexImage2DForCubeMap("Scene/Cubemap/pz.png", GL_TEXTURE_CUBE_MAP_POSITIVE_Z);
-	readTexImage2DForCubeMap("Scene/Cubemap/nz.png", GL_TEXTURE_CUBE_MAP_NEGATIVE_Z);
-	fprintf(stdout, " * Loaded cube map textures into graphics memory.\n\n");
+	const char* cube_filenames[6] = { "Scene/Cubemap/px.png", "Scene/Cubemap/nx.png", "Scene/Cubemap/py.png",
+		"Scene/Cubemap/ny.png", "Scene/Cubemap/pz.png", "Scene/Cubemap/nz.png" };
+	FIBITMAP* cube_faces[6];
+	for (int face = 0; face < 6; face++)
+		cube_faces[face] = readTexImage2DForCubeMap(cube_filenames[face], GL_TEXTURE_CUBE_MAP_POSITIVE_X + face);
+	fprintf(stdout, " * Loaded cube map textures into graphics memory.\n");
+
+	prepare_ambient_irradiance(cube_filenames, cube_faces);
+	for (int face = 0; face < 6; face++)
+		if (cube_faces[face])
+			FreeImage_Unload(cube_faces[face]);
+	fprintf(stdout, "\n");
 
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -1247,31 +2128,154 @@ void draw_skybox(void) {
 	ModelViewProjectionMatrix = ProjectionMatrix * ModelViewMatrix;
 	ModelViewMatrixInvTrans = glm::transpose(glm::inverse(glm::mat3(ModelViewMatrix)));
 
-	glUniformMatrix4fv(loc_ModelViewProjectionMatrix_SKY, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
+	glUniformMatrix4fv(loc_ModelViewProjectionMatrix_SKY, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
+
+	glBindVertexArray(skybox_VAO);
+	glActiveTexture(GL_TEXTURE0 + TEXTURE_INDEX_SKYMAP);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, skybox_texture_name);
+
+	glFrontFace(GL_CW);
+	glDrawArrays(GL_TRIANGLES, 0, 6 * 2 * 3);
+	glBindVertexArray(0);
+	glDisable(GL_CULL_FACE);
+	glUseProgram(0);
+}
+#ifdef PROFILER_ENABLED
+// profiler overlay: one column per frame of history (newest on the right), the GPU times of the
+// top-level passes stacked in the column, and a line at 16.6 ms
+#define OVERLAY_COLUMN_WIDTH	(2.0f)
+#define OVERLAY_PIXELS_PER_MS	(6.0f)
+#define OVERLAY_MARGIN			(10.0f)
+#define N_OVERLAY_PASSES		(6)
+
+PROFILE_PASS overlay_passes[N_OVERLAY_PASSES] = { PROFILE_SHADOWS, PROFILE_GRID, PROFILE_BISTRO, PROFILE_AXES, PROFILE_SKYBOX, PROFILE_CREATURES };
+GLfloat overlay_colors[N_OVERLAY_PASSES][3] = {
+	{ 0.6f, 0.2f, 0.9f }, { 0.5f, 0.5f, 0.5f }, { 0.9f, 0.6f, 0.1f }, { 0.2f, 0.8f, 0.2f }, { 0.3f, 0.5f, 1.0f }, { 0.9f, 0.2f, 0.6f }
+};
+GLfloat overlay_line_color[3] = { 1.0f, 1.0f, 1.0f };
+GLfloat overlay_vertices[N_OVERLAY_PASSES * PROFILER_HISTORY_FRAMES * 6 + 2][2];
+GLuint overlay_VBO, overlay_VAO;
+bool flag_profiler_overlay = false;
+
+void prepare_profiler_overlay(void) {
+	glGenBuffers(1, &overlay_VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, overlay_VBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(overlay_vertices), NULL, GL_STREAM_DRAW);
+
+	glGenVertexArrays(1, &overlay_VAO);
+	glBindVertexArray(overlay_VAO);
+	glVertexAttribPointer(INDEX_VERTEX_POSITION, 2, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+	glEnableVertexAttribArray(INDEX_VERTEX_POSITION);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+}
 
-	glBindVertexArray(skybox_VAO);
-	glActiveTexture(GL_TEXTURE0 + TEXTURE_INDEX_SKYMAP);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, skybox_texture_name);
+void draw_profiler_overlay(void) {
+	int n_frames = profiler_history_length();
+	int first[N_OVERLAY_PASSES + 1], n_vertices = 0;
+	float right = OVERLAY_MARGIN + OVERLAY_COLUMN_WIDTH * PROFILER_HISTORY_FRAMES;
 
-	glFrontFace(GL_CW);
-	glDrawArrays(GL_TRIANGLES, 0, 6 * 2 * 3);
+	if (!flag_profiler_overlay || n_frames == 0)
+		return;
+
+	for (int i = 0; i < N_OVERLAY_PASSES; i++) {
+		first[i] = n_vertices;
+		for (int age = 0; age < n_frames; age++) {
+			float bottom = OVERLAY_MARGIN, top;
+			float x1 = right - OVERLAY_COLUMN_WIDTH * age, x0 = x1 - OVERLAY_COLUMN_WIDTH;
+
+			for (int j = 0; j < i; j++)
+				bottom += OVERLAY_PIXELS_PER_MS * max(profiler_history_gpu_ms(age, overlay_passes[j]), 0.0f);
+			top = bottom + OVERLAY_PIXELS_PER_MS * max(profiler_history_gpu_ms(age, overlay_passes[i]), 0.0f);
+			if (top <= bottom)
+				continue;
+
+			GLfloat quad[6][2] = { { x0, bottom }, { x1, bottom }, { x1, top }, { x0, bottom }, { x1, top }, { x0, top } };
+			memcpy(overlay_vertices[n_vertices], quad, sizeof(quad));
+			n_vertices += 6;
+		}
+	}
+	first[N_OVERLAY_PASSES] = n_vertices;
+	overlay_vertices[n_vertices][0] = OVERLAY_MARGIN;
+	overlay_vertices[n_vertices][1] = overlay_vertices[n_vertices + 1][1] = OVERLAY_MARGIN + OVERLAY_PIXELS_PER_MS * 16.6f;
+	overlay_vertices[n_vertices + 1][0] = right;
+	n_vertices += 2;
+
+	glBindBuffer(GL_ARRAY_BUFFER, overlay_VBO);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, n_vertices * sizeof(overlay_vertices[0]), &overlay_vertices[0][0]);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(h_ShaderProgram_simple);
+	ModelViewProjectionMatrix = glm::ortho(0.0f, (float)window_width, 0.0f, (float)window_height, -1.0f, 1.0f);
+	glUniformMatrix4fv(loc_ModelViewProjectionMatrix, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
+	glBindVertexArray(overlay_VAO);
+	for (int i = 0; i < N_OVERLAY_PASSES; i++) {
+		glUniform3fv(loc_primitive_color, 1, overlay_colors[i]);
+		glDrawArrays(GL_TRIANGLES, first[i], first[i + 1] - first[i]);
+	}
+	glUniform3fv(loc_primitive_color, 1, overlay_line_color);
+	glDrawArrays(GL_LINES, first[N_OVERLAY_PASSES], 2);
 	glBindVertexArray(0);
-	glDisable(GL_CULL_FACE);
 	glUseProgram(0);
+	glEnable(GL_DEPTH_TEST);
 }
+
+void export_profile(void) {
+	if (profiler_export_csv("profile.csv") && profiler_export_json("profile.json"))
+		fprintf(stdout, " * Wrote the last %d frames to profile.csv and profile.json\n", profiler_history_length());
+	else
+		fprintf(stderr, "Error: cannot write profile.csv / profile.json\n");
+}
+#endif
 /*****************************  END: geometry setup *****************************/
 
-/********************  START: callback function definitions *********************/
-void display(void) {
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// creatures, in drawing order; all but the ironman and the tank move (or are rescaled)
+typedef enum {
+	CREATURE_TIGER,
+	CREATURE_WOLF,
+	CREATURE_SPIDER,
+	CREATURE_OPTIMUS,
+	CREATURE_GODZILLA,
+	CREATURE_DRAGON,
+	CREATURE_IRONMAN,
+	CREATURE_TANK,
+	N_CREATURES
+} CREATURE_INDEX;
+
+glm::mat4 creature_model_matrices[N_CREATURES];
+GLfloat creature_colors[N_CREATURES][3] = {
+	{ 0.95164f, 0.60648f, 0.22648f },
+	{ 0.3f, 0.3f, 0.9878f },
+	{ 0.2f, 0.985f, 0.3f },
+	{ 0.9878f, 0.3f, 0.3f },
+	{ 88 / 255.0f, 57 / 255.0f, 39 / 255.0f },
+	{ 1.0f, 1.0f, 0.0f },
+	{ 170 / 255.0f, 5 / 255.0f, 5 / 255.0f },
+	{ 0.0f, 80 / 255.0f, 0.0f }
+};
 
-	draw_grid();
-	//draw_axes();
-	draw_bistro_exterior();
-	draw_axes();
-	draw_skybox();
+bool is_dynamic_creature(int creature) {
+	return creature != CREATURE_IRONMAN && creature != CREATURE_TANK;
+}
 
-	glUseProgram(h_ShaderProgram_simple);
+void draw_creature(int creature) {
+	switch (creature) {
+	case CREATURE_TIGER: draw_tiger(); break;
+	case CREATURE_WOLF: draw_wolf(); break;
+	case CREATURE_SPIDER: draw_spider(); break;
+	case CREATURE_OPTIMUS: draw_optimus(); break;
+	case CREATURE_GODZILLA: draw_godzilla(); break;
+	case CREATURE_DRAGON: draw_dragon(); break;
+	case CREATURE_IRONMAN: draw_ironman(); break;
+	case CREATURE_TANK: draw_tank(); break;
+	}
+}
+
+// model matrices of the current animation state; also updates the tiger camera frames
+void set_creature_model_matrices(void) {
+	glm::mat4 ModelMatrix;
 
 	Matrix_FollowingTiger = glm::translate(glm::mat4(1.0f), glm::vec3(0, 80, 550));
 	if (tigerCamMode) {
@@ -1297,139 +2301,503 @@ void display(void) {
 	Matrix_EyeCamInv = Matrix_TigerBody * Matrix_TigerEye;
 	Matrix_FollowingCamInv = Matrix_TigerBody * Matrix_TigerEye * Matrix_FollowingTiger;
 
-	//draw tiger
-	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	if (tigerTurn == 1) {
-		ModelViewMatrix = glm::translate(ViewMatrix, glm::vec3(4500, -2588, 0));
-		ModelViewMatrix = glm::rotate(ModelViewMatrix, -rotation_angle_tiger * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
-		ModelViewMatrix = glm::translate(ModelViewMatrix, glm::vec3(1000.0f, 0, 0));
-		ModelViewMatrix = glm::scale(ModelViewMatrix, glm::vec3(2.0f, 2.0f, 2.0f));
-	}
-	else if (tigerStraight == 1) {
-		ModelViewMatrix = glm::translate(ViewMatrix, glm::vec3(tigerPathX, tigerPathY, 0));
-		ModelViewMatrix = glm::rotate(ModelViewMatrix, tigerPathRot * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
-		ModelViewMatrix = glm::scale(ModelViewMatrix, glm::vec3(2.0f, 2.0f, 2.0f));
-	}
-	ModelViewProjectionMatrix = ProjectionMatrix * ModelViewMatrix;
-
-	glUniform3f(loc_primitive_color, 0.95164f, 0.60648f, 0.22648f);
-	glUniformMatrix4fv(loc_ModelViewProjectionMatrix, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
-	draw_tiger();
-
-	//ModelViewMatrix = glm::translate(ViewMatrix, glm::vec3(1350, 3500, 0));
-	//ModelViewProjectionMatrix = ProjectionMatrix * ModelViewMatrix;
-	//glUniform3f(loc_primitive_color, 0, 0, 0);
-	//glUniformMatrix4fv(loc_ModelViewProjectionMatrix, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
-	//draw_tiger();
+	creature_model_matrices[CREATURE_TIGER] = Matrix_TigerBody * tiger_mesh.position_decode; // of the quantized vertices
 
-
-	//draw_wolf
 	int wolf_clock = _timestamp_scene % 1440;
 	if (wolf_clock <= 360) {
-		ModelViewMatrix = glm::translate(ViewMatrix, glm::vec3(WOLF_ROTATION_RADIUS, 0.0f, 0.0f));
-		ModelViewMatrix = glm::rotate(ModelViewMatrix, wolf_clock * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
-		ModelViewMatrix = glm::translate(ModelViewMatrix, glm::vec3(-WOLF_ROTATION_RADIUS, 0.0f, 0.0f));
+		ModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(WOLF_ROTATION_RADIUS, 0.0f, 0.0f));
+		ModelMatrix = glm::rotate(ModelMatrix, wolf_clock * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
+		ModelMatrix = glm::translate(ModelMatrix, glm::vec3(-WOLF_ROTATION_RADIUS, 0.0f, 0.0f));
 	}
 	else if (wolf_clock <= 720) {
-		ModelViewMatrix = glm::translate(ViewMatrix, glm::vec3(-WOLF_ROTATION_RADIUS, 0.0f, 0.0f));
-		ModelViewMatrix = glm::rotate(ModelViewMatrix, -(wolf_clock)*TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
-		ModelViewMatrix = glm::translate(ModelViewMatrix, glm::vec3(WOLF_ROTATION_RADIUS, 0.0f, 0.0f));
+		ModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(-WOLF_ROTATION_RADIUS, 0.0f, 0.0f));
+		ModelMatrix = glm::rotate(ModelMatrix, -(wolf_clock)*TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
+		ModelMatrix = glm::translate(ModelMatrix, glm::vec3(WOLF_ROTATION_RADIUS, 0.0f, 0.0f));
 	}
 	else if (wolf_clock <= 1080) {
-		ModelViewMatrix = glm::translate(ViewMatrix, glm::vec3(0.0, -WOLF_ROTATION_RADIUS, 0.0f));
-		ModelViewMatrix = glm::rotate(ModelViewMatrix, -(wolf_clock)*TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
-		ModelViewMatrix = glm::translate(ModelViewMatrix, glm::vec3(0.0, WOLF_ROTATION_RADIUS, 0.0f));
-		ModelViewMatrix = glm::rotate(ModelViewMatrix, (90) * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
-	}
-	else if (wolf_clock <= 1440) {
-		ModelViewMatrix = glm::translate(ViewMatrix, glm::vec3(0.0, WOLF_ROTATION_RADIUS, 0.0f));
-		ModelViewMatrix = glm::rotate(ModelViewMatrix, (wolf_clock)*TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
-		ModelViewMatrix = glm::translate(ModelViewMatrix, glm::vec3(0.0, -WOLF_ROTATION_RADIUS, 0.0f));
-		ModelViewMatrix = glm::rotate(ModelViewMatrix, (90) * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
-	}
-	ModelViewMatrix = glm::scale(ModelViewMatrix, glm::vec3(900.0f, 900.0f, 900.0f));
-	ModelViewMatrix = glm::rotate(ModelViewMatrix, 90.0f * TO_RADIAN, glm::vec3(1.0f, 0.0f, 0.0f));
-	ModelViewProjectionMatrix = ProjectionMatrix * ModelViewMatrix;
-	glUniform3f(loc_primitive_color, 0.3f, 0.3f, 0.9878f);
-	glUniformMatrix4fv(loc_ModelViewProjectionMatrix, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
-	draw_wolf();
+		ModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0, -WOLF_ROTATION_RADIUS, 0.0f));
+		ModelMatrix = glm::rotate(ModelMatrix, -(wolf_clock)*TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
+		ModelMatrix = glm::translate(ModelMatrix, glm::vec3(0.0, WOLF_ROTATION_RADIUS, 0.0f));
+		ModelMatrix = glm::rotate(ModelMatrix, (90) * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
+	}
+	else {
+		ModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0, WOLF_ROTATION_RADIUS, 0.0f));
+		ModelMatrix = glm::rotate(ModelMatrix, (wolf_clock)*TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
+		ModelMatrix = glm::translate(ModelMatrix, glm::vec3(0.0, -WOLF_ROTATION_RADIUS, 0.0f));
+		ModelMatrix = glm::rotate(ModelMatrix, (90) * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
+	}
+	ModelMatrix = glm::scale(ModelMatrix, glm::vec3(900.0f, 900.0f, 900.0f));
+	creature_model_matrices[CREATURE_WOLF] = glm::rotate(ModelMatrix, 90.0f * TO_RADIAN, glm::vec3(1.0f, 0.0f, 0.0f)) * wolf_mesh.position_decode;
 
+	int spider_clock = (_timestamp_scene % 1442) / 2 - 360;
+	ModelMatrix = glm::rotate(glm::mat4(1.0f), 65 * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
+	ModelMatrix = glm::translate(ModelMatrix, glm::vec3(-250, -1700, 1950));
+	ModelMatrix = glm::translate(ModelMatrix, glm::vec3((float)spider_clock * 3, 300.0f * sinf(spider_clock * TO_RADIAN), 0));
+	ModelMatrix = glm::scale(ModelMatrix, glm::vec3(200.0f, 200.0f, 200.0f));
+	ModelMatrix = glm::rotate(ModelMatrix, -90 * TO_RADIAN, glm::vec3(1.0f, 0.0f, 0.0f));
+	creature_model_matrices[CREATURE_SPIDER] = glm::rotate(ModelMatrix, 90 * TO_RADIAN, glm::vec3(0.0f, 1.0f, 0.0f)) * spider_mesh.position_decode;
+
+	ModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(-5000, -1500, 0));
+	ModelMatrix = glm::rotate(ModelMatrix, 20 * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
+	creature_model_matrices[CREATURE_OPTIMUS] = glm::scale(ModelMatrix, glm::vec3(optimusScale, optimusScale, optimusScale));
+
+	ModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(5000, 3000, 0));
+	ModelMatrix = glm::rotate(ModelMatrix, -75 * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
+	ModelMatrix = glm::translate(ModelMatrix, glm::vec3(1000.0f, 0, 0));
+	ModelMatrix = glm::scale(ModelMatrix, glm::vec3(godzillaScale, godzillaScale, godzillaScale));
+	creature_model_matrices[CREATURE_GODZILLA] = glm::rotate(ModelMatrix, 90.0f * TO_RADIAN, glm::vec3(1.0f, 0.0f, 0.0f));
+
+	ModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(-500, -3000, 0));
+	ModelMatrix = glm::rotate(ModelMatrix, 90 * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
+	creature_model_matrices[CREATURE_DRAGON] = glm::scale(ModelMatrix, glm::vec3(dragonScale, dragonScale, dragonScale));
+
+	ModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(-290, -50, 110));
+	ModelMatrix = glm::scale(ModelMatrix, glm::vec3(ironmanScale, ironmanScale, ironmanScale));
+	ModelMatrix = glm::rotate(ModelMatrix, 190 * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
+	creature_model_matrices[CREATURE_IRONMAN] = glm::rotate(ModelMatrix, 90.0f * TO_RADIAN, glm::vec3(1.0f, 0.0f, 0.0f));
+
+	ModelMatrix = glm::rotate(glm::mat4(1.0f), -45 * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
+	ModelMatrix = glm::translate(ModelMatrix, glm::vec3(-1500, 1500, 0));
+	creature_model_matrices[CREATURE_TANK] = glm::scale(ModelMatrix, glm::vec3(tankScale, tankScale, tankScale));
+}
 
+void prepare_shadow_map(GLuint* pFBO, GLuint* pTexture, int size) {
+	glGenTextures(1, pTexture);
+	glBindTexture(GL_TEXTURE_2D, *pTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, pFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, *pFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, *pTexture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		fprintf(stderr, "Error: the %dx%d shadow map framebuffer is incomplete.\n", size, size);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-	//draw spider;
-	int spider_clock = (_timestamp_scene % 1442) / 2 - 360;
-	ModelViewMatrix = glm::rotate(ViewMatrix, 65 * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
-	ModelViewMatrix = glm::translate(ModelViewMatrix, glm::vec3(-250, -1700, 1950));
-	ModelViewMatrix = glm::translate(ModelViewMatrix, glm::vec3((float)spider_clock * 3, 300.0f * sinf(spider_clock * TO_RADIAN), 0));
-	ModelViewMatrix = glm::scale(ModelViewMatrix, glm::vec3(200.0f, 200.0f, 200.0f));
-	ModelViewMatrix = glm::rotate(ModelViewMatrix, -90 * TO_RADIAN, glm::vec3(1.0f, 0.0f, 0.0f));
-	ModelViewMatrix = glm::rotate(ModelViewMatrix, 90 * TO_RADIAN, glm::vec3(0.0f, 1.0f, 0.0f));
-	ModelViewProjectionMatrix = ProjectionMatrix * ModelViewMatrix;
-	glUniform3f(loc_primitive_color, 0.2, 0.985f, 0.3f);
-	glUniformMatrix4fv(loc_ModelViewProjectionMatrix, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
-	draw_spider();
+int dynamic_shadow_map_size = DYNAMIC_SHADOW_MAP_SIZE;
 
+void prepare_shadows(void) {
+	prepare_shadow_map(&static_shadow_FBO, &static_shadow_texture, STATIC_SHADOW_MAP_SIZE);
+	prepare_shadow_map(&dynamic_shadow_FBO, &dynamic_shadow_texture, dynamic_shadow_map_size);
+	flag_static_shadow_valid = false;
+}
 
-	//draw optimus;
-	ModelViewMatrix = glm::translate(ViewMatrix, glm::vec3(-5000, -1500, 0));
-	ModelViewMatrix = glm::rotate(ModelViewMatrix, 20 * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
-	ModelViewMatrix = glm::scale(ModelViewMatrix, glm::vec3(optimusScale, optimusScale, optimusScale));
-	ModelViewProjectionMatrix = ProjectionMatrix * ModelViewMatrix;
-	glUniform3f(loc_primitive_color, 0.9878f, 0.3f, 0.3f);
-	glUniformMatrix4fv(loc_ModelViewProjectionMatrix, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
-	draw_optimus();
+void resize_dynamic_shadow_map(int size) {
+	if (size == dynamic_shadow_map_size)
+		return;
+	dynamic_shadow_map_size = size;
 
+	glBindTexture(GL_TEXTURE_2D, dynamic_shadow_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
 
-	//draw godzilla;
-	ModelViewMatrix = glm::translate(ViewMatrix, glm::vec3(5000, 3000, 0));
-	ModelViewMatrix = glm::rotate(ModelViewMatrix, -75 * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
-	ModelViewMatrix = glm::translate(ModelViewMatrix, glm::vec3(1000.0f, 0, 0));
-	ModelViewMatrix = glm::scale(ModelViewMatrix, glm::vec3(godzillaScale, godzillaScale, godzillaScale));
-	ModelViewMatrix = glm::rotate(ModelViewMatrix, 90.0f * TO_RADIAN, glm::vec3(1.0f, 0.0f, 0.0f));
-	ModelViewProjectionMatrix = ProjectionMatrix * ModelViewMatrix;
-	glUniform3f(loc_primitive_color, 88 / 255.0, 57 / 255.0, 39 / 255.0);
-	glUniformMatrix4fv(loc_ModelViewProjectionMatrix, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
-	draw_godzilla();
+// orthographic sun projection around the Bistro; the near plane is pulled towards the sun
+// so that creatures between the sun and the Bistro still cast onto it
+#define SHADOW_CASTER_MARGIN	(10000.0f)
+
+void set_shadow_projection(glm::vec3 sun_direction) {
+	glm::vec3 bounds_min = glm::vec3(bistro_exterior_bounds[0][0], bistro_exterior_bounds[0][1], bistro_exterior_bounds[0][2]);
+	glm::vec3 bounds_max = glm::vec3(bistro_exterior_bounds[1][0], bistro_exterior_bounds[1][1], bistro_exterior_bounds[1][2]);
+	glm::vec3 center = 0.5f * (bounds_min + bounds_max);
+	glm::vec3 up = (fabsf(sun_direction.z) > 0.99f) ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f);
+	glm::mat4 LightViewMatrix = glm::lookAt(center + sun_direction, center, up);
+	float light_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, light_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	for (int corner = 0; corner < 8; corner++) {
+		glm::vec3 p = glm::vec3((corner & 1) ? bounds_max.x : bounds_min.x, (corner & 2) ? bounds_max.y : bounds_min.y,
+			(corner & 4) ? bounds_max.z : bounds_min.z);
+		glm::vec4 q = LightViewMatrix * glm::vec4(p, 1.0f);
+		for (int k = 0; k < 3; k++) {
+			light_min[k] = min(light_min[k], q[k]);
+			light_max[k] = max(light_max[k], q[k]);
+		}
+	}
+	ShadowViewProjectionMatrix = glm::ortho(light_min[0], light_max[0], light_min[1], light_max[1], -light_max[2] - SHADOW_CASTER_MARGIN, -light_min[2])
+		* LightViewMatrix;
+}
+
+void draw_shadow_casters(GLuint FBO, int size, bool dynamic_casters) {
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glViewport(0, 0, size, size);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	glUseProgram(h_ShaderProgram_Depth);
+	if (!dynamic_casters) {
+		glUniformMatrix4fv(loc_ModelViewProjectionMatrix_Depth, 1, GL_FALSE, &ShadowViewProjectionMatrix[0][0]);
+		if (flag_streaming) { // the resident tiles; the map is redrawn when they change
+			const STREAM_TILES* pTiles = get_stream_tiles();
+			for (int tile = 0; tile < pTiles->n_tiles; tile++) {
+				if (!is_stream_tile_resident(tile))
+					continue;
+				glBindVertexArray(stream_tile_VAO[tile]);
+				glDrawArrays(GL_TRIANGLES, 0, pTiles->tile_n_vertices[tile]);
+			}
+		}
+		else {
+			glBindVertexArray(bistro_exterior_position_VAO);
+			glDrawArrays(GL_TRIANGLES, 0, bistro_exterior_n_total_vertices);
+		}
+		glBindVertexArray(0);
+	}
+	for (int creature = 0; creature < N_CREATURES; creature++) {
+		if (is_dynamic_creature(creature) != dynamic_casters)
+			continue;
+		ModelViewProjectionMatrix = ShadowViewProjectionMatrix * creature_model_matrices[creature];
+		glUniformMatrix4fv(loc_ModelViewProjectionMatrix_Depth, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
+		draw_creature(creature); // filled, though the creatures are drawn as wireframes
+	}
+	glUseProgram(0);
+}
 
+// static map only when the sun moved (or on first use), dynamic map every frame
+void update_shadow_maps(void) {
+	int sun = -1;
+	GLint target_FBO, viewport[4];
 
-	//draw dragon;
-	ModelViewMatrix = glm::translate(ViewMatrix, glm::vec3(-500, -3000, 0));
-	ModelViewMatrix = glm::rotate(ModelViewMatrix, 90 * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
-	ModelViewMatrix = glm::scale(ModelViewMatrix, glm::vec3(dragonScale, dragonScale, dragonScale));
-	ModelViewProjectionMatrix = ProjectionMatrix * ModelViewMatrix;
-	glUniform3f(loc_primitive_color, 255 / 255, 255 / 255, 0 / 255);
-	glUniformMatrix4fv(loc_ModelViewProjectionMatrix, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
-	draw_dragon();
+	for (int i = 0; i < scene.n_lights && sun < 0; i++)
+		if (scene.light_list[i].type == LIGHT_DIRECTIONAL)
+			sun = i;
+	if (!flag_shadows || sun < 0 || get_light_clusters()->sun_light < 0)
+		return;
 
+	glm::vec3 sun_direction = glm::normalize(glm::vec3(scene.light_list[sun].pos[0], scene.light_list[sun].pos[1], scene.light_list[sun].pos[2]));
 
-	//draw ironman
-	ModelViewMatrix = glm::translate(ViewMatrix, glm::vec3(-290, -50, 110));
-	ModelViewMatrix = glm::scale(ModelViewMatrix, glm::vec3(ironmanScale, ironmanScale, ironmanScale));
-	ModelViewMatrix = glm::rotate(ModelViewMatrix, 190 * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
-	ModelViewMatrix = glm::rotate(ModelViewMatrix, 90.0f * TO_RADIAN, glm::vec3(1.0f, 0.0f, 0.0f));
-	ModelViewProjectionMatrix = ProjectionMatrix * ModelViewMatrix;
-	glUniform3f(loc_primitive_color, 170 / 255.0, 5 / 255.0, 5 / 255.0);
-	glUniformMatrix4fv(loc_ModelViewProjectionMatrix, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
-	draw_ironman();
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target_FBO);
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.0f, 4.0f);
 
+	if (!flag_static_shadow_valid || glm::distance(sun_direction, shadow_sun_direction) > 1.0e-5f) {
+		double start_time = profiler_time_ms();
 
-	//draw tank
-	ModelViewMatrix = glm::rotate(ViewMatrix, -45 * TO_RADIAN, glm::vec3(0.0f, 0.0f, 1.0f));
-	ModelViewMatrix = glm::translate(ModelViewMatrix, glm::vec3(-1500, 1500, 0));
-	ModelViewMatrix = glm::scale(ModelViewMatrix, glm::vec3(tankScale, tankScale, tankScale));
-	ModelViewProjectionMatrix = ProjectionMatrix * ModelViewMatrix;
-	glUniform3f(loc_primitive_color, 0 / 255, 80 / 255.0, 0 / 255);
-	glUniformMatrix4fv(loc_ModelViewProjectionMatrix, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
-	draw_tank();
+		shadow_sun_direction = sun_direction;
+		set_shadow_projection(sun_direction);
+		draw_shadow_casters(static_shadow_FBO, STATIC_SHADOW_MAP_SIZE, false);
+		glFinish();
+		flag_static_shadow_valid = true;
+		fprintf(stdout, " * Rendered the %dx%d static shadow map in %.1f ms\n", STATIC_SHADOW_MAP_SIZE, STATIC_SHADOW_MAP_SIZE,
+			profiler_time_ms() - start_time);
+	}
+	draw_shadow_casters(dynamic_shadow_FBO, dynamic_shadow_map_size, true);
+
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glBindFramebuffer(GL_FRAMEBUFFER, target_FBO);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+	glActiveTexture(GL_TEXTURE0 + TEXTURE_INDEX_STATIC_SHADOW);
+	glBindTexture(GL_TEXTURE_2D, static_shadow_texture);
+	glActiveTexture(GL_TEXTURE0 + TEXTURE_INDEX_DYNAMIC_SHADOW);
+	glBindTexture(GL_TEXTURE_2D, dynamic_shadow_texture);
+	glActiveTexture(GL_TEXTURE0);
+}
 
+/********************  START: callback function definitions *********************/
+// draws the scene from the current camera into the bound framebuffer
+void draw_view(void) {
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+	PROFILE_BEGIN(PROFILE_GRID);
+	draw_grid();
+	PROFILE_END(PROFILE_GRID);
+	//draw_axes();
+	PROFILE_BEGIN(PROFILE_BISTRO);
+	draw_bistro_exterior();
+	PROFILE_END(PROFILE_BISTRO);
+	PROFILE_BEGIN(PROFILE_AXES);
+	draw_axes();
+	PROFILE_END(PROFILE_AXES);
+	PROFILE_BEGIN(PROFILE_SKYBOX);
+	draw_skybox();
+	PROFILE_END(PROFILE_SKYBOX);
 
+	PROFILE_BEGIN(PROFILE_CREATURES);
+	glUseProgram(h_ShaderProgram_simple);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+	for (int creature = 0; creature < N_CREATURES; creature++) {
+		ModelViewMatrix = ViewMatrix * creature_model_matrices[creature];
+		ModelViewProjectionMatrix = ProjectionMatrix * ModelViewMatrix;
+		glUniform3fv(loc_primitive_color, 1, creature_colors[creature]);
+		glUniformMatrix4fv(loc_ModelViewProjectionMatrix, 1, GL_FALSE, &ModelViewProjectionMatrix[0][0]);
+		draw_creature(creature);
+	}
 	glUseProgram(0);
 
 
 
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	PROFILE_END(PROFILE_CREATURES);
+}
+
+// multi-view grid ('j'): every predefined camera in its own cell, first row on top. The animation, the
+// shadow maps and the culling pass are shared by all views; each view is drawn into a cell-sized
+// framebuffer (so the G-buffer and the light cluster tiles need no viewport offset) and blitted into its cell.
+#define MULTIVIEW_COLUMNS	(4)
+#define MULTIVIEW_ROWS		((NUM_CAMERAS + MULTIVIEW_COLUMNS - 1) / MULTIVIEW_COLUMNS)
+
+bool flag_multiview = false;
+GLuint multiview_FBO, multiview_color_renderbuffer, multiview_depth_renderbuffer;
+int multiview_width, multiview_height;
+
+void resize_multiview(int width, int height) {
+	if (width == multiview_width && height == multiview_height)
+		return;
+	multiview_width = width;
+	multiview_height = height;
+
+	glBindRenderbuffer(GL_RENDERBUFFER, multiview_color_renderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, multiview_depth_renderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+}
+
+void prepare_multiview(void) {
+	glGenRenderbuffers(1, &multiview_color_renderbuffer);
+	glGenRenderbuffers(1, &multiview_depth_renderbuffer);
+	resize_multiview(1, 1);
+
+	glGenFramebuffers(1, &multiview_FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, multiview_FBO);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, multiview_color_renderbuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, multiview_depth_renderbuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void set_camera_projection(void) {
+	ProjectionMatrix = glm::perspective(current_camera.fovy, current_camera.aspect_ratio, current_camera.near_c, current_camera.far_c);
+	set_ViewMatrix_from_camera_frame();
+	ViewProjectionMatrix = ProjectionMatrix * ViewMatrix;
+}
+
+void draw_multiview(void) {
+	GLint target_FBO;
+	Camera saved_camera = current_camera;
+	float view_projections[NUM_CAMERAS][16];
+	int cell_width = max(render_width / MULTIVIEW_COLUMNS, 1), cell_height = max(render_height / MULTIVIEW_ROWS, 1);
+
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target_FBO);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // the cells without a camera
+
+	// cull all views in one pass; views whose camera did not move keep last frame's results
+	for (int camera = 0; camera < NUM_CAMERAS; camera++) {
+		current_camera = camera_info[camera];
+		set_camera_projection();
+		memcpy(view_projections[camera], &ViewProjectionMatrix[0][0], sizeof(view_projections[camera]));
+	}
+	cull_views(CULL_SLOT_MULTIVIEW, NUM_CAMERAS, &view_projections[0][0]);
+
+	resize_multiview(cell_width, cell_height);
+	resize_gbuffer(cell_width, cell_height);
+	for (int camera = 0; camera < NUM_CAMERAS; camera++) {
+		int x = (camera % MULTIVIEW_COLUMNS) * cell_width, y = render_height - (camera / MULTIVIEW_COLUMNS + 1) * cell_height;
+
+		// the light cluster tiles only change with the projection, which the presets usually share
+		Camera* pCamera = &camera_info[camera];
+		if (camera == 0 || pCamera->fovy != pCamera[-1].fovy || pCamera->aspect_ratio != pCamera[-1].aspect_ratio
+			|| pCamera->near_c != pCamera[-1].near_c || pCamera->far_c != pCamera[-1].far_c)
+			set_light_cluster_projection(pCamera->fovy, pCamera->aspect_ratio, pCamera->near_c, pCamera->far_c, cell_width, cell_height);
+		current_camera = *pCamera;
+		set_camera_projection();
+		cull_slot = CULL_SLOT_MULTIVIEW + camera;
+		measure_view = (camera == 0);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, multiview_FBO);
+		glViewport(0, 0, cell_width, cell_height);
+		draw_view();
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, multiview_FBO);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_FBO);
+		glBlitFramebuffer(0, 0, cell_width, cell_height, x, y, x + cell_width, y + cell_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target_FBO);
+	glViewport(0, 0, render_width, render_height);
+	cull_slot = CULL_SLOT_MAIN;
+	measure_view = true;
+	current_camera = saved_camera;
+	set_camera_projection();
+	update_light_cluster_projection();
+}
+
+// draws one frame into the bound framebuffer; shared by the window and the headless benchmark
+void render_frame(void) {
+	set_creature_model_matrices();
+
+	if (flag_streaming && update_streaming(current_camera.pos)) {
+		flag_static_shadow_valid = false;
+		report_streaming();
+	}
+
+	PROFILE_BEGIN(PROFILE_SHADOWS);
+	update_shadow_maps();
+	PROFILE_END(PROFILE_SHADOWS);
+
+	if (flag_multiview)
+		draw_multiview();
+	else
+		draw_view();
+
+	report_depth_prepass();
+	update_texture_residency();
+	PROFILE_END_FRAME();
+}
+
+// frame capture ('n' or --capture-png / --capture-y4m); starts at the next frame so that the window size is known.
+// The frames follow the scene time, not the display: every tick adds capture_fps * SCENE_TICK_MS / 1000 frames
+// due, and a displayed frame is captured as many times as whole frames are due (repeated, or skipped for
+// rates below the tick rate), so a capture plays back at the speed of the scene at capture_fps.
+bool flag_capture = false;
+const char* capture_target = "capture_";
+CAPTURE_FORMAT capture_target_format = CAPTURE_PNG;
+int capture_fps = 30;
+double capture_frames_due;
+
+void update_capture(void) {
+	if (flag_capture && !is_capturing()) {
+		if (!begin_capture(capture_target, capture_target_format, window_width, window_height, capture_fps))
+			flag_capture = false;
+		capture_frames_due = 1.0; // the first frame
+	}
+	else if (!flag_capture && is_capturing())
+		end_capture();
+}
+
+void capture_due_frames(void) {
+	for (; is_capturing() && capture_frames_due >= 1.0; capture_frames_due -= 1.0)
+		capture_frame();
+}
+
+// adaptive quality ('w', or --budget <ms>): the frame cost is the CPU time of the frame and its GPU time,
+// read back a frame later without waiting; below full resolution the frame is drawn into an offscreen
+// target and upscaled into the window
+bool flag_governor = false;
+float governor_budget_ms = GOVERNOR_DEFAULT_BUDGET_MS;
+const char* governor_log_filename = NULL;
+GLuint governor_FBO, governor_color_renderbuffer, governor_depth_renderbuffer;
+GLuint governor_queries[2];
+bool governor_query_pending[2];
+unsigned int governor_frame;
+double governor_frame_start;
+
+void prepare_governor(void) {
+	glGenRenderbuffers(1, &governor_color_renderbuffer);
+	glGenRenderbuffers(1, &governor_depth_renderbuffer);
+	glGenFramebuffers(1, &governor_FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, governor_FBO);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, governor_color_renderbuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, governor_depth_renderbuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glGenQueries(2, governor_queries);
+
+	initialize_governor(governor_budget_ms, governor_log_filename);
+}
+
+bool is_render_scaled(void) {
+	return render_width != window_width || render_height != window_height;
+}
+
+// everything that depends on the size of the rendered frame
+void set_render_size(int width, int height) {
+	render_width = width;
+	render_height = height;
+	glViewport(0, 0, width, height);
+	if (!flag_multiview)
+		resize_gbuffer(width, height);
+	update_light_cluster_projection();
+
+	if (is_render_scaled()) {
+		glBindRenderbuffer(GL_RENDERBUFFER, governor_color_renderbuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, governor_depth_renderbuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	}
+}
+
+void apply_governor_settings(void) {
+	GOVERNOR_SETTINGS* pSettings = get_governor_settings();
+	int width = max((int)(pSettings->render_scale * window_width + 0.5f), 1);
+	int height = max((int)(pSettings->render_scale * window_height + 0.5f), 1);
+
+	if (width != render_width || height != render_height)
+		set_render_size(width, height);
+	set_light_cluster_min_size(pSettings->light_min_size);
+	set_cull_detail(pSettings->detail_min_size);
+	resize_dynamic_shadow_map(pSettings->shadow_map_size);
+}
+
+void begin_governed_frame(void) {
+	if (!flag_governor)
+		return;
+
+	governor_frame_start = profiler_time_ms();
+	glBeginQuery(GL_TIME_ELAPSED, governor_queries[governor_frame & 1]);
+	if (is_render_scaled())
+		glBindFramebuffer(GL_FRAMEBUFFER, governor_FBO);
+}
+
+void end_governed_frame(void) {
+	if (!flag_governor)
+		return;
+
+	if (is_render_scaled()) {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, governor_FBO);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, render_width, render_height, 0, 0, window_width, window_height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	glEndQuery(GL_TIME_ELAPSED);
+	governor_query_pending[governor_frame & 1] = true;
+	float cpu_ms = (float)(profiler_time_ms() - governor_frame_start);
+
+	// the previous frame's GPU time, only if it is already available
+	int slot = (governor_frame + 1) & 1;
+	float gpu_ms = -1.0f;
+	if (governor_query_pending[slot]) {
+		GLint available = 0;
+
+		glGetQueryObjectiv(governor_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available) {
+			GLuint64 elapsed_ns;
+
+			glGetQueryObjectui64v(governor_queries[slot], GL_QUERY_RESULT, &elapsed_ns);
+			gpu_ms = (float)(elapsed_ns * 1.0e-6);
+			governor_query_pending[slot] = false;
+		}
+	}
+	governor_frame++;
+
+	if (update_governor(cpu_ms, gpu_ms)) {
+		GOVERNOR_SETTINGS* pSettings = get_governor_settings();
+
+		apply_governor_settings();
+		fprintf(stdout, " * Governor: quality %.2f, %dx%d, %d lights, detail %.4f, %dx%d dynamic shadows\n", pSettings->quality,
+			render_width, render_height, get_light_clusters()->n_binned_lights, pSettings->detail_min_size,
+			pSettings->shadow_map_size, pSettings->shadow_map_size);
+	}
+}
 
+void display(void) {
+	glViewport(0, 0, render_width, render_height);
+	begin_governed_frame();
+	render_frame();
+	end_governed_frame();
+	glViewport(0, 0, window_width, window_height); // the capture and the overlay are in window pixels
+	update_capture();
+	capture_due_frames(); // before the overlay
+#ifdef PROFILER_ENABLED
+	draw_profiler_overlay();
+#endif
 	glutSwapBuffers();
 }
 
@@ -1546,7 +2914,23 @@ void upRight(void) {
 	current_camera.uaxis[0] = dir.x; current_camera.uaxis[1] = dir.y; current_camera.uaxis[2] = dir.z;
 }
 
+// --record / --replay: live input is logged while recording and ignored (but ESC) while a recording drives the session
+bool replay_dispatching = false;
+double replay_start_ms;
+int replay_n_frames;
+
+bool accept_input(REPLAY_EVENT_TYPE type, int code, int state, int x, int y) {
+	if (is_replaying() && !replay_dispatching)
+		return false;
+
+	record_event(type, code, state, x, y);
+	return true;
+}
+
 void keyboard(unsigned char key, int x, int y) {
+	if (key != 27 && !accept_input(REPLAY_EVENT_KEY, key, 0, x, y))
+		return;
+
 	switch (key) {
 	case 'f':
 		b_draw_grid = b_draw_grid ? false : true;
@@ -1679,19 +3063,92 @@ void keyboard(unsigned char key, int x, int y) {
 		tigerCamMode = 0;
 		tigerFollowMode = 1 - tigerFollowMode;
 		break;
+	case 'D':
+	case 'd':
+		flag_depth_prepass = !flag_depth_prepass;
+		fprintf(stdout, " * Depth pre-pass %s\n", flag_depth_prepass ? "on" : "off");
+		glutPostRedisplay();
+		break;
+	case 'M':
+	case 'm':
+		flag_deferred_shading = !flag_deferred_shading;
+		fprintf(stdout, " * %s shading\n", flag_deferred_shading ? "Deferred" : "Forward");
+		glutPostRedisplay();
+		break;
+	case 'B':
+	case 'b':
+		flag_shadows = !flag_shadows;
+		fprintf(stdout, " * Sun shadows %s\n", flag_shadows ? "on" : "off");
+		glutPostRedisplay();
+		break;
+	case 'N':
+	case 'n':
+		flag_capture = !flag_capture;
+		glutPostRedisplay();
+		break;
+	case 'W':
+	case 'w':
+		flag_governor = !flag_governor;
+		reset_governor();
+		apply_governor_settings(); // full quality
+		fprintf(stdout, " * Quality governor %s (%.1f ms budget)\n", flag_governor ? "on" : "off", get_governor_budget());
+		glutPostRedisplay();
+		break;
+	case 'J':
+	case 'j':
+		flag_multiview = !flag_multiview;
+		if (flag_multiview)
+			fprintf(stdout, " * Multi-view: %d cameras in a %dx%d grid\n", NUM_CAMERAS, MULTIVIEW_COLUMNS, MULTIVIEW_ROWS);
+		else {
+			fprintf(stdout, " * Multi-view off\n");
+			resize_gbuffer(render_width, render_height);
+		}
+		glutPostRedisplay();
+		break;
+#ifdef PROFILER_ENABLED
+	case 'H':
+	case 'h':
+		flag_profiler_overlay = !flag_profiler_overlay;
+		glutPostRedisplay();
+		break;
+	case 'K':
+	case 'k':
+		export_profile();
+		break;
+#endif
+	case 'Y':
+	case 'y':
+		report_texture_residency();
+		report_streaming();
+		report_process_memory("now");
+		break;
 	case 27: // ESC key
 		glutLeaveMainLoop(); // Incur destuction callback for cleanups.
 		break;
 	}
 }
 
-void reshape(int width, int height) {
-	float aspect_ratio;
-
-	glViewport(0, 0, width, height);
+void resize_renderer(int width, int height) {
+	if (is_capturing() && (width != window_width || height != window_height)) {
+		fprintf(stdout, " * The window size changed; capture stopped\n");
+		end_capture();
+		flag_capture = false;
+	}
 
+	window_width = width;
+	window_height = height;
 	ProjectionMatrix = glm::perspective(current_camera.fovy, current_camera.aspect_ratio, current_camera.near_c, current_camera.far_c);
 	ViewProjectionMatrix = ProjectionMatrix * ViewMatrix;
+	if (flag_governor)
+		apply_governor_settings();
+	else
+		set_render_size(width, height);
+}
+
+void reshape(int width, int height) {
+	if (!accept_input(REPLAY_EVENT_RESHAPE, 0, 0, width, height))
+		return; // a replay sizes the renderer itself, see advance_replay()
+	resize_renderer(width, height);
 	glutPostRedisplay();
 }
 
@@ -1705,10 +3162,56 @@ void cleanup(void) {
 	glDeleteVertexArrays(scene.n_materials, bistro_exterior_VAO);
 	glDeleteBuffers(scene.n_materials, bistro_exterior_VBO);
 	glDeleteTextures(scene.n_textures, bistro_exterior_texture_names);
+	if (flag_streaming) {
+		glDeleteVertexArrays(get_stream_tiles()->n_tiles, stream_tile_VAO);
+		glDeleteBuffers(get_stream_tiles()->n_tiles, stream_tile_VBO);
+		free(stream_tile_VAO);
+		free(stream_tile_VBO);
+		free_streaming();
+	}
 
 	glDeleteVertexArrays(1, &skybox_VAO);
 	glDeleteBuffers(1, &skybox_VBO);
 
+	free_animated_creature(&tiger_mesh);
+	free_animated_creature(&wolf_mesh);
+	free_animated_creature(&spider_mesh);
+
+	glDeleteTextures(1, &light_data_texture);
+	glDeleteTextures(1, &cluster_grid_texture);
+	glDeleteTextures(1, &cluster_index_texture);
+	glDeleteBuffers(1, &light_data_buffer);
+	glDeleteBuffers(1, &cluster_grid_buffer);
+	glDeleteBuffers(1, &cluster_index_buffer);
+	free_light_clusters();
+
+	glDeleteFramebuffers(1, &gbuffer_FBO);
+	glDeleteTextures(N_GBUFFER_TARGETS, gbuffer_textures);
+	glDeleteTextures(1, &gbuffer_depth_texture);
+	glDeleteVertexArrays(1, &fullscreen_VAO);
+	glDeleteQueries(4, &prepass_queries[0][0]);
+	glDeleteFramebuffers(1, &static_shadow_FBO);
+	glDeleteFramebuffers(1, &dynamic_shadow_FBO);
+	glDeleteTextures(1, &static_shadow_texture);
+	glDeleteTextures(1, &dynamic_shadow_texture);
+	glDeleteFramebuffers(1, &governor_FBO);
+	glDeleteRenderbuffers(1, &governor_color_renderbuffer);
+	glDeleteRenderbuffers(1, &governor_depth_renderbuffer);
+	glDeleteQueries(2, governor_queries);
+	free_governor();
+	glDeleteFramebuffers(1, &multiview_FBO);
+	glDeleteRenderbuffers(1, &multiview_color_renderbuffer);
+	glDeleteRenderbuffers(1, &multiview_depth_renderbuffer);
+	free_culling();
+	free_spatial_hash();
+#ifdef PROFILER_ENABLED
+	profiler_free();
+	glDeleteVertexArrays(1, &overlay_VAO);
+	glDeleteBuffers(1, &overlay_VBO);
+#endif
+	glDeleteVertexArrays(1, &bistro_exterior_position_VAO);
+	glDeleteBuffers(1, &bistro_exterior_position_VBO);
+
 	free(bistro_exterior_n_triangles);
 	free(bistro_exterior_vertex_offset);
 
@@ -1717,12 +3220,27 @@ void cleanup(void) {
 
 	free(bistro_exterior_texture_names);
 	free(flag_texture_mapping);
+	free(material_draw_order);
+	free(material_uv_density);
+	free_texture_residency();
+	free_texture_dedup();
+	glDeleteTextures(1, &white_texture);
+	glDeleteTextures(1, &flat_normal_texture);
+	glDeleteTextures(1, &default_metallic_roughness_texture);
+	glDeleteTextures(1, &black_texture);
+
+	end_recording();
+	close_replay();
+	end_capture();
 }
 /*********************  END: callback function definitions **********************/
 
 
 
 void special(int key, int x, int y) {
+	if (!accept_input(REPLAY_EVENT_SPECIAL, key, 0, x, y))
+		return;
+
 	switch (key) {
 	case GLUT_KEY_CTRL_L:
 		ctrl_pressed = 1;
@@ -1734,6 +3252,9 @@ void special(int key, int x, int y) {
 }
 
 void specialup(int key, int x, int y) {
+	if (!accept_input(REPLAY_EVENT_SPECIAL_UP, key, 0, x, y))
+		return;
+
 	switch (key) {
 	case GLUT_KEY_CTRL_L:
 		ctrl_pressed = 0;
@@ -1746,6 +3267,9 @@ void specialup(int key, int x, int y) {
 
 float prevx, prevy;
 void mousepress(int button, int state, int x, int y) {
+	if (!accept_input(REPLAY_EVENT_MOUSE, button, state, x, y))
+		return;
+
 	if ((button == GLUT_LEFT_BUTTON) && (state == GLUT_DOWN)) {
 		leftbuttonpressed = 1;
 		prevx = x; prevy = y;
@@ -1766,6 +3290,7 @@ void mousepress(int button, int state, int x, int y) {
 			current_camera.fovy = current_camera.fovy * 0.9;
 			ProjectionMatrix = glm::perspective(current_camera.fovy, current_camera.aspect_ratio, current_camera.near_c, current_camera.far_c);
 			ViewProjectionMatrix = ProjectionMatrix * ViewMatrix;
+			update_light_cluster_projection();
 			glutPostRedisplay();
 		}
 	}
@@ -1777,12 +3302,16 @@ void mousepress(int button, int state, int x, int y) {
 			}
 			ProjectionMatrix = glm::perspective(current_camera.fovy, current_camera.aspect_ratio, current_camera.near_c, current_camera.far_c);
 			ViewProjectionMatrix = ProjectionMatrix * ViewMatrix;
+			update_light_cluster_projection();
 			glutPostRedisplay();
 		}
 	}
 }
 
 void mousemove(int x, int y) {
+	if (!accept_input(REPLAY_EVENT_MOTION, 0, 0, x, y))
+		return;
+
 	if (leftbuttonpressed && !shift_pressed) {
 		rotateCamV_20181200(prevx - x);
 	}
@@ -1813,29 +3342,66 @@ void tigerCam2_20181200(void) {
 	glutPostRedisplay();
 }
 
-void checkDist_20181200(void) {
-	glm::vec3 cameraPos(current_camera.pos[0], current_camera.pos[1], current_camera.pos[2]);
-	if (glm::distance(treePos, cameraPos) < 300) {
-		if (shrunkFlag == 0) {
-			optimusScale /= 20.0;
-			godzillaScale /= 20.0;
-			dragonScale /= 20.0;
-			shrunkFlag = 1;
-			bigFlag = 0;
-		}
+/*********************************  START: triggers *********************************/
+int camera_entity, tiger_entity;
+
+// the camera near the tree shrinks the giants, near the tank restores them
+void treeTrigger_20181200(int /*trigger*/, int entity, SPATIAL_EVENT event, void* /*user_data*/) {
+	if (entity != camera_entity || event != SPATIAL_EVENT_ENTER)
+		return;
+	if (shrunkFlag == 0) {
+		optimusScale /= 20.0;
+		godzillaScale /= 20.0;
+		dragonScale /= 20.0;
+		shrunkFlag = 1;
+		bigFlag = 0;
 	}
+}
 
-	else if (glm::distance(tankPos, cameraPos) < 300) {
-		if (bigFlag == 0) {
-			optimusScale *= 20.0;
-			godzillaScale *= 20.0;
-			dragonScale *= 20.0;
-			bigFlag = 1;
-			shrunkFlag = 0;
-		}
+void tankTrigger_20181200(int /*trigger*/, int entity, SPATIAL_EVENT event, void* /*user_data*/) {
+	if (entity != camera_entity || event != SPATIAL_EVENT_ENTER)
+		return;
+	if (bigFlag == 0) {
+		optimusScale *= 20.0;
+		godzillaScale *= 20.0;
+		dragonScale *= 20.0;
+		bigFlag = 1;
+		shrunkFlag = 0;
 	}
 }
 
+void doorTrigger_20181200(int /*trigger*/, int entity, SPATIAL_EVENT event, void* /*user_data*/) {
+	if (entity != tiger_entity || event != SPATIAL_EVENT_ENTER || tigerPathDx > 0)
+		return;
+	tigerPathDx *= -1;
+	tigerPathDy *= -1;
+	tigerPathRot = 75;
+}
+
+void prepare_triggers(void) {
+	// the door lies just past the turning point: the tiger, walking toward -x, touches it at doorPos
+	glm::vec3 doorCenter = doorPos - glm::vec3(DOOR_HALF_SIZE - TIGER_RADIUS, 0, 0);
+	glm::vec3 doorMin = doorCenter - glm::vec3(DOOR_HALF_SIZE, DOOR_HALF_SIZE, 0);
+	glm::vec3 doorMax = doorCenter + glm::vec3(DOOR_HALF_SIZE, DOOR_HALF_SIZE, 2 * DOOR_HALF_SIZE);
+	glm::vec3 tigerPos(tigerPathX, tigerPathY, 0);
+
+	initialize_spatial_hash();
+	add_spatial_trigger_sphere(&treePos[0], PROXIMITY_RADIUS, treeTrigger_20181200, NULL);
+	add_spatial_trigger_sphere(&tankPos[0], PROXIMITY_RADIUS, tankTrigger_20181200, NULL);
+	add_spatial_trigger_box(&doorMin[0], &doorMax[0], doorTrigger_20181200, NULL);
+	camera_entity = add_spatial_entity(current_camera.pos, 0.0f);
+	tiger_entity = add_spatial_entity(&tigerPos[0], TIGER_RADIUS);
+}
+
+void checkDist_20181200(void) {
+	glm::vec3 tigerPos(tigerPathX, tigerPathY, 0);
+
+	move_spatial_entity(camera_entity, current_camera.pos);
+	move_spatial_entity(tiger_entity, &tigerPos[0]);
+	update_spatial_triggers();
+}
+/*********************************  END: triggers *********************************/
+
 void tigerNod_20181200(void) {
 	if (tigerNodAng > 5) {
 		tigerNodDx *= -1;
@@ -1863,21 +3429,16 @@ void changeTigerPath_20181200(void) {
 		tigerPathX += tigerPathDx;
 		tigerPathY += tigerPathDy;
 	}
-
-	if (tiger_timestamp_scene % 1000 == 600) {
-		tigerPathDx *= -1;
-		tigerPathDy *= -1;
-		tigerPathRot = 75;
-	}
+	// turning back at the door: doorTrigger_20181200()
 }
 
-void timer_scene(int value) {
+// one simulation tick (SCENE_TICK_MS of scene time)
+void update_scene(void) {
 	cur_frame_tiger = tiger_timestamp_scene % N_TIGER_FRAMES;
 	cur_frame_wolf = _timestamp_scene % N_WOLF_FRAMES;
 	cur_frame_spider = _timestamp_scene % N_SPIDER_FRAMES;
 	rotation_angle_tiger = tiger_timestamp_scene % 360;
 	rotation_angle_rest = _timestamp_scene % 360;
-	glutPostRedisplay();
 	_timestamp_scene = (_timestamp_scene + 5) % UINT_MAX;
 
 	tigerNod_20181200();
@@ -1896,11 +3457,85 @@ void timer_scene(int value) {
 
 	checkDist_20181200();
 
-	glutTimerFunc(100, timer_scene, 0); //100 = 1 second?
+	if (is_capturing())
+		capture_frames_due += capture_fps * SCENE_TICK_MS / 1000.0;
+}
+
+void timer_scene(int value) {
+	record_event(REPLAY_EVENT_TICK, 0, 0, 0, 0);
+	update_scene();
+	glutPostRedisplay();
+
+	glutTimerFunc(SCENE_TICK_MS, timer_scene, 0);
+}
+
+// applies the recorded input up to the next tick, then ticks; false at the end of the recording
+bool advance_replay(void) {
+	REPLAY_EVENT event;
+
+	replay_dispatching = true;
+	while (read_replay_event(&event)) {
+		switch (event.type) {
+		case REPLAY_EVENT_TICK:
+			update_scene();
+			replay_dispatching = false;
+			return true;
+		case REPLAY_EVENT_KEY:
+			keyboard(event.code, event.x, event.y);
+			break;
+		case REPLAY_EVENT_SPECIAL:
+			special(event.code, event.x, event.y);
+			break;
+		case REPLAY_EVENT_SPECIAL_UP:
+			specialup(event.code, event.x, event.y);
+			break;
+		case REPLAY_EVENT_MOUSE:
+			mousepress(event.code, event.state, event.x, event.y);
+			break;
+		case REPLAY_EVENT_MOTION:
+			mousemove(event.x, event.y);
+			break;
+		case REPLAY_EVENT_RESHAPE:
+			// at once: glutReshapeWindow() only resizes the window later, and that reshape is ignored
+			if (event.x != window_width || event.y != window_height)
+				glutReshapeWindow(event.x, event.y);
+			resize_renderer(event.x, event.y);
+			break;
+		}
+	}
+	replay_dispatching = false;
+
+	return false;
+}
+
+// replay renders exactly one frame per recorded tick, as fast as possible
+void display_replay(void) {
+	if (replay_n_frames == 0)
+		replay_start_ms = profiler_time_ms();
+
+	if (!advance_replay()) {
+		double elapsed_ms = profiler_time_ms() - replay_start_ms;
+
+		fprintf(stdout, " * Replay finished: %d frames in %.1f ms (%.3f ms per frame)\n",
+			replay_n_frames, elapsed_ms, replay_n_frames ? elapsed_ms / replay_n_frames : 0.0);
+		close_replay();
+		flag_capture = false; // a replay with --capture-* exports exactly the recorded frames
+		update_capture();
+
+		// hand the session back to live input
+		glutDisplayFunc(display);
+		glutTimerFunc(SCENE_TICK_MS, timer_scene, 0);
+		glutPostRedisplay();
+		return;
+	}
+
+	display();
+	replay_n_frames++;
+	glutPostRedisplay();
 }
 
 void register_callbacks(void) {
-	glutDisplayFunc(display);
+	glutDisplayFunc(is_replaying() ? display_replay : display);
 	glutKeyboardFunc(keyboard);
 	glutReshapeFunc(reshape);
 	glutCloseFunc(cleanup);
@@ -1908,26 +3543,49 @@ void register_callbacks(void) {
 	glutSpecialUpFunc(specialup);
 	glutMouseFunc(mousepress);
 	glutMotionFunc(mousemove);
-	glutTimerFunc(100, timer_scene, 0);
+	if (!is_replaying()) // otherwise the recording provides the ticks
+		glutTimerFunc(SCENE_TICK_MS, timer_scene, 0);
 }
 
 void initialize_OpenGL(void) {
 	glEnable(GL_DEPTH_TEST);
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glVertexAttrib1f(INDEX_AO, 1.0f); // unoccluded for meshes without baked AO
 
 	ViewMatrix = glm::mat4(1.0f);
 	ProjectionMatrix = glm::mat4(1.0f);
 	ViewProjectionMatrix = ProjectionMatrix * ViewMatrix;
 
+	PROFILE_STARTUP_BEGIN("lights");
 	initialize_lights();
+	PROFILE_STARTUP_END();
+	PROFILE_STARTUP_BEGIN("gbuffer");
+	prepare_gbuffer();
+	PROFILE_STARTUP_END();
+	prepare_depth_prepass();
+	prepare_shadows();
+	prepare_multiview();
+	prepare_governor();
+#ifdef PROFILER_ENABLED
+	profiler_initialize();
+	prepare_profiler_overlay();
+#endif
 }
 
 void prepare_scene(void) {
+	PROFILE_STARTUP_BEGIN("axes_grid");
 	prepare_axes();
 	prepare_grid();
+	PROFILE_STARTUP_END();
+	PROFILE_STARTUP_BEGIN("bistro_exterior");
+	initialize_culling(&scene); // the streaming tiles are made of the culling chunks
 	prepare_bistro_exterior();
+	PROFILE_STARTUP_END();
+	PROFILE_STARTUP_BEGIN("skybox");
 	prepare_skybox();
+	PROFILE_STARTUP_END();
+	PROFILE_STARTUP_BEGIN("creatures");
 	prepare_tiger();
 	prepare_wolf();
 	prepare_spider();
@@ -1936,14 +3594,34 @@ void prepare_scene(void) {
 	prepare_optimus();
 	prepare_ironman();
 	prepare_tank();
+	PROFILE_STARTUP_END();
 }
 
-void initialize_renderer(void) {
-	register_callbacks();
+// everything but the window callbacks; the headless benchmark starts here
+void initialize_scene_renderer(void) {
+	InitShaderCache("Shaders/Cache");
+	PROFILE_STARTUP_BEGIN("shader_compile_start");
+	begin_shader_programs();
+	PROFILE_STARTUP_END();
+	prepare_scene();
+	PROFILE_STARTUP_BEGIN("shader_compile_finish");
 	prepare_shader_program();
+	PROFILE_STARTUP_END();
 	initialize_OpenGL();
-	prepare_scene();
 	initialize_camera();
+	prepare_triggers();
+	release_scene_geometry();
+	report_process_memory("after loading");
+}
+
+void initialize_renderer(void) {
+	register_callbacks();
+	initialize_scene_renderer();
+}
+
+void set_render_options(bool deferred_shading, bool depth_prepass) {
+	flag_deferred_shading = deferred_shading;
+	flag_depth_prepass = depth_prepass;
 }
 
 void initialize_glew(void) {
@@ -1980,7 +3658,11 @@ void greetings(char* program_name, char messages[][256], int n_message_lines) {
 	initialize_glew();
 }
 
-#define N_MESSAGE_LINES 9
+#ifdef PROFILER_ENABLED
+#define N_MESSAGE_LINES 18
+#else
+#define N_MESSAGE_LINES 16
+#endif
 void drawScene(int argc, char* argv[]) {
 	char program_name[64] = "Sogang CSE4170 Bistro Exterior Scene";
 	char messages[N_MESSAGE_LINES][256] = {
@@ -1992,6 +3674,17 @@ void drawScene(int argc, char* argv[]) {
 		"		'4' : set the camera for top view",
 		"		'5' : set the camera for front view",
 		"		'6' : set the camera for side view",
+		"		'm' : toggle forward / deferred shading",
+		"		'd' : toggle the depth pre-pass",
+		"		'b' : toggle the sun shadows",
+		"		'n' : start / stop capturing frames",
+		"		'j' : toggle the multi-view grid of all predefined cameras",
+		"		'w' : toggle the adaptive quality governor",
+		"		'y' : print the texture residency, streaming and memory statistics",
+#ifdef PROFILER_ENABLED
+		"		'h' : toggle the frame time overlay",
+		"		'k' : export the frame time history to profile.csv / profile.json",
+#endif
 		"		'ESC' : program close",
 	};
 
@@ -1999,10 +3692,47 @@ void drawScene(int argc, char* argv[]) {
 	glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
 	glutInitWindowSize(900, 600);
 	glutInitWindowPosition(20, 20);
-	glutInitContextVersion(3, 3);
+	glutInitContextVersion(4, 0); // the shaders are #version 400
 	glutInitContextProfile(GLUT_CORE_PROFILE);
 	glutCreateWindow(program_name);
 
+	// glutInit() has removed its own options from argv
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--record") && i + 1 < argc)
+			begin_recording(argv[++i]);
+		else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+			open_replay(argv[++i]);
+		else if ((!strcmp(argv[i], "--capture-png") || !strcmp(argv[i], "--capture-y4m")) && i + 1 < argc) {
+			capture_target_format = strcmp(argv[i], "--capture-y4m") ? CAPTURE_PNG : CAPTURE_Y4M;
+			capture_target = argv[++i];
+			flag_capture = true;
+		}
+		else if (!strcmp(argv[i], "--capture-fps") && i + 1 < argc)
+			capture_fps = max(atoi(argv[++i]), 1);
+		else if (!strcmp(argv[i], "--budget") && i + 1 < argc) {
+			governor_budget_ms = (float)atof(argv[++i]);
+			flag_governor = true;
+		}
+		else if (!strcmp(argv[i], "--governor-log") && i + 1 < argc)
+			governor_log_filename = argv[++i];
+		else if (!strcmp(argv[i], "--stream"))
+			flag_streaming = true;
+		else if (!strcmp(argv[i], "--stream-cpu-mb") && i + 1 < argc)
+			stream_cpu_budget_mb = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--stream-gpu-mb") && i + 1 < argc)
+			stream_gpu_budget_mb = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--texture-budget-mb") && i + 1 < argc)
+			texture_budget_mb = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--low-memory"))
+			flag_low_memory = true;
+		else if (!strcmp(argv[i], "--keep-positions"))
+			flag_keep_positions = true;
+	}
+	if (is_recording() && is_replaying()) {
+		fprintf(stderr, "Error: --record and --replay cannot be combined; not recording\n");
+		end_recording();
+	}
+
 	greetings(program_name, messages, N_MESSAGE_LINES);
 	initialize_renderer();
 
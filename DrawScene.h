@@ -8,4 +8,45 @@
 
 #pragma once
 
-void drawScene(int argc, char* argv[]);
\ No newline at end of file
+// floats of an interleaved Bistro vertex: 3 for position, 3 for normal, 2 for texcoord, 4 for tangent,
+// and the baked AO byte (and 3 padding bytes) in the last one
+#define BISTRO_VERTEX_FLOATS	(13)
+
+// predefined cameras, in the order of the camera keys
+typedef enum {
+	CAMERA_1,
+	CAMERA_2,
+	CAMERA_3,
+	CAMERA_4,
+	CAMERA_5,
+	CAMERA_6,
+	CAMERA_u,
+	CAMERA_i,
+	CAMERA_o,
+	CAMERA_p,
+	CAMERA_a,
+	NUM_CAMERAS
+} CAMERA_INDEX;
+
+void drawScene(int argc, char* argv[]);
+
+// for running the renderer without a window (Benchmark.cpp); needs a current GL 4.0 context
+void initialize_scene_renderer(void);
+void resize_renderer(int width, int height);
+void set_render_options(bool deferred_shading, bool depth_prepass);
+void set_memory_options(bool low_memory, bool keep_positions);	// before initialize_scene_renderer()
+void set_current_camera(int camera_num);
+void set_camera_path_position(float s);
+void update_scene(void);
+void render_frame(void);
+void cleanup(void);
+
+// camera presets without a GL context (SoftwareRenderer.cpp, PathTracer.cpp)
+void initialize_camera(void);
+void get_camera(int camera_num, float* view_matrix, float* fovy, float* aspect_ratio, float* near_c, float* far_c);	// column-major 4x4
+const char* get_camera_key(int camera_num);	// the key selecting the camera, e.g. "u"
+int get_camera_index(const char* key);		// -1 for an unknown key
+
+// the vertices of n_triangles triangles of a material, also without a GL context (LoaderBenchmark.cpp);
+// ao holds a byte per vertex of the material
+void get_bistro_vertices(int materialIdx, int first_triangle, int n_triangles, const unsigned char* ao, float* vertices);
@@ -0,0 +1,136 @@
+﻿//
+//  Governor.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+
+#include "Governor.h"
+
+// response curves: (q, value) points in increasing q. Lowering q from 1 first halves the dynamic
+// shadow map, then drops the small lights, then the small geometry, and lowers the resolution last.
+static const float render_scale_curve[][2] = { { 0.0f, 0.5f }, { 0.5f, 1.0f }, { 1.0f, 1.0f } };
+static const float light_min_size_curve[][2] = { { 0.0f, 0.02f }, { 0.6f, 0.005f }, { 0.8f, 0.0f }, { 1.0f, 0.0f } };
+static const float detail_min_size_curve[][2] = { { 0.0f, 0.01f }, { 0.5f, 0.002f }, { 0.7f, 0.0f }, { 1.0f, 0.0f } };
+static const float shadow_map_size_curve[][2] = { { 0.0f, 512.0f }, { 0.7f, 1024.0f }, { 0.9f, 2048.0f }, { 1.0f, 2048.0f } };
+
+#define CURVE_POINTS(curve)	((int)(sizeof(curve) / sizeof(curve[0])))
+
+static GOVERNOR_SETTINGS settings;
+static float budget;
+static double window_cost, window_cpu, window_gpu;
+static int window_frames, window_gpu_frames;
+static unsigned int frame_number;
+static FILE* log_fp;
+
+static float evaluate_curve(const float curve[][2], int n_points, float q) {
+	if (q <= curve[0][0])
+		return curve[0][1];
+	for (int i = 1; i < n_points; i++) {
+		if (q <= curve[i][0]) {
+			float t = (q - curve[i - 1][0]) / (curve[i][0] - curve[i - 1][0]);
+			return curve[i - 1][1] + t * (curve[i][1] - curve[i - 1][1]);
+		}
+	}
+	return curve[n_points - 1][1];
+}
+
+static void set_quality(float q) {
+	int shadow_map_size = 256;
+
+	settings.quality = q;
+	settings.render_scale = evaluate_curve(render_scale_curve, CURVE_POINTS(render_scale_curve), q);
+	settings.light_min_size = evaluate_curve(light_min_size_curve, CURVE_POINTS(light_min_size_curve), q);
+	settings.detail_min_size = evaluate_curve(detail_min_size_curve, CURVE_POINTS(detail_min_size_curve), q);
+
+	// largest power of two not above the curve, so that the map is only reallocated at the steps
+	while (2 * shadow_map_size <= (int)(evaluate_curve(shadow_map_size_curve, CURVE_POINTS(shadow_map_size_curve), q) + 0.5f))
+		shadow_map_size *= 2;
+	settings.shadow_map_size = shadow_map_size;
+}
+
+void initialize_governor(float budget_ms, const char* log_filename) {
+	budget = budget_ms;
+	reset_governor();
+
+	if (log_filename && log_fp == NULL) {
+		log_fp = fopen(log_filename, "w");
+		if (log_fp == NULL)
+			fprintf(stderr, "Error: cannot open %s\n", log_filename);
+		else
+			fprintf(log_fp, "frame,cost_ms,cpu_ms,gpu_ms,budget_ms,decision,quality,render_scale,light_min_size,detail_min_size,shadow_map_size\n");
+	}
+}
+
+bool update_governor(float cpu_ms, float gpu_ms) {
+	float cost = (gpu_ms > cpu_ms) ? gpu_ms : cpu_ms;
+
+	frame_number++;
+	window_cost += cost;
+	window_cpu += cpu_ms;
+	if (gpu_ms >= 0.0f) {
+		window_gpu += gpu_ms;
+		window_gpu_frames++;
+	}
+	if (++window_frames < GOVERNOR_WINDOW_FRAMES)
+		return false;
+
+	float mean_cost = (float)(window_cost / window_frames);
+	float error = 1.0f - mean_cost / budget; // > 0: headroom
+	float step = 0.0f;
+
+	if (error > GOVERNOR_DEAD_BAND || error < -GOVERNOR_DEAD_BAND) {
+		step = GOVERNOR_GAIN * error;
+		if (step > GOVERNOR_MAX_STEP)
+			step = GOVERNOR_MAX_STEP;
+		if (step < -GOVERNOR_MAX_STEP)
+			step = -GOVERNOR_MAX_STEP;
+	}
+	float q = settings.quality + step;
+	if (q < 0.0f)
+		q = 0.0f;
+	if (q > 1.0f)
+		q = 1.0f;
+
+	bool changed = q != settings.quality;
+	if (changed)
+		set_quality(q);
+
+	if (log_fp) {
+		fprintf(log_fp, "%u,%.3f,%.3f,%.3f,%.3f,%s,%.3f,%.3f,%.4f,%.4f,%d\n", frame_number, mean_cost, (float)(window_cpu / window_frames),
+			window_gpu_frames ? (float)(window_gpu / window_gpu_frames) : -1.0f, budget,
+			changed ? (step < 0.0f ? "lower" : "raise") : "hold", settings.quality, settings.render_scale,
+			settings.light_min_size, settings.detail_min_size, settings.shadow_map_size);
+		fflush(log_fp);
+	}
+
+	// the next window only sees frames rendered with the new settings
+	window_cost = window_cpu = window_gpu = 0.0;
+	window_frames = window_gpu_frames = 0;
+	return changed;
+}
+
+void reset_governor(void) {
+	set_quality(1.0f);
+	window_cost = window_cpu = window_gpu = 0.0;
+	window_frames = window_gpu_frames = 0;
+}
+
+float get_governor_budget(void) {
+	return budget;
+}
+
+GOVERNOR_SETTINGS* get_governor_settings(void) {
+	return &settings;
+}
+
+void free_governor(void) {
+	if (log_fp)
+		fclose(log_fp);
+	log_fp = NULL;
+}
@@ -0,0 +1,34 @@
+﻿//
+//  Governor.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+// Adaptive quality: one quality level q in [0, 1] (1 = full quality) is steered so that the frame
+// cost, the larger of the CPU and the GPU time of a frame, stays at the budget. Every knob follows q
+// through its own piecewise-linear response curve (Governor.cpp), so they give way one after another.
+#define GOVERNOR_DEFAULT_BUDGET_MS	(16.6f)
+#define GOVERNOR_WINDOW_FRAMES		(15)	// frames averaged per decision
+#define GOVERNOR_DEAD_BAND			(0.08f)	// no change while |cost / budget - 1| is below this
+#define GOVERNOR_GAIN				(0.5f)	// change of q per unit of relative error
+#define GOVERNOR_MAX_STEP			(0.2f)	// largest change of q per decision
+
+typedef struct {
+	float	quality;
+	float	render_scale;		// of the window size; the frame is upscaled to the window
+	float	light_min_size;		// bounded lights with radius / depth below this are not shaded
+	float	detail_min_size;	// geometric LOD bias: chunks with radius / depth below this are culled
+	int		shadow_map_size;	// of the dynamic sun shadow map
+} GOVERNOR_SETTINGS;
+
+// Governor.cpp
+void initialize_governor(float budget_ms, const char* log_filename);	// CSV log of every decision if log_filename is not NULL
+bool update_governor(float cpu_ms, float gpu_ms);	// once per frame, gpu_ms < 0 if unknown; true when the settings changed
+void reset_governor(void);	// back to full quality
+float get_governor_budget(void);
+GOVERNOR_SETTINGS* get_governor_settings(void);
+void free_governor(void);
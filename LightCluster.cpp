@@ -0,0 +1,270 @@
+﻿//
+//  LightCluster.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <math.h>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define LIGHT_CLUSTER_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+#include "LightCluster.h"
+
+#define TO_RADIAN 0.01745329252f
+
+// world-space copy of the scene lights, global (unbounded) lights first
+typedef struct {
+	int		type;
+	float	pos[3];
+	float	radius;		// 0 for lights that reach every cluster
+	float	color[3];
+	float	attenuation[3];
+	float	spot_exp;
+	float	spot_dir[3];
+	float	spot_cos_cutoff;
+} CLUSTER_LIGHT;
+
+static CLUSTER_LIGHT* cluster_light_list;
+static LIGHT_CLUSTERS clusters;
+static LIGHT_CLUSTER_PARAMS cluster_params;
+
+// view-space AABBs of all clusters (SoA so four clusters are tested at once)
+static float cluster_min_x[CLUSTER_COUNT], cluster_min_y[CLUSTER_COUNT], cluster_min_z[CLUSTER_COUNT];
+static float cluster_max_x[CLUSTER_COUNT], cluster_max_y[CLUSTER_COUNT], cluster_max_z[CLUSTER_COUNT];
+static float cluster_far_depth;
+static float light_min_size;
+
+static unsigned short cluster_lights[CLUSTER_COUNT][MAX_LIGHTS_PER_CLUSTER];
+static unsigned int cluster_light_count[CLUSTER_COUNT];
+
+static float light_range(const LIGHT* pLight) {
+	float kc = pLight->light_attenuation_factors[0];
+	float kl = pLight->light_attenuation_factors[1];
+	float kq = pLight->light_attenuation_factors[2];
+	float target = 1.0f / LIGHT_CLUSTER_CUTOFF;
+
+	if (pLight->type == LIGHT_DIRECTIONAL)
+		return 0.0f;
+	if (kc >= target) // never above the cutoff, no positive range: like constant attenuation, not a NaN bound
+		return 0.0f;
+	if (kq > 0.0f) // kq * d^2 + kl * d + kc = target
+		return (-kl + sqrtf(max(kl * kl - 4.0f * kq * (kc - target), 0.0f))) / (2.0f * kq);
+	if (kl > 0.0f)
+		return (target - kc) / kl;
+	return 0.0f; // constant attenuation: lights everything
+}
+
+static void fill_cluster_light(CLUSTER_LIGHT* pClusterLight, const LIGHT* pLight, float radius) {
+	pClusterLight->type = pLight->type;
+	pClusterLight->radius = radius;
+	for (int k = 0; k < 3; k++) {
+		pClusterLight->pos[k] = pLight->pos[k];
+		pClusterLight->color[k] = pLight->color[k];
+		pClusterLight->attenuation[k] = pLight->light_attenuation_factors[k];
+		pClusterLight->spot_dir[k] = pLight->spot_dir[k];
+	}
+	pClusterLight->spot_exp = pLight->spot_exp;
+	if (pLight->type == LIGHT_SPOT && pLight->spot_cutoff_angle < 90.0f)
+		pClusterLight->spot_cos_cutoff = cosf(pLight->spot_cutoff_angle * TO_RADIAN);
+	else
+		pClusterLight->spot_cos_cutoff = -1.0f;
+}
+
+void initialize_light_clusters(SCENE* pScene) {
+	int n_lights = min(pScene->n_lights, MAX_CLUSTER_LIGHTS);
+
+	if (pScene->n_lights > MAX_CLUSTER_LIGHTS)
+		fprintf(stdout, " * Only %d of %d scene lights fit in the light buffer.\n", MAX_CLUSTER_LIGHTS, pScene->n_lights);
+
+	cluster_light_list = (CLUSTER_LIGHT*)malloc(sizeof(CLUSTER_LIGHT) * max(n_lights, 1));
+	clusters.light_data = (float*)malloc(sizeof(float) * 4 * LIGHT_TEXELS_PER_LIGHT * max(n_lights, 1));
+	clusters.cluster_grid = (unsigned int*)malloc(sizeof(unsigned int) * 2 * CLUSTER_COUNT);
+	clusters.light_index = (unsigned int*)malloc(sizeof(unsigned int) * CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER);
+
+	// unbounded lights go first so the shader can loop over them without a cluster lookup
+	clusters.n_lights = 0;
+	clusters.sun_light = -1;
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < n_lights; i++) {
+			float radius = light_range(&pScene->light_list[i]);
+			if ((pass == 0) != (radius == 0.0f))
+				continue;
+			if (clusters.sun_light < 0 && pScene->light_list[i].type == LIGHT_DIRECTIONAL)
+				clusters.sun_light = clusters.n_lights;
+			fill_cluster_light(&cluster_light_list[clusters.n_lights++], &pScene->light_list[i], radius);
+		}
+		if (pass == 0)
+			clusters.n_global_lights = clusters.n_lights;
+	}
+
+	memset(clusters.cluster_grid, 0, sizeof(unsigned int) * 2 * CLUSTER_COUNT);
+	clusters.n_light_indices = 0;
+	clusters.n_dropped_indices = 0;
+
+	fprintf(stdout, " * Clustered %d lights (%d global, %d bounded) into %dx%dx%d clusters.\n", clusters.n_lights,
+		clusters.n_global_lights, clusters.n_lights - clusters.n_global_lights, CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z);
+}
+
+static float slice_near_depth(int slice, float near_c) {
+	if (slice == 0)
+		return near_c;
+	return CLUSTER_NEAR_DEPTH * expf((slice - 1) / cluster_params.slice_scale);
+}
+
+static int depth_to_slice(float depth) {
+	if (depth < CLUSTER_NEAR_DEPTH)
+		return 0;
+	int slice = 1 + (int)(logf(depth / CLUSTER_NEAR_DEPTH) * cluster_params.slice_scale);
+	return min(slice, CLUSTER_GRID_Z - 1);
+}
+
+void set_light_cluster_projection(float fovy, float aspect_ratio, float near_c, float far_c, int width, int height) {
+	float tan_y = tanf(0.5f * fovy), tan_x = tan_y * aspect_ratio;
+	int tile_width = (width + CLUSTER_GRID_X - 1) / CLUSTER_GRID_X;
+	int tile_height = (height + CLUSTER_GRID_Y - 1) / CLUSTER_GRID_Y;
+
+	cluster_params.near_depth = CLUSTER_NEAR_DEPTH;
+	cluster_params.slice_scale = (CLUSTER_GRID_Z - 1) / logf(far_c / CLUSTER_NEAR_DEPTH);
+	cluster_params.tile_size[0] = (float)max(tile_width, 1);
+	cluster_params.tile_size[1] = (float)max(tile_height, 1);
+	cluster_far_depth = far_c;
+
+	for (int z = 0; z < CLUSTER_GRID_Z; z++) {
+		float d0 = slice_near_depth(z, near_c);
+		float d1 = (z == CLUSTER_GRID_Z - 1) ? far_c : slice_near_depth(z + 1, near_c);
+
+		for (int y = 0; y < CLUSTER_GRID_Y; y++) {
+			float ny0 = 2.0f * y * cluster_params.tile_size[1] / height - 1.0f;
+			float ny1 = 2.0f * (y + 1) * cluster_params.tile_size[1] / height - 1.0f;
+
+			for (int x = 0; x < CLUSTER_GRID_X; x++) {
+				float nx0 = 2.0f * x * cluster_params.tile_size[0] / width - 1.0f;
+				float nx1 = 2.0f * (x + 1) * cluster_params.tile_size[0] / width - 1.0f;
+				int c = (z * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x;
+
+				// the tile frustum segment between d0 and d1 is bounded by its eight corners
+				cluster_min_x[c] = min(min(nx0 * d0, nx0 * d1), min(nx1 * d0, nx1 * d1)) * tan_x;
+				cluster_max_x[c] = max(max(nx0 * d0, nx0 * d1), max(nx1 * d0, nx1 * d1)) * tan_x;
+				cluster_min_y[c] = min(min(ny0 * d0, ny0 * d1), min(ny1 * d0, ny1 * d1)) * tan_y;
+				cluster_max_y[c] = max(max(ny0 * d0, ny0 * d1), max(ny1 * d0, ny1 * d1)) * tan_y;
+				cluster_min_z[c] = -d1;
+				cluster_max_z[c] = -d0;
+			}
+		}
+	}
+}
+
+static void transform_point(const float* m, const float* p, float w, float* out) {
+	for (int k = 0; k < 3; k++)
+		out[k] = m[k] * p[0] + m[4 + k] * p[1] + m[8 + k] * p[2] + m[12 + k] * w;
+}
+
+static void add_light_to_cluster(int cluster, int light) {
+	if (cluster_light_count[cluster] < MAX_LIGHTS_PER_CLUSTER)
+		cluster_lights[cluster][cluster_light_count[cluster]++] = (unsigned short)light;
+	else
+		clusters.n_dropped_indices++;
+}
+
+// assigns a bounded light to every cluster of one depth slice its sphere overlaps
+static void bin_light_in_slice(int slice, int light, const float* center, float radius) {
+	int first = slice * CLUSTER_GRID_X * CLUSTER_GRID_Y;
+	int last = first + CLUSTER_GRID_X * CLUSTER_GRID_Y;
+
+#ifdef LIGHT_CLUSTER_USE_SSE
+	__m128 cx = _mm_set1_ps(center[0]), cy = _mm_set1_ps(center[1]), cz = _mm_set1_ps(center[2]);
+	__m128 r2 = _mm_set1_ps(radius * radius), zero = _mm_setzero_ps();
+
+	for (int c = first; c < last; c += 4) {
+		// squared distance from the sphere center to four cluster AABBs
+		__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&cluster_min_x[c]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&cluster_max_x[c]))), zero);
+		__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&cluster_min_y[c]), cy), _mm_sub_ps(cy, _mm_loadu_ps(&cluster_max_y[c]))), zero);
+		__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&cluster_min_z[c]), cz), _mm_sub_ps(cz, _mm_loadu_ps(&cluster_max_z[c]))), zero);
+		__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		int mask = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+
+		for (int k = 0; mask; k++, mask >>= 1)
+			if (mask & 1)
+				add_light_to_cluster(c + k, light);
+	}
+#else
+	for (int c = first; c < last; c++) {
+		float dx = max(max(cluster_min_x[c] - center[0], center[0] - cluster_max_x[c]), 0.0f);
+		float dy = max(max(cluster_min_y[c] - center[1], center[1] - cluster_max_y[c]), 0.0f);
+		float dz = max(max(cluster_min_z[c] - center[2], center[2] - cluster_max_z[c]), 0.0f);
+		if (dx * dx + dy * dy + dz * dz <= radius * radius)
+			add_light_to_cluster(c, light);
+	}
+#endif
+}
+
+void set_light_cluster_min_size(float min_size) {
+	light_min_size = min_size;
+}
+
+void update_light_clusters(const float* view_matrix) {
+	memset(cluster_light_count, 0, sizeof(cluster_light_count));
+	clusters.n_dropped_indices = 0;
+	clusters.n_binned_lights = 0;
+
+	for (int i = 0; i < clusters.n_lights; i++) {
+		CLUSTER_LIGHT* pLight = &cluster_light_list[i];
+		float* texel = &clusters.light_data[i * 4 * LIGHT_TEXELS_PER_LIGHT];
+		float center[3];
+
+		// directional lights store their direction in pos
+		transform_point(view_matrix, pLight->pos, (pLight->type == LIGHT_DIRECTIONAL) ? 0.0f : 1.0f, center);
+		texel[0] = center[0]; texel[1] = center[1]; texel[2] = center[2]; texel[3] = pLight->radius;
+		texel[4] = pLight->color[0]; texel[5] = pLight->color[1]; texel[6] = pLight->color[2]; texel[7] = (float)pLight->type;
+		texel[8] = pLight->attenuation[0]; texel[9] = pLight->attenuation[1]; texel[10] = pLight->attenuation[2]; texel[11] = pLight->spot_exp;
+		transform_point(view_matrix, pLight->spot_dir, 0.0f, &texel[12]);
+		texel[15] = pLight->spot_cos_cutoff;
+
+		if (i < clusters.n_global_lights)
+			continue;
+
+		float depth = -center[2];
+		if (depth + pLight->radius < 0.0f || depth - pLight->radius > cluster_far_depth)
+			continue;
+		if (pLight->radius < light_min_size * depth) // too small on screen to matter
+			continue;
+		clusters.n_binned_lights++;
+
+		int slice_first = depth_to_slice(max(depth - pLight->radius, 0.0f));
+		int slice_last = depth_to_slice(depth + pLight->radius);
+		for (int slice = slice_first; slice <= slice_last; slice++)
+			bin_light_in_slice(slice, i, center, pLight->radius);
+	}
+
+	// pack the per-cluster lists
+	unsigned int offset = 0;
+	for (int c = 0; c < CLUSTER_COUNT; c++) {
+		clusters.cluster_grid[2 * c] = offset;
+		clusters.cluster_grid[2 * c + 1] = cluster_light_count[c];
+		for (unsigned int k = 0; k < cluster_light_count[c]; k++)
+			clusters.light_index[offset++] = cluster_lights[c][k];
+	}
+	clusters.n_light_indices = offset;
+}
+
+LIGHT_CLUSTERS* get_light_clusters(void) {
+	return &clusters;
+}
+
+LIGHT_CLUSTER_PARAMS* get_light_cluster_params(void) {
+	return &cluster_params;
+}
+
+void free_light_clusters(void) {
+	free(cluster_light_list);
+	free(clusters.light_data);
+	free(clusters.cluster_grid);
+	free(clusters.light_index);
+}
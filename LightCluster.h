@@ -0,0 +1,51 @@
+﻿//
+//  LightCluster.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+#include "LoadScene.h"
+
+// view-space froxel grid: CLUSTER_GRID_X x CLUSTER_GRID_Y screen tiles, CLUSTER_GRID_Z depth slices
+#define CLUSTER_GRID_X				(16)
+#define CLUSTER_GRID_Y				(9)
+#define CLUSTER_GRID_Z				(24)
+#define CLUSTER_COUNT				(CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+
+#define CLUSTER_NEAR_DEPTH			(50.0f)	// slice 0 covers [near, CLUSTER_NEAR_DEPTH], the rest is log-spaced
+#define MAX_CLUSTER_LIGHTS			(1024)
+#define MAX_LIGHTS_PER_CLUSTER		(128)
+#define LIGHT_CLUSTER_CUTOFF		(1.0f / 256.0f)	// attenuation at which a bounded light stops contributing
+
+#define LIGHT_TEXELS_PER_LIGHT		(4)	// RGBA32F texels per light in the light buffer
+
+typedef struct {
+	int				n_lights;			// lights in light_data, unbounded (global) lights first
+	int				n_global_lights;	// lights applied to every cluster
+	int				sun_light;			// first directional light (the shadow caster), -1 without one
+	float*			light_data;			// LIGHT_TEXELS_PER_LIGHT * 4 floats per light, eye coordinates
+	unsigned int*	cluster_grid;		// (offset, count) into light_index per cluster
+	unsigned int*	light_index;		// light indices of all clusters, packed
+	int				n_light_indices;
+	int				n_dropped_indices;	// overflow of MAX_LIGHTS_PER_CLUSTER in the last update
+	int				n_binned_lights;	// bounded lights binned in the last update
+} LIGHT_CLUSTERS;
+
+typedef struct {
+	float	near_depth;		// CLUSTER_NEAR_DEPTH
+	float	slice_scale;	// (CLUSTER_GRID_Z - 1) / log(far / CLUSTER_NEAR_DEPTH)
+	float	tile_size[2];	// in pixels
+} LIGHT_CLUSTER_PARAMS;
+
+// LightCluster.cpp
+void initialize_light_clusters(SCENE* pScene);
+void set_light_cluster_projection(float fovy, float aspect_ratio, float near_c, float far_c, int width, int height);
+void update_light_clusters(const float* view_matrix);	// column-major 4x4
+void set_light_cluster_min_size(float min_size);	// skip bounded lights with radius / depth below min_size (0: none)
+LIGHT_CLUSTERS* get_light_clusters(void);
+LIGHT_CLUSTER_PARAMS* get_light_cluster_params(void);
+void free_light_clusters(void);
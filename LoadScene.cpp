@@ -8,25 +8,41 @@
 
 #define _CRT_SECURE_NO_WARNINGS 
 
+#include <stdlib.h>
+#if defined(_WIN32) || defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
 #include "LoadScene.h"
+#include "SceneFile.h"
+#include "Profiler.h"
 
-void read3DSceneFromFile(SCENE* pScene) {
-	FILE* fp = fopen("./Scene/BistroExterior.bin", "rb");
+// positions kept by releaseSceneGeometry(), per material
+static float3** scene_positions;
+static int n_scene_positions;
+
+bool readLegacySceneFile(SCENE* pScene) {
+	FILE* fp = fopen(SCENE_LEGACY_FILE, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "Error: cannot read %s\n", SCENE_LEGACY_FILE);
+		memset(pScene, 0, sizeof(SCENE));
+		return false;
+	}
 	fread(pScene, sizeof(SCENE), 1, fp);
 
 	//light list save
-	pScene->light_list = (LIGHT*)malloc(sizeof(LIGHT) * pScene->n_lights);
+	pScene->light_list = (LIGHT*)SCENE_MALLOC(sizeof(LIGHT) * pScene->n_lights);
 	fread(pScene->light_list, sizeof(LIGHT), pScene->n_lights, fp);
 
 	//material list save
-	pScene->material_list = (MATERIAL*)malloc(sizeof(MATERIAL) * pScene->n_materials);
+	pScene->material_list = (MATERIAL*)SCENE_MALLOC(sizeof(MATERIAL) * pScene->n_materials);
 	fread(pScene->material_list, sizeof(MATERIAL), pScene->n_materials, fp);
 	for (int materialIdx = 0; materialIdx < pScene->n_materials; materialIdx++) {
 		MATERIAL* pMaterial = &(pScene->material_list[materialIdx]);
 
 		//triangle list save
 		GEOMETRY_TRIANGULAR_MESH* pMesh = &(pMaterial->geometry.tm);
-		pMesh->triangle_list = (TRIANGLE*)malloc(sizeof(TRIANGLE) * pMesh->n_triangle);
+		pMesh->triangle_list = (TRIANGLE*)SCENE_MALLOC(sizeof(TRIANGLE) * pMesh->n_triangle);
 		fread(pMesh->triangle_list, sizeof(TRIANGLE), pMesh->n_triangle, fp);
 
 		for (int triIdx = 0; triIdx < pMesh->n_triangle; triIdx++)
@@ -34,13 +50,76 @@ void read3DSceneFromFile(SCENE* pScene) {
 			TRIANGLE* triObj = &(pMesh->triangle_list[triIdx]);
 			for (int vertexIdx = 0; vertexIdx < NUM_TRI_VERTICES; vertexIdx++)
 			{
-				triObj->texture_list[vertexIdx] = (float2*)malloc(sizeof(float2) * pMesh->n_textures);
+				triObj->texture_list[vertexIdx] = (float2*)SCENE_MALLOC(sizeof(float2) * pMesh->n_textures);
 				fread(triObj->texture_list[vertexIdx], sizeof(float2), pMesh->n_textures, fp);
 			}
 		}
 	}
 
 	fclose(fp);
+	return true;
+}
+
+// the chunked file, written from the legacy file the first time
+void read3DSceneFromFile(SCENE* pScene) {
+	double start = profiler_time_ms();
+
+	if (open_scene_file(pScene)) {
+		bool loaded = load_scene_materials(pScene, 0);
+		close_scene_file();
+		if (loaded) {
+			fprintf(stdout, " * Loaded %d materials from %s in %.1f s.\n", pScene->n_materials, SCENE_FILE, (profiler_time_ms() - start) / 1000.0);
+			return;
+		}
+		freeData(pScene);
+	}
+	if (readLegacySceneFile(pScene) && write_scene_file(pScene))
+		fprintf(stdout, " * Wrote the chunked scene file %s.\n", SCENE_FILE);
+}
+
+size_t releaseSceneGeometry(SCENE* pScene, bool keep_positions) {
+	size_t released = 0, kept = 0;
+
+	if (keep_positions && scene_positions == NULL) {
+		n_scene_positions = pScene->n_materials;
+		scene_positions = (float3**)calloc(n_scene_positions > 0 ? n_scene_positions : 1, sizeof(float3*));
+	}
+	for (int materialIdx = 0; materialIdx < pScene->n_materials; materialIdx++) {
+		MATERIAL* pMaterial = &(pScene->material_list[materialIdx]);
+
+		GEOMETRY_TRIANGULAR_MESH* pMesh = &(pMaterial->geometry.tm);
+		if (pMaterial->geometry_type != GEOMETRY_TYPE_TRIANGULAR_MESH || pMesh->triangle_list == NULL)
+			continue;
+		if (keep_positions) {
+			scene_positions[materialIdx] = (float3*)SCENE_MALLOC(sizeof(float3) * NUM_TRI_VERTICES * (pMesh->n_triangle > 0 ? pMesh->n_triangle : 1));
+			for (int triIdx = 0; triIdx < pMesh->n_triangle; triIdx++)
+				memcpy(&scene_positions[materialIdx][NUM_TRI_VERTICES * triIdx], pMesh->triangle_list[triIdx].position, sizeof(float3) * NUM_TRI_VERTICES);
+			kept += sizeof(float3) * NUM_TRI_VERTICES * pMesh->n_triangle;
+		}
+		for (int triIdx = 0; triIdx < pMesh->n_triangle; triIdx++) {
+			TRIANGLE* tri = &(pMesh->triangle_list[triIdx]);
+
+			for (int vertex = 0; vertex < NUM_TRI_VERTICES; vertex++)
+				free(tri->texture_list[vertex]);
+		}
+		free(pMesh->triangle_list);
+		pMesh->triangle_list = NULL; // n_triangle stays for the draw calls
+		released += (sizeof(TRIANGLE) + NUM_TRI_VERTICES * sizeof(float2) * pMesh->n_textures) * (size_t)pMesh->n_triangle;
+	}
+
+	// hand the freed pages back, the triangles are millions of small blocks
+#if defined(_WIN32)
+	_heapmin();
+#elif defined(__GLIBC__)
+	malloc_trim(0);
+#endif
+	return released - kept;
+}
+
+const float3* getScenePositions(int materialIdx) {
+	if (materialIdx < 0 || materialIdx >= n_scene_positions)
+		return NULL;
+	return scene_positions[materialIdx];
 }
 
 void freeData(SCENE* pScene) {
@@ -50,6 +129,8 @@ void freeData(SCENE* pScene) {
 		MATERIAL* pMaterial = &(pScene->material_list[materialIdx]);
 
 		GEOMETRY_TRIANGULAR_MESH* pMesh = &(pMaterial->geometry.tm);
+		if (pMaterial->geometry_type != GEOMETRY_TYPE_TRIANGULAR_MESH || pMesh->triangle_list == NULL)
+			continue; // not loaded from the chunked file
 		for (int triIdx = 0; triIdx < pMesh->n_triangle; triIdx++) {
 			TRIANGLE* tri = &(pMesh->triangle_list[triIdx]);
 
@@ -60,4 +141,10 @@ void freeData(SCENE* pScene) {
 	}
 
 	free(pScene->material_list);
+
+	for (int materialIdx = 0; materialIdx < n_scene_positions; materialIdx++)
+		free(scene_positions[materialIdx]);
+	free(scene_positions);
+	scene_positions = NULL;
+	n_scene_positions = 0;
 }
\ No newline at end of file
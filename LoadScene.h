@@ -20,6 +20,14 @@
 #define max(a,b) (((a) > (b)) ? (a) : (b))
 #define min(a,b) (((a) < (b)) ? (a) : (b))
 
+// the allocations of the scene and texture loaders; the loader benchmarks (Benchmarks/) count them
+#ifdef SCENE_COUNT_ALLOCATIONS
+void* scene_malloc(size_t size);
+#define SCENE_MALLOC(size)	scene_malloc(size)
+#else
+#define SCENE_MALLOC(size)	malloc(size)
+#endif
+
 typedef struct {
 	float e[3];
 	float at[3];
@@ -199,4 +207,9 @@ typedef struct {
 
 // LoadScene.cpp
 void read3DSceneFromFile(SCENE* pScene);
+bool readLegacySceneFile(SCENE* pScene);	// SCENE_LEGACY_FILE (SceneFile.h) only, a raw dump of SCENE
 void freeData(SCENE* pScene);
+// low-memory mode: frees the triangles once nothing reads them any more, optionally keeping their positions
+// (3 per triangle) for CPU queries; returns the bytes released
+size_t releaseSceneGeometry(SCENE* pScene, bool keep_positions);
+const float3* getScenePositions(int materialIdx);	// NULL unless kept by releaseSceneGeometry()
@@ -0,0 +1,619 @@
+﻿//
+//  PathTracer.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+// Reference path tracer on the CPU: a progressive, multithreaded Monte Carlo estimate of the Bistro
+// lighting to compare the rasterized approximations (SH ambient, shadow maps) against. Every pass traces
+// one jittered sample per pixel; tiles of PATH_TILE_SIZE x PATH_TILE_SIZE pixels are taken by the worker
+// threads from an atomic counter and each 2x2 pixel quad is traced as one BVH_PACKET. Direct light uses
+// the BRDF of PBR_Lighting.frag with a shadow ray to every unbounded light and to one bounded light
+// picked in proportion to its unshadowed intensity; indirect light follows a Lambertian or, for metals,
+// an approximate glossy bounce.
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <thread>
+#include <atomic>
+
+#include "LoadScene.h"
+#include "DrawScene.h"
+#include "LightCluster.h"
+#include "CpuTexture.h"
+#include "CpuShading.h"
+#include "Bvh.h"
+#include "Profiler.h"
+#include "PathTracer.h"
+
+extern SCENE scene;
+
+#define PI					(3.14159265359f)
+#define RAY_EPSILON			(0.05f)		// offset of secondary rays from the surface, in scene units
+#define RAY_FAR				(1e30f)
+#define BOUNCE_SPREAD		(0.1f)		// ray cone spread angle after a diffuse or glossy bounce
+#define ROULETTE_BOUNCE		(3)			// Russian roulette from this bounce on
+#define MAX_DISPLAY_VALUE	(0.999f)	// inverse tonemapping limit for the skybox seen directly
+
+bool parse_path_options(int argc, char* argv[], PATH_OPTIONS* pOptions) {
+	bool path_trace = false;
+
+	pOptions->width = 900;
+	pOptions->height = 600;
+	pOptions->camera = CAMERA_1;
+	pOptions->spp = 64;
+	pOptions->max_bounces = 4;
+	pOptions->n_threads = 0;
+	pOptions->texture_size = 512;
+	pOptions->progress = 8;
+	pOptions->output_file = "pathtrace.png";
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--pathtrace"))
+			path_trace = true;
+		else if (!strcmp(argv[i], "--camera") && i + 1 < argc) {
+			i++;
+			if (get_camera_index(argv[i]) >= 0)
+				pOptions->camera = get_camera_index(argv[i]);
+		}
+		else if (!strcmp(argv[i], "--size") && i + 1 < argc)
+			sscanf(argv[++i], "%dx%d", &pOptions->width, &pOptions->height);
+		else if (!strcmp(argv[i], "--spp") && i + 1 < argc)
+			pOptions->spp = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--bounces") && i + 1 < argc)
+			pOptions->max_bounces = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			pOptions->n_threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--texture-size") && i + 1 < argc)
+			pOptions->texture_size = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--progress") && i + 1 < argc)
+			pOptions->progress = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+			pOptions->output_file = argv[++i];
+	}
+	if (pOptions->width < 1)
+		pOptions->width = 1;
+	if (pOptions->height < 1)
+		pOptions->height = 1;
+	if (pOptions->spp < 1)
+		pOptions->spp = 1;
+	if (pOptions->max_bounces < 0)
+		pOptions->max_bounces = 0;
+	if (pOptions->texture_size < 1)
+		pOptions->texture_size = 1;
+	if (pOptions->progress < 0)
+		pOptions->progress = 0;
+
+	return path_trace;
+}
+
+/*****************************  START: frame data *****************************/
+typedef struct {
+	int			width, height;
+	int			n_tiles_x, n_tiles_y;
+	float		view[16];			// column-major
+	float		eye[3];
+	float		tan_half_fovy, aspect_ratio;
+	float		pixel_spread;		// ray cone angle of a pixel
+	int			pass;
+	float*		accumulation;		// RGB sums of all passes, bottom row first
+	unsigned char* pixels;			// BGR
+} PATH_FRAME;
+
+typedef struct {
+	long long	n_primary_rays, n_bounce_rays, n_shadow_rays;
+} PATH_THREAD;
+
+// the state of one ray of a packet
+typedef struct {
+	float	throughput[3];
+	float	radiance[3];
+	float	cone_width, cone_spread;	// for texture filtering
+} PATH_LANE;
+
+static int n_threads;
+static PATH_FRAME frame;
+static PATH_THREAD path_threads[PATH_MAX_THREADS];
+static std::atomic<int> next_tile;
+static int max_bounces;
+/*****************************  END: frame data *****************************/
+
+/*****************************  START: sampling *****************************/
+static unsigned int hash_seed(unsigned int seed) {
+	seed = (seed ^ 61u) ^ (seed >> 16);
+	seed *= 9u;
+	seed ^= seed >> 4;
+	seed *= 0x27d4eb2du;
+	return seed ^ (seed >> 15);
+}
+
+// xorshift32 in [0, 1)
+static float random_float(unsigned int* pState) {
+	unsigned int x = *pState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*pState = x;
+	return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+static float dot3(const float* a, const float* b) {
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void normalize3(float* v) {
+	float length = sqrtf(dot3(v, v));
+	if (length > 0.0f)
+		for (int k = 0; k < 3; k++)
+			v[k] /= length;
+}
+
+// an orthonormal basis around n
+static void make_basis(const float* n, float* t, float* b) {
+	float sign = (n[2] >= 0.0f) ? 1.0f : -1.0f;
+	float a = -1.0f / (sign + n[2]), c = n[0] * n[1] * a;
+	t[0] = 1.0f + sign * n[0] * n[0] * a; t[1] = sign * c; t[2] = -sign * n[0];
+	b[0] = c; b[1] = sign + n[1] * n[1] * a; b[2] = -n[1];
+}
+
+static void sample_cosine_hemisphere(const float* n, unsigned int* pState, float* dir) {
+	float t[3], b[3];
+	float r = sqrtf(random_float(pState)), phi = 2.0f * PI * random_float(pState);
+	float x = r * cosf(phi), y = r * sinf(phi), z = sqrtf(max(0.0f, 1.0f - r * r));
+
+	make_basis(n, t, b);
+	for (int k = 0; k < 3; k++)
+		dir[k] = x * t[k] + y * b[k] + z * n[k];
+}
+
+static void sample_unit_sphere(unsigned int* pState, float* dir) {
+	float z = 2.0f * random_float(pState) - 1.0f, phi = 2.0f * PI * random_float(pState);
+	float r = sqrtf(max(0.0f, 1.0f - z * z));
+	dir[0] = r * cosf(phi); dir[1] = r * sinf(phi); dir[2] = z;
+}
+
+static float luminance(const float* rgb) {
+	return 0.2126f * rgb[0] + 0.7152f * rgb[1] + 0.0722f * rgb[2];
+}
+/*****************************  END: sampling *****************************/
+
+/*****************************  START: shading *****************************/
+typedef struct {
+	float	P[3], N[3], Ng[3];		// N and Ng face the incoming ray
+	float	albedo[3], emissive[3];
+	float	metallic, roughness;
+	float	mirror, transmission;	// probabilities of a perfect reflection and of passing through
+} PATH_HIT;
+
+static void sample_texture(int texId, float u, float v, float lod, float* rgb) {
+	const CPU_TEXTURE* pTexture = get_scene_texture(texId);
+	sample_cpu_texture(pTexture, u, v, lod + pTexture->lod_offset, rgb);
+}
+
+static bool is_fraction(float value) {
+	return value >= 0.0f && value <= 1.0f; // false for NaN
+}
+
+// getMaterial() of PBR_Material.frag plus the mirror and opacity terms of the Phong materials
+static void get_hit(const BVH_PACKET* pPacket, int lane, float cone_width, PATH_HIT* pHit) {
+	const BVH_TRIANGLE* pBvhTri = get_bvh_triangle(pPacket->hit[lane]);
+	MATERIAL* pMaterial = &scene.material_list[pBvhTri->material];
+	TRIANGLE* pTri = &pMaterial->geometry.tm.triangle_list[pBvhTri->triangle];
+	float b[3] = { 1.0f - pPacket->u[lane] - pPacket->v[lane], pPacket->u[lane], pPacket->v[lane] };
+	float dir[3] = { pPacket->direction[0][lane], pPacket->direction[1][lane], pPacket->direction[2][lane] };
+	float u = 0.0f, v = 0.0f, rgb[3];
+
+	for (int k = 0; k < 3; k++) {
+		pHit->P[k] = pPacket->origin[k][lane] + pPacket->t_max[lane] * dir[k];
+		pHit->N[k] = 0.0f;
+	}
+	for (int i = 0; i < 3; i++) {
+		pHit->N[0] += b[i] * pTri->normal_vetcor[i].x;
+		pHit->N[1] += b[i] * pTri->normal_vetcor[i].y;
+		pHit->N[2] += b[i] * pTri->normal_vetcor[i].z;
+		u += b[i] * pTri->texture_list[i][0].u;
+		v += b[i] * pTri->texture_list[i][0].v;
+	}
+	pHit->Ng[0] = pBvhTri->accel.e2e1.x; pHit->Ng[1] = pBvhTri->accel.e2e1.y; pHit->Ng[2] = pBvhTri->accel.e2e1.z;
+	float double_area = sqrtf(dot3(pHit->Ng, pHit->Ng));
+	normalize3(pHit->Ng);
+	normalize3(pHit->N);
+	if (dot3(pHit->Ng, dir) > 0.0f) // two-sided
+		for (int k = 0; k < 3; k++)
+			pHit->Ng[k] = -pHit->Ng[k];
+	if (dot3(pHit->N, pHit->Ng) <= 0.0f)
+		for (int k = 0; k < 3; k++)
+			pHit->N[k] = pHit->Ng[k];
+
+	// footprint of the ray cone in uv units
+	float2* uv[3] = { pTri->texture_list[0], pTri->texture_list[1], pTri->texture_list[2] };
+	float uv_double_area = fabsf((uv[1]->u - uv[0]->u) * (uv[2]->v - uv[0]->v) - (uv[2]->u - uv[0]->u) * (uv[1]->v - uv[0]->v));
+	float cos_theta = max(fabsf(dot3(pHit->Ng, dir)), 0.1f);
+	float lod = (double_area > 0.0f && uv_double_area > 0.0f) ? log2f(cone_width * sqrtf(uv_double_area / double_area) / cos_theta + 1e-20f) : 0.0f;
+
+	for (int k = 0; k < 3; k++) {
+		pHit->albedo[k] = 1.0f;
+		pHit->emissive[k] = 0.0f;
+	}
+	pHit->metallic = 0.0f;
+	pHit->roughness = 1.0f;
+	if (get_scene_texture(pMaterial->diffuseTexId)) {
+		sample_texture(pMaterial->diffuseTexId, u, v, lod, rgb);
+		for (int k = 0; k < 3; k++)
+			pHit->albedo[k] = powf(rgb[k], 2.2f);
+	}
+	if (get_scene_texture(pMaterial->specularTexId)) {
+		sample_texture(pMaterial->specularTexId, u, v, lod, rgb);
+		pHit->metallic = rgb[2];
+		pHit->roughness = rgb[1];
+	}
+	if (get_scene_texture(pMaterial->emissiveTexId)) {
+		sample_texture(pMaterial->emissiveTexId, u, v, lod, rgb);
+		for (int k = 0; k < 3; k++)
+			pHit->emissive[k] = rgb[k];
+	}
+
+	// the exporter leaves these fields unset for most materials; only plausible values are used
+	pHit->mirror = pHit->transmission = 0.0f;
+	if (pMaterial->shading_type == SHADING_TYPE_PHONG) {
+		if (is_fraction(pMaterial->shading.ph.reflectivity))
+			pHit->mirror = pMaterial->shading.ph.reflectivity;
+		if (is_fraction(pMaterial->shading.ph.opacity) && pMaterial->shading.ph.opacity > 0.0f)
+			pHit->transmission = min(1.0f - pMaterial->shading.ph.opacity, 1.0f - pHit->mirror);
+	}
+	else if (pMaterial->shading_type == SHADING_TYPE_PHONG_TEXTURE) {
+		const float* kr = pMaterial->shading.pt.kr;
+		if (is_fraction(kr[0]) && is_fraction(kr[1]) && is_fraction(kr[2]))
+			pHit->mirror = luminance(kr);
+	}
+}
+
+// one bounded light chosen in proportion to its unshadowed intensity at P (weighted reservoir sampling);
+// returns the light and its probability, or -1 if none reaches P
+static int pick_bounded_light(const float* P, unsigned int* pState, float* probability) {
+	LIGHT_CLUSTERS* pClusters = get_light_clusters();
+	float weight_sum = 0.0f, picked_weight = 0.0f;
+	int picked = -1;
+
+	for (int i = pClusters->n_global_lights; i < pClusters->n_lights; i++) {
+		const float* light = &pClusters->light_data[4 * LIGHT_TEXELS_PER_LIGHT * i];
+		float d[3] = { light[0] - P[0], light[1] - P[1], light[2] - P[2] };
+		float distance = sqrtf(dot3(d, d));
+		if (distance >= light[3])
+			continue;
+		float ratio = distance / light[3];
+		float window = 1.0f - ratio * ratio * ratio * ratio;
+		float weight = luminance(&light[4]) * window * window / max(light[8] + light[9] * distance + light[10] * distance * distance, 0.0001f);
+		if (!(weight > 0.0f))
+			continue;
+		weight_sum += weight;
+		if (random_float(pState) * weight_sum < weight) {
+			picked = i;
+			picked_weight = weight;
+		}
+	}
+	*probability = (picked >= 0) ? picked_weight / weight_sum : 0.0f;
+	return picked;
+}
+
+static void set_shadow_lane(BVH_PACKET* pShadow, int lane, const PATH_HIT* pHit, const float* L, float distance) {
+	for (int k = 0; k < 3; k++) {
+		pShadow->origin[k][lane] = pHit->P[k] + RAY_EPSILON * pHit->Ng[k];
+		pShadow->direction[k][lane] = L[k];
+	}
+	pShadow->t_max[lane] = (distance == FLT_MAX) ? RAY_FAR : distance - 2.0f * RAY_EPSILON;
+	pShadow->active |= 1 << lane;
+}
+
+// direct light of the lanes in hit_mask, shadowed
+static void add_direct_light(const BVH_PACKET* pPacket, int hit_mask, const PATH_HIT* hits, PATH_LANE* lanes, unsigned int* pState, PATH_THREAD* pThread) {
+	LIGHT_CLUSTERS* pClusters = get_light_clusters();
+	BVH_PACKET shadow;
+	float radiance[BVH_PACKET_SIZE][3], L[3];
+
+	// light -1 is the sampled bounded light
+	for (int light_index = -1; light_index < pClusters->n_global_lights; light_index++) {
+		shadow.active = 0;
+		for (int lane = 0; lane < BVH_PACKET_SIZE; lane++) {
+			if (!(hit_mask & (1 << lane)))
+				continue;
+			const PATH_HIT* pHit = &hits[lane];
+			float probability = 1.0f;
+			int light = (light_index < 0) ? pick_bounded_light(pHit->P, pState, &probability) : light_index;
+			if (light < 0)
+				continue;
+
+			float V[3] = { -pPacket->direction[0][lane], -pPacket->direction[1][lane], -pPacket->direction[2][lane] };
+			float distance = shade_cpu_light(&pClusters->light_data[4 * LIGHT_TEXELS_PER_LIGHT * light], pHit->P, pHit->N, V,
+				pHit->albedo, pHit->metallic, pHit->roughness, radiance[lane], L);
+			if (radiance[lane][0] + radiance[lane][1] + radiance[lane][2] <= 0.0f || dot3(L, pHit->Ng) <= 0.0f)
+				continue;
+			float scale = (1.0f - pHit->mirror - pHit->transmission) / probability;
+			for (int k = 0; k < 3; k++)
+				radiance[lane][k] *= scale;
+			set_shadow_lane(&shadow, lane, pHit, L, distance);
+		}
+		if (!shadow.active)
+			continue;
+
+		int occluded = occluded_bvh_packet(&shadow);
+		for (int lane = 0; lane < BVH_PACKET_SIZE; lane++) {
+			if (!(shadow.active & (1 << lane)))
+				continue;
+			pThread->n_shadow_rays++;
+			if (occluded & (1 << lane))
+				continue;
+			for (int k = 0; k < 3; k++)
+				lanes[lane].radiance[k] += lanes[lane].throughput[k] * radiance[lane][k];
+		}
+	}
+}
+
+// picks the next direction of a lane; false ends the path
+static bool scatter(BVH_PACKET* pPacket, int lane, const PATH_HIT* pHit, PATH_LANE* pLane, unsigned int* pState) {
+	float dir[3] = { pPacket->direction[0][lane], pPacket->direction[1][lane], pPacket->direction[2][lane] };
+	float next[3], choice = random_float(pState);
+	float surface = 1.0f - pHit->mirror - pHit->transmission;
+
+	if (choice < pHit->mirror) {
+		float d = 2.0f * dot3(dir, pHit->N);
+		for (int k = 0; k < 3; k++)
+			next[k] = dir[k] - d * pHit->N[k];
+	}
+	else if (choice < pHit->mirror + pHit->transmission) {
+		for (int k = 0; k < 3; k++)
+			next[k] = dir[k];
+	}
+	else {
+		// the branch probabilities (1 - metallic) and metallic carry the kD and F0 weights
+		if ((choice - pHit->mirror - pHit->transmission) < surface * pHit->metallic) {
+			float d = 2.0f * dot3(dir, pHit->N), fuzz[3], a = pHit->roughness * pHit->roughness;
+			sample_unit_sphere(pState, fuzz);
+			for (int k = 0; k < 3; k++)
+				next[k] = dir[k] - d * pHit->N[k] + a * fuzz[k];
+			normalize3(next);
+		}
+		else
+			sample_cosine_hemisphere(pHit->N, pState, next);
+		for (int k = 0; k < 3; k++)
+			pLane->throughput[k] *= pHit->albedo[k];
+		pLane->cone_spread = max(pLane->cone_spread, BOUNCE_SPREAD);
+	}
+
+	float side = (dot3(next, pHit->Ng) >= 0.0f) ? 1.0f : -1.0f;
+	if (choice >= pHit->mirror && choice < pHit->mirror + pHit->transmission)
+		side = -1.0f;
+	else if (side < 0.0f)
+		return false; // below the surface
+	for (int k = 0; k < 3; k++) {
+		pPacket->origin[k][lane] = pHit->P[k] + side * RAY_EPSILON * pHit->Ng[k];
+		pPacket->direction[k][lane] = next[k];
+	}
+	pPacket->t_max[lane] = RAY_FAR;
+	return true;
+}
+
+static void trace_packet(BVH_PACKET* pPacket, PATH_LANE* lanes, unsigned int* pState, PATH_THREAD* pThread) {
+	PATH_HIT hits[BVH_PACKET_SIZE];
+
+	for (int bounce = 0; bounce <= max_bounces && pPacket->active; bounce++) {
+		intersect_bvh_packet(pPacket);
+
+		int hit_mask = 0;
+		for (int lane = 0; lane < BVH_PACKET_SIZE; lane++) {
+			if (!(pPacket->active & (1 << lane)))
+				continue;
+			PATH_LANE* pLane = &lanes[lane];
+			float origin[3] = { pPacket->origin[0][lane], pPacket->origin[1][lane], pPacket->origin[2][lane] };
+			float dir[3] = { pPacket->direction[0][lane], pPacket->direction[1][lane], pPacket->direction[2][lane] };
+			if (bounce == 0)
+				pThread->n_primary_rays++;
+			else
+				pThread->n_bounce_rays++;
+
+			if (pPacket->hit[lane] == BVH_NO_HIT) {
+				float sky[3];
+				sample_skybox_ray(origin, dir, sky);
+				for (int k = 0; k < 3; k++) {
+					// seen directly, the skybox is displayed as stored, so undo the tonemapping of the output;
+					// otherwise it lights the scene as the SH ambient does
+					float value = sky[k];
+					if (bounce == 0) {
+						value = min(powf(max(value, 0.0f), 2.2f), MAX_DISPLAY_VALUE);
+						value = value / (1.0f - value);
+					}
+					pLane->radiance[k] += pLane->throughput[k] * value;
+				}
+				pPacket->active &= ~(1 << lane);
+				continue;
+			}
+
+			pLane->cone_width += pLane->cone_spread * pPacket->t_max[lane];
+			get_hit(pPacket, lane, pLane->cone_width, &hits[lane]);
+			float surface = 1.0f - hits[lane].mirror - hits[lane].transmission;
+			for (int k = 0; k < 3; k++)
+				pLane->radiance[k] += pLane->throughput[k] * hits[lane].emissive[k] * surface;
+			hit_mask |= 1 << lane;
+		}
+		add_direct_light(pPacket, hit_mask, hits, lanes, pState, pThread);
+
+		for (int lane = 0; lane < BVH_PACKET_SIZE; lane++) {
+			if (!(hit_mask & (1 << lane)))
+				continue;
+			PATH_LANE* pLane = &lanes[lane];
+			bool alive = bounce < max_bounces && scatter(pPacket, lane, &hits[lane], pLane, pState);
+			if (alive && bounce + 1 >= ROULETTE_BOUNCE) {
+				float survival = min(max(max(pLane->throughput[0], pLane->throughput[1]), pLane->throughput[2]), 0.95f);
+				alive = random_float(pState) < survival;
+				for (int k = 0; k < 3 && alive; k++)
+					pLane->throughput[k] /= survival;
+			}
+			if (!alive)
+				pPacket->active &= ~(1 << lane);
+		}
+	}
+}
+/*****************************  END: shading *****************************/
+
+/*****************************  START: passes *****************************/
+static void trace_tile(int tile, PATH_THREAD* pThread) {
+	int tile_x = (tile % frame.n_tiles_x) * PATH_TILE_SIZE, tile_y = (tile / frame.n_tiles_x) * PATH_TILE_SIZE;
+	unsigned int state = hash_seed((unsigned int)(frame.pass * frame.n_tiles_x * frame.n_tiles_y + tile)) | 1u;
+	const float* m = frame.view;
+
+	for (int y0 = tile_y; y0 < min(tile_y + PATH_TILE_SIZE, frame.height); y0 += 2)
+		for (int x0 = tile_x; x0 < min(tile_x + PATH_TILE_SIZE, frame.width); x0 += 2) {
+			BVH_PACKET packet;
+			PATH_LANE lanes[BVH_PACKET_SIZE];
+
+			packet.active = 0;
+			for (int lane = 0; lane < BVH_PACKET_SIZE; lane++) {
+				int x = x0 + (lane & 1), y = y0 + (lane >> 1);
+				float frag_x = x + random_float(&state), frag_y = y + random_float(&state); // jittered within the pixel
+				float dir_EC[3] = { (2.0f * frag_x / frame.width - 1.0f) * frame.tan_half_fovy * frame.aspect_ratio,
+					(2.0f * frag_y / frame.height - 1.0f) * frame.tan_half_fovy, -1.0f };
+				float dir[3] = { m[0] * dir_EC[0] + m[1] * dir_EC[1] + m[2] * dir_EC[2],
+					m[4] * dir_EC[0] + m[5] * dir_EC[1] + m[6] * dir_EC[2],
+					m[8] * dir_EC[0] + m[9] * dir_EC[1] + m[10] * dir_EC[2] };
+				normalize3(dir);
+
+				for (int k = 0; k < 3; k++) {
+					packet.origin[k][lane] = frame.eye[k];
+					packet.direction[k][lane] = dir[k];
+					lanes[lane].throughput[k] = 1.0f;
+					lanes[lane].radiance[k] = 0.0f;
+				}
+				packet.t_max[lane] = RAY_FAR;
+				lanes[lane].cone_width = 0.0f;
+				lanes[lane].cone_spread = frame.pixel_spread;
+				if (x < frame.width && y < frame.height)
+					packet.active |= 1 << lane;
+			}
+
+			trace_packet(&packet, lanes, &state, pThread);
+
+			for (int lane = 0; lane < BVH_PACKET_SIZE; lane++) {
+				int x = x0 + (lane & 1), y = y0 + (lane >> 1);
+				if (x >= frame.width || y >= frame.height)
+					continue;
+				float* sum = &frame.accumulation[3 * ((size_t)y * frame.width + x)];
+				for (int k = 0; k < 3; k++)
+					sum[k] += lanes[lane].radiance[k];
+			}
+		}
+}
+
+static void pass_job(PATH_THREAD* pThread) {
+	int n_tiles = frame.n_tiles_x * frame.n_tiles_y;
+
+	for (int tile = next_tile++; tile < n_tiles; tile = next_tile++)
+		trace_tile(tile, pThread);
+}
+
+static void trace_pass(void) {
+	std::thread threads[PATH_MAX_THREADS];
+
+	next_tile = 0;
+	for (int t = 1; t < n_threads; t++)
+		threads[t] = std::thread(pass_job, &path_threads[t]);
+	pass_job(&path_threads[0]);
+	for (int t = 1; t < n_threads; t++)
+		threads[t].join();
+	frame.pass++;
+}
+
+static bool save_accumulation(const char* filename) {
+	float scale = 1.0f / frame.pass;
+
+	for (size_t i = 0; i < (size_t)frame.width * frame.height; i++) {
+		float color[3] = { frame.accumulation[3 * i] * scale, frame.accumulation[3 * i + 1] * scale, frame.accumulation[3 * i + 2] * scale };
+		encode_display_color(color, &frame.pixels[3 * i]);
+	}
+	return save_png_bgr(filename, frame.width, frame.height, frame.pixels);
+}
+/*****************************  END: passes *****************************/
+
+static void set_frame_camera(int camera, int width, int height) {
+	float fovy, aspect_ratio, near_c, far_c;
+	float identity[16] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+
+	get_camera(camera, frame.view, &fovy, &aspect_ratio, &near_c, &far_c);
+	// eye = -R^T t for the rigid view matrix
+	for (int k = 0; k < 3; k++)
+		frame.eye[k] = -(frame.view[4 * k] * frame.view[12] + frame.view[4 * k + 1] * frame.view[13] + frame.view[4 * k + 2] * frame.view[14]);
+	frame.tan_half_fovy = tanf(0.5f * fovy);
+	frame.aspect_ratio = aspect_ratio;
+	frame.pixel_spread = 2.0f * frame.tan_half_fovy / height;
+	frame.width = width;
+	frame.height = height;
+	frame.n_tiles_x = (width + PATH_TILE_SIZE - 1) / PATH_TILE_SIZE;
+	frame.n_tiles_y = (height + PATH_TILE_SIZE - 1) / PATH_TILE_SIZE;
+	frame.pass = 0;
+
+	// the lights in world coordinates
+	set_light_cluster_projection(fovy, aspect_ratio, near_c, far_c, width, height);
+	update_light_clusters(identity);
+}
+
+int run_path_tracer(PATH_OPTIONS* pOptions) {
+	int exit_code = 0;
+
+	n_threads = pOptions->n_threads > 0 ? pOptions->n_threads : (int)std::thread::hardware_concurrency();
+	n_threads = max(1, min(n_threads, PATH_MAX_THREADS));
+	max_bounces = pOptions->max_bounces;
+
+	double start = profiler_time_ms();
+	initialize_camera();
+	initialize_light_clusters(&scene);
+	load_scene_textures(&scene, pOptions->texture_size, n_threads);
+	build_bvh(&scene, n_threads);
+	fprintf(stdout, " * Prepared the path tracer in %.1f ms (%d threads).\n\n", profiler_time_ms() - start, n_threads);
+
+	set_frame_camera(pOptions->camera, pOptions->width, pOptions->height);
+	frame.accumulation = (float*)calloc(3 * (size_t)frame.width * frame.height, sizeof(float));
+	frame.pixels = (unsigned char*)malloc(3 * (size_t)frame.width * frame.height);
+	memset(path_threads, 0, sizeof(path_threads));
+
+	double trace_start = profiler_time_ms();
+	while (frame.pass < pOptions->spp) {
+		trace_pass();
+		bool last = frame.pass == pOptions->spp;
+		if (!last && (pOptions->progress == 0 || frame.pass % pOptions->progress != 0))
+			continue;
+
+		double elapsed = profiler_time_ms() - trace_start;
+		if (!save_accumulation(pOptions->output_file)) {
+			fprintf(stderr, "Error: cannot write %s\n", pOptions->output_file);
+			exit_code = 1;
+			break;
+		}
+		fprintf(stdout, " * %d/%d samples per pixel after %.1f s, saved to %s.\n", frame.pass, pOptions->spp, elapsed / 1000.0, pOptions->output_file);
+	}
+	double trace_time = profiler_time_ms() - trace_start;
+
+	PATH_THREAD total = { 0, 0, 0 };
+	for (int t = 0; t < n_threads; t++) {
+		total.n_primary_rays += path_threads[t].n_primary_rays;
+		total.n_bounce_rays += path_threads[t].n_bounce_rays;
+		total.n_shadow_rays += path_threads[t].n_shadow_rays;
+	}
+	long long n_rays = total.n_primary_rays + total.n_bounce_rays + total.n_shadow_rays;
+	fprintf(stdout, " * Camera %s: %dx%d pixels at %d spp in %.1f s, %.2f Mrays/s (%lld primary, %lld bounce, %lld shadow rays).\n",
+		get_camera_key(pOptions->camera), frame.width, frame.height, frame.pass, trace_time / 1000.0,
+		n_rays / max(trace_time, 1.0) / 1000.0, total.n_primary_rays, total.n_bounce_rays, total.n_shadow_rays);
+
+	free(frame.accumulation);
+	free(frame.pixels);
+	free_bvh();
+	free_scene_textures();
+	free_light_clusters();
+
+	return exit_code;
+}
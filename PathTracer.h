@@ -0,0 +1,27 @@
+﻿//
+//  PathTracer.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+#define PATH_TILE_SIZE		(16)	// pixels per side of a work tile, even so that 2x2 ray packets fit
+#define PATH_MAX_THREADS	(32)
+
+typedef struct {
+	int			width, height;
+	int			camera;			// CAMERA_INDEX
+	int			spp;			// samples per pixel, one per pass
+	int			max_bounces;	// indirect bounces after the first hit, 0 for direct light only
+	int			n_threads;		// 0: one per hardware thread
+	int			texture_size;	// textures and cube map faces are scaled down to fit
+	int			progress;		// the image is written every progress passes, 0: only at the end
+	const char*	output_file;	// PNG
+} PATH_OPTIONS;
+
+// PathTracer.cpp
+bool parse_path_options(int argc, char* argv[], PATH_OPTIONS* pOptions);	// false without --pathtrace
+int run_path_tracer(PATH_OPTIONS* pOptions);	// process exit code
@@ -0,0 +1,302 @@
+﻿//
+//  Profiler.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <time.h>
+#endif
+#include <GL/glew.h>
+
+#include "Profiler.h"
+
+#define MAX_STARTUP_STAGES	(32)
+
+static const char* pass_names[N_PROFILE_PASSES] = {
+	"grid", "shadows", "bistro", "light_clusters", "depth_prepass", "forward", "gbuffer", "deferred_lighting",
+	"axes", "skybox", "creatures"
+};
+
+static double pass_last_frame[N_PROFILE_PASSES];	// stays 0 without PROFILER_ENABLED
+
+#ifdef PROFILER_ENABLED
+// CPU
+static double pass_start[N_PROFILE_PASSES];
+static double pass_cpu[N_PROFILE_PASSES];
+static double last_frame_end;
+
+// GPU: a timestamp pair per pass, double buffered; a frame's results are read at the end of the next frame
+static GLuint gpu_queries[2][N_PROFILE_PASSES][2];
+static bool gpu_issued[2][N_PROFILE_PASSES];
+static bool gpu_ready;
+static unsigned int frame_number;
+
+// sums since the last printed averages
+static double report_cpu[N_PROFILE_PASSES];
+static double report_gpu[N_PROFILE_PASSES];
+static int report_gpu_samples[N_PROFILE_PASSES];
+static double report_frame_ms;
+static int report_frames;
+
+// history[frame % PROFILER_HISTORY_FRAMES]
+static float history_cpu[PROFILER_HISTORY_FRAMES][N_PROFILE_PASSES];
+static float history_gpu[PROFILER_HISTORY_FRAMES][N_PROFILE_PASSES];
+static float history_frame[PROFILER_HISTORY_FRAMES];
+static int n_history;
+
+static const char* startup_stage_names[MAX_STARTUP_STAGES];
+static double startup_stage_ms[MAX_STARTUP_STAGES];
+static int n_startup_stages;
+static double startup_stage_start;
+#endif
+
+double profiler_time_ms(void) {
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return 1000.0 * (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return 1000.0 * ts.tv_sec + 1.0e-6 * ts.tv_nsec;
+#endif
+}
+
+// the working set on Windows, VmRSS and VmHWM on Linux
+bool profiler_memory(size_t* resident_bytes, size_t* peak_bytes) {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return false;
+	*resident_bytes = counters.WorkingSetSize;
+	*peak_bytes = counters.PeakWorkingSetSize;
+	return true;
+#else
+	FILE* fp = fopen("/proc/self/status", "r");
+	char line[256];
+	unsigned long long kb;
+	int n_found = 0;
+
+	if (fp == NULL)
+		return false;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "VmRSS: %llu kB", &kb) == 1) {
+			*resident_bytes = (size_t)kb << 10;
+			n_found++;
+		}
+		else if (sscanf(line, "VmHWM: %llu kB", &kb) == 1) {
+			*peak_bytes = (size_t)kb << 10;
+			n_found++;
+		}
+	}
+	fclose(fp);
+	return n_found == 2;
+#endif
+}
+
+#ifdef PROFILER_ENABLED
+void profiler_initialize(void) {
+	glGenQueries(2 * N_PROFILE_PASSES * 2, &gpu_queries[0][0][0]);
+	gpu_ready = true;
+	last_frame_end = profiler_time_ms();
+}
+
+void profiler_free(void) {
+	if (gpu_ready)
+		glDeleteQueries(2 * N_PROFILE_PASSES * 2, &gpu_queries[0][0][0]);
+	gpu_ready = false;
+}
+
+void profiler_begin(PROFILE_PASS pass) {
+	pass_start[pass] = profiler_time_ms();
+	if (gpu_ready)
+		glQueryCounter(gpu_queries[frame_number & 1][pass][0], GL_TIMESTAMP); // timestamps nest, unlike GL_TIME_ELAPSED
+}
+
+void profiler_end(PROFILE_PASS pass) {
+	pass_cpu[pass] += profiler_time_ms() - pass_start[pass];
+	if (gpu_ready) {
+		glQueryCounter(gpu_queries[frame_number & 1][pass][1], GL_TIMESTAMP);
+		gpu_issued[frame_number & 1][pass] = true;
+	}
+}
+
+static void print_averages(void) {
+	if (report_frames == 0)
+		return;
+	fprintf(stdout, " * Profile of the last %d frames: %.3f ms per frame\n", report_frames, report_frame_ms / report_frames);
+
+	for (int pass = 0; pass < N_PROFILE_PASSES; pass++) {
+		if (report_gpu_samples[pass] > 0)
+			fprintf(stdout, "     %-18s CPU %7.3f ms   GPU %7.3f ms\n", pass_names[pass], report_cpu[pass] / report_frames,
+				report_gpu[pass] / report_gpu_samples[pass]);
+		report_cpu[pass] = report_gpu[pass] = 0.0;
+		report_gpu_samples[pass] = 0;
+	}
+	report_frame_ms = 0.0;
+	report_frames = 0;
+}
+
+void profiler_end_frame(void) {
+	double now = profiler_time_ms();
+	int row = frame_number % PROFILER_HISTORY_FRAMES;
+
+	for (int pass = 0; pass < N_PROFILE_PASSES; pass++) {
+		history_cpu[row][pass] = (float)pass_cpu[pass];
+		history_gpu[row][pass] = -1.0f;
+	}
+	history_frame[row] = (float)(now - last_frame_end);
+	for (int pass = 0; pass < N_PROFILE_PASSES; pass++) {
+		pass_last_frame[pass] = pass_cpu[pass];
+		report_cpu[pass] += pass_cpu[pass];
+		pass_cpu[pass] = 0.0;
+	}
+	report_frame_ms += now - last_frame_end;
+	report_frames++;
+	last_frame_end = now;
+
+	// the previous frame's queries are reused by the next frame, so collect them now
+	int slot = (frame_number + 1) & 1;
+	if (gpu_ready && frame_number > 0) {
+		int previous_row = (frame_number - 1) % PROFILER_HISTORY_FRAMES;
+		for (int pass = 0; pass < N_PROFILE_PASSES; pass++) {
+			if (!gpu_issued[slot][pass])
+				continue;
+
+			GLuint64 begin_ns, end_ns;
+			glGetQueryObjectui64v(gpu_queries[slot][pass][0], GL_QUERY_RESULT, &begin_ns);
+			glGetQueryObjectui64v(gpu_queries[slot][pass][1], GL_QUERY_RESULT, &end_ns);
+			double gpu_ms = (end_ns - begin_ns) * 1.0e-6;
+			report_gpu[pass] += gpu_ms;
+			report_gpu_samples[pass]++;
+			history_gpu[previous_row][pass] = (float)gpu_ms;
+			gpu_issued[slot][pass] = false;
+		}
+		if (n_history < PROFILER_HISTORY_FRAMES)
+			n_history++;
+	}
+
+	frame_number++;
+	if (frame_number % PROFILER_REPORT_FRAMES == 0)
+		print_averages();
+}
+#endif
+
+const char* profiler_pass_name(PROFILE_PASS pass) {
+	return pass_names[pass];
+}
+
+double profiler_last_frame_ms(PROFILE_PASS pass) {
+	return pass_last_frame[pass];
+}
+
+#ifdef PROFILER_ENABLED
+void profiler_startup_begin(const char* stage) {
+	if (n_startup_stages < MAX_STARTUP_STAGES)
+		startup_stage_names[n_startup_stages] = stage;
+	startup_stage_start = profiler_time_ms();
+}
+
+void profiler_startup_end(void) {
+	if (n_startup_stages >= MAX_STARTUP_STAGES)
+		return;
+
+	startup_stage_ms[n_startup_stages] = profiler_time_ms() - startup_stage_start;
+	fprintf(stdout, " * Startup stage %s: %.1f ms\n", startup_stage_names[n_startup_stages], startup_stage_ms[n_startup_stages]);
+	n_startup_stages++;
+}
+
+int profiler_history_length(void) {
+	return n_history;
+}
+
+// age 0 is frame_number - 2: the newest frame whose GPU times have been collected
+static int history_row(int age) {
+	return (frame_number - 2 - age) % PROFILER_HISTORY_FRAMES;
+}
+
+float profiler_history_cpu_ms(int age, PROFILE_PASS pass) {
+	return history_cpu[history_row(age)][pass];
+}
+
+float profiler_history_gpu_ms(int age, PROFILE_PASS pass) {
+	return history_gpu[history_row(age)][pass];
+}
+
+float profiler_history_frame_ms(int age) {
+	return history_frame[history_row(age)];
+}
+
+bool profiler_export_csv(const char* filename) {
+	FILE* fp = fopen(filename, "w");
+	if (fp == NULL)
+		return false;
+
+	fprintf(fp, "frame,frame_ms");
+	for (int pass = 0; pass < N_PROFILE_PASSES; pass++)
+		fprintf(fp, ",%s_cpu_ms,%s_gpu_ms", pass_names[pass], pass_names[pass]);
+	fprintf(fp, "\n");
+
+	for (int age = n_history - 1; age >= 0; age--) {
+		fprintf(fp, "%d,%.4f", n_history - 1 - age, profiler_history_frame_ms(age));
+		for (int pass = 0; pass < N_PROFILE_PASSES; pass++) {
+			float gpu = profiler_history_gpu_ms(age, (PROFILE_PASS)pass);
+			if (gpu >= 0.0f)
+				fprintf(fp, ",%.4f,%.4f", profiler_history_cpu_ms(age, (PROFILE_PASS)pass), gpu);
+			else
+				fprintf(fp, ",%.4f,", profiler_history_cpu_ms(age, (PROFILE_PASS)pass));
+		}
+		fprintf(fp, "\n");
+	}
+	fclose(fp);
+
+	return true;
+}
+
+bool profiler_export_json(const char* filename) {
+	FILE* fp = fopen(filename, "w");
+	if (fp == NULL)
+		return false;
+
+	fprintf(fp, "{\n  \"startup_ms\": {");
+	for (int i = 0; i < n_startup_stages; i++)
+		fprintf(fp, "%s \"%s\": %.3f", i ? "," : "", startup_stage_names[i], startup_stage_ms[i]);
+	fprintf(fp, " },\n  \"frames\": [\n");
+
+	for (int age = n_history - 1; age >= 0; age--) {
+		fprintf(fp, "    { \"frame_ms\": %.4f, \"cpu_ms\": {", profiler_history_frame_ms(age));
+		for (int pass = 0; pass < N_PROFILE_PASSES; pass++)
+			fprintf(fp, "%s \"%s\": %.4f", pass ? "," : "", pass_names[pass], profiler_history_cpu_ms(age, (PROFILE_PASS)pass));
+		fprintf(fp, " }, \"gpu_ms\": {");
+
+		bool first = true;
+		for (int pass = 0; pass < N_PROFILE_PASSES; pass++) {
+			float gpu = profiler_history_gpu_ms(age, (PROFILE_PASS)pass);
+			if (gpu < 0.0f)
+				continue;
+			fprintf(fp, "%s \"%s\": %.4f", first ? "" : ",", pass_names[pass], gpu);
+			first = false;
+		}
+		fprintf(fp, " } }%s\n", age ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+	fclose(fp);
+
+	return true;
+}
+#endif
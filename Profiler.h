@@ -0,0 +1,78 @@
+﻿//
+//  Profiler.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+#include <stddef.h>
+
+// Debug builds, builds with ENABLE_PROFILER defined and the headless builds (USE_EGL or USE_OSMESA, whose
+// benchmark reports the CPU time of every pass) time the render passes on the CPU and with GPU timestamp
+// queries, print their averages every PROFILER_REPORT_FRAMES frames and keep a frame history for the overlay
+// and the CSV/JSON export. Other release builds compile the instrumentation out.
+#if defined(_DEBUG) || defined(ENABLE_PROFILER) || defined(USE_EGL) || defined(USE_OSMESA)
+#define PROFILER_ENABLED
+#endif
+
+// render passes, each run once per frame (once per view in the multi-view grid: the CPU times add up,
+// the GPU times are those of the last view); passes may nest
+// (PROFILE_BISTRO contains the cluster update, the pre-pass and the shading passes)
+typedef enum {
+	PROFILE_GRID,
+	PROFILE_SHADOWS,
+	PROFILE_BISTRO,
+	PROFILE_LIGHT_CLUSTERS,
+	PROFILE_DEPTH_PREPASS,
+	PROFILE_FORWARD,
+	PROFILE_GBUFFER,
+	PROFILE_DEFERRED_LIGHTING,
+	PROFILE_AXES,
+	PROFILE_SKYBOX,
+	PROFILE_CREATURES,
+	N_PROFILE_PASSES
+} PROFILE_PASS;
+
+#define PROFILER_HISTORY_FRAMES		(240)
+#define PROFILER_REPORT_FRAMES		(120)	// frames between the averages printed to stdout
+
+#ifdef PROFILER_ENABLED
+#define PROFILE_BEGIN(pass)				profiler_begin(pass)
+#define PROFILE_END(pass)				profiler_end(pass)
+#define PROFILE_END_FRAME()				profiler_end_frame()
+#define PROFILE_STARTUP_BEGIN(stage)	profiler_startup_begin(stage)
+#define PROFILE_STARTUP_END()			profiler_startup_end()
+#else
+#define PROFILE_BEGIN(pass)				((void)0)
+#define PROFILE_END(pass)				((void)0)
+#define PROFILE_END_FRAME()				((void)0)
+#define PROFILE_STARTUP_BEGIN(stage)	((void)0)
+#define PROFILE_STARTUP_END()			((void)0)
+#endif
+
+// Profiler.cpp
+double profiler_time_ms(void);	// monotonic clock, available in every build
+bool profiler_memory(size_t* resident_bytes, size_t* peak_bytes);	// of the process, in every build; false if unknown
+
+const char* profiler_pass_name(PROFILE_PASS pass);
+double profiler_last_frame_ms(PROFILE_PASS pass);	// CPU time in the frame just ended; 0 without PROFILER_ENABLED
+
+// PROFILER_ENABLED only
+void profiler_initialize(void);	// GPU timestamp queries; needs the GL context
+void profiler_begin(PROFILE_PASS pass);
+void profiler_end(PROFILE_PASS pass);
+void profiler_end_frame(void);	// latches the CPU times, collects last frame's GPU times
+void profiler_free(void);
+void profiler_startup_begin(const char* stage);
+void profiler_startup_end(void);
+// rolling history; age 0 is the newest frame with complete (CPU and GPU) data
+int profiler_history_length(void);
+float profiler_history_cpu_ms(int age, PROFILE_PASS pass);
+float profiler_history_gpu_ms(int age, PROFILE_PASS pass);	// negative when the pass did not run
+float profiler_history_frame_ms(int age);	// CPU time from one frame end to the next
+
+bool profiler_export_csv(const char* filename);
+bool profiler_export_json(const char* filename);
@@ -0,0 +1,165 @@
+﻿//
+//  Replay.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+//  File layout (little endian): header { magic, version, n_events, n_ticks }, then
+//  n_events records of 11 bytes { type, code, state, x (int16), y (int16), time_ms (uint32) }.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Profiler.h"
+#include "Replay.h"
+
+#define REPLAY_RECORD_BYTES	(11)
+
+static FILE* record_fp;
+static unsigned int record_n_events, record_n_ticks;
+static double record_start_ms;
+
+static FILE* replay_fp;
+static unsigned int replay_n_events, replay_n_ticks, replay_next_event;
+
+static void put_u16(unsigned char* p, unsigned short v) {
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+}
+
+static void put_u32(unsigned char* p, unsigned int v) {
+	put_u16(p, (unsigned short)v);
+	put_u16(p + 2, (unsigned short)(v >> 16));
+}
+
+static unsigned short get_u16(const unsigned char* p) {
+	return (unsigned short)(p[0] | (p[1] << 8));
+}
+
+static unsigned int get_u32(const unsigned char* p) {
+	return get_u16(p) | ((unsigned int)get_u16(p + 2) << 16);
+}
+
+static void write_header(FILE* fp, unsigned int n_events, unsigned int n_ticks) {
+	unsigned char header[16];
+
+	put_u32(header, REPLAY_FILE_MAGIC);
+	put_u32(header + 4, REPLAY_FILE_VERSION);
+	put_u32(header + 8, n_events);
+	put_u32(header + 12, n_ticks);
+	fwrite(header, sizeof(header), 1, fp);
+}
+
+bool begin_recording(const char* filename) {
+	record_fp = fopen(filename, "wb");
+	if (record_fp == NULL) {
+		fprintf(stderr, "Error: cannot write the recording %s\n", filename);
+		return false;
+	}
+
+	write_header(record_fp, 0, 0); // counts are filled in by end_recording()
+	record_n_events = record_n_ticks = 0;
+	record_start_ms = profiler_time_ms();
+	fprintf(stdout, " * Recording input to %s\n", filename);
+
+	return true;
+}
+
+bool is_recording(void) {
+	return record_fp != NULL;
+}
+
+void record_event(REPLAY_EVENT_TYPE type, int code, int state, int x, int y) {
+	unsigned char record[REPLAY_RECORD_BYTES];
+
+	if (record_fp == NULL)
+		return;
+
+	record[0] = (unsigned char)type;
+	record[1] = (unsigned char)code;
+	record[2] = (unsigned char)state;
+	put_u16(record + 3, (unsigned short)(short)x);
+	put_u16(record + 5, (unsigned short)(short)y);
+	put_u32(record + 7, (unsigned int)(profiler_time_ms() - record_start_ms));
+	fwrite(record, sizeof(record), 1, record_fp);
+
+	record_n_events++;
+	if (type == REPLAY_EVENT_TICK)
+		record_n_ticks++;
+}
+
+void end_recording(void) {
+	if (record_fp == NULL)
+		return;
+
+	fseek(record_fp, 0, SEEK_SET);
+	write_header(record_fp, record_n_events, record_n_ticks);
+	fclose(record_fp);
+	record_fp = NULL;
+	fprintf(stdout, " * Recorded %u input events over %u ticks\n", record_n_events - record_n_ticks, record_n_ticks);
+}
+
+bool open_replay(const char* filename) {
+	unsigned char header[16];
+
+	replay_fp = fopen(filename, "rb");
+	if (replay_fp == NULL) {
+		fprintf(stderr, "Error: cannot open the recording %s\n", filename);
+		return false;
+	}
+
+	if (fread(header, sizeof(header), 1, replay_fp) != 1 || get_u32(header) != REPLAY_FILE_MAGIC
+		|| get_u32(header + 4) != REPLAY_FILE_VERSION) {
+		fprintf(stderr, "Error: %s is not a recording of this version\n", filename);
+		fclose(replay_fp);
+		replay_fp = NULL;
+		return false;
+	}
+
+	replay_n_events = get_u32(header + 8);
+	replay_n_ticks = get_u32(header + 12);
+	replay_next_event = 0;
+	fprintf(stdout, " * Replaying %s: %u input events over %u ticks\n", filename, replay_n_events - replay_n_ticks, replay_n_ticks);
+
+	return true;
+}
+
+bool is_replaying(void) {
+	return replay_fp != NULL;
+}
+
+bool read_replay_event(REPLAY_EVENT* pEvent) {
+	unsigned char record[REPLAY_RECORD_BYTES];
+
+	if (replay_fp == NULL || replay_next_event >= replay_n_events)
+		return false;
+	if (fread(record, sizeof(record), 1, replay_fp) != 1) {
+		fprintf(stderr, "Error: the recording ends after %u of %u events\n", replay_next_event, replay_n_events);
+		replay_n_events = replay_next_event;
+		return false;
+	}
+
+	pEvent->type = record[0];
+	pEvent->code = record[1];
+	pEvent->state = record[2];
+	pEvent->x = (short)get_u16(record + 3);
+	pEvent->y = (short)get_u16(record + 5);
+	pEvent->time_ms = get_u32(record + 7);
+	replay_next_event++;
+
+	return true;
+}
+
+int get_replay_tick_count(void) {
+	return (int)replay_n_ticks;
+}
+
+void close_replay(void) {
+	if (replay_fp != NULL)
+		fclose(replay_fp);
+	replay_fp = NULL;
+}
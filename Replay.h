@@ -0,0 +1,45 @@
+﻿//
+//  Replay.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+// Input recording: every GLUT input event and every simulation tick, in the order they reached
+// the program. Replaying the events between ticks and then ticking reproduces the session exactly.
+typedef enum {
+	REPLAY_EVENT_TICK,			// update_scene()
+	REPLAY_EVENT_KEY,			// keyboard(code, x, y)
+	REPLAY_EVENT_SPECIAL,		// special(code, x, y)
+	REPLAY_EVENT_SPECIAL_UP,	// specialup(code, x, y)
+	REPLAY_EVENT_MOUSE,			// mousepress(code, state, x, y)
+	REPLAY_EVENT_MOTION,		// mousemove(x, y)
+	REPLAY_EVENT_RESHAPE,		// window size (x, y)
+	N_REPLAY_EVENT_TYPES
+} REPLAY_EVENT_TYPE;
+
+typedef struct {
+	unsigned char	type;		// REPLAY_EVENT_TYPE
+	unsigned char	code;		// key or mouse button
+	unsigned char	state;		// mouse button state
+	short			x, y;
+	unsigned int	time_ms;	// since the start of the recording; informational, replay is tick driven
+} REPLAY_EVENT;
+
+#define REPLAY_FILE_MAGIC		(0x4C505242)	// "BRPL"
+#define REPLAY_FILE_VERSION		(1)
+
+// Replay.cpp
+bool begin_recording(const char* filename);
+bool is_recording(void);
+void record_event(REPLAY_EVENT_TYPE type, int code, int state, int x, int y);
+void end_recording(void);	// writes the event and tick counts into the header
+
+bool open_replay(const char* filename);
+bool is_replaying(void);
+bool read_replay_event(REPLAY_EVENT* pEvent);	// false at the end of the recording
+int get_replay_tick_count(void);
+void close_replay(void);
@@ -0,0 +1,460 @@
+﻿//
+//  SceneFile.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+
+#include "LoadScene.h"
+#include "SceneFile.h"
+
+#if defined(_WIN32)
+#define fseek_64	_fseeki64	// the geometry of larger scenes passes 2 GB
+#define ftell_64	_ftelli64
+#else
+#define fseek_64	fseeko
+#define ftell_64	ftello
+#endif
+
+#define SCENE_FILE_MAGIC	(0x31535842)	// "BXS1"
+#define N_SCENE_CHUNKS		(5)		// written
+#define SCENE_MAX_CHUNKS	(256)	// read
+
+typedef struct {
+	unsigned int		magic, version;
+	unsigned int		n_chunks, reserved;
+	unsigned long long	source_key;		// of the legacy file it was written from
+} SCENE_FILE_HEADER;
+
+typedef struct {
+	unsigned int		tag, version;
+	unsigned long long	offset, size;
+} SCENE_CHUNK;
+
+typedef struct {
+	CAMERA	camera;
+	float	ambient_light_color[3];
+	float	background_color[3];
+	int		n_textures, n_lights, n_materials, reserved;
+} SCENE_FILE_GLOBALS;	// followed by the string of every texture
+
+// a material without pointers
+typedef struct {
+	int						geometry_type, shading_type;
+	float					geometry[16];	// the union for the types other than triangular meshes
+	unsigned char			shading[sizeof(((MATERIAL*)0)->shading)];
+	int						tex_ids[4];		// diffuse, normal map, specular, emissive
+	int						object_id, reserved;
+	GEOMETRY_AABB			aabb;			// as in the legacy file
+	SCENE_MATERIAL_ENTRY	entry;
+} SCENE_FILE_MATERIAL;
+
+typedef struct {
+	float3		position[NUM_TRI_VERTICES];
+	float3		normal_vetcor[NUM_TRI_VERTICES];
+	TRIACCEL	accel;
+	float3		tangent;
+	float3		bitangent;
+} SCENE_FILE_TRIANGLE;	// the texture coordinates of all triangles of a material follow them
+
+static_assert(sizeof(GEOMETRY_RECTANGLE) <= sizeof(((SCENE_FILE_MATERIAL*)0)->geometry), "geometry union");
+
+static std::vector<SCENE_MATERIAL_ENTRY> material_entries;
+static unsigned long long scene_file_size;	// as opened
+static std::atomic<int> next_material;
+static std::atomic<bool> load_failed;
+
+unsigned long long get_scene_source_key(bool* legacy_exists) {
+	unsigned long long key = 0xcbf29ce484222325ull; // FNV-1a
+	unsigned long long values[2] = { 0, 0 };
+	struct stat file_stat;
+	bool exists = stat(SCENE_LEGACY_FILE, &file_stat) == 0;
+
+	if (legacy_exists != NULL)
+		*legacy_exists = exists;
+	if (!exists) {
+		FILE* fp = fopen(SCENE_FILE, "rb");
+		SCENE_FILE_HEADER header;
+
+		if (fp == NULL)
+			return 0;
+		bool valid = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == SCENE_FILE_MAGIC;
+		fclose(fp);
+		return valid ? header.source_key : 0;
+	}
+	values[0] = (unsigned long long)file_stat.st_size;
+	values[1] = (unsigned long long)file_stat.st_mtime;
+	const unsigned char* bytes = (const unsigned char*)values;
+	for (size_t i = 0; i < sizeof(values); i++) {
+		key ^= bytes[i];
+		key *= 0x100000001b3ull;
+	}
+	return key;
+}
+
+static const SCENE_CHUNK* find_chunk(const std::vector<SCENE_CHUNK>& chunks, unsigned int tag) {
+	for (const SCENE_CHUNK& chunk : chunks)
+		if (chunk.tag == tag && chunk.version <= SCENE_FILE_VERSION)
+			return &chunk;
+	return NULL;
+}
+
+// the sizes and counts come from the file: nothing is allocated before they are known to fit in it
+static bool is_range_in_file(unsigned long long offset, unsigned long long size) {
+	return offset <= scene_file_size && size <= scene_file_size - offset;
+}
+
+static bool is_chunk_in_file(const SCENE_CHUNK* pChunk) {
+	return pChunk != NULL && is_range_in_file(pChunk->offset, pChunk->size);
+}
+
+static bool read_chunk(FILE* fp, const SCENE_CHUNK* pChunk, std::vector<unsigned char>* bytes) {
+	if (!is_chunk_in_file(pChunk) || fseek_64(fp, (long long)pChunk->offset, SEEK_SET) != 0)
+		return false;
+	bytes->resize((size_t)pChunk->size);
+	return fread(bytes->data(), 1, bytes->size(), fp) == bytes->size();
+}
+
+// the triangles, then 3 texture coordinates per uv set and triangle, exactly filling the geometry of the entry
+static bool is_entry_valid(const SCENE_MATERIAL_ENTRY* pEntry) {
+	if (pEntry->n_triangles < 0 || pEntry->n_uv_sets < 0 || !is_range_in_file(pEntry->offset, pEntry->size))
+		return false;
+	unsigned long long triangle_bytes = sizeof(SCENE_FILE_TRIANGLE) * (unsigned long long)pEntry->n_triangles;
+	unsigned long long uv_set_bytes = sizeof(float2) * NUM_TRI_VERTICES * (unsigned long long)pEntry->n_triangles;
+	if (triangle_bytes > pEntry->size)
+		return false;
+	unsigned long long uv_bytes = pEntry->size - triangle_bytes;
+	if (uv_set_bytes == 0)
+		return uv_bytes == 0;
+	return uv_bytes % uv_set_bytes == 0 && uv_bytes / uv_set_bytes == (unsigned long long)pEntry->n_uv_sets;
+}
+
+static void set_material(MATERIAL* pMaterial, const SCENE_FILE_MATERIAL* pFileMaterial) {
+	memset(pMaterial, 0, sizeof(MATERIAL));
+	pMaterial->geometry_type = (GEOMETRY_TYPE)pFileMaterial->geometry_type;
+	if (pMaterial->geometry_type == GEOMETRY_TYPE_TRIANGULAR_MESH) {
+		pMaterial->geometry.tm.n_triangle = pFileMaterial->entry.n_triangles;
+		pMaterial->geometry.tm.n_textures = pFileMaterial->entry.n_uv_sets;
+		pMaterial->geometry.tm.object_id = pFileMaterial->object_id;
+		pMaterial->geometry.tm.aabb = pFileMaterial->aabb;
+	}
+	else
+		memcpy(&pMaterial->geometry, pFileMaterial->geometry, sizeof(GEOMETRY_RECTANGLE));
+	pMaterial->shading_type = (SHADING_TYPE)pFileMaterial->shading_type;
+	memcpy(&pMaterial->shading, pFileMaterial->shading, sizeof(pMaterial->shading));
+	pMaterial->diffuseTexId = pFileMaterial->tex_ids[0];
+	pMaterial->normalMapTexId = pFileMaterial->tex_ids[1];
+	pMaterial->specularTexId = pFileMaterial->tex_ids[2];
+	pMaterial->emissiveTexId = pFileMaterial->tex_ids[3];
+}
+
+bool open_scene_file(SCENE* pScene) {
+	FILE* fp = fopen(SCENE_FILE, "rb");
+	SCENE_FILE_HEADER header;
+	std::vector<SCENE_CHUNK> chunks;
+	std::vector<unsigned char> strings, globals, lights, materials;
+	bool legacy_exists;
+
+	if (fp == NULL)
+		return false;
+	long long file_size = fseek_64(fp, 0, SEEK_END) == 0 ? ftell_64(fp) : -1;
+	scene_file_size = file_size > 0 ? (unsigned long long)file_size : 0;
+	unsigned long long legacy_key = get_scene_source_key(&legacy_exists);
+	bool valid = file_size > 0 && fseek_64(fp, 0, SEEK_SET) == 0 && fread(&header, sizeof(header), 1, fp) == 1 && header.magic == SCENE_FILE_MAGIC
+		&& header.version <= SCENE_FILE_VERSION && header.n_chunks <= SCENE_MAX_CHUNKS && (!legacy_exists || header.source_key == legacy_key);
+	if (valid) {
+		chunks.resize(header.n_chunks);
+		valid = fread(chunks.data(), sizeof(SCENE_CHUNK), chunks.size(), fp) == chunks.size()
+			&& read_chunk(fp, find_chunk(chunks, SCENE_CHUNK_STRINGS), &strings)
+			&& read_chunk(fp, find_chunk(chunks, SCENE_CHUNK_SCENE), &globals)
+			&& read_chunk(fp, find_chunk(chunks, SCENE_CHUNK_LIGHTS), &lights)
+			&& read_chunk(fp, find_chunk(chunks, SCENE_CHUNK_MATERIALS), &materials)
+			&& is_chunk_in_file(find_chunk(chunks, SCENE_CHUNK_GEOMETRY));
+	}
+	fclose(fp);
+
+	// the sizes of the chunks must agree with their counts
+	SCENE_FILE_GLOBALS* pGlobals = (SCENE_FILE_GLOBALS*)globals.data();
+	unsigned int n_strings = 0;
+	if (valid && strings.size() >= sizeof(unsigned int))
+		memcpy(&n_strings, strings.data(), sizeof(unsigned int));
+	size_t string_table = sizeof(unsigned int) * (2 + (size_t)n_strings);
+	valid = valid && strings.size() >= string_table && globals.size() >= sizeof(SCENE_FILE_GLOBALS)
+		&& pGlobals->n_textures >= 0 && pGlobals->n_textures <= MAX_TEXTURE_FILES && pGlobals->n_lights >= 0 && pGlobals->n_materials >= 0
+		&& globals.size() == sizeof(SCENE_FILE_GLOBALS) + sizeof(int) * pGlobals->n_textures
+		&& lights.size() == sizeof(LIGHT) * pGlobals->n_lights
+		&& materials.size() == sizeof(SCENE_FILE_MATERIAL) * pGlobals->n_materials;
+	for (int materialIdx = 0; valid && materialIdx < pGlobals->n_materials; materialIdx++) {
+		const SCENE_FILE_MATERIAL* pFileMaterial = (const SCENE_FILE_MATERIAL*)materials.data() + materialIdx;
+		valid = pFileMaterial->geometry_type != GEOMETRY_TYPE_TRIANGULAR_MESH || is_entry_valid(&pFileMaterial->entry);
+	}
+	if (!valid) {
+		if (!chunks.empty())
+			fprintf(stderr, "Error: %s is corrupt or out of date\n", SCENE_FILE);
+		return false;
+	}
+
+	memset(pScene, 0, sizeof(SCENE));
+	pScene->camera = pGlobals->camera;
+	memcpy(pScene->ambient_light_color, pGlobals->ambient_light_color, sizeof(pScene->ambient_light_color));
+	memcpy(pScene->background_color, pGlobals->background_color, sizeof(pScene->background_color));
+
+	const unsigned int* string_offsets = (const unsigned int*)(strings.data() + sizeof(unsigned int));
+	const char* string_bytes = (const char*)strings.data() + string_table;
+	const int* texture_strings = (const int*)(globals.data() + sizeof(SCENE_FILE_GLOBALS));
+	pScene->n_textures = pGlobals->n_textures;
+	for (int texId = 0; texId < pScene->n_textures; texId++) {
+		unsigned int s = (unsigned int)texture_strings[texId];
+		if (s >= n_strings || string_offsets[s] > string_offsets[s + 1] || string_table + string_offsets[s + 1] > strings.size())
+			continue;
+		size_t length = min(string_offsets[s + 1] - string_offsets[s], sizeof(pScene->texture_file_name[texId]) - 1);
+		memcpy(pScene->texture_file_name[texId], string_bytes + string_offsets[s], length);
+	}
+
+	pScene->n_lights = pGlobals->n_lights;
+	pScene->light_list = (LIGHT*)SCENE_MALLOC(sizeof(LIGHT) * max(pScene->n_lights, 1));
+	memcpy(pScene->light_list, lights.data(), lights.size());
+
+	pScene->n_materials = pGlobals->n_materials;
+	pScene->material_list = (MATERIAL*)SCENE_MALLOC(sizeof(MATERIAL) * max(pScene->n_materials, 1));
+	material_entries.resize(pScene->n_materials);
+	for (int materialIdx = 0; materialIdx < pScene->n_materials; materialIdx++) {
+		const SCENE_FILE_MATERIAL* pFileMaterial = (const SCENE_FILE_MATERIAL*)materials.data() + materialIdx;
+		set_material(&pScene->material_list[materialIdx], pFileMaterial);
+		material_entries[materialIdx] = pFileMaterial->entry;
+	}
+	return true;
+}
+
+const SCENE_MATERIAL_ENTRY* get_scene_material_entry(int materialIdx) {
+	if (materialIdx < 0 || materialIdx >= (int)material_entries.size())
+		return NULL;
+	return &material_entries[materialIdx];
+}
+
+bool load_scene_material(SCENE* pScene, int materialIdx) {
+	GEOMETRY_TRIANGULAR_MESH* pMesh = &pScene->material_list[materialIdx].geometry.tm;
+	const SCENE_MATERIAL_ENTRY* pEntry = &material_entries[materialIdx];
+
+	if (pScene->material_list[materialIdx].geometry_type != GEOMETRY_TYPE_TRIANGULAR_MESH || pMesh->triangle_list != NULL)
+		return true;
+
+	if (!is_entry_valid(pEntry)) { // as open_scene_file() did, before anything is allocated from it
+		fprintf(stderr, "Error: cannot read material %d of %s\n", materialIdx, SCENE_FILE);
+		return false;
+	}
+	size_t n_triangles = (size_t)pEntry->n_triangles, n_uvs = NUM_TRI_VERTICES * n_triangles * pEntry->n_uv_sets;
+	std::vector<SCENE_FILE_TRIANGLE> file_triangles(n_triangles);
+	std::vector<float2> uvs(n_uvs);
+	FILE* fp = fopen(SCENE_FILE, "rb"); // one per call, so that the materials can be read in parallel
+	bool loaded = fp != NULL && fseek_64(fp, (long long)pEntry->offset, SEEK_SET) == 0
+		&& fread(file_triangles.data(), sizeof(SCENE_FILE_TRIANGLE), n_triangles, fp) == n_triangles
+		&& fread(uvs.data(), sizeof(float2), n_uvs, fp) == n_uvs;
+	if (fp != NULL)
+		fclose(fp);
+	if (!loaded) {
+		fprintf(stderr, "Error: cannot read material %d of %s\n", materialIdx, SCENE_FILE);
+		return false;
+	}
+
+	TRIANGLE* triangles = (TRIANGLE*)SCENE_MALLOC(sizeof(TRIANGLE) * max(n_triangles, (size_t)1));
+	const float2* uv = uvs.data();
+	for (size_t triIdx = 0; triIdx < n_triangles; triIdx++) {
+		TRIANGLE* tri = &triangles[triIdx];
+		const SCENE_FILE_TRIANGLE* pFileTri = &file_triangles[triIdx];
+
+		memcpy(tri->position, pFileTri->position, sizeof(tri->position));
+		memcpy(tri->normal_vetcor, pFileTri->normal_vetcor, sizeof(tri->normal_vetcor));
+		tri->accel = pFileTri->accel;
+		tri->tangent = pFileTri->tangent;
+		tri->bitangent = pFileTri->bitangent;
+		for (int vertexIdx = 0; vertexIdx < NUM_TRI_VERTICES; vertexIdx++) {
+			tri->texture_list[vertexIdx] = (float2*)SCENE_MALLOC(sizeof(float2) * pEntry->n_uv_sets);
+			memcpy(tri->texture_list[vertexIdx], uv, sizeof(float2) * pEntry->n_uv_sets);
+			uv += pEntry->n_uv_sets;
+		}
+	}
+	pMesh->triangle_list = triangles;
+	return true;
+}
+
+static void load_material_job(SCENE* pScene) {
+	for (int materialIdx = next_material++; materialIdx < pScene->n_materials; materialIdx = next_material++)
+		if (!load_scene_material(pScene, materialIdx))
+			load_failed = true;
+}
+
+bool load_scene_materials(SCENE* pScene, int n_threads) {
+	std::thread threads[SCENE_MAX_LOADER_THREADS];
+
+	n_threads = n_threads > 0 ? n_threads : (int)std::thread::hardware_concurrency();
+	n_threads = max(1, min(n_threads, SCENE_MAX_LOADER_THREADS));
+	next_material = 0;
+	load_failed = false;
+	for (int t = 1; t < n_threads; t++)
+		threads[t] = std::thread(load_material_job, pScene);
+	load_material_job(pScene);
+	for (int t = 1; t < n_threads; t++)
+		threads[t].join();
+	return !load_failed;
+}
+
+void close_scene_file(void) {
+	std::vector<SCENE_MATERIAL_ENTRY>().swap(material_entries);
+}
+
+bool write_scene_file(const SCENE* pScene) {
+	SCENE_FILE_HEADER header = { SCENE_FILE_MAGIC, SCENE_FILE_VERSION, N_SCENE_CHUNKS, 0, 0 };
+	SCENE_CHUNK chunks[N_SCENE_CHUNKS] = {
+		{ SCENE_CHUNK_STRINGS, SCENE_FILE_VERSION, 0, 0 }, { SCENE_CHUNK_SCENE, SCENE_FILE_VERSION, 0, 0 },
+		{ SCENE_CHUNK_LIGHTS, SCENE_FILE_VERSION, 0, 0 }, { SCENE_CHUNK_MATERIALS, SCENE_FILE_VERSION, 0, 0 },
+		{ SCENE_CHUNK_GEOMETRY, SCENE_FILE_VERSION, 0, 0 } };
+
+	header.source_key = get_scene_source_key(NULL);
+
+	// the strings, each once
+	std::unordered_map<std::string, int> string_ids;
+	std::vector<unsigned int> string_offsets(1, 0);
+	std::string string_bytes;
+	std::vector<int> texture_strings(pScene->n_textures);
+	for (int texId = 0; texId < pScene->n_textures; texId++) {
+		std::string name(pScene->texture_file_name[texId], strnlen(pScene->texture_file_name[texId], sizeof(pScene->texture_file_name[texId])));
+		auto found = string_ids.find(name);
+		if (found == string_ids.end()) {
+			found = string_ids.emplace(name, (int)string_ids.size()).first;
+			string_bytes += name;
+			string_offsets.push_back((unsigned int)string_bytes.size());
+		}
+		texture_strings[texId] = found->second;
+	}
+	unsigned int n_strings = (unsigned int)string_ids.size();
+
+	SCENE_FILE_GLOBALS globals;
+	memset(&globals, 0, sizeof(globals));
+	globals.camera = pScene->camera;
+	memcpy(globals.ambient_light_color, pScene->ambient_light_color, sizeof(globals.ambient_light_color));
+	memcpy(globals.background_color, pScene->background_color, sizeof(globals.background_color));
+	globals.n_textures = pScene->n_textures;
+	globals.n_lights = pScene->n_lights;
+	globals.n_materials = pScene->n_materials;
+
+	chunks[0].size = sizeof(unsigned int) * (1 + string_offsets.size()) + string_bytes.size();
+	chunks[1].size = sizeof(SCENE_FILE_GLOBALS) + sizeof(int) * pScene->n_textures;
+	chunks[2].size = sizeof(LIGHT) * pScene->n_lights;
+	chunks[3].size = sizeof(SCENE_FILE_MATERIAL) * pScene->n_materials;
+	chunks[0].offset = sizeof(header) + sizeof(chunks);
+	for (int c = 1; c < N_SCENE_CHUNKS; c++)
+		chunks[c].offset = chunks[c - 1].offset + chunks[c - 1].size;
+
+	// the table of contents: the geometry of material m follows that of material m - 1
+	std::vector<SCENE_FILE_MATERIAL> materials(pScene->n_materials);
+	unsigned long long offset = chunks[4].offset;
+	for (int materialIdx = 0; materialIdx < pScene->n_materials; materialIdx++) {
+		const MATERIAL* pMaterial = &pScene->material_list[materialIdx];
+		SCENE_FILE_MATERIAL* pFileMaterial = &materials[materialIdx];
+
+		memset(pFileMaterial, 0, sizeof(SCENE_FILE_MATERIAL));
+		pFileMaterial->geometry_type = pMaterial->geometry_type;
+		pFileMaterial->shading_type = pMaterial->shading_type;
+		memcpy(pFileMaterial->shading, &pMaterial->shading, sizeof(pFileMaterial->shading));
+		pFileMaterial->tex_ids[0] = pMaterial->diffuseTexId;
+		pFileMaterial->tex_ids[1] = pMaterial->normalMapTexId;
+		pFileMaterial->tex_ids[2] = pMaterial->specularTexId;
+		pFileMaterial->tex_ids[3] = pMaterial->emissiveTexId;
+		if (pMaterial->geometry_type != GEOMETRY_TYPE_TRIANGULAR_MESH) {
+			memcpy(pFileMaterial->geometry, &pMaterial->geometry, sizeof(GEOMETRY_RECTANGLE));
+			pFileMaterial->entry.offset = offset;
+			continue;
+		}
+
+		const GEOMETRY_TRIANGULAR_MESH* pMesh = &pMaterial->geometry.tm;
+		SCENE_MATERIAL_ENTRY* pEntry = &pFileMaterial->entry;
+		pFileMaterial->object_id = pMesh->object_id;
+		pFileMaterial->aabb = pMesh->aabb;
+		pEntry->n_triangles = pMesh->n_triangle;
+		pEntry->n_uv_sets = pMesh->n_textures;
+		if (pMesh->n_triangle > 0) {
+			float* p_min = &pEntry->bounds.p_min.x, * p_max = &pEntry->bounds.p_max.x;
+			for (int k = 0; k < 3; k++) {
+				p_min[k] = (&pMesh->triangle_list[0].position[0].x)[k];
+				p_max[k] = p_min[k];
+			}
+			for (int triIdx = 0; triIdx < pMesh->n_triangle; triIdx++)
+				for (int vertexIdx = 0; vertexIdx < NUM_TRI_VERTICES; vertexIdx++)
+					for (int k = 0; k < 3; k++) {
+						float p = (&pMesh->triangle_list[triIdx].position[vertexIdx].x)[k];
+						p_min[k] = min(p_min[k], p);
+						p_max[k] = max(p_max[k], p);
+					}
+		}
+		pEntry->offset = offset;
+		pEntry->size = (sizeof(SCENE_FILE_TRIANGLE) + NUM_TRI_VERTICES * sizeof(float2) * pMesh->n_textures) * (unsigned long long)pMesh->n_triangle;
+		offset += pEntry->size;
+	}
+	chunks[4].size = offset - chunks[4].offset;
+
+	FILE* fp = fopen(SCENE_FILE, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Error: cannot write %s\n", SCENE_FILE);
+		return false;
+	}
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(chunks, sizeof(chunks), 1, fp);
+	fwrite(&n_strings, sizeof(n_strings), 1, fp);
+	fwrite(string_offsets.data(), sizeof(unsigned int), string_offsets.size(), fp);
+	fwrite(string_bytes.data(), 1, string_bytes.size(), fp);
+	fwrite(&globals, sizeof(globals), 1, fp);
+	fwrite(texture_strings.data(), sizeof(int), texture_strings.size(), fp);
+	fwrite(pScene->light_list, sizeof(LIGHT), pScene->n_lights, fp);
+	fwrite(materials.data(), sizeof(SCENE_FILE_MATERIAL), materials.size(), fp);
+
+	std::vector<SCENE_FILE_TRIANGLE> file_triangles;
+	std::vector<float2> uvs;
+	for (int materialIdx = 0; materialIdx < pScene->n_materials; materialIdx++) {
+		const MATERIAL* pMaterial = &pScene->material_list[materialIdx];
+		if (pMaterial->geometry_type != GEOMETRY_TYPE_TRIANGULAR_MESH)
+			continue;
+
+		const GEOMETRY_TRIANGULAR_MESH* pMesh = &pMaterial->geometry.tm;
+		file_triangles.resize(pMesh->n_triangle);
+		uvs.resize(NUM_TRI_VERTICES * (size_t)pMesh->n_triangle * pMesh->n_textures);
+		float2* uv = uvs.data();
+		for (int triIdx = 0; triIdx < pMesh->n_triangle; triIdx++) {
+			const TRIANGLE* tri = &pMesh->triangle_list[triIdx];
+			SCENE_FILE_TRIANGLE* pFileTri = &file_triangles[triIdx];
+
+			memcpy(pFileTri->position, tri->position, sizeof(pFileTri->position));
+			memcpy(pFileTri->normal_vetcor, tri->normal_vetcor, sizeof(pFileTri->normal_vetcor));
+			pFileTri->accel = tri->accel;
+			pFileTri->tangent = tri->tangent;
+			pFileTri->bitangent = tri->bitangent;
+			for (int vertexIdx = 0; vertexIdx < NUM_TRI_VERTICES; vertexIdx++) {
+				memcpy(uv, tri->texture_list[vertexIdx], sizeof(float2) * pMesh->n_textures);
+				uv += pMesh->n_textures;
+			}
+		}
+		fwrite(file_triangles.data(), sizeof(SCENE_FILE_TRIANGLE), file_triangles.size(), fp);
+		fwrite(uvs.data(), sizeof(float2), uvs.size(), fp);
+	}
+	bool written = ferror(fp) == 0;
+	fclose(fp);
+	if (!written) {
+		fprintf(stderr, "Error: cannot write %s\n", SCENE_FILE);
+		remove(SCENE_FILE);
+		return false;
+	}
+	return true;
+}
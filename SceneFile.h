@@ -0,0 +1,52 @@
+﻿//
+//  SceneFile.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+#include "LoadScene.h"
+
+// The chunked scene file. A header and a directory of chunks (tag, version, offset, size) come first, so
+// that any chunk is found without reading the ones before it, and readers skip chunks they do not know:
+//   SCENE_CHUNK_STRINGS	the interned strings, each distinct texture file name once
+//   SCENE_CHUNK_SCENE		camera, ambient and background colors, and the string of every texture
+//   SCENE_CHUNK_LIGHTS		the light list
+//   SCENE_CHUNK_MATERIALS	the table of contents: per material its shading and texture ids, its triangle
+//							and uv set counts, bounds, and the offset and size of its geometry
+//   SCENE_CHUNK_GEOMETRY	per material its triangles without pointers, then their texture coordinates
+// The file is written from the legacy .bin (a raw dump of SCENE) the first time and whenever the size or
+// modification time of that file changes. After open_scene_file() the geometry of the materials can be
+// loaded in any order, in parallel or only when needed.
+#define SCENE_FILE					"Scene/BistroExterior.bxs"
+#define SCENE_LEGACY_FILE			"Scene/BistroExterior.bin"	// keys the files derived from the scene, see get_scene_source_key()
+#define SCENE_FILE_VERSION			(1)
+#define SCENE_MAX_LOADER_THREADS	(16)
+
+#define SCENE_CHUNK_STRINGS		(0x53525453)	// "STRS"
+#define SCENE_CHUNK_SCENE		(0x454e4353)	// "SCNE"
+#define SCENE_CHUNK_LIGHTS		(0x5448474c)	// "LGHT"
+#define SCENE_CHUNK_MATERIALS	(0x4c52544d)	// "MTRL"
+#define SCENE_CHUNK_GEOMETRY	(0x4d4f4547)	// "GEOM"
+
+typedef struct {
+	int					n_triangles, n_uv_sets;
+	GEOMETRY_AABB		bounds;			// of the triangles
+	unsigned long long	offset, size;	// of the geometry, in bytes from the start of the file
+} SCENE_MATERIAL_ENTRY;
+
+// SceneFile.cpp
+// all but the triangles: the triangle lists stay NULL until their material is loaded; false if the file
+// is missing, corrupt or older than the legacy file
+bool open_scene_file(SCENE* pScene);
+const SCENE_MATERIAL_ENTRY* get_scene_material_entry(int materialIdx);
+bool load_scene_material(SCENE* pScene, int materialIdx);	// any thread, different materials; true if loaded before
+bool load_scene_materials(SCENE* pScene, int n_threads);	// the ones not loaded yet; 0 threads for all cores
+void close_scene_file(void);
+bool write_scene_file(const SCENE* pScene);	// a fully loaded scene
+// FNV-1a of the size and modification time of SCENE_LEGACY_FILE, for the chunked file and the AO and tile
+// caches; without the legacy file, the key of the one SCENE_FILE was written from (0 if neither exists)
+unsigned long long get_scene_source_key(bool* legacy_exists);	// legacy_exists may be NULL
@@ -0,0 +1,12 @@
+#version 400
+// position-only stream of the depth pre-pass; gl_Position must match PBR_Tx.vert bit for bit
+layout (location = 0) in vec3 a_position;
+
+uniform mat4 u_ModelViewProjectionMatrix;
+
+invariant gl_Position;
+
+void main()
+{
+	gl_Position = u_ModelViewProjectionMatrix * vec4(a_position, 1.0f);
+}
@@ -0,0 +1,41 @@
+#version 400
+// lighting pass of the deferred path: shades every covered pixel of the G-buffer once
+layout (location = 0) out vec4 fragColor;
+
+in vec2 v_tex_coord;
+
+uniform sampler2D u_gAlbedo;
+uniform sampler2D u_gNormal;
+uniform sampler2D u_gMetallicRoughness;
+uniform sampler2D u_gEmissive;
+uniform sampler2D u_gDepth;
+
+uniform mat4 u_InvProjectionMatrix;
+
+// PBR_Lighting.frag
+vec3 shadePBR(vec3 P, vec3 N, vec3 albedo, float metallic, float roughness, float ao, vec3 emissive);
+
+vec3 decodeNormal(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(u_gDepth, texel, 0).r;
+    if (depth == 1.0)
+        discard;    // nothing of the Bistro was drawn here; keep the background
+
+    vec4 P = u_InvProjectionMatrix * vec4(vec3(v_tex_coord, depth) * 2.0 - 1.0, 1.0);
+    vec3 albedo = texelFetch(u_gAlbedo, texel, 0).rgb;
+    vec3 N = decodeNormal(texelFetch(u_gNormal, texel, 0).xy);
+    vec3 mra = texelFetch(u_gMetallicRoughness, texel, 0).rgb;
+    vec3 emissive = texelFetch(u_gEmissive, texel, 0).rgb;
+
+    fragColor = vec4(shadePBR(P.xyz / P.w, N, pow(albedo, vec3(2.2)), mra.r, mra.g, mra.b, emissive), 1.0);
+    gl_FragDepth = depth;   // so the axes, skybox and creatures still depth test against the Bistro
+}
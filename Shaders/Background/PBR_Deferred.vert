@@ -0,0 +1,12 @@
+#version 400
+// fullscreen triangle, no vertex attributes
+
+out vec2 v_tex_coord;
+
+void main()
+{
+	vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	v_tex_coord = position;
+
+	gl_Position = vec4(position * 2.0f - 1.0f, 0.0f, 1.0f);
+}
@@ -0,0 +1,36 @@
+#version 400
+// G-buffer pass of the deferred path; lighting is done once per pixel in PBR_Deferred.frag
+layout (location = 0) out vec4 g_albedo;            // RGBA8: albedo (gamma encoded)
+layout (location = 1) out vec2 g_normal;            // RG16F: octahedral eye-space normal
+layout (location = 2) out vec4 g_metallicRoughness; // RGBA8: metallic, roughness, ao
+layout (location = 3) out vec3 g_emissive;          // R11F_G11F_B10F
+
+in vec3 v_normal_EC;
+in vec2 v_tex_coord;
+in vec4 v_tangent_EC;
+in float v_ao;
+
+// PBR_Material.frag
+void getMaterial(vec3 normal_EC, vec4 tangent_EC, vec2 tex_coord,
+    out vec3 albedo, out float metallic, out float roughness, out float ao, out vec3 emissive, out vec3 N);
+
+vec2 encodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return n.xy;
+}
+
+void main()
+{
+    vec3 albedo, emissive, N;
+    float metallic, roughness, ao;
+    getMaterial(v_normal_EC, v_tangent_EC, v_tex_coord, albedo, metallic, roughness, ao, emissive, N);
+    ao *= v_ao;
+
+    g_albedo = vec4(albedo, 1.0);
+    g_normal = encodeNormal(N);
+    g_metallicRoughness = vec4(metallic, roughness, ao, 1.0);
+    g_emissive = emissive;
+}
@@ -0,0 +1,204 @@
+#version 400
+// Cook-Torrance shading over the clustered light list, linked into both the
+// forward (PBR_Tx.frag) and the deferred lighting (PBR_Deferred.frag) programs.
+
+// lights, binned into view-space clusters on the CPU (LightCluster.cpp)
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+
+#define LIGHT_POINT 0
+#define LIGHT_DIRECTIONAL 1
+
+uniform samplerBuffer u_lightData;          // 4 texels per light: position+radius, color+type, attenuation+spot_exp, spot_dir+cos_cutoff
+uniform usamplerBuffer u_clusterGrid;       // (offset, count) per cluster
+uniform usamplerBuffer u_clusterLightIndex;
+uniform int u_global_light_count;           // lights [0, u_global_light_count) reach every cluster
+uniform vec4 u_cluster_params;              // near slice depth, slice scale, tile size in pixels
+
+// sun shadow: the static map is rendered once, the dynamic one holds only the moving objects;
+// both use the same light projection, so a fragment is lit when neither map occludes it
+uniform sampler2DShadow u_staticShadowMap;
+uniform sampler2DShadow u_dynamicShadowMap;
+uniform mat4 u_ShadowMatrix;                // eye coordinates -> shadow map [0, 1]^3
+uniform int u_shadow_light_index;           // global light that casts the shadow, -1 without shadows
+
+// diffuse irradiance / pi of the skybox as order-2 spherical harmonics (SphericalHarmonics.cpp)
+uniform vec3 u_irradianceSH[9];
+uniform mat3 u_EyeToEnvironment;            // eye directions -> cube map directions
+
+const float PI = 3.14159265359;
+// ----------------------------------------------------------------------------
+float DistributionGGX(vec3 N, vec3 H, float roughness)
+{
+    float a = roughness*roughness;
+    float a2 = a*a;
+    float NdotH = max(dot(N, H), 0.0);
+    float NdotH2 = NdotH*NdotH;
+
+    float nom   = a2;
+    float denom = (NdotH2 * (a2 - 1.0) + 1.0);
+    denom = PI * denom * denom;
+
+    return nom / denom;
+}
+// ----------------------------------------------------------------------------
+float GeometrySchlickGGX(float NdotV, float roughness)
+{
+    float r = (roughness + 1.0);
+    float k = (r*r) / 8.0;
+
+    float nom   = NdotV;
+    float denom = NdotV * (1.0 - k) + k;
+
+    return nom / denom;
+}
+// ----------------------------------------------------------------------------
+float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness)
+{
+    float NdotV = max(dot(N, V), 0.0);
+    float NdotL = max(dot(N, L), 0.0);
+    float ggx2 = GeometrySchlickGGX(NdotV, roughness);
+    float ggx1 = GeometrySchlickGGX(NdotL, roughness);
+
+    return ggx1 * ggx2;
+}
+// ----------------------------------------------------------------------------
+vec3 fresnelSchlick(float cosTheta, vec3 F0)
+{
+    return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
+}
+// ----------------------------------------------------------------------------
+int getClusterIndex(vec3 position_EC)
+{
+    ivec2 tile = min(ivec2(gl_FragCoord.xy / u_cluster_params.zw), ivec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+    float depth = -position_EC.z;
+    int slice = 0;
+    if (depth >= u_cluster_params.x)
+        slice = min(CLUSTER_GRID_Z - 1, 1 + int(log(depth / u_cluster_params.x) * u_cluster_params.y));
+
+    return (slice * CLUSTER_GRID_Y + tile.y) * CLUSTER_GRID_X + tile.x;
+}
+// ----------------------------------------------------------------------------
+vec3 irradianceSH(vec3 n)
+{
+    return u_irradianceSH[0]
+         + u_irradianceSH[1] * n.y + u_irradianceSH[2] * n.z + u_irradianceSH[3] * n.x
+         + u_irradianceSH[4] * (n.x * n.y) + u_irradianceSH[5] * (n.y * n.z)
+         + u_irradianceSH[6] * (3.0 * n.z * n.z - 1.0)
+         + u_irradianceSH[7] * (n.x * n.z) + u_irradianceSH[8] * (n.x * n.x - n.y * n.y);
+}
+// ----------------------------------------------------------------------------
+float shadowVisibility(vec3 P, vec3 N)
+{
+    vec4 shadowCoord = u_ShadowMatrix * vec4(P + 2.0 * N, 1.0);    // normal offset against acne on grazing surfaces
+    if (any(lessThan(shadowCoord.xyz, vec3(0.0))) || any(greaterThan(shadowCoord.xyz, vec3(1.0))))
+        return 1.0;
+
+    // 2x2 hardware-filtered taps half a texel apart on the static map (PCF over 3x3 texels)
+    vec2 texel = 1.0 / vec2(textureSize(u_staticShadowMap, 0));
+    float lit = 0.0;
+    for (int i = 0; i < 4; ++i)
+        lit += texture(u_staticShadowMap, vec3(shadowCoord.xy + texel * (vec2(i & 1, i >> 1) - 0.5), shadowCoord.z));
+
+    return min(0.25 * lit, texture(u_dynamicShadowMap, shadowCoord.xyz));
+}
+// ----------------------------------------------------------------------------
+vec3 shadeLight(int lightIdx, vec3 P, vec3 N, vec3 V, vec3 albedo, float metallic, float roughness, vec3 F0)
+{
+    vec4 positionRadius = texelFetch(u_lightData, 4 * lightIdx);
+    vec4 colorType      = texelFetch(u_lightData, 4 * lightIdx + 1);
+
+    // calculate per-light radiance
+    vec3 L;
+    float attenuation = 1.0;   // for directional light
+    if (int(colorType.w) == LIGHT_DIRECTIONAL) {
+        L = normalize(positionRadius.xyz);
+    }
+    else {
+        vec3 toLight = positionRadius.xyz - P;
+        float distance = length(toLight);
+        L = toLight / distance;
+
+        vec4 attenuationSpotExp = texelFetch(u_lightData, 4 * lightIdx + 2);
+        if (positionRadius.w > 0.0) {
+            // windowed so the light fades out exactly at its cluster radius
+            float window = clamp(1.0 - pow(distance / positionRadius.w, 4.0), 0.0, 1.0);
+            attenuation = window * window / max(dot(attenuationSpotExp.xyz, vec3(1.0, distance, distance * distance)), 0.0001);
+        }
+
+        vec4 spotDirCutoff = texelFetch(u_lightData, 4 * lightIdx + 3);
+        if (spotDirCutoff.w > -1.0) {
+            float spotCos = dot(-L, normalize(spotDirCutoff.xyz));
+            attenuation *= (spotCos < spotDirCutoff.w) ? 0.0 : pow(spotCos, attenuationSpotExp.w);
+        }
+    }
+    vec3 H = normalize(V + L);
+    //vec3 radiance = colorType.rgb * attenuation;
+    vec3 radiance = colorType.rgb * attenuation * vec3(4.5);   //day heuristic : light intensity
+
+    // Cook-Torrance BRDF
+    float NDF = DistributionGGX(N, H, roughness);   
+    float G   = GeometrySmith(N, V, L, roughness);      
+    vec3 F    = fresnelSchlick(max(dot(H, V), 0.0), F0);
+       
+    vec3 numerator    = NDF * G * F; 
+    float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0) + 0.0001; // + 0.0001 to prevent divide by zero
+    vec3 specular = numerator / denominator;
+    
+    // kS is equal to Fresnel
+    vec3 kS = F;
+    // for energy conservation, the diffuse and specular light can't
+    // be above 1.0 (unless the surface emits light); to preserve this
+    // relationship the diffuse component (kD) should equal 1.0 - kS.
+    vec3 kD = vec3(1.0) - kS;
+    // multiply kD by the inverse metalness such that only non-metals 
+    // have diffuse lighting, or a linear blend if partly metal (pure metals
+    // have no diffuse light).
+    kD *= 1.0 - metallic;
+
+    // scale light by NdotL
+    float NdotL = max(dot(N, L), 0.0);
+
+    // outgoing radiance of this light
+    //return (kD * albedo / PI + specular) * radiance * NdotL;  // note that we already multiplied the BRDF by the Fresnel (kS) so we won't multiply by kS again
+    return (kD * albedo + specular) * radiance * NdotL; //heuristic
+}
+// ----------------------------------------------------------------------------
+// P and N in eye coordinates, albedo in linear space; returns the display color
+vec3 shadePBR(vec3 P, vec3 N, vec3 albedo, float metallic, float roughness, float ao, vec3 emissive)
+{
+    vec3 V = normalize(-P);
+
+    // calculate reflectance at normal incidence; if dia-electric (like plastic) use F0 
+    // of 0.04 and if it's a metal, use the albedo color as F0 (metallic workflow)    
+    vec3 F0 = vec3(0.04); 
+    F0 = mix(F0, albedo, metallic);
+
+    // reflectance equation: global lights, then the lights binned into this fragment's cluster
+    vec3 Lo = vec3(0.0);
+    for(int i = 0; i < u_global_light_count; ++i) {
+        vec3 radiance = shadeLight(i, P, N, V, albedo, metallic, roughness, F0);
+        Lo += (i == u_shadow_light_index) ? radiance * shadowVisibility(P, N) : radiance;
+    }
+
+    uvec2 cluster = texelFetch(u_clusterGrid, getClusterIndex(P)).xy;
+    for(uint k = 0u; k < cluster.y; ++k)
+        Lo += shadeLight(int(texelFetch(u_clusterLightIndex, int(cluster.x + k)).r), P, N, V, albedo, metallic, roughness, F0);
+
+    // ambient lighting (note that the next IBL tutorial will replace 
+    // this ambient lighting with environment lighting).
+    //vec3 ambient = vec3(0.03) * albedo * ao;
+    //vec3 ambient = vec3(0.2) * albedo; //night heuristic
+    //vec3 ambient = vec3(0.9) * albedo;   //day heuristic
+    vec3 ambient = max(irradianceSH(normalize(u_EyeToEnvironment * N)), vec3(0.0)) * albedo * ao;
+
+    vec3 color = ambient + emissive + Lo;
+
+    // HDR tonemapping
+    color = color / (color + vec3(1.0));
+    // gamma correct
+    color = pow(color, vec3(1.0/2.2)); 
+    
+    return color;
+}
@@ -0,0 +1,59 @@
+#version 400
+// material texture fetches shared by the forward (PBR_Tx.frag) and G-buffer (PBR_GBuffer.frag) programs
+// compiled once per material variant; the application defines MATERIAL_NORMAL_MAP,
+// MATERIAL_METALLIC_ROUGHNESS_MAP and MATERIAL_EMISSIVE_MAP for the maps a material has
+
+uniform sampler2D u_albedoMap;  // a white texture when the material has none
+#ifdef MATERIAL_NORMAL_MAP
+uniform sampler2D u_normalMap;
+#endif
+#ifdef MATERIAL_METALLIC_ROUGHNESS_MAP
+uniform sampler2D u_metallicRoughnessMap;
+#endif
+#ifdef MATERIAL_EMISSIVE_MAP
+uniform sampler2D u_emissiveMap;
+#endif
+
+#ifdef MATERIAL_NORMAL_MAP
+// tangent-space normal to eye space with the interpolated per-vertex frame
+vec3 getNormalFromMap(vec3 normal_EC, vec4 tangent_EC, vec2 tex_coord)
+{
+    vec3 tangentNormal = texture(u_normalMap, tex_coord).xyz * 2.0 - 1.0;
+    tangentNormal.z *= -1;  // for normal map based in directX
+
+    vec3 N   = normalize(normal_EC);
+    vec3 T   = normalize(tangent_EC.xyz - N * dot(N, tangent_EC.xyz));
+    vec3 B   = -tangent_EC.w * cross(N, T);
+    mat3 TBN = mat3(T, B, N);
+
+    return normalize(TBN * tangentNormal);
+}
+#endif
+// ----------------------------------------------------------------------------
+// albedo is returned as stored in the texture (gamma encoded)
+void getMaterial(vec3 normal_EC, vec4 tangent_EC, vec2 tex_coord,
+    out vec3 albedo, out float metallic, out float roughness, out float ao, out vec3 emissive, out vec3 N)
+{
+    albedo    = texture(u_albedoMap, tex_coord).rgb;
+#ifdef MATERIAL_METALLIC_ROUGHNESS_MAP
+    vec3 aoRoughnessMetallic = texture(u_metallicRoughnessMap, tex_coord).rgb;
+    metallic  = aoRoughnessMetallic.b;
+    roughness = aoRoughnessMetallic.g;
+    ao        = aoRoughnessMetallic.r;
+#else
+    metallic  = 0.0;
+    roughness = 1.0;
+    ao        = 1.0;
+#endif
+#ifdef MATERIAL_EMISSIVE_MAP
+    emissive  = texture(u_emissiveMap, tex_coord).rgb;
+#else
+    emissive  = vec3(0.0);
+#endif
+
+#ifdef MATERIAL_NORMAL_MAP
+    N = getNormalFromMap(normal_EC, tangent_EC, tex_coord);
+#else
+    N = normalize(normal_EC);
+#endif
+}
@@ -2,20 +2,28 @@
 layout (location = 0) in vec3 a_position;
 layout (location = 1) in vec3 a_normal;
 layout (location = 2) in vec2 a_tex_coord;
+layout (location = 3) in vec4 a_tangent;    // w: handedness
+layout (location = 4) in float a_ao;        // baked ambient occlusion, 1.0 if the mesh has none
 
 out vec3 v_position_EC;
 out vec3 v_normal_EC;
 out vec2 v_tex_coord;
+out vec4 v_tangent_EC;
+out float v_ao;
 
 uniform mat4 u_ModelViewProjectionMatrix;
 uniform mat4 u_ModelViewMatrix;
 uniform mat3 u_ModelViewMatrixInvTrans;
 
+invariant gl_Position;  // the depth pre-pass (Depth.vert) must produce identical depths for GL_EQUAL
+
 void main()
 {
 	v_position_EC = vec3(u_ModelViewMatrix * vec4(a_position, 1.0f));
 	v_normal_EC = normalize(u_ModelViewMatrixInvTrans * a_normal);  
 	v_tex_coord = a_tex_coord;
+	v_tangent_EC = vec4(normalize(mat3(u_ModelViewMatrix) * a_tangent.xyz), a_tangent.w);
+	v_ao = a_ao;
 
 	gl_Position = u_ModelViewProjectionMatrix * vec4(a_position, 1.0f);
 }
\ No newline at end of file
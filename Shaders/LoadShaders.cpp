@@ -2,6 +2,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
 #include <GL/glew.h>
 #include "LoadShaders.h"
@@ -35,59 +41,246 @@ GLchar* ReadShader(const char* filename) {
 
 //----------------------------------------------------------------------------
 
-GLuint LoadShaders(ShaderInfo* shaders) {
-	if (shaders == NULL) { return 0; }
+#define SHADER_CACHE_MAGIC			(0x42505842u) // "BXPB"
+#define SHADER_CACHE_MAX_BINARY		(64u << 20) // larger lengths in a header are taken for corruption
+#define MAX_PENDING_PROGRAMS		(32)
+#define MAX_SHADERS_PER_PROGRAM		(8)
+
+typedef struct {
+	GLuint				program;
+	GLuint				shaders[MAX_SHADERS_PER_PROGRAM];
+	int					n_shaders;
+	unsigned long long	hash;
+	GLboolean			from_cache;
+} PendingProgram;
+
+static char cache_dir[256];
+static unsigned long long driver_hash;
+static GLboolean use_program_binary, use_parallel_compile;
+static PendingProgram pending[MAX_PENDING_PROGRAMS];
+
+// 64-bit FNV-1a
+static unsigned long long HashBytes(unsigned long long hash, const void* data, size_t size) {
+	const unsigned char* bytes = (const unsigned char*)data;
+
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
 
-	GLuint program = glCreateProgram();
+static unsigned long long HashString(unsigned long long hash, const char* string) {
+	return HashBytes(hash, string ? string : "", string ? strlen(string) + 1 : 1);
+}
+
+static void CacheFileName(char* filename, unsigned long long hash) {
+	sprintf(filename, "%s/%016llx.bin", cache_dir, hash);
+}
 
-	ShaderInfo* entry = shaders;
-	while (entry->type != GL_NONE) {
-		GLuint shader = glCreateShader(entry->type);
+void InitShaderCache(const char* cache_directory) {
+	strncpy(cache_dir, cache_directory, sizeof(cache_dir) - 1);
+#ifdef _WIN32
+	_mkdir(cache_dir);
+#else
+	mkdir(cache_dir, 0755);
+#endif
+
+	driver_hash = 0xcbf29ce484222325ull;
+	driver_hash = HashString(driver_hash, (const char*)glGetString(GL_VENDOR));
+	driver_hash = HashString(driver_hash, (const char*)glGetString(GL_RENDERER));
+	driver_hash = HashString(driver_hash, (const char*)glGetString(GL_VERSION));
+
+	GLint n_binary_formats = 0;
+	if (GLEW_ARB_get_program_binary)
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &n_binary_formats);
+	use_program_binary = (n_binary_formats > 0) ? GL_TRUE : GL_FALSE;
+
+	use_parallel_compile = GLEW_KHR_parallel_shader_compile ? GL_TRUE : GL_FALSE;
+	if (use_parallel_compile)
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF); // as many as the implementation likes
+}
 
-		entry->shader = shader;
+static GLboolean LoadProgramBinary(GLuint program, unsigned long long hash) {
+	char filename[320];
+	unsigned int header[3]; // magic, binary format, length
 
-		GLchar* source = ReadShader(entry->filename);
-		if (source == NULL) {
-			for (entry = shaders; entry->type != GL_NONE; ++entry) {
-				glDeleteShader(entry->shader);
-				entry->shader = 0;
-			}
+	if (!use_program_binary)
+		return GL_FALSE;
 
-			return 0;
+	CacheFileName(filename, hash);
+	FILE* infile = fopen(filename, "rb");
+	if (!infile)
+		return GL_FALSE;
+
+	// any failure is a cache miss: the program is compiled from its sources
+	GLboolean loaded = GL_FALSE;
+	long file_size = (fseek(infile, 0, SEEK_END) == 0) ? ftell(infile) : -1;
+	if (file_size > 0 && fseek(infile, 0, SEEK_SET) == 0
+		&& fread(header, sizeof(header), 1, infile) == 1 && header[0] == SHADER_CACHE_MAGIC
+		&& header[2] > 0 && header[2] <= SHADER_CACHE_MAX_BINARY && header[2] <= (unsigned long)file_size - sizeof(header)) {
+		void* binary = malloc(header[2]);
+
+		if (binary != NULL && fread(binary, 1, header[2], infile) == header[2]) {
+			GLint linked;
+
+			glProgramBinary(program, header[1], binary, header[2]);
+			glGetProgramiv(program, GL_LINK_STATUS, &linked); // a driver update may reject an old binary
+			loaded = linked ? GL_TRUE : GL_FALSE;
 		}
+		free(binary);
+	}
+	fclose(infile);
 
-		glShaderSource(shader, 1, &source, NULL);
-		free(source);
+	return loaded;
+}
 
-		glCompileShader(shader);
+static void StoreProgramBinary(GLuint program, unsigned long long hash) {
+	char filename[320];
+	unsigned int header[3];
+	GLint length = 0;
+
+	if (!use_program_binary)
+		return;
+
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	void* binary = malloc(length);
+	GLenum format;
+	glGetProgramBinary(program, length, NULL, &format, binary);
+
+	CacheFileName(filename, hash);
+	FILE* outfile = fopen(filename, "wb");
+	if (outfile) {
+		header[0] = SHADER_CACHE_MAGIC;
+		header[1] = format;
+		header[2] = (unsigned int)length;
+		fwrite(header, sizeof(header), 1, outfile);
+		fwrite(binary, 1, length, outfile);
+		fclose(outfile);
+	}
+	free(binary);
+}
 
-		GLint compiled;
-		glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
-		if (!compiled) {
-#ifdef _DEBUG
-			GLsizei len;
-			glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &len);
+static PendingProgram* FindPending(GLuint program) {
+	for (int i = 0; i < MAX_PENDING_PROGRAMS; i++)
+		if (pending[i].program == program)
+			return &pending[i];
+	return NULL;
+}
 
-			GLchar* log = (GLchar*)malloc((len + 1) * sizeof(GLchar));
-			glGetShaderInfoLog(shader, len, &len, log);
-			fprintf(stdout, "Shader compilation failed: %s\n", log);
-			free(log);
-#endif /* DEBUG */
+static void ReleasePending(PendingProgram* entry) {
+	for (int i = 0; i < entry->n_shaders; i++) {
+		glDetachShader(entry->program, entry->shaders[i]);
+		glDeleteShader(entry->shaders[i]);
+	}
+	memset(entry, 0, sizeof(PendingProgram));
+}
+
+GLuint BeginLoadShaders(ShaderInfo* shaders) {
+	if (shaders == NULL) { return 0; }
+
+	PendingProgram* entry = FindPending(0);
+	if (entry == NULL) {
+		fprintf(stderr, "Too many shader programs loading at once\n");
+		return 0;
+	}
+
+	// the cache key covers every source, so any shader edit invalidates the binary
+	GLchar* sources[MAX_SHADERS_PER_PROGRAM];
+	int n_shaders = 0;
+	unsigned long long hash = driver_hash;
 
+	for (ShaderInfo* info = shaders; info->type != GL_NONE; ++info) {
+		GLchar* source = (n_shaders < MAX_SHADERS_PER_PROGRAM) ? ReadShader(info->filename) : NULL;
+		if (source == NULL) {
+			while (n_shaders > 0)
+				free(sources[--n_shaders]);
 			return 0;
 		}
+		hash = HashBytes(hash, &info->type, sizeof(info->type));
+		hash = HashString(hash, info->defines);
+		hash = HashString(hash, source);
+		sources[n_shaders++] = source;
+	}
 
-		glAttachShader(program, shader);
+	GLuint program = glCreateProgram();
+	entry->program = program;
+	entry->hash = hash;
+
+	if (LoadProgramBinary(program, hash)) {
+		entry->from_cache = GL_TRUE;
+	}
+	else {
+		int i = 0;
+		for (ShaderInfo* info = shaders; info->type != GL_NONE; ++info, ++i) {
+			GLuint shader = glCreateShader(info->type);
+
+			info->shader = shader;
+			if (info->defines) {
+				// #version must stay the first line
+				char* body = strchr(sources[i], '\n');
+				body = body ? body + 1 : sources[i] + strlen(sources[i]);
+
+				const GLchar* parts[3] = { sources[i], info->defines, body };
+				GLint lengths[3] = { (GLint)(body - sources[i]), (GLint)strlen(info->defines), -1 };
+				glShaderSource(shader, 3, parts, lengths);
+			}
+			else
+				glShaderSource(shader, 1, &sources[i], NULL);
+			glCompileShader(shader); // status is checked after linking so nothing here blocks
+			glAttachShader(program, shader);
+			entry->shaders[entry->n_shaders++] = shader;
+		}
 
-		++entry;
+		if (use_program_binary)
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(program);
 	}
 
-	glLinkProgram(program);
+	for (int i = 0; i < n_shaders; i++)
+		free(sources[i]);
+
+	return program;
+}
+
+GLboolean PollShaders(GLuint program) {
+	PendingProgram* entry = FindPending(program);
+	GLint completed;
+
+	if (program == 0 || entry == NULL || entry->from_cache || !use_parallel_compile)
+		return GL_TRUE;
+
+	glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &completed);
+	return completed ? GL_TRUE : GL_FALSE;
+}
+
+GLuint FinishLoadShaders(GLuint program) {
+	PendingProgram* entry = FindPending(program);
+
+	if (program == 0 || entry == NULL) { return program; }
 
 	GLint linked;
 	glGetProgramiv(program, GL_LINK_STATUS, &linked);
 	if (!linked) {
 #ifdef _DEBUG
+		for (int i = 0; i < entry->n_shaders; i++) {
+			GLint compiled;
+			glGetShaderiv(entry->shaders[i], GL_COMPILE_STATUS, &compiled);
+			if (compiled)
+				continue;
+
+			GLsizei len;
+			glGetShaderiv(entry->shaders[i], GL_INFO_LOG_LENGTH, &len);
+
+			GLchar* log = (GLchar*)malloc((len + 1) * sizeof(GLchar));
+			glGetShaderInfoLog(entry->shaders[i], len, &len, log);
+			fprintf(stdout, "Shader compilation failed: %s\n", log);
+			free(log);
+		}
+
 		GLsizei len;
 		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &len);
 
@@ -97,15 +290,21 @@ GLuint LoadShaders(ShaderInfo* shaders) {
 		free(log);
 #endif /* DEBUG */
 
-		for (entry = shaders; entry->type != GL_NONE; ++entry) {
-			glDeleteShader(entry->shader);
-			entry->shader = 0;
-		}
+		ReleasePending(entry);
+		glDeleteProgram(program);
 
 		return 0;
 	}
 
+	if (!entry->from_cache)
+		StoreProgramBinary(program, entry->hash);
+	ReleasePending(entry);
+
 	return program;
 }
 
+//----------------------------------------------------------------------------
 
+GLuint LoadShaders(ShaderInfo* shaders) {
+	return FinishLoadShaders(BeginLoadShaders(shaders));
+}
@@ -7,8 +7,21 @@ typedef struct {
 	GLenum       type;
 	const char*  filename;
 	GLuint       shader;
+	const char*  defines;	// optional "#define ..." lines, inserted right after #version
 } ShaderInfo;
 
 GLuint LoadShaders(ShaderInfo*);
 
+// Program binaries are cached in cache_directory, keyed by the shader sources and the
+// GL vendor/renderer/version strings. Call once after the context is created.
+void InitShaderCache(const char* cache_directory);
+
+// BeginLoadShaders() returns the program at once: from the cache, or with compilation and
+// linking started (concurrently on the driver's threads with GL_KHR_parallel_shader_compile).
+// PollShaders() never blocks; FinishLoadShaders() waits, checks the result and stores the
+// binary on a cache miss. It returns the program, or 0 on failure.
+GLuint BeginLoadShaders(ShaderInfo*);
+GLboolean PollShaders(GLuint program);
+GLuint FinishLoadShaders(GLuint program);
+
 #endif // __LOAD_SHADERS_H__
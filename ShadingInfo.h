@@ -18,10 +18,34 @@ typedef struct _loc_LIGHT_Parameters {
 	GLint color;
 } loc_light_Parameters;
 
+typedef struct _loc_Cluster_Parameters {
+	GLint lightData, clusterGrid, clusterLightIndex;
+	GLint globalLightCount, clusterParams;
+} loc_Cluster_Parameters;
+
+typedef struct _loc_Shadow_Parameters {
+	GLint shadowMatrix, staticShadowMap, dynamicShadowMap, shadowLightIndex;
+} loc_Shadow_Parameters;
+
+typedef struct _loc_Ambient_Parameters {
+	GLint irradianceSH, eyeToEnvironment;
+} loc_Ambient_Parameters;
+
 typedef struct _Material_Parameters {
 	int  diffuseTex, normalTex, specularTex, emissiveTex;
 } Material_Parameters;
 
 typedef struct _loc_Material_Parameters {
 	GLuint diffuseTex, normalTex, specularTex, emissiveTex;
-} loc_Material_Parameters;
\ No newline at end of file
+} loc_Material_Parameters;
+typedef struct _loc_GBuffer_Parameters {
+	GLint albedo, normal, metallicRoughness, emissive, depth;
+} loc_GBuffer_Parameters;
+
+typedef struct _loc_PBR_Program {
+	GLint modelViewProjectionMatrix, modelViewMatrix, modelViewMatrixInvTrans;
+	loc_Material_Parameters material;
+	loc_Cluster_Parameters cluster;
+	loc_Shadow_Parameters shadow;
+	loc_Ambient_Parameters ambient;
+} loc_PBR_Program;
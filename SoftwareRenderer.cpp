@@ -0,0 +1,705 @@
+﻿//
+//  SoftwareRenderer.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+//  CPU renderer for machines without a usable GPU: draws the static Bistro and the skybox
+//  from a predefined camera into a PNG with the shading of PBR_Tx.frag (clustered lights,
+//  spherical harmonics ambient), without normal maps and the sun shadow.
+//  All threads first transform, near-clip and bin the triangles of the visible chunks
+//  (Culling.cpp) into SOFTWARE_TILE_SIZE tiles; then each thread takes whole tiles,
+//  rasterizes them into a tile-local depth and triangle id buffer and shades every
+//  covered pixel once, so no two threads ever write the same pixel.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define SOFTWARE_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "LoadScene.h"
+#include "DrawScene.h"
+#include "Culling.h"
+#include "LightCluster.h"
+#include "SphericalHarmonics.h"
+#include "CpuTexture.h"
+#include "CpuShading.h"
+#include "Profiler.h"
+#include "SoftwareRenderer.h"
+
+extern SCENE scene;
+
+#define NO_TRIANGLE			(0xFFFFFFFFu)
+#define TRIANGLE_ID_SHIFT	(27)	// triangle id: setup thread << TRIANGLE_ID_SHIFT | index in its list
+
+bool parse_software_options(int argc, char* argv[], SOFTWARE_OPTIONS* pOptions) {
+	bool software = false;
+
+	pOptions->width = 900;
+	pOptions->height = 600;
+	pOptions->camera = CAMERA_1;
+	pOptions->n_threads = 0;
+	pOptions->texture_size = 256;
+	pOptions->output_file = "software.png";
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--software"))
+			software = true;
+		else if (!strcmp(argv[i], "--camera") && i + 1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "all"))
+				pOptions->camera = -1;
+			else if (get_camera_index(argv[i]) >= 0)
+				pOptions->camera = get_camera_index(argv[i]);
+		}
+		else if (!strcmp(argv[i], "--size") && i + 1 < argc)
+			sscanf(argv[++i], "%dx%d", &pOptions->width, &pOptions->height);
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			pOptions->n_threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--texture-size") && i + 1 < argc)
+			pOptions->texture_size = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+			pOptions->output_file = argv[++i];
+	}
+	if (pOptions->width < 1)
+		pOptions->width = 1;
+	if (pOptions->height < 1)
+		pOptions->height = 1;
+	if (pOptions->texture_size < 1)
+		pOptions->texture_size = 1;
+
+	return software;
+}
+
+/*****************************  START: scene data *****************************/
+typedef struct {
+	int		material;
+	int		first_triangle, n_triangles;
+} SW_CHUNK;
+
+typedef struct {
+	float			x[3], y[3];		// window coordinates, y up
+	float			z[3];			// normalized device depth
+	float			inv_w[3];
+	int				material, triangle;
+	int				clip;			// first of 9 barycentrics in the thread's clip list, -1 if not clipped
+	unsigned char	vertex[3];		// scene triangle vertex of each corner when not clipped
+	float			lod;			// log2 of the texel footprint of a 1x1 texture
+	int				bounds[4];		// covered pixels: x_min, y_min, x_max, y_max
+} SW_TRIANGLE;
+
+typedef struct {
+	std::vector<SW_TRIANGLE>		triangles;
+	std::vector<float>				clip_barycentrics;	// scene triangle barycentrics of the corners of clipped triangles
+	std::vector<std::vector<int> >	bins;				// triangle indices per tile
+	int								first_chunk, end_chunk;
+} SW_SETUP_THREAD;
+
+typedef struct {
+	int			width, height;
+	int			n_tiles_x, n_tiles_y;
+	float		view[16], view_projection[16];	// column-major
+	float		eye[3];							// camera position in world coordinates
+	float		tan_half_fovy, aspect_ratio;
+	unsigned char* pixels;						// BGR, bottom row first as in FreeImage
+} SW_FRAME;
+
+static int n_threads;
+static float irradiance[SH_COEFFICIENTS][3];
+
+static SW_FRAME frame;
+static std::vector<SW_CHUNK> visible_chunks;
+static SW_SETUP_THREAD setup_threads[SOFTWARE_MAX_THREADS];
+static std::atomic<int> next_job;
+
+// the cache of the GL renderer; without it, project the scaled-down faces (not cached, as less exact)
+static void prepare_irradiance(void) {
+	const char* skybox_files[6] = SKYBOX_FACE_FILES;
+	const unsigned char* face_texels[6];
+	bool usable = true;
+
+	if (load_irradiance_cache("Scene/Cubemap/irradiance.sh9", get_cubemap_cache_key(skybox_files), irradiance))
+		return;
+	int size = get_skybox_face(0) ? get_skybox_face(0)->levels[0].width : 0;
+	for (int face = 0; face < 6 && usable; face++) {
+		const CPU_TEXTURE* pFace = get_skybox_face(face);
+		usable = pFace != NULL && pFace->levels[0].width == size && pFace->levels[0].height == size;
+		if (usable)
+			face_texels[face] = (const unsigned char*)pFace->levels[0].texels;
+	}
+	memset(irradiance, 0, sizeof(irradiance));
+	if (usable)
+		project_cubemap_irradiance(face_texels, size, 4 * size, 4, irradiance);
+	else
+		irradiance[0][0] = irradiance[0][1] = irradiance[0][2] = 0.9f;
+}
+
+static void free_setup_data(void) {
+	for (int t = 0; t < SOFTWARE_MAX_THREADS; t++) {
+		std::vector<SW_TRIANGLE>().swap(setup_threads[t].triangles);
+		std::vector<float>().swap(setup_threads[t].clip_barycentrics);
+		std::vector<std::vector<int> >().swap(setup_threads[t].bins);
+	}
+}
+/*****************************  END: scene data *****************************/
+
+/*****************************  START: triangle setup *****************************/
+static void transform(const float* m, const float* v, float w, float* result) {
+	for (int k = 0; k < 4; k++)
+		result[k] = m[k] * v[0] + m[4 + k] * v[1] + m[8 + k] * v[2] + m[12 + k] * w;
+}
+
+// corners: clip coordinates (4 floats) and scene triangle barycentrics (3 floats)
+static void emit_triangle(SW_SETUP_THREAD* pThread, int materialIdx, int triIdx, float corners[3][7], bool clipped) {
+	SW_TRIANGLE tri;
+	int order[3] = { 0, 1, 2 };
+
+	for (int v = 0; v < 3; v++) {
+		tri.inv_w[v] = 1.0f / corners[v][3];
+		tri.x[v] = (corners[v][0] * tri.inv_w[v] * 0.5f + 0.5f) * frame.width;
+		tri.y[v] = (corners[v][1] * tri.inv_w[v] * 0.5f + 0.5f) * frame.height;
+		tri.z[v] = corners[v][2] * tri.inv_w[v];
+	}
+
+	// no face culling in the GL renderer either; make every triangle counterclockwise
+	float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+	if (!(area != 0.0f))
+		return;
+	if (area < 0.0f) {
+		float t;
+		t = tri.x[1]; tri.x[1] = tri.x[2]; tri.x[2] = t;
+		t = tri.y[1]; tri.y[1] = tri.y[2]; tri.y[2] = t;
+		t = tri.z[1]; tri.z[1] = tri.z[2]; tri.z[2] = t;
+		t = tri.inv_w[1]; tri.inv_w[1] = tri.inv_w[2]; tri.inv_w[2] = t;
+		order[1] = 2; order[2] = 1;
+		area = -area;
+	}
+
+	float x_min = min(tri.x[0], min(tri.x[1], tri.x[2])), x_max = max(tri.x[0], max(tri.x[1], tri.x[2]));
+	float y_min = min(tri.y[0], min(tri.y[1], tri.y[2])), y_max = max(tri.y[0], max(tri.y[1], tri.y[2]));
+	x_min = max(x_min, -1.0f); x_max = min(x_max, frame.width + 1.0f); // clamped before the int conversion
+	y_min = max(y_min, -1.0f); y_max = min(y_max, frame.height + 1.0f);
+	tri.bounds[0] = max((int)floorf(x_min - 0.5f), 0);
+	tri.bounds[1] = max((int)floorf(y_min - 0.5f), 0);
+	tri.bounds[2] = min((int)ceilf(x_max - 0.5f), frame.width - 1);
+	tri.bounds[3] = min((int)ceilf(y_max - 0.5f), frame.height - 1);
+	if (tri.bounds[0] > tri.bounds[2] || tri.bounds[1] > tri.bounds[3])
+		return;
+
+	tri.material = materialIdx;
+	tri.triangle = triIdx;
+	tri.clip = -1;
+	for (int v = 0; v < 3; v++)
+		tri.vertex[v] = (unsigned char)order[v];
+	if (clipped) {
+		tri.clip = (int)pThread->clip_barycentrics.size();
+		for (int v = 0; v < 3; v++)
+			pThread->clip_barycentrics.insert(pThread->clip_barycentrics.end(), &corners[order[v]][4], &corners[order[v]][7]);
+	}
+
+	// texture footprint of the triangle, used for all its pixels
+	TRIANGLE* pTri = &scene.material_list[materialIdx].geometry.tm.triangle_list[triIdx];
+	float uv[3][2];
+	for (int v = 0; v < 3; v++) {
+		uv[v][0] = uv[v][1] = 0.0f;
+		for (int k = 0; k < 3; k++) {
+			uv[v][0] += corners[order[v]][4 + k] * pTri->texture_list[k][0].u;
+			uv[v][1] += corners[order[v]][4 + k] * pTri->texture_list[k][0].v;
+		}
+	}
+	float uv_area = fabsf((uv[1][0] - uv[0][0]) * (uv[2][1] - uv[0][1]) - (uv[2][0] - uv[0][0]) * (uv[1][1] - uv[0][1]));
+	tri.lod = (uv_area > 0.0f) ? 0.5f * log2f(uv_area / area) : -16.0f;
+
+	int index = (int)pThread->triangles.size();
+	pThread->triangles.push_back(tri);
+	for (int ty = tri.bounds[1] / SOFTWARE_TILE_SIZE; ty <= tri.bounds[3] / SOFTWARE_TILE_SIZE; ty++)
+		for (int tx = tri.bounds[0] / SOFTWARE_TILE_SIZE; tx <= tri.bounds[2] / SOFTWARE_TILE_SIZE; tx++)
+			pThread->bins[ty * frame.n_tiles_x + tx].push_back(index);
+}
+
+static void setup_triangle(SW_SETUP_THREAD* pThread, int materialIdx, int triIdx) {
+	TRIANGLE* pTri = &scene.material_list[materialIdx].geometry.tm.triangle_list[triIdx];
+	float corners[3][7];
+	int outside_all = 0x3F, outside_any = 0;
+
+	for (int v = 0; v < 3; v++) {
+		float* c = corners[v];
+		transform(frame.view_projection, &pTri->position[v].x, 1.0f, c);
+		c[4] = c[5] = c[6] = 0.0f;
+		c[4 + v] = 1.0f;
+
+		int code = (c[0] < -c[3]) | ((c[0] > c[3]) << 1) | ((c[1] < -c[3]) << 2) | ((c[1] > c[3]) << 3)
+			| ((c[2] < -c[3]) << 4) | ((c[2] > c[3]) << 5);
+		outside_all &= code;
+		outside_any |= code;
+	}
+	if (outside_all)
+		return;
+	if (!(outside_any & 0x10)) {
+		emit_triangle(pThread, materialIdx, triIdx, corners, false);
+		return;
+	}
+
+	// Sutherland-Hodgman against the near plane z + w >= 0; the other planes are left to the
+	// bounds and the depth test (depth > 1 never passes against the cleared buffer)
+	float polygon[4][7];
+	int n_corners = 0;
+	for (int i = 0; i < 3; i++) {
+		int j = (i + 1) % 3;
+		float d_i = corners[i][2] + corners[i][3], d_j = corners[j][2] + corners[j][3];
+
+		if (d_i >= 0.0f)
+			memcpy(polygon[n_corners++], corners[i], sizeof(corners[i]));
+		if ((d_i >= 0.0f) != (d_j >= 0.0f)) {
+			float t = d_i / (d_i - d_j);
+			for (int k = 0; k < 7; k++)
+				polygon[n_corners][k] = corners[i][k] + t * (corners[j][k] - corners[i][k]);
+			n_corners++;
+		}
+	}
+	for (int i = 2; i < n_corners; i++) {
+		float fan[3][7];
+		memcpy(fan[0], polygon[0], sizeof(fan[0]));
+		memcpy(fan[1], polygon[i - 1], sizeof(fan[1]));
+		memcpy(fan[2], polygon[i], sizeof(fan[2]));
+		emit_triangle(pThread, materialIdx, triIdx, fan, true);
+	}
+}
+
+static void setup_job(SW_SETUP_THREAD* pThread) {
+	pThread->triangles.clear();
+	pThread->clip_barycentrics.clear();
+	pThread->bins.resize(frame.n_tiles_x * frame.n_tiles_y);
+	for (size_t tile = 0; tile < pThread->bins.size(); tile++)
+		pThread->bins[tile].clear();
+
+	for (int chunk = pThread->first_chunk; chunk < pThread->end_chunk; chunk++) {
+		SW_CHUNK* pChunk = &visible_chunks[chunk];
+		for (int triIdx = pChunk->first_triangle; triIdx < pChunk->first_triangle + pChunk->n_triangles; triIdx++)
+			setup_triangle(pThread, pChunk->material, triIdx);
+	}
+}
+
+// visible chunks in material order, split into contiguous ranges of about the same triangle count
+// so that the bins, and with them the order of equal-depth triangles, do not depend on timing
+static int setup_triangles(void) {
+	CULL_CHUNKS* pChunks = get_cull_chunks();
+	const unsigned char* visible = get_cull_visibility(0);
+	std::thread threads[SOFTWARE_MAX_THREADS];
+	long long n_visible_triangles = 0, n_assigned = 0;
+
+	visible_chunks.clear();
+	for (int materialIdx = 0; materialIdx < scene.n_materials; materialIdx++)
+		for (int chunk = pChunks->material_first_chunk[materialIdx]; chunk < pChunks->material_first_chunk[materialIdx + 1]; chunk++)
+			if (visible[chunk]) {
+				SW_CHUNK visible_chunk = { materialIdx, pChunks->chunk_first_triangle[chunk], pChunks->chunk_n_triangles[chunk] };
+				visible_chunks.push_back(visible_chunk);
+				n_visible_triangles += visible_chunk.n_triangles;
+			}
+
+	int chunk = 0;
+	for (int t = 0; t < n_threads; t++) {
+		setup_threads[t].first_chunk = chunk;
+		while (chunk < (int)visible_chunks.size() && n_assigned < n_visible_triangles * (t + 1) / n_threads)
+			n_assigned += visible_chunks[chunk++].n_triangles;
+		setup_threads[t].end_chunk = chunk;
+	}
+
+	for (int t = 1; t < n_threads; t++)
+		threads[t] = std::thread(setup_job, &setup_threads[t]);
+	setup_job(&setup_threads[0]);
+	for (int t = 1; t < n_threads; t++)
+		threads[t].join();
+
+	int n_triangles = 0;
+	for (int t = 0; t < n_threads; t++)
+		n_triangles += (int)setup_threads[t].triangles.size();
+	return n_triangles;
+}
+/*****************************  END: triangle setup *****************************/
+
+/*****************************  START: shading *****************************/
+static void sample_texture(int texId, float u, float v, float lod, float* rgb) {
+	const CPU_TEXTURE* pTexture = get_scene_texture(texId);
+	sample_cpu_texture(pTexture, u, v, lod + pTexture->lod_offset, rgb);
+}
+
+static void shade_background(float frag_x, float frag_y, float* rgb) {
+	glm::vec3 dir_EC = glm::vec3((2.0f * frag_x / frame.width - 1.0f) * frame.tan_half_fovy * frame.aspect_ratio,
+		(2.0f * frag_y / frame.height - 1.0f) * frame.tan_half_fovy, -1.0f);
+	const float* m = frame.view;
+	glm::vec3 dir = glm::vec3(m[0] * dir_EC.x + m[1] * dir_EC.y + m[2] * dir_EC.z,
+		m[4] * dir_EC.x + m[5] * dir_EC.y + m[6] * dir_EC.z,
+		m[8] * dir_EC.x + m[9] * dir_EC.y + m[10] * dir_EC.z);
+	sample_skybox_ray(frame.eye, &dir[0], rgb);
+}
+
+// shadePBR() of PBR_Lighting.frag without the shadow; writes BGR bytes
+static void shade_pixel(const SW_TRIANGLE* pTri, const float* barycentrics, float frag_x, float frag_y, unsigned char* bgr) {
+	MATERIAL* pMaterial = &scene.material_list[pTri->material];
+	TRIANGLE* pSceneTri = &pMaterial->geometry.tm.triangle_list[pTri->triangle];
+	glm::vec3 position = glm::vec3(0.0f), normal = glm::vec3(0.0f);
+	float u = 0.0f, v = 0.0f, rgb[3];
+
+	for (int k = 0; k < 3; k++) {
+		position += barycentrics[k] * glm::vec3(pSceneTri->position[k].x, pSceneTri->position[k].y, pSceneTri->position[k].z);
+		normal += barycentrics[k] * glm::vec3(pSceneTri->normal_vetcor[k].x, pSceneTri->normal_vetcor[k].y, pSceneTri->normal_vetcor[k].z);
+		u += barycentrics[k] * pSceneTri->texture_list[k][0].u;
+		v += barycentrics[k] * pSceneTri->texture_list[k][0].v;
+	}
+	float normal_length = glm::length(normal);
+	normal = (normal_length > 0.0f) ? normal / normal_length : glm::vec3(0.0f, 0.0f, 1.0f);
+
+	float P_EC[4];
+	transform(frame.view, &position[0], 1.0f, P_EC);
+	const float* m = frame.view;
+	glm::vec3 P = glm::vec3(P_EC[0], P_EC[1], P_EC[2]);
+	glm::vec3 N = glm::normalize(glm::vec3(m[0] * normal.x + m[4] * normal.y + m[8] * normal.z,
+		m[1] * normal.x + m[5] * normal.y + m[9] * normal.z, m[2] * normal.x + m[6] * normal.y + m[10] * normal.z));
+
+	// getMaterial() of PBR_Material.frag
+	glm::vec3 albedo = glm::vec3(1.0f), emissive = glm::vec3(0.0f);
+	float metallic = 0.0f, roughness = 1.0f;
+	if (get_scene_texture(pMaterial->diffuseTexId)) {
+		sample_texture(pMaterial->diffuseTexId, u, v, pTri->lod, rgb);
+		albedo = glm::vec3(powf(rgb[0], 2.2f), powf(rgb[1], 2.2f), powf(rgb[2], 2.2f));
+	}
+	if (get_scene_texture(pMaterial->specularTexId)) {
+		sample_texture(pMaterial->specularTexId, u, v, pTri->lod, rgb);
+		metallic = rgb[2];
+		roughness = rgb[1];
+	}
+	if (get_scene_texture(pMaterial->emissiveTexId)) {
+		sample_texture(pMaterial->emissiveTexId, u, v, pTri->lod, rgb);
+		emissive = glm::vec3(rgb[0], rgb[1], rgb[2]);
+	}
+
+	glm::vec3 V = glm::normalize(-P);
+	glm::vec3 Lo = glm::vec3(0.0f);
+	LIGHT_CLUSTERS* pClusters = get_light_clusters();
+	LIGHT_CLUSTER_PARAMS* pParams = get_light_cluster_params();
+	float radiance[3], L[3];
+
+	for (int i = 0; i < pClusters->n_global_lights; i++) {
+		shade_cpu_light(&pClusters->light_data[4 * LIGHT_TEXELS_PER_LIGHT * i], &P[0], &N[0], &V[0], &albedo[0], metallic, roughness, radiance, L);
+		Lo += glm::vec3(radiance[0], radiance[1], radiance[2]);
+	}
+
+	// getClusterIndex()
+	int tile_x = min((int)(frag_x / pParams->tile_size[0]), CLUSTER_GRID_X - 1);
+	int tile_y = min((int)(frag_y / pParams->tile_size[1]), CLUSTER_GRID_Y - 1);
+	float depth = -P.z;
+	int slice = 0;
+	if (depth >= pParams->near_depth)
+		slice = min(CLUSTER_GRID_Z - 1, 1 + (int)(logf(depth / pParams->near_depth) * pParams->slice_scale));
+	const unsigned int* cluster = &pClusters->cluster_grid[2 * ((slice * CLUSTER_GRID_Y + tile_y) * CLUSTER_GRID_X + tile_x)];
+	for (unsigned int k = 0; k < cluster[1]; k++) {
+		const float* light = &pClusters->light_data[4 * LIGHT_TEXELS_PER_LIGHT * pClusters->light_index[cluster[0] + k]];
+		shade_cpu_light(light, &P[0], &N[0], &V[0], &albedo[0], metallic, roughness, radiance, L);
+		Lo += glm::vec3(radiance[0], radiance[1], radiance[2]);
+	}
+
+	float n_skybox[3] = { normal.x, normal.z, normal.y }, ambient[3]; // world -> cube map coordinates
+	evaluate_irradiance_sh(irradiance, n_skybox, ambient);
+	glm::vec3 color = glm::vec3(max(ambient[0], 0.0f), max(ambient[1], 0.0f), max(ambient[2], 0.0f)) * albedo + emissive + Lo;
+
+	encode_display_color(&color[0], bgr);
+}
+/*****************************  END: shading *****************************/
+
+/*****************************  START: rasterization *****************************/
+typedef struct {
+	int		x0, y0, width, height;	// tile rectangle in pixels
+	float	depth[SOFTWARE_TILE_SIZE * SOFTWARE_TILE_SIZE];
+	unsigned int id[SOFTWARE_TILE_SIZE * SOFTWARE_TILE_SIZE];
+} SW_TILE;
+
+// edge functions E_k(x, y) = a[k] x + b[k] y + c[k] of the edge opposite corner k, twice the area
+// of the subtriangle, so E_k / area is the screen-space barycentric of corner k; the coefficients are
+// computed from the edge's corners in a fixed order and negated as needed, so that the two triangles
+// of a shared edge get exactly opposite values and no pixel along it is missed or drawn twice
+typedef struct {
+	float	a[3], b[3], c[3];
+	float	area;
+	bool	top_left[3];	// pixels exactly on a top or left edge belong to the triangle
+} SW_EDGES;
+
+static void get_edges(const SW_TRIANGLE* pTri, SW_EDGES* pEdges) {
+	for (int k = 0; k < 3; k++) {
+		int i = (k + 1) % 3, j = (k + 2) % 3;
+		bool swapped = pTri->x[j] < pTri->x[i] || (pTri->x[j] == pTri->x[i] && pTri->y[j] < pTri->y[i]);
+		int p = swapped ? j : i, q = swapped ? i : j;
+
+		pEdges->a[k] = pTri->y[p] - pTri->y[q];
+		pEdges->b[k] = pTri->x[q] - pTri->x[p];
+		pEdges->c[k] = -(pEdges->a[k] * pTri->x[p] + pEdges->b[k] * pTri->y[p]);
+		if (swapped) {
+			pEdges->a[k] = -pEdges->a[k];
+			pEdges->b[k] = -pEdges->b[k];
+			pEdges->c[k] = -pEdges->c[k];
+		}
+		pEdges->top_left[k] = pEdges->a[k] > 0.0f || (pEdges->a[k] == 0.0f && pEdges->b[k] < 0.0f);
+	}
+	pEdges->area = (pTri->x[1] - pTri->x[0]) * (pTri->y[2] - pTri->y[0]) - (pTri->x[2] - pTri->x[0]) * (pTri->y[1] - pTri->y[0]);
+}
+
+static void raster_triangle(SW_TILE* pTile, const SW_TRIANGLE* pTri, unsigned int id) {
+	SW_EDGES edges;
+	int x_min = max(pTri->bounds[0], pTile->x0), x_max = min(pTri->bounds[2], pTile->x0 + pTile->width - 1);
+	int y_min = max(pTri->bounds[1], pTile->y0), y_max = min(pTri->bounds[3], pTile->y0 + pTile->height - 1);
+
+	if (x_min > x_max || y_min > y_max)
+		return;
+	get_edges(pTri, &edges);
+
+	// depth is affine in window coordinates: z = z_c + z_x x + z_y y
+	float inv_area = 1.0f / edges.area;
+	float dz1 = (pTri->z[1] - pTri->z[0]) * inv_area, dz2 = (pTri->z[2] - pTri->z[0]) * inv_area;
+	float z_x = dz1 * edges.a[1] + dz2 * edges.a[2];
+	float z_y = dz1 * edges.b[1] + dz2 * edges.b[2];
+	float z_c = pTri->z[0] + dz1 * edges.c[1] + dz2 * edges.c[2];
+
+#ifdef SOFTWARE_USE_SSE
+	// four pixels of a row at once, starting at a multiple of 4 within the tile
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 lane_offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	__m128 a[3], top_left[3];
+	for (int k = 0; k < 3; k++) {
+		a[k] = _mm_set1_ps(edges.a[k]);
+		top_left[k] = _mm_cmpneq_ps(_mm_set1_ps(edges.top_left[k] ? 1.0f : 0.0f), zero);
+	}
+	__m128 z_dx = _mm_set1_ps(z_x);
+	__m128 x_first = _mm_set1_ps((float)x_min), x_end = _mm_set1_ps((float)x_max + 1.0f);
+	int x_start = pTile->x0 + ((x_min - pTile->x0) & ~3);
+
+	for (int y = y_min; y <= y_max; y++) {
+		float frag_y = y + 0.5f;
+		__m128 row[3];
+		for (int k = 0; k < 3; k++)
+			row[k] = _mm_set1_ps(edges.b[k] * frag_y + edges.c[k]);
+		__m128 z_row = _mm_set1_ps(z_y * frag_y + z_c);
+		float* depth = &pTile->depth[(y - pTile->y0) * SOFTWARE_TILE_SIZE - pTile->x0];
+		unsigned int* ids = &pTile->id[(y - pTile->y0) * SOFTWARE_TILE_SIZE - pTile->x0];
+
+		for (int x = x_start; x <= x_max; x += 4) {
+			__m128 frag_x = _mm_add_ps(_mm_set1_ps((float)x), lane_offsets);
+			__m128 inside = _mm_and_ps(_mm_cmpgt_ps(frag_x, x_first), _mm_cmplt_ps(frag_x, x_end));
+			for (int k = 0; k < 3; k++) {
+				__m128 e = _mm_add_ps(_mm_mul_ps(a[k], frag_x), row[k]);
+				inside = _mm_and_ps(inside, _mm_or_ps(_mm_cmpgt_ps(e, zero), _mm_and_ps(_mm_cmpeq_ps(e, zero), top_left[k])));
+			}
+			if (!_mm_movemask_ps(inside))
+				continue;
+
+			__m128 z = _mm_add_ps(_mm_mul_ps(z_dx, frag_x), z_row);
+			__m128 old_depth = _mm_loadu_ps(&depth[x]);
+			inside = _mm_and_ps(inside, _mm_cmplt_ps(z, old_depth));
+			int mask = _mm_movemask_ps(inside);
+			if (!mask)
+				continue;
+			_mm_storeu_ps(&depth[x], _mm_or_ps(_mm_and_ps(inside, z), _mm_andnot_ps(inside, old_depth)));
+			for (int i = 0; i < 4; i++)
+				if (mask & (1 << i))
+					ids[x + i] = id;
+		}
+	}
+#else
+	for (int y = y_min; y <= y_max; y++) {
+		float frag_y = y + 0.5f;
+		float* depth = &pTile->depth[(y - pTile->y0) * SOFTWARE_TILE_SIZE - pTile->x0];
+		unsigned int* ids = &pTile->id[(y - pTile->y0) * SOFTWARE_TILE_SIZE - pTile->x0];
+
+		for (int x = x_min; x <= x_max; x++) {
+			float frag_x = x + 0.5f;
+			bool inside = true;
+			for (int k = 0; k < 3 && inside; k++) {
+				float e = edges.a[k] * frag_x + edges.b[k] * frag_y + edges.c[k];
+				inside = e > 0.0f || (e == 0.0f && edges.top_left[k]);
+			}
+			float z = z_x * frag_x + z_y * frag_y + z_c;
+			if (inside && z < depth[x]) {
+				depth[x] = z;
+				ids[x] = id;
+			}
+		}
+	}
+#endif
+}
+
+static void shade_tile(SW_TILE* pTile) {
+	for (int y = pTile->y0; y < pTile->y0 + pTile->height; y++) {
+		unsigned char* bgr = &frame.pixels[3 * ((size_t)y * frame.width + pTile->x0)];
+		const unsigned int* ids = &pTile->id[(y - pTile->y0) * SOFTWARE_TILE_SIZE];
+		float frag_y = y + 0.5f;
+
+		for (int x = 0; x < pTile->width; x++, bgr += 3) {
+			float frag_x = pTile->x0 + x + 0.5f;
+
+			if (ids[x] == NO_TRIANGLE) {
+				float rgb[3];
+				shade_background(frag_x, frag_y, rgb);
+				for (int c = 0; c < 3; c++)
+					bgr[2 - c] = (unsigned char)(glm::clamp(rgb[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+				continue;
+			}
+
+			SW_SETUP_THREAD* pThread = &setup_threads[ids[x] >> TRIANGLE_ID_SHIFT];
+			const SW_TRIANGLE* pTri = &pThread->triangles[ids[x] & ((1u << TRIANGLE_ID_SHIFT) - 1)];
+			SW_EDGES edges;
+			get_edges(pTri, &edges);
+
+			// perspective-correct barycentrics of the corners, then of the scene triangle
+			float corner[3], sum = 0.0f, barycentrics[3] = { 0.0f, 0.0f, 0.0f };
+			for (int k = 0; k < 3; k++) {
+				corner[k] = max(edges.a[k] * frag_x + edges.b[k] * frag_y + edges.c[k], 0.0f) * pTri->inv_w[k];
+				sum += corner[k];
+			}
+			for (int k = 0; k < 3; k++)
+				corner[k] = (sum > 0.0f) ? corner[k] / sum : 1.0f / 3.0f;
+			if (pTri->clip < 0) {
+				for (int k = 0; k < 3; k++)
+					barycentrics[pTri->vertex[k]] = corner[k];
+			}
+			else {
+				const float* clip_barycentrics = &pThread->clip_barycentrics[pTri->clip];
+				for (int k = 0; k < 3; k++)
+					for (int i = 0; i < 3; i++)
+						barycentrics[i] += corner[k] * clip_barycentrics[3 * k + i];
+			}
+			shade_pixel(pTri, barycentrics, frag_x, frag_y, bgr);
+		}
+	}
+}
+
+static void raster_job(void) {
+	SW_TILE* pTile = (SW_TILE*)malloc(sizeof(SW_TILE));
+	int n_tiles = frame.n_tiles_x * frame.n_tiles_y;
+
+	for (int tile = next_job++; tile < n_tiles; tile = next_job++) {
+		pTile->x0 = (tile % frame.n_tiles_x) * SOFTWARE_TILE_SIZE;
+		pTile->y0 = (tile / frame.n_tiles_x) * SOFTWARE_TILE_SIZE;
+		pTile->width = min(SOFTWARE_TILE_SIZE, frame.width - pTile->x0);
+		pTile->height = min(SOFTWARE_TILE_SIZE, frame.height - pTile->y0);
+		for (int i = 0; i < SOFTWARE_TILE_SIZE * SOFTWARE_TILE_SIZE; i++) {
+			pTile->depth[i] = 1.0f;
+			pTile->id[i] = NO_TRIANGLE;
+		}
+
+		// setup thread order is draw order: of two triangles at the same depth the first one stays
+		for (int t = 0; t < n_threads; t++) {
+			const std::vector<int>& bin = setup_threads[t].bins[tile];
+			for (size_t i = 0; i < bin.size(); i++)
+				raster_triangle(pTile, &setup_threads[t].triangles[bin[i]], ((unsigned int)t << TRIANGLE_ID_SHIFT) | (unsigned int)bin[i]);
+		}
+		shade_tile(pTile);
+	}
+	free(pTile);
+}
+
+static void raster_tiles(void) {
+	std::thread threads[SOFTWARE_MAX_THREADS];
+
+	next_job = 0;
+	for (int t = 1; t < n_threads; t++)
+		threads[t] = std::thread(raster_job);
+	raster_job();
+	for (int t = 1; t < n_threads; t++)
+		threads[t].join();
+}
+/*****************************  END: rasterization *****************************/
+
+static void set_frame_camera(int camera, int width, int height) {
+	float fovy, aspect_ratio, near_c, far_c;
+
+	get_camera(camera, frame.view, &fovy, &aspect_ratio, &near_c, &far_c);
+	glm::mat4 ViewProjectionMatrix = glm::perspective(fovy, aspect_ratio, near_c, far_c) * glm::make_mat4(frame.view);
+	memcpy(frame.view_projection, &ViewProjectionMatrix[0][0], sizeof(frame.view_projection));
+
+	// eye = -R^T t for the rigid view matrix
+	for (int k = 0; k < 3; k++)
+		frame.eye[k] = -(frame.view[4 * k] * frame.view[12] + frame.view[4 * k + 1] * frame.view[13] + frame.view[4 * k + 2] * frame.view[14]);
+	frame.tan_half_fovy = tanf(0.5f * fovy);
+	frame.aspect_ratio = aspect_ratio;
+	frame.width = width;
+	frame.height = height;
+	frame.n_tiles_x = (width + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+	frame.n_tiles_y = (height + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+
+	cull_views(0, 1, frame.view_projection);
+	set_light_cluster_projection(fovy, aspect_ratio, near_c, far_c, width, height);
+	update_light_clusters(frame.view);
+}
+
+// with every camera, "software.png" becomes "software_u.png" for camera 'u'
+static void get_output_filename(SOFTWARE_OPTIONS* pOptions, int camera, char* filename, size_t size) {
+	if (pOptions->camera >= 0) {
+		snprintf(filename, size, "%s", pOptions->output_file);
+		return;
+	}
+	const char* extension = strrchr(pOptions->output_file, '.');
+	int base_length = extension ? (int)(extension - pOptions->output_file) : (int)strlen(pOptions->output_file);
+	snprintf(filename, size, "%.*s_%s%s", base_length, pOptions->output_file, get_camera_key(camera), extension ? extension : ".png");
+}
+
+int run_software_renderer(SOFTWARE_OPTIONS* pOptions) {
+	int exit_code = 0;
+
+	n_threads = pOptions->n_threads > 0 ? pOptions->n_threads : (int)std::thread::hardware_concurrency();
+	n_threads = max(1, min(n_threads, SOFTWARE_MAX_THREADS));
+
+	double start = profiler_time_ms();
+	initialize_camera();
+	initialize_culling(&scene);
+	initialize_light_clusters(&scene);
+	load_scene_textures(&scene, pOptions->texture_size, n_threads);
+	prepare_irradiance();
+	fprintf(stdout, " * Prepared the software renderer in %.1f ms (%d threads).\n\n", profiler_time_ms() - start, n_threads);
+
+	frame.pixels = (unsigned char*)malloc(3 * (size_t)pOptions->width * pOptions->height);
+	int first_camera = pOptions->camera >= 0 ? pOptions->camera : 0;
+	int last_camera = pOptions->camera >= 0 ? pOptions->camera : NUM_CAMERAS - 1;
+	for (int camera = first_camera; camera <= last_camera; camera++) {
+		char filename[512];
+
+		set_frame_camera(camera, pOptions->width, pOptions->height);
+		double setup_start = profiler_time_ms();
+		int n_triangles = setup_triangles();
+		double raster_start = profiler_time_ms();
+		raster_tiles();
+		double raster_end = profiler_time_ms();
+
+		get_output_filename(pOptions, camera, filename, sizeof(filename));
+		bool saved = save_png_bgr(filename, frame.width, frame.height, frame.pixels);
+		if (!saved) {
+			fprintf(stderr, "Error: cannot write %s\n", filename);
+			exit_code = 1;
+		}
+		fprintf(stdout, " * Camera %s: %d triangles set up in %.1f ms, %dx%d pixels rasterized and shaded in %.1f ms%s%s.\n",
+			get_camera_key(camera), n_triangles, raster_start - setup_start, pOptions->width, pOptions->height,
+			raster_end - raster_start, saved ? ", saved to " : "", saved ? filename : "");
+	}
+
+	free(frame.pixels);
+	free_setup_data();
+	free_scene_textures();
+	free_light_clusters();
+	free_culling();
+
+	return exit_code;
+}
@@ -0,0 +1,24 @@
+﻿//
+//  SoftwareRenderer.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+#define SOFTWARE_TILE_SIZE		(64)	// pixels per side of a raster tile, a multiple of 4
+#define SOFTWARE_MAX_THREADS	(32)
+
+typedef struct {
+	int			width, height;
+	int			camera;			// CAMERA_INDEX, -1 for every predefined camera
+	int			n_threads;		// 0: one per hardware thread
+	int			texture_size;	// textures and cube map faces are scaled down to fit
+	const char*	output_file;	// PNG; for every camera the camera key is inserted before the extension
+} SOFTWARE_OPTIONS;
+
+// SoftwareRenderer.cpp
+bool parse_software_options(int argc, char* argv[], SOFTWARE_OPTIONS* pOptions);	// false without --software
+int run_software_renderer(SOFTWARE_OPTIONS* pOptions);	// process exit code
@@ -0,0 +1,315 @@
+﻿//
+//  SpatialHash.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "LoadScene.h"
+#include "SpatialHash.h"
+
+typedef struct {
+	float	box_min[3], box_max[3];	// bounds; for spheres also center and radius below
+	float	center[3];
+	float	radius;					// < 0 for boxes
+	int		cell_min[3], cell_max[3];
+	bool	large;					// in the large list instead of the cells
+} SPATIAL_VOLUME;
+
+typedef struct {
+	SPATIAL_VOLUME				volume;
+	SPATIAL_TRIGGER_CALLBACK	callback;
+	void*						user_data;
+} SPATIAL_TRIGGER;
+
+typedef struct {
+	SPATIAL_VOLUME		volume;
+	bool				moved;		// since the last update_spatial_triggers()
+	std::vector<int>	overlaps;	// triggers it is in, sorted
+} SPATIAL_ENTITY;
+
+// a bucket holds the objects of every cell hashed to it, so candidates are tested exactly
+typedef struct {
+	std::vector<int>	buckets[SPATIAL_HASH_BUCKETS];
+	std::vector<int>	large;
+	std::vector<int>	stamps;		// last query of each object, to report it once
+	int					stamp;
+} SPATIAL_GRID;
+
+static std::vector<SPATIAL_TRIGGER> triggers;
+static std::vector<SPATIAL_ENTITY> entities;
+static SPATIAL_GRID trigger_grid, entity_grid;
+
+static unsigned int hash_cell(int x, int y, int z) {
+	return ((unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u ^ (unsigned int)z * 83492791u) & (SPATIAL_HASH_BUCKETS - 1);
+}
+
+static void set_volume(SPATIAL_VOLUME* pVolume, const float* box_min, const float* box_max, float radius) {
+	int n_cells = 1;
+
+	for (int k = 0; k < 3; k++) {
+		pVolume->box_min[k] = box_min[k];
+		pVolume->box_max[k] = box_max[k];
+		pVolume->center[k] = 0.5f * (box_min[k] + box_max[k]);
+		pVolume->cell_min[k] = (int)floorf(box_min[k] / SPATIAL_CELL_SIZE);
+		pVolume->cell_max[k] = (int)floorf(box_max[k] / SPATIAL_CELL_SIZE);
+		n_cells *= pVolume->cell_max[k] - pVolume->cell_min[k] + 1;
+	}
+	pVolume->radius = radius;
+	pVolume->large = n_cells > SPATIAL_MAX_OBJECT_CELLS;
+}
+
+static void set_sphere(SPATIAL_VOLUME* pVolume, const float* center, float radius) {
+	float box_min[3] = { center[0] - radius, center[1] - radius, center[2] - radius };
+	float box_max[3] = { center[0] + radius, center[1] + radius, center[2] + radius };
+
+	set_volume(pVolume, box_min, box_max, radius);
+}
+
+static void insert_volume(SPATIAL_GRID* pGrid, const SPATIAL_VOLUME* pVolume, int object) {
+	if (pVolume->large) {
+		pGrid->large.push_back(object);
+		return;
+	}
+	for (int z = pVolume->cell_min[2]; z <= pVolume->cell_max[2]; z++)
+		for (int y = pVolume->cell_min[1]; y <= pVolume->cell_max[1]; y++)
+			for (int x = pVolume->cell_min[0]; x <= pVolume->cell_max[0]; x++) {
+				std::vector<int>& bucket = pGrid->buckets[hash_cell(x, y, z)];
+				if (bucket.empty() || bucket.back() != object) // cells of one object may share a bucket
+					bucket.push_back(object);
+			}
+}
+
+static void remove_volume(SPATIAL_GRID* pGrid, const SPATIAL_VOLUME* pVolume, int object) {
+	if (pVolume->large) {
+		pGrid->large.erase(std::find(pGrid->large.begin(), pGrid->large.end(), object));
+		return;
+	}
+	for (int z = pVolume->cell_min[2]; z <= pVolume->cell_max[2]; z++)
+		for (int y = pVolume->cell_min[1]; y <= pVolume->cell_max[1]; y++)
+			for (int x = pVolume->cell_min[0]; x <= pVolume->cell_max[0]; x++) {
+				std::vector<int>& bucket = pGrid->buckets[hash_cell(x, y, z)];
+				std::vector<int>::iterator it = std::find(bucket.begin(), bucket.end(), object);
+				if (it != bucket.end()) {
+					*it = bucket.back();
+					bucket.pop_back();
+				}
+			}
+}
+
+static bool same_cells(const SPATIAL_VOLUME* a, const SPATIAL_VOLUME* b) {
+	for (int k = 0; k < 3; k++)
+		if (a->cell_min[k] != b->cell_min[k] || a->cell_max[k] != b->cell_max[k])
+			return false;
+	return true;
+}
+
+static float box_distance_squared(const float* box_min, const float* box_max, const float* point) {
+	float distance = 0.0f;
+
+	for (int k = 0; k < 3; k++) {
+		float d = max(max(box_min[k] - point[k], point[k] - box_max[k]), 0.0f);
+		distance += d * d;
+	}
+	return distance;
+}
+
+// an entity (always a sphere) against a trigger
+static bool overlap_entity(const SPATIAL_VOLUME* pEntity, const SPATIAL_VOLUME* pTrigger) {
+	if (pTrigger->radius < 0.0f)
+		return box_distance_squared(pTrigger->box_min, pTrigger->box_max, pEntity->center) <= pEntity->radius * pEntity->radius;
+
+	float d[3] = { pEntity->center[0] - pTrigger->center[0], pEntity->center[1] - pTrigger->center[1], pEntity->center[2] - pTrigger->center[2] };
+	float r = pEntity->radius + pTrigger->radius;
+	return d[0] * d[0] + d[1] * d[1] + d[2] * d[2] <= r * r;
+}
+
+// calls visit(object) once for every object registered in the cells of the box (and every large object)
+template <typename VISITOR>
+static void visit_cells(SPATIAL_GRID* pGrid, const float* box_min, const float* box_max, VISITOR visit) {
+	int cell_min[3], cell_max[3];
+
+	pGrid->stamp++;
+	for (size_t i = 0; i < pGrid->large.size(); i++)
+		visit(pGrid->large[i]);
+	for (int k = 0; k < 3; k++) {
+		cell_min[k] = (int)floorf(box_min[k] / SPATIAL_CELL_SIZE);
+		cell_max[k] = (int)floorf(box_max[k] / SPATIAL_CELL_SIZE);
+	}
+	for (int z = cell_min[2]; z <= cell_max[2]; z++)
+		for (int y = cell_min[1]; y <= cell_max[1]; y++)
+			for (int x = cell_min[0]; x <= cell_max[0]; x++) {
+				const std::vector<int>& bucket = pGrid->buckets[hash_cell(x, y, z)];
+				for (size_t i = 0; i < bucket.size(); i++) {
+					int object = bucket[i];
+					if (pGrid->stamps[object] == pGrid->stamp)
+						continue;
+					pGrid->stamps[object] = pGrid->stamp;
+					visit(object);
+				}
+			}
+}
+
+static void clear_grid(SPATIAL_GRID* pGrid) {
+	for (int b = 0; b < SPATIAL_HASH_BUCKETS; b++)
+		std::vector<int>().swap(pGrid->buckets[b]);
+	std::vector<int>().swap(pGrid->large);
+	std::vector<int>().swap(pGrid->stamps);
+	pGrid->stamp = 0;
+}
+
+void initialize_spatial_hash(void) {
+	free_spatial_hash();
+}
+
+static int add_trigger(const SPATIAL_VOLUME* pVolume, SPATIAL_TRIGGER_CALLBACK callback, void* user_data) {
+	SPATIAL_TRIGGER trigger;
+	int index = (int)triggers.size();
+
+	trigger.volume = *pVolume;
+	trigger.callback = callback;
+	trigger.user_data = user_data;
+	triggers.push_back(trigger);
+	trigger_grid.stamps.push_back(0);
+	insert_volume(&trigger_grid, pVolume, index);
+
+	// entities already inside get their enter event on the next update
+	for (size_t i = 0; i < entities.size(); i++)
+		entities[i].moved = true;
+	return index;
+}
+
+int add_spatial_trigger_box(const float* box_min, const float* box_max, SPATIAL_TRIGGER_CALLBACK callback, void* user_data) {
+	SPATIAL_VOLUME volume;
+
+	set_volume(&volume, box_min, box_max, -1.0f);
+	return add_trigger(&volume, callback, user_data);
+}
+
+int add_spatial_trigger_sphere(const float* center, float radius, SPATIAL_TRIGGER_CALLBACK callback, void* user_data) {
+	SPATIAL_VOLUME volume;
+
+	set_sphere(&volume, center, radius);
+	return add_trigger(&volume, callback, user_data);
+}
+
+int add_spatial_entity(const float* center, float radius) {
+	int index = (int)entities.size();
+
+	entities.push_back(SPATIAL_ENTITY());
+	SPATIAL_ENTITY* pEntity = &entities[index];
+	set_sphere(&pEntity->volume, center, radius);
+	pEntity->moved = true;
+	entity_grid.stamps.push_back(0);
+	insert_volume(&entity_grid, &pEntity->volume, index);
+	return index;
+}
+
+void move_spatial_entity(int entity, const float* center) {
+	SPATIAL_ENTITY* pEntity = &entities[entity];
+	SPATIAL_VOLUME volume;
+
+	if (center[0] == pEntity->volume.center[0] && center[1] == pEntity->volume.center[1] && center[2] == pEntity->volume.center[2])
+		return;
+	set_sphere(&volume, center, pEntity->volume.radius);
+	if (!same_cells(&volume, &pEntity->volume) || volume.large != pEntity->volume.large) {
+		remove_volume(&entity_grid, &pEntity->volume, entity);
+		insert_volume(&entity_grid, &volume, entity);
+	}
+	pEntity->volume = volume;
+	pEntity->moved = true;
+}
+
+void update_spatial_triggers(void) {
+	std::vector<int> overlaps;
+
+	for (int e = 0; e < (int)entities.size(); e++) {
+		SPATIAL_ENTITY* pEntity = &entities[e];
+		if (!pEntity->moved)
+			continue;
+		pEntity->moved = false;
+
+		overlaps.clear();
+		visit_cells(&trigger_grid, pEntity->volume.box_min, pEntity->volume.box_max, [&](int trigger) {
+			if (overlap_entity(&pEntity->volume, &triggers[trigger].volume))
+				overlaps.push_back(trigger);
+		});
+		std::sort(overlaps.begin(), overlaps.end());
+		if (overlaps == pEntity->overlaps)
+			continue;
+
+		// merge the sorted lists; a callback may move entities, which only marks them for the next update
+		std::vector<int> previous;
+		previous.swap(pEntity->overlaps);
+		pEntity->overlaps = overlaps;
+		size_t i = 0, j = 0;
+		while (i < previous.size() || j < overlaps.size()) {
+			if (j == overlaps.size() || (i < previous.size() && previous[i] < overlaps[j])) {
+				SPATIAL_TRIGGER* pTrigger = &triggers[previous[i++]];
+				if (pTrigger->callback)
+					pTrigger->callback(previous[i - 1], e, SPATIAL_EVENT_EXIT, pTrigger->user_data);
+			}
+			else if (i == previous.size() || overlaps[j] < previous[i]) {
+				SPATIAL_TRIGGER* pTrigger = &triggers[overlaps[j++]];
+				if (pTrigger->callback)
+					pTrigger->callback(overlaps[j - 1], e, SPATIAL_EVENT_ENTER, pTrigger->user_data);
+			}
+			else {
+				i++;
+				j++;
+			}
+		}
+	}
+}
+
+int query_spatial_entities(const float* center, float radius, int* results, int max_results) {
+	float box_min[3] = { center[0] - radius, center[1] - radius, center[2] - radius };
+	float box_max[3] = { center[0] + radius, center[1] + radius, center[2] + radius };
+	int n_results = 0;
+
+	visit_cells(&entity_grid, box_min, box_max, [&](int entity) {
+		const SPATIAL_VOLUME* pVolume = &entities[entity].volume;
+		float d[3] = { pVolume->center[0] - center[0], pVolume->center[1] - center[1], pVolume->center[2] - center[2] };
+		float r = pVolume->radius + radius;
+		if (d[0] * d[0] + d[1] * d[1] + d[2] * d[2] > r * r)
+			return;
+		if (n_results < max_results)
+			results[n_results] = entity;
+		n_results++;
+	});
+	return n_results;
+}
+
+int query_spatial_triggers(const float* box_min, const float* box_max, int* results, int max_results) {
+	int n_results = 0;
+
+	visit_cells(&trigger_grid, box_min, box_max, [&](int trigger) {
+		const SPATIAL_VOLUME* pVolume = &triggers[trigger].volume;
+		for (int k = 0; k < 3; k++)
+			if (pVolume->box_min[k] > box_max[k] || pVolume->box_max[k] < box_min[k])
+				return;
+		if (pVolume->radius >= 0.0f && box_distance_squared(box_min, box_max, pVolume->center) > pVolume->radius * pVolume->radius)
+			return;
+		if (n_results < max_results)
+			results[n_results] = trigger;
+		n_results++;
+	});
+	return n_results;
+}
+
+void free_spatial_hash(void) {
+	std::vector<SPATIAL_TRIGGER>().swap(triggers);
+	std::vector<SPATIAL_ENTITY>().swap(entities);
+	clear_grid(&trigger_grid);
+	clear_grid(&entity_grid);
+}
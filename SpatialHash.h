@@ -0,0 +1,40 @@
+﻿//
+//  SpatialHash.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+// Broadphase for the gameplay logic. Trigger volumes (boxes or spheres placed in the scene) and moving
+// entities (spheres) are registered in the cells of a uniform grid they overlap; the cells are hashed
+// into SPATIAL_HASH_BUCKETS buckets, so the grid is unbounded and costs memory only where objects are.
+// An entity is re-registered only when it moves to other cells, and update_spatial_triggers() tests
+// only the entities that moved against the triggers of their cells, calling the trigger callbacks on
+// enter and exit. Objects spanning more than SPATIAL_MAX_OBJECT_CELLS cells are kept in a list that
+// every query tests.
+#define SPATIAL_CELL_SIZE			(500.0f)	// scene units
+#define SPATIAL_HASH_BUCKETS		(4096)		// a power of two
+#define SPATIAL_MAX_OBJECT_CELLS	(64)
+
+typedef enum {
+	SPATIAL_EVENT_ENTER,
+	SPATIAL_EVENT_EXIT
+} SPATIAL_EVENT;
+
+typedef void (*SPATIAL_TRIGGER_CALLBACK)(int trigger, int entity, SPATIAL_EVENT event, void* user_data);
+
+// SpatialHash.cpp
+void initialize_spatial_hash(void);
+int add_spatial_trigger_box(const float* box_min, const float* box_max, SPATIAL_TRIGGER_CALLBACK callback, void* user_data);
+int add_spatial_trigger_sphere(const float* center, float radius, SPATIAL_TRIGGER_CALLBACK callback, void* user_data);
+int add_spatial_entity(const float* center, float radius);
+void move_spatial_entity(int entity, const float* center);
+void update_spatial_triggers(void);	// fires the enter and exit events since the last update
+// the entities within radius of center and the triggers overlapping a box; return the number found
+// (up to max_results are written)
+int query_spatial_entities(const float* center, float radius, int* results, int max_results);
+int query_spatial_triggers(const float* box_min, const float* box_max, int* results, int max_results);
+void free_spatial_hash(void);
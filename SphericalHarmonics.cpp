@@ -0,0 +1,266 @@
+﻿//
+//  SphericalHarmonics.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+//  L_lm = sum over texels of L(w) Y_lm(w) dw, with dw = (2 / size)^2 / (1 + u^2 + v^2)^(3/2);
+//  irradiance / pi = sum of (A_l / pi) L_lm Y_lm with A_0 = pi, A_1 = 2 pi / 3, A_2 = pi / 4.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <thread>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define SH_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+#include "SphericalHarmonics.h"
+
+#define SH_CACHE_MAGIC		(0x39485342)	// "BSH9"
+#define SH_PI				(3.14159265358979f)
+
+// direction = (u, v, 1) terms of each component, per GL cube map face (s = u, t = v in [-1, 1])
+static const float face_axes[6][3][3] = {
+	{ {  0.0f,  0.0f,  1.0f }, {  0.0f, -1.0f,  0.0f }, { -1.0f,  0.0f,  0.0f } },	// +X: ( 1, -v, -u)
+	{ {  0.0f,  0.0f, -1.0f }, {  0.0f, -1.0f,  0.0f }, {  1.0f,  0.0f,  0.0f } },	// -X: (-1, -v,  u)
+	{ {  1.0f,  0.0f,  0.0f }, {  0.0f,  0.0f,  1.0f }, {  0.0f,  1.0f,  0.0f } },	// +Y: ( u,  1,  v)
+	{ {  1.0f,  0.0f,  0.0f }, {  0.0f,  0.0f, -1.0f }, {  0.0f, -1.0f,  0.0f } },	// -Y: ( u, -1, -v)
+	{ {  1.0f,  0.0f,  0.0f }, {  0.0f, -1.0f,  0.0f }, {  0.0f,  0.0f,  1.0f } },	// +Z: ( u, -v,  1)
+	{ { -1.0f,  0.0f,  0.0f }, {  0.0f, -1.0f,  0.0f }, {  0.0f,  0.0f, -1.0f } }	// -Z: (-u, -v, -1)
+};
+
+// order-2 basis, without the normalization constants (applied once at the end)
+static const float basis_constants[SH_COEFFICIENTS] = {
+	0.282095f, 0.488603f, 0.488603f, 0.488603f, 1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f
+};
+static const float band_convolution[SH_COEFFICIENTS] = { // A_l / pi
+	1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f
+};
+
+static float srgb_to_linear[256];
+
+// Per row (fixed v), every basis function times the solid angle is a quadratic in u over a power of
+// inv_length = 1 / sqrt(1 + u^2 + v^2), so a face row only needs six weighted color moments. The
+// weights depend on (u, v) alone and are shared by the same row of all six faces.
+#define N_MOMENTS	(6)	// w, w il, w il u, w il^2, w il^2 u, w il^2 u^2 with w = il^3
+
+typedef struct {
+	const unsigned char**	faces;
+	int						size, pitch, bytes_per_pixel;
+	int						first_row, end_row;
+	double					sums[SH_COEFFICIENTS][3];
+	double					weight;
+} SH_JOB;
+
+// sum over the row of q2 u^2 + q1 u + q0, scaled by w il^2
+static float quadratic_moment(const float moments[N_MOMENTS], float q2, float q1, float q0) {
+	return q2 * moments[5] + q1 * moments[4] + q0 * moments[3];
+}
+
+static void accumulate_rows(SH_JOB* pJob) {
+	const float texel_scale = 2.0f / pJob->size;
+	int size = pJob->size;
+	float* weights = (float*)malloc(sizeof(float) * N_MOMENTS * (size + 3)); // [moment][x], rows padded to 4
+
+	for (int k = 0; k < SH_COEFFICIENTS; k++)
+		pJob->sums[k][0] = pJob->sums[k][1] = pJob->sums[k][2] = 0.0;
+	pJob->weight = 0.0;
+
+	for (int row = pJob->first_row; row < pJob->end_row; row++) {
+		float v = (row + 0.5f) * texel_scale - 1.0f;
+		double row_weight = 0.0;
+
+		for (int x = 0; x < size; x++) {
+			float u = (x + 0.5f) * texel_scale - 1.0f;
+			float inv_length = 1.0f / sqrtf(1.0f + u * u + v * v);
+			float w = inv_length * inv_length * inv_length;
+
+			weights[x] = w;
+			weights[(size + 3) + x] = w * inv_length;
+			weights[2 * (size + 3) + x] = w * inv_length * u;
+			weights[3 * (size + 3) + x] = w * inv_length * inv_length;
+			weights[4 * (size + 3) + x] = w * inv_length * inv_length * u;
+			weights[5 * (size + 3) + x] = w * inv_length * inv_length * u * u;
+			row_weight += w;
+		}
+
+		for (int face = 0; face < 6; face++) {
+			const unsigned char* texels = pJob->faces[face] + (size_t)row * pJob->pitch;
+			float moments[3][N_MOMENTS] = { { 0.0f } };
+			int x = 0;
+
+#ifdef SH_USE_SSE
+			__m128 acc[3][N_MOMENTS];
+			for (int c = 0; c < 3; c++)
+				for (int m = 0; m < N_MOMENTS; m++)
+					acc[c][m] = _mm_setzero_ps();
+
+			for (; x + 4 <= size; x += 4) {
+				// BGR bytes -> linear RGB
+				float rgb[3][4];
+				for (int i = 0; i < 4; i++) {
+					const unsigned char* texel = texels + (x + i) * pJob->bytes_per_pixel;
+					rgb[0][i] = srgb_to_linear[texel[2]];
+					rgb[1][i] = srgb_to_linear[texel[1]];
+					rgb[2][i] = srgb_to_linear[texel[0]];
+				}
+				for (int m = 0; m < N_MOMENTS; m++) {
+					__m128 weight = _mm_loadu_ps(&weights[m * (size + 3) + x]);
+					for (int c = 0; c < 3; c++)
+						acc[c][m] = _mm_add_ps(acc[c][m], _mm_mul_ps(weight, _mm_loadu_ps(rgb[c])));
+				}
+			}
+
+			float lanes[4];
+			for (int c = 0; c < 3; c++)
+				for (int m = 0; m < N_MOMENTS; m++) {
+					_mm_storeu_ps(lanes, acc[c][m]);
+					moments[c][m] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+				}
+#endif
+			for (; x < size; x++) {
+				const unsigned char* texel = texels + x * pJob->bytes_per_pixel;
+				float color[3] = { srgb_to_linear[texel[2]], srgb_to_linear[texel[1]], srgb_to_linear[texel[0]] };
+
+				for (int c = 0; c < 3; c++)
+					for (int m = 0; m < N_MOMENTS; m++)
+						moments[c][m] += weights[m * (size + 3) + x] * color[c];
+			}
+
+			// unnormalized direction component i = a[i] u + b[i]
+			const float(*axes)[3] = face_axes[face];
+			float a[3], b[3];
+			for (int i = 0; i < 3; i++) {
+				a[i] = axes[i][0];
+				b[i] = axes[i][1] * v + axes[i][2];
+			}
+			for (int c = 0; c < 3; c++) {
+				const float* M = moments[c];
+				float basis_sums[SH_COEFFICIENTS] = {
+					M[0],
+					a[1] * M[2] + b[1] * M[1],
+					a[2] * M[2] + b[2] * M[1],
+					a[0] * M[2] + b[0] * M[1],
+					quadratic_moment(M, a[0] * a[1], a[0] * b[1] + a[1] * b[0], b[0] * b[1]),
+					quadratic_moment(M, a[1] * a[2], a[1] * b[2] + a[2] * b[1], b[1] * b[2]),
+					quadratic_moment(M, 3.0f * a[2] * a[2] - 1.0f, 6.0f * a[2] * b[2], 3.0f * b[2] * b[2] - 1.0f - v * v),
+					quadratic_moment(M, a[0] * a[2], a[0] * b[2] + a[2] * b[0], b[0] * b[2]),
+					quadratic_moment(M, a[0] * a[0] - a[1] * a[1], 2.0f * (a[0] * b[0] - a[1] * b[1]), b[0] * b[0] - b[1] * b[1])
+				};
+				// rows are summed in double so that 2K faces do not lose precision
+				for (int k = 0; k < SH_COEFFICIENTS; k++)
+					pJob->sums[k][c] += basis_sums[k];
+			}
+		}
+		pJob->weight += 6.0 * row_weight;
+	}
+
+	free(weights);
+}
+
+int get_irradiance_thread_count(void) {
+	int n_threads = (int)std::thread::hardware_concurrency();
+
+	if (n_threads < 1)
+		n_threads = 1;
+	if (n_threads > SH_MAX_THREADS)
+		n_threads = SH_MAX_THREADS;
+	return n_threads;
+}
+
+void project_cubemap_irradiance(const unsigned char* faces[6], int size, int pitch, int bytes_per_pixel,
+	float irradiance[SH_COEFFICIENTS][3]) {
+	SH_JOB jobs[SH_MAX_THREADS];
+	std::thread threads[SH_MAX_THREADS];
+	int n_threads = get_irradiance_thread_count();
+
+	for (int i = 0; i < 256; i++)
+		srgb_to_linear[i] = powf(i / 255.0f, 2.2f); // the same approximation as the shaders
+
+	for (int t = 0; t < n_threads; t++) {
+		jobs[t].faces = faces;
+		jobs[t].size = size;
+		jobs[t].pitch = pitch;
+		jobs[t].bytes_per_pixel = bytes_per_pixel;
+		jobs[t].first_row = size * t / n_threads;
+		jobs[t].end_row = size * (t + 1) / n_threads;
+		if (t > 0)
+			threads[t] = std::thread(accumulate_rows, &jobs[t]);
+	}
+	accumulate_rows(&jobs[0]);
+	for (int t = 1; t < n_threads; t++)
+		threads[t].join();
+
+	double sums[SH_COEFFICIENTS][3] = { { 0.0 } }, weight = 0.0;
+	for (int t = 0; t < n_threads; t++) {
+		for (int k = 0; k < SH_COEFFICIENTS; k++)
+			for (int c = 0; c < 3; c++)
+				sums[k][c] += jobs[t].sums[k][c];
+		weight += jobs[t].weight;
+	}
+
+	// the solid angles are normalized to sum to 4 pi exactly; each coefficient gets Y_lm's constant twice
+	// (projection and reconstruction) and the cosine lobe's A_l / pi
+	for (int k = 0; k < SH_COEFFICIENTS; k++)
+		for (int c = 0; c < 3; c++)
+			irradiance[k][c] = (float)(sums[k][c] * 4.0 * SH_PI / weight) * basis_constants[k] * basis_constants[k] * band_convolution[k];
+}
+
+unsigned long long get_cubemap_cache_key(const char* filenames[6]) {
+	unsigned long long key = 0xcbf29ce484222325ull; // FNV-1a over (size, mtime) of each face
+
+	for (int face = 0; face < 6; face++) {
+		struct stat file_stat;
+		unsigned long long values[2] = { 0, 0 };
+
+		if (stat(filenames[face], &file_stat) == 0) {
+			values[0] = (unsigned long long)file_stat.st_size;
+			values[1] = (unsigned long long)file_stat.st_mtime;
+		}
+		const unsigned char* bytes = (const unsigned char*)values;
+		for (size_t i = 0; i < sizeof(values); i++) {
+			key ^= bytes[i];
+			key *= 0x100000001b3ull;
+		}
+	}
+	return key;
+}
+
+bool load_irradiance_cache(const char* filename, unsigned long long key, float irradiance[SH_COEFFICIENTS][3]) {
+	FILE* fp = fopen(filename, "rb");
+	unsigned int magic = 0;
+	unsigned long long file_key = 0;
+	bool loaded = false;
+
+	if (fp == NULL)
+		return false;
+	if (fread(&magic, sizeof(magic), 1, fp) == 1 && magic == SH_CACHE_MAGIC
+		&& fread(&file_key, sizeof(file_key), 1, fp) == 1 && file_key == key)
+		loaded = fread(irradiance, sizeof(float) * 3, SH_COEFFICIENTS, fp) == SH_COEFFICIENTS;
+	fclose(fp);
+
+	return loaded;
+}
+
+void save_irradiance_cache(const char* filename, unsigned long long key, float irradiance[SH_COEFFICIENTS][3]) {
+	FILE* fp = fopen(filename, "wb");
+	unsigned int magic = SH_CACHE_MAGIC;
+
+	if (fp == NULL) {
+		fprintf(stderr, "Error: cannot write %s\n", filename);
+		return;
+	}
+	fwrite(&magic, sizeof(magic), 1, fp);
+	fwrite(&key, sizeof(key), 1, fp);
+	fwrite(irradiance, sizeof(float) * 3, SH_COEFFICIENTS, fp);
+	fclose(fp);
+}
@@ -0,0 +1,26 @@
+﻿//
+//  SphericalHarmonics.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+// Diffuse irradiance of an environment cube map as 9 (order 2) spherical harmonics.
+// The coefficients have the SH basis constants and the clamped cosine convolution folded in,
+// divided by pi, so E(n) / pi = c[0] + c[1] y + c[2] z + c[3] x + c[4] xy + c[5] yz
+//                              + c[6] (3z^2 - 1) + c[7] xz + c[8] (x^2 - y^2)
+// for a unit direction n = (x, y, z) in cube map coordinates.
+#define SH_COEFFICIENTS		(9)
+#define SH_MAX_THREADS		(8)
+
+// SphericalHarmonics.cpp
+int get_irradiance_thread_count(void);	// worker threads of the projection, up to SH_MAX_THREADS
+// faces: 8-bit sRGB BGR texels in GL order (+X, -X, +Y, -Y, +Z, -Z), rows as uploaded with glTexImage2D
+void project_cubemap_irradiance(const unsigned char* faces[6], int size, int pitch, int bytes_per_pixel,
+	float irradiance[SH_COEFFICIENTS][3]);
+unsigned long long get_cubemap_cache_key(const char* filenames[6]);	// from the file sizes and modification times
+bool load_irradiance_cache(const char* filename, unsigned long long key, float irradiance[SH_COEFFICIENTS][3]);
+void save_irradiance_cache(const char* filename, unsigned long long key, float irradiance[SH_COEFFICIENTS][3]);
@@ -0,0 +1,604 @@
+﻿//
+//  Streaming.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "LoadScene.h"
+#include "Culling.h"
+#include "SceneFile.h"
+#include "Profiler.h"
+#include "Streaming.h"
+
+#define STREAM_TILE_MAGIC		(0x31545342)	// "BST1"
+#define STREAM_VELOCITY_WEIGHT	(0.25f)			// of the newest camera step in the smoothed velocity
+
+#ifdef _WIN32
+#define fseek_64	_fseeki64	// tile files of larger scenes pass 2 GB
+#define ftell_64	_ftelli64
+#else
+#define fseek_64	fseeko
+#define ftell_64	ftello
+#endif
+
+// a tile (resources [0, n_tiles)) or a texture (resources [n_tiles, n_tiles + n_textures))
+typedef enum {
+	STREAM_ON_DISK,
+	STREAM_QUEUED,
+	STREAM_LOADING,		// by an I/O thread
+	STREAM_IN_MEMORY,	// data is valid
+	STREAM_FAILED
+} STREAM_STATE;
+
+typedef struct {
+	std::atomic<int>	state;
+	void*				data;		// the vertices or texels while STREAM_IN_MEMORY
+	size_t				bytes;		// of data, the same in graphics memory
+	int					width, height;	// of a texture, 0 if its file could not be read
+	int					data_width, data_height;	// of the texels read, set by the I/O thread
+	float				distance;	// to the camera or its predicted position, whichever is nearer
+	bool				on_gpu;
+	bool				keep_on_gpu, keep_in_memory;
+} STREAM_RESOURCE;
+
+static STREAM_CALLBACKS callbacks;
+static STREAM_TILES tiles;
+static float (*tile_box)[4];	// XY bounds: x_min, y_min, x_max, y_max
+static long long* tile_offset;	// in the tile file
+static std::vector<int> tile_first_texture, tile_textures;	// textures of tile t: [tile_first_texture[t], tile_first_texture[t + 1])
+static int n_stream_textures, n_resources;
+static STREAM_RESOURCE* resources;
+static std::vector<int> resource_order;	// nearest first
+static size_t cpu_budget_bytes, gpu_budget_bytes;
+static bool streaming_initialized = false;
+
+static float last_position[3], velocity[3];
+static double last_time = -1.0;
+
+static const char** texture_file_names;
+static std::thread io_threads[STREAM_IO_THREADS];
+static std::deque<int> io_queue;	// nearest first
+static std::mutex io_mutex;
+static std::condition_variable io_condition;
+static bool io_quit;
+
+// from the scene file and everything that changes the layout
+static unsigned long long get_tile_file_key(int n_chunks, int vertex_floats) {
+	unsigned long long key = 0xcbf29ce484222325ull; // FNV-1a
+	unsigned long long values[5] = { get_scene_source_key(NULL), (unsigned long long)n_chunks, CULL_CHUNK_TRIANGLES, (unsigned long long)vertex_floats, 0 };
+	float tile_size = STREAM_TILE_SIZE;
+
+	memcpy(&values[4], &tile_size, sizeof(tile_size));
+	const unsigned char* bytes = (const unsigned char*)values;
+	for (size_t i = 0; i < sizeof(values); i++) {
+		key ^= bytes[i];
+		key *= 0x100000001b3ull;
+	}
+	return key;
+}
+
+static void allocate_tiles(int n_chunks, int n_tiles) {
+	tiles.n_tiles = n_tiles;
+	tiles.chunk_tile = (int*)malloc(sizeof(int) * n_chunks);
+	tiles.chunk_first_vertex = (int*)malloc(sizeof(int) * n_chunks);
+	tiles.tile_n_vertices = (int*)malloc(sizeof(int) * max(n_tiles, 1));
+	tile_box = (float(*)[4])malloc(sizeof(float[4]) * max(n_tiles, 1));
+	tile_offset = (long long*)malloc(sizeof(long long) * (n_tiles + 1));
+}
+
+static long long get_header_size(int n_chunks, int n_tiles, int n_textures) {
+	return sizeof(unsigned int) + sizeof(unsigned long long) + 4 * sizeof(int)
+		+ 2 * sizeof(int) * (long long)n_chunks + (sizeof(int) + sizeof(float[4])) * (long long)n_tiles + 2 * sizeof(int) * (long long)n_textures;
+}
+
+static void set_tile_offsets(int n_chunks, int n_textures) {
+	tile_offset[0] = get_header_size(n_chunks, tiles.n_tiles, n_textures);
+	for (int t = 0; t < tiles.n_tiles; t++)
+		tile_offset[t + 1] = tile_offset[t] + (long long)sizeof(float) * callbacks.vertex_floats * tiles.tile_n_vertices[t];
+}
+
+// the table read from the file: every chunk inside its tile, and the vertices of all tiles exactly filling the file
+static bool is_tile_table_valid(CULL_CHUNKS* pChunks, long long file_size, int n_textures, const int* texture_size) {
+	long long n_vertices = 0;
+
+	for (int t = 0; t < tiles.n_tiles; t++) {
+		if (tiles.tile_n_vertices[t] < 0 || tiles.tile_n_vertices[t] % 3 != 0)
+			return false;
+		n_vertices += tiles.tile_n_vertices[t];
+	}
+	for (int c = 0; c < pChunks->n_chunks; c++) {
+		int t = tiles.chunk_tile[c];
+		if (t < 0 || t >= tiles.n_tiles || tiles.chunk_first_vertex[c] < 0
+			|| tiles.chunk_first_vertex[c] + 3 * (long long)pChunks->chunk_n_triangles[c] > tiles.tile_n_vertices[t])
+			return false;
+	}
+	for (int i = 0; i < 2 * n_textures; i++)
+		if (texture_size[i] < 0)
+			return false;
+	return file_size - get_header_size(pChunks->n_chunks, tiles.n_tiles, n_textures) == (long long)sizeof(float) * callbacks.vertex_floats * n_vertices;
+}
+
+static bool load_tile_table(unsigned long long key, CULL_CHUNKS* pChunks, int n_textures, int* texture_size) {
+	FILE* fp = fopen(STREAM_TILE_FILE, "rb");
+	unsigned int magic = 0;
+	unsigned long long file_key = 0;
+	int counts[4] = { 0 };
+	bool loaded = false;
+
+	if (fp == NULL)
+		return false;
+	long long file_size = fseek_64(fp, 0, SEEK_END) == 0 ? ftell_64(fp) : -1;
+	// a tile holds at least one chunk, so there are no more tiles than chunks
+	if (file_size > 0 && fseek_64(fp, 0, SEEK_SET) == 0
+		&& fread(&magic, sizeof(magic), 1, fp) == 1 && magic == STREAM_TILE_MAGIC
+		&& fread(&file_key, sizeof(file_key), 1, fp) == 1 && file_key == key
+		&& fread(counts, sizeof(int), 4, fp) == 4 && counts[0] == pChunks->n_chunks && counts[2] == n_textures
+		&& counts[3] == callbacks.vertex_floats && counts[1] >= 0 && counts[1] <= pChunks->n_chunks
+		&& get_header_size(pChunks->n_chunks, counts[1], n_textures) <= file_size) {
+		allocate_tiles(pChunks->n_chunks, counts[1]);
+		loaded = fread(tiles.chunk_tile, sizeof(int), pChunks->n_chunks, fp) == (size_t)pChunks->n_chunks
+			&& fread(tiles.chunk_first_vertex, sizeof(int), pChunks->n_chunks, fp) == (size_t)pChunks->n_chunks
+			&& fread(tiles.tile_n_vertices, sizeof(int), tiles.n_tiles, fp) == (size_t)tiles.n_tiles
+			&& fread(tile_box, sizeof(float[4]), tiles.n_tiles, fp) == (size_t)tiles.n_tiles
+			&& fread(texture_size, 2 * sizeof(int), n_textures, fp) == (size_t)n_textures
+			&& is_tile_table_valid(pChunks, file_size, n_textures, texture_size);
+	}
+	fclose(fp);
+
+	if (!loaded && counts[0] != 0)
+		fprintf(stderr, "Error: %s is corrupt or out of date\n", STREAM_TILE_FILE);
+	return loaded;
+}
+
+// the header without pixels, where FreeImage can read it that way
+static void get_texture_size(const char* filename, int* size) {
+	FIBITMAP* pixmap = FreeImage_Load(FreeImage_GetFileType(filename, 0), filename, FIF_LOAD_NOPIXELS);
+
+	size[0] = size[1] = 0;
+	if (pixmap == NULL)
+		return;
+	size[0] = FreeImage_GetWidth(pixmap);
+	size[1] = FreeImage_GetHeight(pixmap);
+	FreeImage_Unload(pixmap);
+}
+
+// groups the chunks into tiles and writes the table and the vertices of every tile
+static bool write_tile_file(SCENE* pScene, unsigned long long key, CULL_CHUNKS* pChunks, int* texture_size) {
+	int n_chunks = pChunks->n_chunks;
+	std::vector<int> chunk_material(n_chunks), order(n_chunks);
+	std::vector<long long> chunk_cell(n_chunks);
+	std::vector<float> chunk_box(4 * (size_t)n_chunks);
+
+	for (int m = 0; m < pScene->n_materials; m++) {
+		GEOMETRY_TRIANGULAR_MESH* tm = &pScene->material_list[m].geometry.tm;
+		for (int c = pChunks->material_first_chunk[m]; c < pChunks->material_first_chunk[m + 1]; c++) {
+			float* box = &chunk_box[4 * c];
+			box[0] = box[1] = FLT_MAX;
+			box[2] = box[3] = -FLT_MAX;
+			for (int t = pChunks->chunk_first_triangle[c]; t < pChunks->chunk_first_triangle[c] + pChunks->chunk_n_triangles[c]; t++)
+				for (int v = 0; v < 3; v++) {
+					box[0] = min(box[0], tm->triangle_list[t].position[v].x);
+					box[1] = min(box[1], tm->triangle_list[t].position[v].y);
+					box[2] = max(box[2], tm->triangle_list[t].position[v].x);
+					box[3] = max(box[3], tm->triangle_list[t].position[v].y);
+				}
+			long long cell_x = (long long)floorf(0.5f * (box[0] + box[2]) / STREAM_TILE_SIZE);
+			long long cell_y = (long long)floorf(0.5f * (box[1] + box[3]) / STREAM_TILE_SIZE);
+			chunk_cell[c] = cell_y * 0x100000000ll + cell_x;
+			chunk_material[c] = m;
+			order[c] = c;
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return chunk_cell[a] < chunk_cell[b]; });
+
+	int n_tiles = 0;
+	for (int i = 0; i < n_chunks; i++)
+		n_tiles += (i == 0 || chunk_cell[order[i]] != chunk_cell[order[i - 1]]);
+	allocate_tiles(n_chunks, n_tiles);
+	for (int i = 0, t = -1; i < n_chunks; i++) {
+		int c = order[i];
+		const float* box = &chunk_box[4 * c];
+		if (i == 0 || chunk_cell[c] != chunk_cell[order[i - 1]]) {
+			t++;
+			tiles.tile_n_vertices[t] = 0;
+			memcpy(tile_box[t], box, sizeof(tile_box[t]));
+		}
+		tiles.chunk_tile[c] = t;
+		tiles.chunk_first_vertex[c] = tiles.tile_n_vertices[t];
+		tiles.tile_n_vertices[t] += 3 * pChunks->chunk_n_triangles[c];
+		tile_box[t][0] = min(tile_box[t][0], box[0]);
+		tile_box[t][1] = min(tile_box[t][1], box[1]);
+		tile_box[t][2] = max(tile_box[t][2], box[2]);
+		tile_box[t][3] = max(tile_box[t][3], box[3]);
+	}
+	for (int texId = 0; texId < pScene->n_textures; texId++)
+		get_texture_size(pScene->texture_file_name[texId], &texture_size[2 * texId]);
+
+	FILE* fp = fopen(STREAM_TILE_FILE, "wb");
+	unsigned int magic = STREAM_TILE_MAGIC;
+	int counts[4] = { n_chunks, n_tiles, pScene->n_textures, callbacks.vertex_floats };
+
+	if (fp == NULL) {
+		fprintf(stderr, "Error: cannot write %s\n", STREAM_TILE_FILE);
+		return false;
+	}
+	fwrite(&magic, sizeof(magic), 1, fp);
+	fwrite(&key, sizeof(key), 1, fp);
+	fwrite(counts, sizeof(int), 4, fp);
+	fwrite(tiles.chunk_tile, sizeof(int), n_chunks, fp);
+	fwrite(tiles.chunk_first_vertex, sizeof(int), n_chunks, fp);
+	fwrite(tiles.tile_n_vertices, sizeof(int), n_tiles, fp);
+	fwrite(tile_box, sizeof(float[4]), n_tiles, fp);
+	fwrite(texture_size, 2 * sizeof(int), pScene->n_textures, fp);
+
+	// the chunks of a tile in material order, as the table above numbers their vertices
+	std::vector<float> vertices;
+	bool written = true;
+	for (int i = 0; i < n_chunks; i++) {
+		int c = order[i];
+		vertices.resize((size_t)3 * pChunks->chunk_n_triangles[c] * callbacks.vertex_floats);
+		callbacks.get_vertices(chunk_material[c], pChunks->chunk_first_triangle[c], pChunks->chunk_n_triangles[c], vertices.data());
+		written = written && fwrite(vertices.data(), sizeof(float), vertices.size(), fp) == vertices.size();
+	}
+	if (fclose(fp) != 0 || !written) {
+		fprintf(stderr, "Error: cannot write %s\n", STREAM_TILE_FILE);
+		remove(STREAM_TILE_FILE);
+		return false;
+	}
+	return true;
+}
+
+static bool load_tile(FILE* fp, int tile, STREAM_RESOURCE* pResource) {
+	size_t n_floats = (size_t)tiles.tile_n_vertices[tile] * callbacks.vertex_floats;
+	float* vertices = (float*)malloc(sizeof(float) * max(n_floats, (size_t)1));
+
+	if (fp == NULL || fseek_64(fp, tile_offset[tile], SEEK_SET) != 0 || fread(vertices, sizeof(float), n_floats, fp) != n_floats) {
+		fprintf(stderr, "Error: cannot read tile %d of %s\n", tile, STREAM_TILE_FILE);
+		free(vertices);
+		return false;
+	}
+	pResource->data = vertices;
+	return true;
+}
+
+static bool load_texture(int texId, STREAM_RESOURCE* pResource) {
+	const char* filename = texture_file_names[texId];
+	FIBITMAP* pixmap = FreeImage_Load(FreeImage_GetFileType(filename, 0), filename);
+
+	if (pixmap == NULL) {
+		fprintf(stderr, "Error: cannot read %s\n", filename);
+		return false;
+	}
+	FIBITMAP* pixmap_32 = FreeImage_ConvertTo32Bits(pixmap);
+	FreeImage_Unload(pixmap);
+	if (pixmap_32 == NULL)
+		return false;
+
+	int width = FreeImage_GetWidth(pixmap_32), height = FreeImage_GetHeight(pixmap_32);
+	unsigned int* texels = (unsigned int*)malloc(sizeof(unsigned int) * max(width * height, 1));
+	for (int y = 0; y < height; y++)
+		memcpy(&texels[y * width], FreeImage_GetScanLine(pixmap_32, y), sizeof(unsigned int) * width);
+	FreeImage_Unload(pixmap_32);
+
+	pResource->data_width = width;
+	pResource->data_height = height;
+	pResource->data = texels;
+	return true;
+}
+
+static void io_job(void) {
+	FILE* fp = fopen(STREAM_TILE_FILE, "rb");
+
+	for (;;) {
+		int r;
+		{
+			std::unique_lock<std::mutex> lock(io_mutex);
+			io_condition.wait(lock, [] { return io_quit || !io_queue.empty(); });
+			if (io_quit)
+				break;
+			r = io_queue.front();
+			io_queue.pop_front();
+			resources[r].state = STREAM_LOADING;
+		}
+		bool loaded = (r < tiles.n_tiles) ? load_tile(fp, r, &resources[r]) : load_texture(r - tiles.n_tiles, &resources[r]);
+		resources[r].state = loaded ? STREAM_IN_MEMORY : STREAM_FAILED;
+	}
+	if (fp != NULL)
+		fclose(fp);
+}
+
+bool initialize_streaming(SCENE* pScene, size_t cpu_budget, size_t gpu_budget, const STREAM_CALLBACKS* pCallbacks) {
+	CULL_CHUNKS* pChunks = get_cull_chunks();
+	double start = profiler_time_ms();
+
+	callbacks = *pCallbacks;
+	unsigned long long key = get_tile_file_key(pChunks->n_chunks, callbacks.vertex_floats);
+	std::vector<int> texture_size(2 * (size_t)max(pScene->n_textures, 1));
+
+	if (load_tile_table(key, pChunks, pScene->n_textures, texture_size.data()))
+		fprintf(stdout, " * Loaded the streaming tiles from %s.\n", STREAM_TILE_FILE);
+	else {
+		if (tiles.chunk_tile != NULL) // a stale table
+			free_streaming();
+		if (!write_tile_file(pScene, key, pChunks, texture_size.data())) {
+			free_streaming();
+			return false;
+		}
+		fprintf(stdout, " * Wrote the streaming tiles to %s in %.1f s.\n", STREAM_TILE_FILE, (profiler_time_ms() - start) / 1000.0);
+	}
+	set_tile_offsets(pChunks->n_chunks, pScene->n_textures);
+
+	// the textures a tile needs: those of the materials of its chunks, each once
+	n_stream_textures = pScene->n_textures;
+	std::vector<int> texture_stamp(max(n_stream_textures, 1), -1);
+	tile_first_texture.assign(tiles.n_tiles + 1, 0);
+	tile_textures.clear();
+	std::vector<std::vector<int> > textures_of_tile(tiles.n_tiles);
+	for (int m = 0; m < pScene->n_materials; m++) {
+		MATERIAL* pMaterial = &pScene->material_list[m];
+		int texIds[4] = { pMaterial->diffuseTexId, pMaterial->normalMapTexId, pMaterial->specularTexId, pMaterial->emissiveTexId };
+		for (int c = pChunks->material_first_chunk[m]; c < pChunks->material_first_chunk[m + 1]; c++)
+			for (int i = 0; i < 4; i++)
+				if (texIds[i] != (int)INVALID_TEX_ID && texIds[i] < n_stream_textures)
+					textures_of_tile[tiles.chunk_tile[c]].push_back(texIds[i]);
+	}
+	for (int t = 0; t < tiles.n_tiles; t++) {
+		for (int texId : textures_of_tile[t]) {
+			if (texture_stamp[texId] == t)
+				continue;
+			texture_stamp[texId] = t;
+			tile_textures.push_back(texId);
+		}
+		tile_first_texture[t + 1] = (int)tile_textures.size();
+	}
+
+	n_resources = tiles.n_tiles + n_stream_textures;
+	resources = new STREAM_RESOURCE[max(n_resources, 1)];
+	resource_order.resize(n_resources);
+	size_t total_bytes[2] = { 0, 0 };
+	for (int r = 0; r < n_resources; r++) {
+		STREAM_RESOURCE* pResource = &resources[r];
+		pResource->state = STREAM_ON_DISK;
+		pResource->data = NULL;
+		pResource->on_gpu = pResource->keep_on_gpu = pResource->keep_in_memory = false;
+		pResource->distance = FLT_MAX;
+		if (r < tiles.n_tiles) {
+			pResource->width = pResource->height = 0;
+			pResource->bytes = sizeof(float) * callbacks.vertex_floats * (size_t)tiles.tile_n_vertices[r];
+		}
+		else {
+			pResource->width = texture_size[2 * (r - tiles.n_tiles)];
+			pResource->height = texture_size[2 * (r - tiles.n_tiles) + 1];
+			pResource->bytes = sizeof(unsigned int) * (size_t)pResource->width * pResource->height;
+			if (pResource->width == 0)
+				pResource->state = STREAM_FAILED;
+		}
+		total_bytes[r >= tiles.n_tiles] += pResource->bytes;
+		resource_order[r] = r;
+	}
+
+	texture_file_names = (const char**)malloc(sizeof(char*) * max(n_stream_textures, 1));
+	for (int texId = 0; texId < n_stream_textures; texId++)
+		texture_file_names[texId] = pScene->texture_file_name[texId];
+	cpu_budget_bytes = cpu_budget;
+	gpu_budget_bytes = gpu_budget;
+	last_time = -1.0;
+	memset(velocity, 0, sizeof(velocity));
+
+	io_quit = false;
+	for (int t = 0; t < STREAM_IO_THREADS; t++)
+		io_threads[t] = std::thread(io_job);
+	streaming_initialized = true;
+
+	fprintf(stdout, " * Streaming %d tiles (%.1f MB of vertices) and %d textures (%.1f MB) within %.0f MB of system and %.0f MB of graphics memory.\n",
+		tiles.n_tiles, total_bytes[0] / 1048576.0, n_stream_textures, total_bytes[1] / 1048576.0,
+		cpu_budget / 1048576.0, gpu_budget / 1048576.0);
+	return true;
+}
+
+const STREAM_TILES* get_stream_tiles(void) {
+	return &tiles;
+}
+
+bool is_stream_texture_available(int texId) {
+	return resources[tiles.n_tiles + texId].width > 0;
+}
+
+static float get_box_distance(const float* box, const float* position) {
+	float dx = max(max(box[0] - position[0], position[0] - box[2]), 0.0f);
+	float dy = max(max(box[1] - position[1], position[1] - box[3]), 0.0f);
+	return sqrtf(dx * dx + dy * dy);
+}
+
+static void release_memory(STREAM_RESOURCE* pResource) {
+	free(pResource->data);
+	pResource->data = NULL;
+	pResource->state = STREAM_ON_DISK;
+}
+
+bool update_streaming(const float* camera_position) {
+	double now = profiler_time_ms();
+	float predicted[3];
+	bool tiles_changed = false;
+
+	// the velocity is smoothed over the camera steps, which come with the key repeat rather than every frame
+	if (last_time >= 0.0 && now > last_time) {
+		float seconds = (float)((now - last_time) / 1000.0);
+		for (int k = 0; k < 3; k++)
+			velocity[k] += STREAM_VELOCITY_WEIGHT * ((camera_position[k] - last_position[k]) / seconds - velocity[k]);
+	}
+	last_time = now;
+	memcpy(last_position, camera_position, sizeof(last_position));
+	for (int k = 0; k < 3; k++)
+		predicted[k] = camera_position[k] + STREAM_PREDICT_SECONDS * velocity[k];
+
+	for (int r = 0; r < n_resources; r++)
+		resources[r].distance = FLT_MAX;
+	for (int t = 0; t < tiles.n_tiles; t++) {
+		float distance = min(get_box_distance(tile_box[t], camera_position), get_box_distance(tile_box[t], predicted));
+		resources[t].distance = distance;
+		for (int i = tile_first_texture[t]; i < tile_first_texture[t + 1]; i++) {
+			STREAM_RESOURCE* pTexture = &resources[tiles.n_tiles + tile_textures[i]];
+			pTexture->distance = min(pTexture->distance, distance);
+		}
+	}
+	std::sort(resource_order.begin(), resource_order.end(), [](int a, int b) {
+		return resources[a].distance < resources[b].distance || (resources[a].distance == resources[b].distance && a < b);
+	});
+
+	// nearest first until a budget is full; what misses the graphics memory budget is not loaded at all,
+	// so that a far small texture never takes the place of a near large one
+	size_t gpu_bytes = 0, cpu_bytes = 0;
+	bool gpu_full = false, cpu_full = false;
+	for (int r : resource_order) {
+		STREAM_RESOURCE* pResource = &resources[r];
+		pResource->keep_on_gpu = pResource->keep_in_memory = false;
+		if (pResource->state == STREAM_FAILED)
+			continue;
+		if (r >= tiles.n_tiles && pResource->state == STREAM_IN_MEMORY) { // the file may have changed since the tile file was written
+			pResource->width = pResource->data_width;
+			pResource->height = pResource->data_height;
+			pResource->bytes = sizeof(unsigned int) * (size_t)pResource->width * pResource->height;
+		}
+		if (!gpu_full && pResource->distance < STREAM_LOAD_DISTANCE) {
+			gpu_full = gpu_bytes + pResource->bytes > gpu_budget_bytes;
+			pResource->keep_on_gpu = !gpu_full;
+			gpu_bytes += pResource->keep_on_gpu ? pResource->bytes : 0;
+		}
+		if (!cpu_full && pResource->distance < STREAM_PREFETCH_DISTANCE) {
+			cpu_full = cpu_bytes + pResource->bytes > cpu_budget_bytes;
+			pResource->keep_in_memory = !cpu_full;
+			cpu_bytes += pResource->keep_in_memory ? pResource->bytes : 0;
+		}
+	}
+
+	// evictions first, so that the uploads below stay within the budgets
+	for (int r = 0; r < n_resources; r++) {
+		STREAM_RESOURCE* pResource = &resources[r];
+		if (pResource->on_gpu && !pResource->keep_on_gpu) {
+			if (r < tiles.n_tiles) {
+				callbacks.delete_tile(r);
+				tiles_changed = true;
+			}
+			else
+				callbacks.delete_texture(r - tiles.n_tiles);
+			pResource->on_gpu = false;
+		}
+		bool needed = pResource->keep_in_memory || (pResource->keep_on_gpu && !pResource->on_gpu);
+		if (pResource->state == STREAM_IN_MEMORY && !needed)
+			release_memory(pResource);
+	}
+
+	bool queued;
+	{
+		std::lock_guard<std::mutex> lock(io_mutex);
+		for (int r : io_queue)
+			resources[r].state = STREAM_ON_DISK;
+		io_queue.clear();
+		for (int r : resource_order) {
+			STREAM_RESOURCE* pResource = &resources[r];
+			bool needed = pResource->keep_in_memory || (pResource->keep_on_gpu && !pResource->on_gpu);
+			if (needed && pResource->state == STREAM_ON_DISK) {
+				pResource->state = STREAM_QUEUED;
+				io_queue.push_back(r);
+			}
+		}
+		queued = !io_queue.empty();
+	}
+	if (queued)
+		io_condition.notify_all();
+
+	int n_uploads = 0;
+	for (int r : resource_order) {
+		STREAM_RESOURCE* pResource = &resources[r];
+		if (n_uploads == STREAM_MAX_UPLOADS)
+			break;
+		if (!pResource->keep_on_gpu || pResource->on_gpu || pResource->state != STREAM_IN_MEMORY)
+			continue;
+		if (r < tiles.n_tiles) {
+			callbacks.upload_tile(r, (const float*)pResource->data, tiles.tile_n_vertices[r]);
+			tiles_changed = true;
+		}
+		else
+			callbacks.upload_texture(r - tiles.n_tiles, pResource->width, pResource->height, (const unsigned int*)pResource->data);
+		pResource->on_gpu = true;
+		n_uploads++;
+		if (!pResource->keep_in_memory)
+			release_memory(pResource);
+	}
+	return tiles_changed;
+}
+
+bool is_stream_tile_resident(int tile) {
+	return resources[tile].on_gpu;
+}
+
+bool is_stream_texture_resident(int texId) {
+	return resources[tiles.n_tiles + texId].on_gpu;
+}
+
+void report_streaming(void) {
+	int n_on_gpu[2] = { 0, 0 }, n_in_memory[2] = { 0, 0 };
+	size_t gpu_bytes = 0, cpu_bytes = 0;
+
+	if (!streaming_initialized)
+		return;
+	for (int r = 0; r < n_resources; r++) {
+		int kind = r >= tiles.n_tiles;
+		if (resources[r].on_gpu) {
+			n_on_gpu[kind]++;
+			gpu_bytes += resources[r].bytes;
+		}
+		if (resources[r].state == STREAM_IN_MEMORY) {
+			n_in_memory[kind]++;
+			cpu_bytes += resources[r].bytes;
+		}
+	}
+	fprintf(stdout, " * Streaming: %d tiles and %d textures in graphics memory (%.1f of %.0f MB), %d tiles and %d textures in system memory (%.1f of %.0f MB), camera velocity (%.0f, %.0f, %.0f)\n",
+		n_on_gpu[0], n_on_gpu[1], gpu_bytes / 1048576.0, gpu_budget_bytes / 1048576.0,
+		n_in_memory[0], n_in_memory[1], cpu_bytes / 1048576.0, cpu_budget_bytes / 1048576.0, velocity[0], velocity[1], velocity[2]);
+}
+
+void free_streaming(void) {
+	if (streaming_initialized) {
+		{
+			std::lock_guard<std::mutex> lock(io_mutex);
+			io_quit = true;
+			io_queue.clear();
+		}
+		io_condition.notify_all();
+		for (int t = 0; t < STREAM_IO_THREADS; t++)
+			io_threads[t].join();
+		for (int r = 0; r < n_resources; r++)
+			free(resources[r].data);
+		delete[] resources;
+		resources = NULL;
+		free(texture_file_names);
+		streaming_initialized = false;
+	}
+	free(tiles.chunk_tile);
+	free(tiles.chunk_first_vertex);
+	free(tiles.tile_n_vertices);
+	free(tile_box);
+	free(tile_offset);
+	memset(&tiles, 0, sizeof(tiles));
+	tile_box = NULL;
+	tile_offset = NULL;
+}
@@ -0,0 +1,60 @@
+﻿//
+//  Streaming.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+#include <stddef.h>
+
+#include "LoadScene.h"
+
+// Out-of-core Bistro geometry and textures. The culling chunks (Culling.h) are grouped by the center
+// of their box into square STREAM_TILE_SIZE tiles of the ground (XY) plane, and the interleaved
+// vertices of every tile are written once, tile after tile, to STREAM_TILE_FILE. From then on the tiles
+// and the textures of their materials are read by background I/O threads when the camera, or where its
+// velocity predicts it STREAM_PREDICT_SECONDS later, comes near them, nearest first. Two budgets bound
+// what stays: the tiles and textures in graphics memory (within STREAM_LOAD_DISTANCE) and their copies in
+// system memory (within STREAM_PREFETCH_DISTANCE, so that a tile coming into range only needs an upload);
+// the farthest are evicted first. The GL work is left to the callbacks, called from update_streaming().
+#define STREAM_TILE_SIZE			(1000.0f)	// scene units
+#define STREAM_LOAD_DISTANCE		(4000.0f)	// from the camera to the box of a tile
+#define STREAM_PREFETCH_DISTANCE	(6000.0f)
+#define STREAM_PREDICT_SECONDS		(1.0f)
+#define STREAM_IO_THREADS			(2)
+#define STREAM_MAX_UPLOADS			(4)			// per update, against frame time spikes
+#define STREAM_DEFAULT_CPU_MB		(1024)
+#define STREAM_DEFAULT_GPU_MB		(512)
+#define STREAM_TILE_FILE			"Scene/BistroExterior.tiles"
+
+typedef struct {
+	int		n_tiles;
+	int*	chunk_tile;			// tile of each culling chunk
+	int*	chunk_first_vertex;	// in the vertices of its tile
+	int*	tile_n_vertices;
+} STREAM_TILES;
+
+typedef struct {
+	int		vertex_floats;
+	// the interleaved vertices of n_triangles triangles of a material; only while the tile file is written
+	void	(*get_vertices)(int materialIdx, int first_triangle, int n_triangles, float* vertices);
+	void	(*upload_tile)(int tile, const float* vertices, int n_vertices);
+	void	(*delete_tile)(int tile);
+	void	(*upload_texture)(int texId, int width, int height, const unsigned int* texels);	// BGRA8, bottom row first
+	void	(*delete_texture)(int texId);
+} STREAM_CALLBACKS;
+
+// Streaming.cpp
+// after initialize_culling(); false if the tile file can neither be read nor written
+bool initialize_streaming(SCENE* pScene, size_t cpu_budget, size_t gpu_budget, const STREAM_CALLBACKS* pCallbacks);
+const STREAM_TILES* get_stream_tiles(void);
+bool is_stream_texture_available(int texId);	// the file of the texture could be read when the tile file was written
+// once per frame on the GL thread; true when the tiles in graphics memory changed
+bool update_streaming(const float* camera_position);
+bool is_stream_tile_resident(int tile);
+bool is_stream_texture_resident(int texId);
+void report_streaming(void);
+void free_streaming(void);	// does not call the delete callbacks
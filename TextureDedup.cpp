@@ -0,0 +1,198 @@
+﻿//
+//  TextureDedup.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include "TextureDedup.h"
+
+static std::vector<int> canonical_texture;	// the first texture id with the same contents, itself if none
+static std::vector<size_t> file_bytes;		// 0 if the file cannot be read
+static TEXTURE_DEDUP_STATS stats;
+
+static unsigned long long hash_bytes(unsigned long long key, const unsigned char* bytes, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		key ^= bytes[i];
+		key *= 0x100000001b3ull;
+	}
+	return key;
+}
+
+// FNV-1a of the whole file; false if it cannot be read
+static bool hash_file(const char* filename, unsigned long long* key) {
+	static unsigned char block[DEDUP_COMPARE_BLOCK];
+	FILE* fp = fopen(filename, "rb");
+	size_t n;
+
+	if (fp == NULL)
+		return false;
+	*key = 0xcbf29ce484222325ull;
+	while ((n = fread(block, 1, sizeof(block), fp)) > 0) {
+		*key = hash_bytes(*key, block, n);
+		stats.hashed_bytes += n;
+	}
+	fclose(fp);
+	return true;
+}
+
+// of equal size, against hash collisions
+static bool are_files_equal(const char* filename_a, const char* filename_b) {
+	static unsigned char block_a[DEDUP_COMPARE_BLOCK], block_b[DEDUP_COMPARE_BLOCK];
+	FILE* fp_a = fopen(filename_a, "rb");
+	FILE* fp_b = fopen(filename_b, "rb");
+	bool equal = fp_a != NULL && fp_b != NULL;
+
+	while (equal) {
+		size_t n_a = fread(block_a, 1, sizeof(block_a), fp_a), n_b = fread(block_b, 1, sizeof(block_b), fp_b);
+		stats.hashed_bytes += n_a + n_b;
+		if (n_a != n_b || memcmp(block_a, block_b, n_a) != 0)
+			equal = false;
+		else if (n_a == 0)
+			break;
+	}
+	if (fp_a != NULL)
+		fclose(fp_a);
+	if (fp_b != NULL)
+		fclose(fp_b);
+	return equal;
+}
+
+static void remap_materials(SCENE* pScene) {
+	for (int materialIdx = 0; materialIdx < pScene->n_materials; materialIdx++) {
+		MATERIAL* pMaterial = &pScene->material_list[materialIdx];
+		int* texIds[4] = { &pMaterial->diffuseTexId, &pMaterial->normalMapTexId, &pMaterial->specularTexId, &pMaterial->emissiveTexId };
+		for (int i = 0; i < 4; i++)
+			if (*texIds[i] >= 0 && *texIds[i] < pScene->n_textures) // INVALID_TEX_ID is -1 as an int
+				*texIds[i] = canonical_texture[*texIds[i]];
+	}
+}
+
+void dedup_texture_files(SCENE* pScene) {
+	int n_textures = pScene->n_textures;
+	std::vector<int> order(n_textures);
+
+	memset(&stats, 0, sizeof(stats));
+	stats.n_textures = n_textures;
+	canonical_texture.resize(n_textures);
+	file_bytes.assign(n_textures, 0);
+	for (int texId = 0; texId < n_textures; texId++) {
+		struct stat file_stat;
+
+		canonical_texture[texId] = order[texId] = texId;
+		if (stat(pScene->texture_file_name[texId], &file_stat) == 0)
+			file_bytes[texId] = (size_t)file_stat.st_size;
+	}
+
+	// only files of equal size can be equal
+	std::stable_sort(order.begin(), order.end(), [](int a, int b) { return file_bytes[a] < file_bytes[b]; });
+	for (int first = 0, end; first < n_textures; first = end) {
+		for (end = first + 1; end < n_textures && file_bytes[order[end]] == file_bytes[order[first]]; end++);
+		if (end - first < 2 || file_bytes[order[first]] == 0)
+			continue;
+
+		std::vector<int> group(order.begin() + first, order.begin() + end);
+		std::vector<unsigned long long> keys(group.size());
+		std::vector<bool> readable(group.size());
+		std::sort(group.begin(), group.end());
+		for (size_t i = 0; i < group.size(); i++) {
+			readable[i] = hash_file(pScene->texture_file_name[group[i]], &keys[i]);
+			for (size_t j = 0; j < i && readable[i]; j++) {
+				if (!readable[j] || keys[j] != keys[i] || canonical_texture[group[j]] != group[j]
+					|| !are_files_equal(pScene->texture_file_name[group[j]], pScene->texture_file_name[group[i]]))
+					continue;
+				canonical_texture[group[i]] = group[j];
+				stats.n_file_duplicates++;
+				stats.read_bytes_saved += file_bytes[group[i]];
+				break;
+			}
+		}
+	}
+	remap_materials(pScene);
+}
+
+bool is_texture_duplicate(int texId) {
+	return texId >= 0 && texId < (int)canonical_texture.size() && canonical_texture[texId] != texId;
+}
+
+static size_t get_chain_bytes(const CPU_TEXTURE* pTexture) {
+	size_t bytes = 0;
+
+	for (int level = 0; level < pTexture->n_levels; level++)
+		bytes += sizeof(unsigned int) * (size_t)pTexture->levels[level].width * pTexture->levels[level].height;
+	return bytes;
+}
+
+void dedup_texture_pixels(SCENE* pScene, CPU_TEXTURE* textures, double decode_ms) {
+	std::unordered_map<unsigned long long, std::vector<int> > kept;	// by the hash of level 0
+	std::vector<size_t> chain_bytes(pScene->n_textures, 0);
+	size_t decoded_bytes = 0;
+
+	for (int texId = 0; texId < pScene->n_textures; texId++) {
+		CPU_TEXTURE* pTexture = &textures[texId];
+		if (pTexture->n_levels == 0)
+			continue;
+		decoded_bytes += file_bytes[texId];
+		chain_bytes[texId] = get_chain_bytes(pTexture);
+
+		const CPU_TEXTURE_LEVEL* pLevel = &pTexture->levels[0];
+		size_t n_bytes = sizeof(unsigned int) * (size_t)pLevel->width * pLevel->height;
+		unsigned long long key = 0xcbf29ce484222325ull;
+		key = hash_bytes(key, (const unsigned char*)&pLevel->width, sizeof(pLevel->width));
+		key = hash_bytes(key, (const unsigned char*)&pLevel->height, sizeof(pLevel->height));
+		key = hash_bytes(key, (const unsigned char*)pLevel->texels, n_bytes);
+
+		std::vector<int>& candidates = kept[key];
+		int original = -1;
+		for (int candidate : candidates) {
+			const CPU_TEXTURE_LEVEL* pOther = &textures[candidate].levels[0];
+			if (pOther->width == pLevel->width && pOther->height == pLevel->height && memcmp(pOther->texels, pLevel->texels, n_bytes) == 0) {
+				original = candidate;
+				break;
+			}
+		}
+		if (original < 0) {
+			candidates.push_back(texId);
+			continue;
+		}
+		canonical_texture[texId] = original;
+		stats.n_pixel_duplicates++;
+		free_cpu_texture(pTexture);
+	}
+
+	// the byte-identical duplicates of a pixel-identical duplicate follow it
+	for (int texId = 0; texId < pScene->n_textures; texId++) {
+		canonical_texture[texId] = canonical_texture[canonical_texture[texId]];
+		if (canonical_texture[texId] != texId)
+			stats.memory_bytes_saved += chain_bytes[canonical_texture[texId]];
+	}
+	if (decoded_bytes > 0)
+		stats.decode_ms_saved = decode_ms * stats.read_bytes_saved / decoded_bytes;
+	remap_materials(pScene);
+}
+
+const TEXTURE_DEDUP_STATS* get_texture_dedup_stats(void) {
+	return &stats;
+}
+
+void report_texture_dedup(void) {
+	fprintf(stdout, " * Texture dedup: %d of %d textures are duplicates (%d byte-identical, %d pixel-identical); saved %.1f MB of reads (%.1f MB read to compare), %.0f ms of decoding and %.1f MB of texture memory\n",
+		stats.n_file_duplicates + stats.n_pixel_duplicates, stats.n_textures, stats.n_file_duplicates, stats.n_pixel_duplicates,
+		stats.read_bytes_saved / 1048576.0, stats.hashed_bytes / 1048576.0, stats.decode_ms_saved, stats.memory_bytes_saved / 1048576.0);
+}
+
+void free_texture_dedup(void) {
+	std::vector<int>().swap(canonical_texture);
+	std::vector<size_t>().swap(file_bytes);
+}
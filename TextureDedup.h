@@ -0,0 +1,40 @@
+﻿//
+//  TextureDedup.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+#include <stddef.h>
+
+#include "LoadScene.h"
+#include "CpuTexture.h"
+
+// Duplicate Bistro textures under different names share one GL texture. Before any texture is decoded,
+// the files of equal size are hashed (FNV-1a) and those with equal hashes compared byte by byte; after
+// decoding, level 0 of every remaining texture is hashed and compared texel by texel against the earlier
+// ones, which catches images that are encoded differently. Either way the materials are remapped to the
+// first texture id of each set, so the duplicates are never decoded (byte-identical files) or uploaded.
+#define DEDUP_COMPARE_BLOCK	(1 << 16)	// bytes read at a time when comparing two files
+
+typedef struct {
+	int		n_textures;
+	int		n_file_duplicates, n_pixel_duplicates;
+	size_t	hashed_bytes;		// read to hash and compare the files of equal size
+	size_t	read_bytes_saved;	// files of the byte-identical duplicates, not read by the decoder
+	double	decode_ms_saved;	// the byte-identical duplicates at the mean decode time per file byte
+	size_t	memory_bytes_saved;	// mip chains of all duplicates, in system and graphics memory
+} TEXTURE_DEDUP_STATS;
+
+// TextureDedup.cpp
+void dedup_texture_files(SCENE* pScene);	// before the textures are decoded; remaps the materials
+bool is_texture_duplicate(int texId);		// the materials no longer refer to it
+// textures: one per scene texture, the duplicates left empty, decoded in decode_ms; frees the textures with
+// the same texels as an earlier one and remaps the materials
+void dedup_texture_pixels(SCENE* pScene, CPU_TEXTURE* textures, double decode_ms);
+const TEXTURE_DEDUP_STATS* get_texture_dedup_stats(void);
+void report_texture_dedup(void);
+void free_texture_dedup(void);
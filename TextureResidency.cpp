@@ -0,0 +1,223 @@
+﻿//
+//  TextureResidency.cpp
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <GL/glew.h>
+
+#include "TextureResidency.h"
+
+typedef struct {
+	CPU_TEXTURE		source;				// n_levels is 0 without a source
+	int				base_level;			// finest level in graphics memory
+	int				tail_level;			// this and the coarser levels always stay
+	bool			levels_dropped;		// this frame, the GL texture is recreated
+	int				requested_level;	// finest level sampled this frame, source.n_levels if none
+	unsigned int	level_last_used[CPU_TEXTURE_MAX_LEVELS];	// frame
+} RESIDENT_TEXTURE;
+
+static GLuint* names;
+static int n_resident_textures;
+static RESIDENT_TEXTURE* textures;
+static RESIDENCY_STATS stats;
+static unsigned int residency_frame = 1;
+static int n_requested_textures;	// this frame
+
+void initialize_texture_residency(unsigned int* texture_names, int n_textures, size_t budget_bytes) {
+	names = texture_names;
+	n_resident_textures = n_textures;
+	textures = (RESIDENT_TEXTURE*)calloc(n_textures > 0 ? n_textures : 1, sizeof(RESIDENT_TEXTURE));
+	memset(&stats, 0, sizeof(stats));
+	stats.budget_bytes = budget_bytes;
+}
+
+static size_t get_level_bytes(const RESIDENT_TEXTURE* pTexture, int level) {
+	return sizeof(unsigned int) * (size_t)pTexture->source.levels[level].width * pTexture->source.levels[level].height;
+}
+
+static void upload_level(int texId, int level) {
+	const CPU_TEXTURE_LEVEL* pLevel = &textures[texId].source.levels[level];
+
+	glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, pLevel->width, pLevel->height, 0, GL_BGRA, GL_UNSIGNED_BYTE, pLevel->texels);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+}
+
+// a new GL texture with the levels [base_level, n_levels): dropping levels by redefining them does not
+// reliably release their storage
+static void create_texture(int texId) {
+	RESIDENT_TEXTURE* pTexture = &textures[texId];
+
+	glDeleteTextures(1, &names[texId]);
+	glGenTextures(1, &names[texId]);
+	glBindTexture(GL_TEXTURE_2D, names[texId]);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, pTexture->source.n_levels - 1);
+	for (int level = pTexture->source.n_levels - 1; level >= pTexture->base_level; level--)
+		upload_level(texId, level);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void set_residency_source(int texId, CPU_TEXTURE* pTexture) {
+	RESIDENT_TEXTURE* pResident = &textures[texId];
+
+	if (pResident->source.n_levels > 0)
+		release_residency_source(texId);
+	pResident->source = *pTexture;
+	memset(pTexture, 0, sizeof(CPU_TEXTURE));
+
+	pResident->tail_level = 0;
+	while (pResident->tail_level < pResident->source.n_levels - 1
+		&& max(pResident->source.levels[pResident->tail_level].width, pResident->source.levels[pResident->tail_level].height) > RESIDENCY_TAIL_SIZE)
+		pResident->tail_level++;
+	pResident->base_level = pResident->tail_level;
+	pResident->levels_dropped = false;
+	pResident->requested_level = pResident->source.n_levels;
+	memset(pResident->level_last_used, 0, sizeof(pResident->level_last_used));
+	create_texture(texId);
+
+	for (int level = 0; level < pResident->source.n_levels; level++)
+		stats.source_bytes += get_level_bytes(pResident, level);
+	for (int level = pResident->base_level; level < pResident->source.n_levels; level++)
+		stats.resident_bytes += get_level_bytes(pResident, level);
+	stats.n_textures++;
+}
+
+void release_residency_source(int texId) {
+	RESIDENT_TEXTURE* pResident = &textures[texId];
+
+	if (pResident->source.n_levels == 0)
+		return;
+	for (int level = 0; level < pResident->source.n_levels; level++)
+		stats.source_bytes -= get_level_bytes(pResident, level);
+	for (int level = pResident->base_level; level < pResident->source.n_levels; level++)
+		stats.resident_bytes -= get_level_bytes(pResident, level);
+	stats.n_textures--;
+
+	glDeleteTextures(1, &names[texId]);
+	names[texId] = 0;
+	free_cpu_texture(&pResident->source);
+}
+
+void request_texture_footprint(int texId, float uv_per_pixel) {
+	RESIDENT_TEXTURE* pTexture = &textures[texId];
+	int n_levels = pTexture->source.n_levels;
+
+	if (n_levels == 0)
+		return;
+	// trilinear filtering samples floor(lod) and the level above it
+	float texels_per_pixel = uv_per_pixel * max(pTexture->source.levels[0].width, pTexture->source.levels[0].height);
+	int level = (texels_per_pixel > 1.0f) ? (int)floorf(log2f(texels_per_pixel)) : 0;
+	level = min(level, n_levels - 1);
+
+	if (pTexture->requested_level == n_levels)
+		n_requested_textures++;
+	pTexture->requested_level = min(pTexture->requested_level, level);
+	for (int l = level; l < n_levels && pTexture->level_last_used[l] != residency_frame; l++)
+		pTexture->level_last_used[l] = residency_frame;
+}
+
+// drops the least recently used finest levels not sampled this frame until bytes more fit the budget
+static bool make_room(size_t bytes) {
+	while (stats.resident_bytes + bytes > stats.budget_bytes) {
+		int victim = -1;
+		for (int texId = 0; texId < n_resident_textures; texId++) {
+			RESIDENT_TEXTURE* pTexture = &textures[texId];
+			if (pTexture->source.n_levels == 0 || pTexture->base_level >= pTexture->tail_level
+				|| pTexture->level_last_used[pTexture->base_level] == residency_frame)
+				continue;
+			if (victim < 0 || pTexture->level_last_used[pTexture->base_level] < textures[victim].level_last_used[textures[victim].base_level])
+				victim = texId;
+		}
+		if (victim < 0)
+			return false;
+
+		RESIDENT_TEXTURE* pVictim = &textures[victim];
+		pVictim->levels_dropped = true;
+		stats.resident_bytes -= get_level_bytes(pVictim, pVictim->base_level);
+		pVictim->base_level++;
+		stats.n_evictions++;
+	}
+	return true;
+}
+
+void update_texture_residency(void) {
+	std::vector<int> misses;
+
+	for (int texId = 0; texId < n_resident_textures; texId++)
+		if (textures[texId].requested_level < textures[texId].base_level)
+			misses.push_back(texId);
+	stats.n_misses += (unsigned int)misses.size();
+
+	// the blurriest first: the largest distance between the requested and the resident level
+	std::sort(misses.begin(), misses.end(), [](int a, int b) {
+		int gap_a = textures[a].base_level - textures[a].requested_level, gap_b = textures[b].base_level - textures[b].requested_level;
+		return gap_a > gap_b || (gap_a == gap_b && a < b);
+	});
+
+	size_t uploaded_bytes = 0;
+	std::vector<int> refined;
+	for (int texId : misses) {
+		RESIDENT_TEXTURE* pTexture = &textures[texId];
+		size_t bytes = get_level_bytes(pTexture, pTexture->base_level - 1);
+		if (uploaded_bytes > 0 && uploaded_bytes + bytes > RESIDENCY_UPLOAD_BYTES)
+			break;
+		if (!make_room(bytes))
+			continue;
+		pTexture->base_level--;
+		stats.resident_bytes += bytes;
+		stats.n_uploads++;
+		uploaded_bytes += bytes;
+		refined.push_back(texId);
+	}
+	make_room(0); // over the budget after a budget or source change
+
+	for (int texId = 0; texId < n_resident_textures; texId++) {
+		RESIDENT_TEXTURE* pTexture = &textures[texId];
+		if (pTexture->levels_dropped) {
+			create_texture(texId);
+			pTexture->levels_dropped = false;
+		}
+		pTexture->requested_level = pTexture->source.n_levels;
+	}
+	for (int texId : refined) {
+		glBindTexture(GL_TEXTURE_2D, names[texId]);
+		upload_level(texId, textures[texId].base_level);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	stats.n_used_textures = n_requested_textures;
+	n_requested_textures = 0;
+	residency_frame++;
+}
+
+const RESIDENCY_STATS* get_residency_stats(void) {
+	return &stats;
+}
+
+void report_texture_residency(void) {
+	fprintf(stdout, " * Texture residency: %.1f of %.0f MB in graphics memory (%.1f MB of mip chains in system memory), %d of %d textures used, %u misses, %u uploads, %u evictions\n",
+		stats.resident_bytes / 1048576.0, stats.budget_bytes / 1048576.0, stats.source_bytes / 1048576.0,
+		stats.n_used_textures, stats.n_textures, stats.n_misses, stats.n_uploads, stats.n_evictions);
+}
+
+void free_texture_residency(void) {
+	for (int texId = 0; texId < n_resident_textures; texId++)
+		free_cpu_texture(&textures[texId].source);
+	free(textures);
+	textures = NULL;
+	n_resident_textures = 0;
+}
@@ -0,0 +1,41 @@
+﻿//
+//  TextureResidency.h
+//
+//  Written for CSE4170
+//  Department of Computer Science and Engineering
+//  Copyright © 2023 Sogang University. All rights reserved.
+//
+
+#pragma once
+
+#include <stddef.h>
+
+#include "CpuTexture.h"
+
+// Graphics memory of the material textures. The mip chain of every texture stays in system memory,
+// and only the levels the visible materials sample are uploaded: the draw loop requests the footprint
+// of a texture on the screen, and each frame the textures sampled finer than their finest resident
+// level (the misses) get one finer level, within RESIDENCY_UPLOAD_BYTES per frame. When that would
+// exceed the budget, the least recently used finest levels are dropped first; the levels that are
+// RESIDENCY_TAIL_SIZE texels or smaller always stay, so that every texture can be sampled.
+#define RESIDENCY_DEFAULT_BUDGET_MB	(256)
+#define RESIDENCY_TAIL_SIZE			(64)
+#define RESIDENCY_UPLOAD_BYTES		(16 << 20)	// per frame, at least one level
+
+typedef struct {
+	size_t			resident_bytes, budget_bytes;
+	size_t			source_bytes;		// the mip chains in system memory
+	int				n_textures, n_used_textures;	// with a source; requested last frame
+	unsigned int	n_misses, n_uploads, n_evictions;	// since the start; misses counted once per texture and frame
+} RESIDENCY_STATS;
+
+// TextureResidency.cpp
+// texture_names[texId] is kept pointing at the GL texture of texId (0 without one)
+void initialize_texture_residency(unsigned int* texture_names, int n_textures, size_t budget_bytes);
+void set_residency_source(int texId, CPU_TEXTURE* pTexture);	// takes the texture over and uploads its tail
+void release_residency_source(int texId);	// also deletes the GL texture
+void request_texture_footprint(int texId, float uv_per_pixel);	// from the draw loop; uv units per pixel
+void update_texture_residency(void);	// once per frame, after drawing
+const RESIDENCY_STATS* get_residency_stats(void);
+void report_texture_residency(void);
+void free_texture_residency(void);	// the mip chains; the GL textures are deleted with texture_names
@@ -10,14 +10,32 @@
 
 #include "LoadScene.h"
 #include "DrawScene.h"
+#include "Benchmark.h"
+#include "SoftwareRenderer.h"
+#include "PathTracer.h"
+#include "AmbientOcclusion.h"
 
 SCENE scene;
 
 int main(int argc, char* argv[]) {
-	
+	BENCHMARK_OPTIONS benchmark_options;
+	SOFTWARE_OPTIONS software_options;
+	PATH_OPTIONS path_options;
+	int bake_threads;
+	int exit_code = 1;
+
 	read3DSceneFromFile(&scene);
-	drawScene(argc, argv);
+	if (parse_benchmark_options(argc, argv, &benchmark_options))
+		exit_code = run_benchmark(&benchmark_options); // headless, no window
+	else if (parse_software_options(argc, argv, &software_options))
+		exit_code = run_software_renderer(&software_options); // CPU only, no GL
+	else if (parse_path_options(argc, argv, &path_options))
+		exit_code = run_path_tracer(&path_options); // CPU only, no GL
+	else if (parse_ao_bake_options(argc, argv, &bake_threads))
+		exit_code = run_ao_bake(bake_threads); // CPU only, no GL
+	else
+		drawScene(argc, argv);
 	freeData(&scene);
 
-	return 1;
+	return exit_code;
 }